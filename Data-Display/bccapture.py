@@ -0,0 +1,276 @@
+# --------------------------------------------------------------
+# Python Script as part of the BioConnect Project Template
+#
+# Bindings to the capture reader of the UNIX reader (capture_reader.c)
+# for offline analysis of .bcap captures. The file is memory mapped
+# and decoded chunk by chunk on first access; the arrays returned are
+# numpy views of the decoded columns, nothing is copied.
+#
+# Build the library once with
+#   make -C bioConnect_UNIX-Serial-2-CSV/Debug libs
+# or point BCCAPTURE_LIB at it.
+#
+#   with bccapture.Capture('../Export/data.bcap') as cap:
+#       t, red, ir, valid = cap.time_range(t_from, t_to)
+#
+# Pyramid reads the min/max/mean overview and Spectrogram the
+# spectrogram columns written next to a recording (CSV or capture);
+# both need no library.
+# --------------------------------------------------------------
+
+import bisect
+import ctypes
+import os
+import numpy as np
+
+
+LIB_NAME = os.environ.get('BCCAPTURE_LIB', os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), '../bioConnect_UNIX-Serial-2-CSV/libbccapture.so'))
+
+CHANNELS = {'red': 0, 'ir': 1}
+
+PYRAMID_HEADER_BYTES = 32
+PYRAMID_MAX_LEVELS = 6
+PYRAMID_ENTRY = np.dtype([('t_first', '<f8'), ('t_last', '<f8'),
+                          ('min', '<f4', (2,)), ('max', '<f4', (2,)), ('mean', '<f4', (2,)),
+                          ('n_rows', '<u4'), ('n_valid', '<u4')])
+
+SPECTROGRAM_HEADER = np.dtype([('magic', 'S4'), ('version', '<u2'), ('n_channels', '<u2'),
+                               ('n_fft', '<u4'), ('hop', '<u4'), ('n_bins', '<u4'),
+                               ('sample_rate', '<f4'), ('t_created', '<f8'), ('reserved', 'u1', (32,))])
+
+
+class ChunkStats(ctypes.Structure):
+    _fields_ = [('min', ctypes.c_int32), ('max', ctypes.c_int32), ('sum', ctypes.c_int64)]
+
+
+class ChunkHeader(ctypes.Structure):
+    _fields_ = [('magic', ctypes.c_char * 4),
+                ('n_samples', ctypes.c_uint16),
+                ('n_valid', ctypes.c_uint16),
+                ('seq_first', ctypes.c_uint32),
+                ('payload_bytes', ctypes.c_uint32),
+                ('t_first', ctypes.c_double),
+                ('t_last', ctypes.c_double),
+                ('stats', ChunkStats * 2)]
+
+
+class FileHeader(ctypes.Structure):
+    _fields_ = [('magic', ctypes.c_char * 4),
+                ('version', ctypes.c_uint16),
+                ('n_channels', ctypes.c_uint16),
+                ('chunk_samples', ctypes.c_uint32),
+                ('sample_rate', ctypes.c_float),
+                ('t_created', ctypes.c_double),
+                ('channel_names', (ctypes.c_char * 8) * 2),
+                ('reserved', ctypes.c_uint8 * 24)]
+
+
+def _span(ctype):
+    class Span(ctypes.Structure):
+        _fields_ = [('data', ctypes.POINTER(ctype)), ('len', ctypes.c_size_t)]
+    return Span
+
+
+SpanI32 = _span(ctypes.c_int32)
+SpanF64 = _span(ctypes.c_double)
+SpanU8 = _span(ctypes.c_uint8)
+
+_lib = None
+
+
+def _load():
+    global _lib
+    if _lib is None:
+        lib = ctypes.CDLL(LIB_NAME)
+        lib.cap_reader_new.restype = ctypes.c_void_p
+        lib.cap_reader_new.argtypes = [ctypes.c_char_p]
+        lib.cap_reader_free.argtypes = [ctypes.c_void_p]
+        lib.cap_reader_header.restype = ctypes.POINTER(FileHeader)
+        lib.cap_reader_header.argtypes = [ctypes.c_void_p]
+        lib.cap_reader_rows.restype = ctypes.c_size_t
+        lib.cap_reader_rows.argtypes = [ctypes.c_void_p]
+        lib.cap_reader_chunk_count.restype = ctypes.c_size_t
+        lib.cap_reader_chunk_count.argtypes = [ctypes.c_void_p]
+        lib.cap_reader_chunk.restype = ctypes.POINTER(ChunkHeader)
+        lib.cap_reader_chunk.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+        lib.cap_reader_find_time.restype = ctypes.c_size_t
+        lib.cap_reader_find_time.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double,
+                                             ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_size_t)]
+        lib.cap_reader_channel.restype = SpanI32
+        lib.cap_reader_channel.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_size_t, ctypes.c_size_t]
+        lib.cap_reader_times.restype = SpanF64
+        lib.cap_reader_times.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+        lib.cap_reader_valid.restype = SpanU8
+        lib.cap_reader_valid.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+        _lib = lib
+    return _lib
+
+
+class Capture:
+    """A .bcap capture opened for reading. Arrays handed out stay valid while they are referenced."""
+
+    def __init__(self, path):
+        self._lib = _load()
+        self._handle = self._lib.cap_reader_new(os.fsencode(path))
+        if not self._handle:
+            raise OSError('unable to open capture %s' % path)
+        self._ref = _Owner(self._lib, self._handle)
+        self.rows = self._lib.cap_reader_rows(self._handle)
+        self.header = FileHeader.from_buffer_copy(self._lib.cap_reader_header(self._handle).contents)
+        self.sample_rate = self.header.sample_rate
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __len__(self):
+        return self.rows
+
+    def close(self):
+        # Arrays keep the reader alive through _Owner, it is freed with the last of them
+        self._handle = None
+        self._ref = None
+
+    def __del__(self):
+        self.close()
+
+    def _view(self, span, dtype):
+        if span.len == 0 or not span.data:
+            return np.empty(0, dtype=dtype)
+        buf = (span.data._type_ * span.len).from_address(ctypes.addressof(span.data.contents))
+        buf._owner = self._ref
+        array = np.frombuffer(buf, dtype=dtype)
+        array.flags.writeable = False
+        return array
+
+    def _check(self):
+        if self._handle is None:
+            raise ValueError('capture is closed')
+
+    def chunks(self):
+        """Chunk headers (time range, n_valid, per-channel min/max/sum) without decoding any data."""
+        self._check()
+        n = self._lib.cap_reader_chunk_count(self._handle)
+        return [ChunkHeader.from_buffer_copy(self._lib.cap_reader_chunk(self._handle, i).contents) for i in range(n)]
+
+    def find_time(self, t_from, t_to):
+        """Row range [begin, end) of the rows with t_from <= t < t_to."""
+        self._check()
+        begin, end = ctypes.c_size_t(), ctypes.c_size_t()
+        self._lib.cap_reader_find_time(self._handle, t_from, t_to, ctypes.byref(begin), ctypes.byref(end))
+        return begin.value, end.value
+
+    def channel(self, name, begin=0, end=None):
+        self._check()
+        end = self.rows if end is None else end
+        ch = CHANNELS.get(name, name)
+        return self._view(self._lib.cap_reader_channel(self._handle, ch, begin, end), np.int32)
+
+    def times(self, begin=0, end=None):
+        self._check()
+        end = self.rows if end is None else end
+        return self._view(self._lib.cap_reader_times(self._handle, begin, end), np.float64)
+
+    def valid(self, begin=0, end=None):
+        self._check()
+        end = self.rows if end is None else end
+        return self._view(self._lib.cap_reader_valid(self._handle, begin, end), np.bool_)
+
+    def time_range(self, t_from, t_to):
+        """(t, red, ir, valid) of the rows with t_from <= t < t_to."""
+        begin, end = self.find_time(t_from, t_to)
+        return self.times(begin, end), self.channel('red', begin, end), \
+            self.channel('ir', begin, end), self.valid(begin, end)
+
+
+class _Owner:
+    """Frees the C reader once the Capture and every array viewing it are gone."""
+
+    def __init__(self, lib, handle):
+        self.lib = lib
+        self.handle = handle
+
+    def __del__(self):
+        self.lib.cap_reader_free(self.handle)
+
+
+class Pyramid:
+    """Min/max/mean pyramid of a recording (<base>_pyr1.bin, <base>_pyr2.bin, ...), see summary_pyramid.h.
+
+    Levels are memory mapped and re-mapped when the recorder has appended to them, so a time range is
+    answered by reading about as many entries as there are pixels, however long the recording is.
+    """
+
+    def __init__(self, recording_path):
+        self.base = os.path.splitext(recording_path)[0]
+        self._levels = {}
+
+    def level(self, level):
+        """Entries of a level as a read-only structured array, None if the level does not exist."""
+        path = '%s_pyr%d.bin' % (self.base, level)
+        try:
+            n = (os.path.getsize(path) - PYRAMID_HEADER_BYTES) // PYRAMID_ENTRY.itemsize
+        except OSError:
+            return None
+        cached = self._levels.get(level)
+        if cached is None or cached[0] != n:
+            if n > 0:
+                entries = np.memmap(path, dtype=PYRAMID_ENTRY, mode='r', offset=PYRAMID_HEADER_BYTES, shape=(n,))
+            else:
+                entries = np.empty(0, dtype=PYRAMID_ENTRY)
+            cached = self._levels[level] = (n, entries)
+        return cached[1]
+
+    def query(self, t_from, t_to, pixels):
+        """Entries overlapping [t_from, t_to) from the finest level that has at most `pixels` of them,
+        or from the coarsest level with entries. Returns (level, entries)."""
+        found = (0, np.empty(0, dtype=PYRAMID_ENTRY))
+        for level in range(1, PYRAMID_MAX_LEVELS + 1):
+            entries = self.level(level)
+            if entries is None or len(entries) == 0:
+                break  # the recorder opens every level at the start, those it has not reached are empty
+            # Binary search on the mapped columns touches O(log n) pages
+            begin = bisect.bisect_right(entries['t_last'], t_from)
+            end = bisect.bisect_left(entries['t_first'], t_to)
+            found = (level, entries[begin:max(begin, end)])
+            if end - begin <= pixels:
+                break
+        return found
+
+
+class Spectrogram:
+    """Spectrogram columns of a recording (<base>_stft.bin), see spectrogram_file.h.
+
+    The file is memory mapped; channel() returns a strided view of the columns of one channel,
+    so picking one column per pixel reads only those columns, however long the recording is.
+    """
+
+    def __init__(self, recording_path):
+        path = os.path.splitext(recording_path)[0] + '_stft.bin'
+        header = np.fromfile(path, SPECTROGRAM_HEADER, 1)
+        if len(header) == 0 or header[0]['magic'] != b'BSTF':
+            raise ValueError('%s is not a spectrogram file' % path)
+        header = header[0]
+        self.n_channels = int(header['n_channels'])
+        self.n_fft = int(header['n_fft'])
+        self.hop = int(header['hop'])
+        self.sample_rate = float(header['sample_rate'])
+        n_bins = int(header['n_bins'])
+        self.frequencies = np.arange(n_bins) * self.sample_rate / self.n_fft
+        column = np.dtype([('t', '<f8'), ('channel', '<u4'), ('power_db', '<f4', (n_bins,))])
+        n = (os.path.getsize(path) - SPECTROGRAM_HEADER.itemsize) // column.itemsize
+        n -= n % self.n_channels  # the channels of the last hop may be incomplete
+        if n > 0:
+            self.columns = np.memmap(path, dtype=column, mode='r', offset=SPECTROGRAM_HEADER.itemsize, shape=(n,))
+        else:
+            self.columns = np.empty(0, dtype=column)
+
+    def channel(self, channel, t_from=-np.inf, t_to=np.inf):
+        """Columns of one channel with t in [t_from, t_to). The channels are interleaved hop by hop."""
+        columns = self.columns[channel::self.n_channels]
+        begin = bisect.bisect_left(columns['t'], t_from)
+        end = bisect.bisect_left(columns['t'], t_to)
+        return columns[begin:end]
@@ -0,0 +1,208 @@
+# --------------------------------------------------------------
+# Python Script as part of the BioConnect Project Template
+#
+# Bindings to the streaming DSP of the UNIX reader (ppg_dsp.c), so
+# offline analysis runs the same filters, beat detector, SpO2 and
+# spectrogram as the reader. Every call takes a whole numpy array
+# and loops in C, there are no Python calls per sample. The state
+# is kept between calls, so a recording can be fed in blocks.
+#
+# Build the library once with
+#   make -C bioConnect_UNIX-Serial-2-CSV/Debug libs
+# or point BCDSP_LIB at it. The structs below are checked against
+# the layout the library reports when it is loaded.
+#
+#   dsp = bcdsp.BeatDetector(100.0)
+#   proc, hr, beat = dsp.process(ir, t=t)
+#
+# The capture reader is bound in bccapture.py and the live feed
+# client is sources.SharedMemorySource (numpy views, no library).
+# --------------------------------------------------------------
+
+import ctypes
+import os
+import numpy as np
+
+
+LIB_NAME = os.environ.get('BCDSP_LIB', os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), '../bioConnect_UNIX-Serial-2-CSV/libbcdsp.so'))
+
+PPG_STFT_MAX_FFT = 1024
+
+
+class PpgDsp(ctypes.Structure):
+    _fields_ = [('fs', ctypes.c_float),
+                ('alpha_filt', ctypes.c_float),
+                ('alpha_base', ctypes.c_float),
+                ('peak_thr', ctypes.c_float),
+                ('min_hr_bpm', ctypes.c_float),
+                ('max_hr_bpm', ctypes.c_float),
+                ('refractory_s', ctypes.c_float),
+                ('alpha_hr', ctypes.c_float),
+                ('sample_idx', ctypes.c_long),
+                ('ir_filt', ctypes.c_float),
+                ('ir_base', ctypes.c_float),
+                ('prev_ir_ac', ctypes.c_float),
+                ('last_peak_t', ctypes.c_double),
+                ('prev_peak_t', ctypes.c_double),
+                ('hr_bpm', ctypes.c_float),
+                ('hr_bpm_filt', ctypes.c_float)]
+
+
+class PpgSpo2(ctypes.Structure):
+    _fields_ = [('alpha_base', ctypes.c_float),
+                ('min_pi', ctypes.c_float),
+                ('n_seen', ctypes.c_long),
+                ('base', ctypes.c_double * 2),
+                ('sum_dc', ctypes.c_double * 2),
+                ('sum_ac2', ctypes.c_double * 2),
+                ('n', ctypes.c_long)]
+
+
+class PpgStft(ctypes.Structure):
+    _fields_ = [('n_fft', ctypes.c_int),
+                ('hop', ctypes.c_int),
+                ('n_bins', ctypes.c_int),
+                ('window', ctypes.c_float * PPG_STFT_MAX_FFT),
+                ('window_power', ctypes.c_float),
+                ('n_seen', ctypes.c_long),
+                ('since_column', ctypes.c_int),
+                ('ring', ctypes.c_float * PPG_STFT_MAX_FFT),
+                ('power_db', ctypes.c_float * (PPG_STFT_MAX_FFT // 2 + 1)),
+                ('re', ctypes.c_float * PPG_STFT_MAX_FFT),
+                ('im', ctypes.c_float * PPG_STFT_MAX_FFT),
+                ('cos_tab', ctypes.c_float * (PPG_STFT_MAX_FFT // 2)),
+                ('sin_tab', ctypes.c_float * (PPG_STFT_MAX_FFT // 2))]
+
+
+_lib = None
+
+
+# Compare the structs with the ones the library was built with, a changed ppg_dsp.h fails here
+# instead of corrupting the state
+def _check_layout(lib):
+    lib.ppg_layout.restype = ctypes.c_size_t
+    lib.ppg_layout.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+    for name, struct in (('ppg_dsp_t', PpgDsp), ('ppg_spo2_t', PpgSpo2), ('ppg_stft_t', PpgStft)):
+        size = lib.ppg_layout(name.encode(), None)
+        assert size == ctypes.sizeof(struct), '%s is %d bytes in %s, %d here' % (
+            name, size, LIB_NAME, ctypes.sizeof(struct))
+        for field, _ in struct._fields_:
+            offset = lib.ppg_layout(name.encode(), field.encode())
+            assert offset == getattr(struct, field).offset, '%s.%s is at %d in %s, %d here' % (
+                name, field, offset, LIB_NAME, getattr(struct, field).offset)
+
+
+def _load():
+    global _lib
+    if _lib is None:
+        lib = ctypes.CDLL(LIB_NAME)
+        _check_layout(lib)
+        f32 = np.ctypeslib.ndpointer(np.float32, flags='C_CONTIGUOUS')
+        f64 = np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')
+        u8 = np.ctypeslib.ndpointer(np.uint8, flags='C_CONTIGUOUS')
+        opt_f32 = ctypes.c_void_p  # numpy array or None
+        lib.ppg_dsp_init.argtypes = [ctypes.POINTER(PpgDsp), ctypes.c_float]
+        lib.ppg_dsp_process_block.restype = ctypes.c_size_t
+        lib.ppg_dsp_process_block.argtypes = [ctypes.POINTER(PpgDsp), opt_f32, f32, ctypes.c_void_p, ctypes.c_size_t,
+                                              f32, f32, u8]
+        lib.ppg_spo2_init.argtypes = [ctypes.POINTER(PpgSpo2)]
+        lib.ppg_spo2_add_block.argtypes = [ctypes.POINTER(PpgSpo2), f32, f32, ctypes.c_size_t]
+        lib.ppg_spo2_window.restype = ctypes.c_int
+        lib.ppg_spo2_window.argtypes = [ctypes.POINTER(PpgSpo2), ctypes.POINTER(ctypes.c_float),
+                                        ctypes.POINTER(ctypes.c_float)]
+        lib.ppg_stft_init.restype = ctypes.c_int
+        lib.ppg_stft_init.argtypes = [ctypes.POINTER(PpgStft), ctypes.c_int, ctypes.c_int]
+        lib.ppg_stft_add_block.restype = ctypes.c_size_t
+        lib.ppg_stft_add_block.argtypes = [ctypes.POINTER(PpgStft), f32, ctypes.c_size_t, f32, ctypes.c_size_t]
+        _lib = lib
+    return _lib
+
+
+def _f32(x):
+    return np.ascontiguousarray(x, dtype=np.float32)
+
+
+def _ptr(x):
+    return None if x is None else x.ctypes.data
+
+
+class BeatDetector:
+    """IR smoothing and beat detection of ppg_dsp_t. The parameters and state are the fields of
+    .state, e.g. state.peak_thr or state.hr_bpm_filt."""
+
+    def __init__(self, fs):
+        self._lib = _load()
+        self.state = PpgDsp()
+        self._lib.ppg_dsp_init(self.state, fs)
+
+    def process(self, ir, red=None, t=None):
+        """Process the next samples. t (seconds) defaults to the sample timeline; pass it when ir has
+        missing (nan) samples, they are skipped. Returns the filtered IR, the smoothed heart rate
+        after each sample (0 until the first beat) and a bool array of the detected beats."""
+        ir = _f32(ir)
+        n = len(ir)
+        red = None if red is None else _f32(red)
+        t = None if t is None else np.ascontiguousarray(t, dtype=np.float64)
+        if (red is not None and len(red) != n) or (t is not None and len(t) != n):
+            raise ValueError('ir, red and t must have the same length')
+        proc = np.empty(n, np.float32)
+        hr = np.empty(n, np.float32)
+        beat = np.empty(n, np.uint8)
+        self._lib.ppg_dsp_process_block(self.state, _ptr(red), ir, _ptr(t), n, proc, hr, beat)
+        return proc, hr, beat.view(np.bool_)
+
+
+class SpO2Estimator:
+    """SpO2 from the ratio of ratios of Red and IR, per window (ppg_spo2_t)."""
+
+    def __init__(self):
+        self._lib = _load()
+        self.state = PpgSpo2()
+        self._lib.ppg_spo2_init(self.state)
+
+    def add(self, red, ir):
+        """Add samples to the current window, pairs with a nan value are skipped."""
+        red, ir = _f32(red), _f32(ir)
+        if len(red) != len(ir):
+            raise ValueError('red and ir must have the same length')
+        self._lib.ppg_spo2_add_block(self.state, red, ir, len(ir))
+
+    def window(self):
+        """Close the current window. Returns (spo2 in %, IR perfusion index in %), None without a pulse."""
+        spo2, pi = ctypes.c_float(), ctypes.c_float()
+        if not self._lib.ppg_spo2_window(self.state, ctypes.byref(spo2), ctypes.byref(pi)):
+            return None
+        return spo2.value, pi.value
+
+    def windows(self, red, ir, length):
+        """SpO2 and perfusion index of consecutive windows of `length` samples, nan without a pulse.
+        A last incomplete window stays open for the next call of add() or windows()."""
+        n = len(ir) // length
+        out = np.full((n, 2), np.nan)
+        for i in range(n):
+            self.add(red[i * length:(i + 1) * length], ir[i * length:(i + 1) * length])
+            r = self.window()
+            if r is not None:
+                out[i] = r
+        self.add(red[n * length:], ir[n * length:])
+        return out[:, 0], out[:, 1]
+
+
+class Stft:
+    """Streaming short-time Fourier transform of one channel (ppg_stft_t)."""
+
+    def __init__(self, n_fft=512, hop=50, fs=100.0):
+        self._lib = _load()
+        self.state = PpgStft()
+        if self._lib.ppg_stft_init(self.state, n_fft, hop) != 0:
+            raise ValueError('n_fft must be a power of two up to %d and hop positive' % PPG_STFT_MAX_FFT)
+        self.frequencies = np.arange(self.state.n_bins) * fs / n_fft
+
+    def add(self, x):
+        """Add samples. Returns the new columns, power in dB, shape (columns, n_bins)."""
+        x = _f32(x)
+        max_columns = len(x) // self.state.hop + 1
+        columns = np.empty((max_columns, self.state.n_bins), np.float32)
+        n = self._lib.ppg_stft_add_block(self.state, x, len(x), columns, max_columns)
+        return columns[:n]
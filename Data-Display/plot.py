@@ -1,83 +1,243 @@
 # --------------------------------------------------------------
-# Python Script as part of the BioConnect Project Template 
-# 
+# Python Script as part of the BioConnect Project Template
+#
 # This script reads PPG values from the file FILE_NAME and displays
-# the data in a live plot. 
+# the data in a live plot. Pass another source on the command line,
+# e.g. the live feed of a reader started with -l bioconnect:
+#
+#   python plot.py shm:bioconnect
+#
+# The panels show the Red and IR waveforms with the detected beats
+# and the heart rate and SpO2 of the reader (live feed only, the
+# CSV carries IR only), and the live feed adds the spectrogram of IR
+# computed by the reader.
+#
+# All samples that arrived since the last frame are ingested at once
+# into a numpy ring buffer and all panels are redrawn once per frame
+# with blitting. The x-axis counts samples back from the newest one,
+# so the axes stay fixed and only the lines are redrawn. Buffers
+# longer than the plot is wide are reduced to a min/max pair per
+# pixel column, which keeps every peak visible at any sample rate.
+#
+# The y-axes follow the min/max of the visible window, kept up to
+# date incrementally. They are only changed when the data leaves
+# the axis or uses less than half of it, and at most every
+# RESCALE_MIN_S, since that needs one full redraw.
 # --------------------------------------------------------------
- 
-import csv
+
+import collections
 import os
+import sys
+import time
 import matplotlib.pyplot as plt
 from matplotlib.animation import FuncAnimation
-import collections
+import numpy as np
+from sources import empty_samples, open_source
 
 
-FILE_NAME = '../Export/data.csv' #'/Users/skorsh/STM32CubeIDE/Project_bioConnect/bioConnect_UNIX-Serial-2-CSV/src/data.csv' # in original file it was ../Export/data.csv 
+FILE_NAME = '../Export/data.csv' #'/Users/skorsh/STM32CubeIDE/Project_bioConnect/bioConnect_UNIX-Serial-2-CSV/src/data.csv' # in original file it was ../Export/data.csv
 BUFFER_SIZE = 2**12  # Length of the buffer
 UPDATE_AFTER_MS = 10  # Updates plot after x miliseconds
+FRAME_BUDGET_MS = 30  # Frames taking longer are counted and reported on close
+RESCALE_MIN_S = 0.5  # Shortest time between two changes of the y-axes
+SPECTRUM_HOP = 50  # Samples per spectrogram column (STFT_HOP of the reader)
+SPECTRUM_MAX_HZ = 10  # Highest frequency shown
+
+# Panels: field of the samples, y-axis label, relative height, smallest y-range shown
+PANELS = [('red', 'Red', 2, 20), ('ir', 'IR', 2, 20), ('hr', 'HR [bpm]', 1, 20), ('spo2', 'SpO2 [%]', 1, 10)]
+
+# Ring buffer of the newest BUFFER_SIZE samples, head is where the next one goes
+ring = empty_samples(BUFFER_SIZE)
+head = 0
+n_total = 0  # samples received so far
+
+
+# Min and max of the newest `length` values. Two monotonic deques of (index, value)
+# make every update amortised O(1) per new value, the window is never rescanned.
+class WindowRange:
+    def __init__(self, length):
+        self.length = length
+        self.n = 0
+        self.lo = collections.deque()  # increasing values, the front is the minimum
+        self.hi = collections.deque()  # decreasing values, the front is the maximum
 
-# Fixed size buffer with fast appends and pops on eighter end (FILO-Queue)
-y_data = collections.deque(maxlen=BUFFER_SIZE)
+    def push(self, values):
+        skipped = max(len(values) - self.length, 0)  # older than the window already
+        self.n += skipped
+        for v in values[skipped:].tolist():
+            i = self.n
+            self.n += 1
+            if v != v:
+                continue  # nan, missing
+            while self.lo and self.lo[-1][1] >= v:
+                self.lo.pop()
+            self.lo.append((i, v))
+            while self.hi and self.hi[-1][1] <= v:
+                self.hi.pop()
+            self.hi.append((i, v))
+        start = self.n - self.length
+        while self.lo and self.lo[0][0] < start:
+            self.lo.popleft()
+        while self.hi and self.hi[0][0] < start:
+            self.hi.popleft()
+
+    def range(self):
+        return (self.lo[0][1], self.hi[0][1]) if self.lo else None
+
+
+# Open the data source
+source = open_source(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), FILE_NAME))
+spectrum = hasattr(source, 'read_columns')
 
 # Initialize the plot
-fig, ax = plt.subplots()
-line, = ax.plot([], [], c='k')  # Line to be updated
-ax.set_ylim(-14000, -11700)  # Adjust y-axis !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! in original -2300 to 4200
-a, b = 0, BUFFER_SIZE  # Set x-axis limits
-
-# Opening the CSV file
-filepath = os.path.join(os.path.dirname(__file__), FILE_NAME)
-with open(filepath, 'r') as f:
-    # Getting the number of rows of the CSV file
-    row_count = sum(1 for row in csv.reader(f))
-
-# Open CSV file and fill buffer with last chunk of data
-file = open(filepath, 'r')
-reader = csv.reader(file)
-for i, row in enumerate(reader):
-    if i == (row_count-BUFFER_SIZE) and row:
-        y_data.append(float(row[0]))
-        break
+n_axes = len(PANELS) + spectrum
+fig, axes = plt.subplots(n_axes, 1, sharex=True, gridspec_kw={'height_ratios': [p[2] for p in PANELS] + [2] * spectrum})
+lines = []
+for ax, (field, label, _, _) in zip(axes, PANELS):
+    line, = ax.plot([], [], c='k', lw=1)  # Line to be updated
+    ax.set_ylabel(label)
+    lines.append(line)
+beats, = axes[1].plot([], [], 'o', c='r', ms=3)  # Beat markers on the IR waveform
+axes[0].set_xlim(-BUFFER_SIZE, 0)  # Samples before the newest one
+axes[-1].set_xlabel('samples')
+artists = lines + [beats]
+ranges = [WindowRange(BUFFER_SIZE) for _ in PANELS]
+
+# Spectrogram of IR: one image column per reader column, the newest on the right
+if spectrum:
+    n_bins = source.columns.dtype['power_db'].shape[0]
+    hz_per_bin = source.sample_rate / (2 * (n_bins - 1))  # bins span 0 .. sample_rate / 2
+    bins_shown = min(n_bins, int(SPECTRUM_MAX_HZ / hz_per_bin) + 1)
+    spec = np.full((bins_shown, BUFFER_SIZE // SPECTRUM_HOP), np.nan)
+    # Every column covers the SPECTRUM_HOP samples up to the newest one of its frame
+    image = axes[-1].imshow(spec, aspect='auto', origin='lower', cmap='viridis',
+                            extent=(-spec.shape[1] * SPECTRUM_HOP, 0, 0, (bins_shown - 1) * hz_per_bin))
+    axes[-1].set_ylabel('IR [Hz]')
+    artists.append(image)
+
+# Append samples to the ring buffer, overwriting the oldest ones
+def ring_append(samples):
+    global head, n_total
+    n_total += len(samples)
+    samples = samples[-BUFFER_SIZE:]
+    n = len(samples)
+    first = min(n, BUFFER_SIZE - head)
+    ring[head:head + first] = samples[:first]
+    ring[:n - first] = samples[first:]
+    head = (head + n) % BUFFER_SIZE
+
+# Buffer contents from the oldest to the newest sample
+def ring_ordered():
+    return np.concatenate((ring[head:], ring[:head]))
+
+# Reduce y to a min and a max per bucket when there are more values than columns.
+# x is the position of each point in samples before the newest one.
+def decimate(y, columns):
+    n = len(y)
+    if n <= 2 * columns:
+        return np.arange(-n, 0), y
+    per = -(-n // columns)  # values per bucket, rounded up
+    pad = (-n) % per
+    buckets = np.concatenate((np.full(pad, np.nan), y)).reshape(-1, per)
+    lo = np.fmin.reduce(buckets, axis=1)  # fmin/fmax skip missing (nan) values
+    hi = np.fmax.reduce(buckets, axis=1)
+    x = np.arange(-n - pad, 0, per)
+    return np.repeat(x, 2), np.column_stack((lo, hi)).ravel()
+
+# New y-limits for the range (lo, hi) of the data, None if the current ones still fit
+def new_limits(ax, rng, min_span, margin=0.1):
+    lo, hi = rng
+    cur_lo, cur_hi = ax.get_ylim()
+    span = max(hi - lo, min_span)
+    if lo >= cur_lo and hi <= cur_hi and span >= 0.5 * (cur_hi - cur_lo):
+        return None
+    mid = (lo + hi) / 2
+    return mid - (0.5 + margin) * span, mid + (0.5 + margin) * span
+
+# Adjust the y-axes to the visible window. Returns True if any changed.
+def rescale():
+    changed = False
+    for ax, rng, panel in zip(axes, ranges, PANELS):
+        r = rng.range()
+        limits = new_limits(ax, r, panel[3]) if r is not None else None
+        if limits is not None:
+            ax.set_ylim(*limits)
+            changed = True
+    return changed
+
+# Ingest new samples into the buffer and the window ranges
+def ingest(samples):
+    ring_append(samples)
+    for rng, (field, _, _, _) in zip(ranges, PANELS):
+        rng.push(samples[field])
+
+# Draw the buffer, at most two points per pixel column of the axes
+def draw_buffer():
+    window = ring_ordered()[BUFFER_SIZE - min(n_total, BUFFER_SIZE):]
+    columns = max(int(axes[0].bbox.width), 1)
+    for line, (field, _, _, _) in zip(lines, PANELS):
+        line.set_data(*decimate(window[field], columns))
+    idx = np.flatnonzero(window['beat'])
+    beats.set_data(idx - len(window), window['ir'][idx])
+
+# Shift the new IR columns into the spectrogram image, colours from its 5th to 99th percentile
+def ingest_columns(columns):
+    power = columns['power_db'][columns['channel'] == 1][-spec.shape[1]:, :spec.shape[0]]
+    if len(power) == 0:
+        return False
+    spec[:, :-len(power)] = spec[:, len(power):].copy()
+    spec[:, -len(power):] = power.T
+    image.set_data(spec)
+    if np.isfinite(spec).any():
+        image.set_clim(*np.nanpercentile(spec, (5, 99)))
+    return True
+
+# Fill the buffer with the newest samples
+ingest(source.tail(BUFFER_SIZE))
+rescale()
+last_rescale = time.monotonic()
+n_slow = 0  # frames over FRAME_BUDGET_MS
 
 # Function to initialize the plot
 def init():
-    line.set_data([], [])
-    return line,
+    draw_buffer()
+    return artists
 
-# Function to update the plot
+# Function to update the plot, one tick for all panels
 def update(frame):
-    global y_data, a, b # declare global variables
-    
-    # Read new lines from the CSV file
-    for i, row in enumerate(reader):
-        if row:
-
-            # Append new row of data to the buffer (pops the first element)
-            y_data.append(float(row[0])) 
-            
-            # Update x-axis limits
-            a += 1 
-            b += 1
-   
-            # Update the line plot
-            line.set_data(range(a, b), y_data)       
-            
-            # Adjust x-axis
-            ax.set_xlim(a, b)
-        else:
-            print('waiting')
-
-    return line,
-
-# Create animation function which countinously calls the update function 
-ani = FuncAnimation(fig, update, frames=None, init_func=init, blit=False, interval=UPDATE_AFTER_MS, save_count=BUFFER_SIZE)
-
-# Close the CSV file when the window is closed
+    global last_rescale, n_slow
+    t0 = time.monotonic()
+
+    # Read the samples that arrived since the last frame, all at once
+    new_samples = source.read()
+    if len(new_samples) > 0:
+        ingest(new_samples)
+    if spectrum:
+        ingest_columns(source.read_columns())
+
+    # New y-limits need a full redraw of the axes, the lines are blitted on top
+    if t0 - last_rescale >= RESCALE_MIN_S and rescale():
+        last_rescale = t0
+        fig.canvas.draw()
+    elif len(new_samples) == 0:
+        return artists
+
+    draw_buffer()
+    if (time.monotonic() - t0) * 1e3 > FRAME_BUDGET_MS:
+        n_slow += 1
+    return artists
+
+# Create animation function which countinously calls the update function
+ani = FuncAnimation(fig, update, frames=None, init_func=init, blit=True, interval=UPDATE_AFTER_MS, save_count=BUFFER_SIZE)
+
+# Close the data source when the window is closed
 def close_file(event):
     print("Closing file...")
-    file.close()
+    if n_slow > 0:
+        print("%d frames took longer than %d ms" % (n_slow, FRAME_BUDGET_MS))
+    source.close()
 
-# Connect the close event to also close the file
+# Connect the close event to also close the source
 fig.canvas.mpl_connect('close_event', close_file)
 
 # Show the plot
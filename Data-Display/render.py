@@ -0,0 +1,210 @@
+# --------------------------------------------------------------
+# Python Script as part of the BioConnect Project Template
+#
+# Renders the overview of a recording to an image without a
+# display, for reviewing long (overnight) recordings:
+#
+#   python render.py ../Export/data.csv                 data_overview.png
+#   python render.py ../Export/data.bcap -o night.svg --from 3600 --to 7200
+#
+# Nothing is decoded sample by sample. The Red and IR waveforms are
+# drawn as min/max bands from the summary pyramid written next to
+# the recording (build it with `start_reader pyramid` for recordings
+# made without one), at the level with about one entry per pixel.
+#
+# SpO2 is estimated per pyramid entry of at least SPO2_ENTRY_S from
+# the ratio of ratios of the peak-to-peak and mean of both channels,
+# with the calibration of ppg_spo2_window. Heart rate comes from the
+# beats in <base>_features.csv written by `start_reader batch`, or
+# else from the IR peak of the spectrogram in <base>_stft.bin. Lost
+# samples listed in <base>_gaps.csv are marked in every panel.
+# --------------------------------------------------------------
+
+import argparse
+import os
+import time
+import warnings
+import matplotlib
+matplotlib.use('Agg')  # no display needed
+import matplotlib.pyplot as plt
+import numpy as np
+from bccapture import Pyramid, Spectrogram
+
+
+WIDTH_PX = 1600  # Default image size
+HEIGHT_PX = 900
+DPI = 100
+SPO2_ENTRY_S = 2.0  # Shortest pyramid entry SpO2 is estimated over, at least one pulse
+SPO2_MIN_PI = 0.05  # Peak-to-peak IR perfusion index in % below which there is no usable pulse
+HR_BAND_HZ = (0.6, 3.5)  # Spectral peaks searched for the heart rate, 36 to 210 bpm
+
+
+# Reduce t, v to the median per bucket when there are more values than pixels
+def bucket_median(t, v, pixels):
+    n = len(v)
+    if n <= pixels:
+        return t, v
+    per = -(-n // pixels)  # values per bucket, rounded up
+    pad = (-n) % per
+    buckets = np.concatenate((v, np.full(pad, np.nan))).reshape(-1, per)
+    with warnings.catch_warnings():
+        warnings.simplefilter('ignore', RuntimeWarning)  # all-nan buckets stay nan
+        return t[::per], np.nanmedian(buckets, axis=1)
+
+# Pyramid entries of [t_from, t_to) at the finest level whose entries span at least min_s
+def entries_spanning(pyramid, factor, sample_rate, t_from, t_to, min_s):
+    level = 1
+    while factor ** level / sample_rate < min_s:
+        above = pyramid.level(level + 1)
+        if above is None or len(above) == 0:  # levels the recording has not reached are empty
+            break
+        level += 1
+    entries = pyramid.level(level)
+    if entries is None:
+        return entries
+    begin = np.searchsorted(entries['t_last'], t_from, 'right')
+    end = np.searchsorted(entries['t_first'], t_to, 'left')
+    return entries[begin:max(begin, end)]
+
+# SpO2 in % per entry from the ratio of ratios, nan where there is no pulse
+def spo2_of_entries(entries):
+    with np.errstate(all='ignore'):
+        ac = entries['max'] - entries['min']
+        dc = entries['mean']
+        red, ir = ac[:, 0] / dc[:, 0], ac[:, 1] / dc[:, 1]
+        spo2 = np.clip(110.0 - 25.0 * red / ir, 0.0, 100.0)
+        spo2[~(100.0 * ir >= SPO2_MIN_PI)] = np.nan
+    return spo2
+
+# Heart rate from the beats found by the batch tool, None if it has not been run. A CSV without
+# times gives beats from 0 s on (row / sample rate); when the pyramid is on the host clock (t0 of
+# its first entry), they are moved to start there.
+def hr_from_features(base, t_from, t_to, t0):
+    path = base + '_features.csv'
+    if not os.path.exists(path):
+        return None
+    f = np.loadtxt(path, delimiter=',', skiprows=1, ndmin=2)
+    if len(f) == 0:
+        return None
+    if f[-1, 0] < t0:
+        f[:, 0] += t0
+    keep = (f[:, 0] >= t_from) & (f[:, 0] < t_to)
+    return f[keep, 0], f[keep, 2]
+
+# Heart rate from the strongest IR peak in HR_BAND_HZ, one spectrogram column per pixel at most.
+# The peak is refined by a parabola through the dB values of the three bins around it.
+def hr_from_spectrogram(recording, t_from, t_to, pixels):
+    try:
+        spec = Spectrogram(recording)
+    except (OSError, ValueError):
+        return None
+    columns = spec.channel(1, t_from, t_to)
+    if len(columns) == 0:
+        return None
+    idx = np.unique(np.linspace(0, len(columns) - 1, min(pixels, len(columns))).astype(int))
+    picked = columns[idx]  # reads only these columns of the mapping
+    band = np.flatnonzero((spec.frequencies >= HR_BAND_HZ[0]) & (spec.frequencies <= HR_BAND_HZ[1]))
+    p = np.nan_to_num(picked['power_db'][:, band[0] - 1:band[-1] + 2].astype(float), nan=-np.inf)
+    k = np.argmax(p[:, 1:-1], axis=1) + 1
+    rows = np.arange(len(k))
+    a, b, c = p[rows, k - 1], p[rows, k], p[rows, k + 1]
+    with np.errstate(all='ignore'):
+        shift = np.where(np.isfinite(a + c) & (a - 2 * b + c < 0), 0.5 * (a - c) / (a - 2 * b + c), 0.0)
+    hz = (band[0] - 1 + k + shift) * spec.sample_rate / spec.n_fft
+    hz[~np.isfinite(b)] = np.nan
+    return picked['t'], 60.0 * hz
+
+# Lost samples of the reader in [t_from, t_to) as [(t_from, t_to), ...], at least min_s long.
+# Gaps closer than min_s are merged, so a recording with many short gaps stays quick to draw.
+def gaps(base, t_from, t_to, min_s):
+    path = base + '_gaps.csv'
+    if not os.path.exists(path):
+        return []
+    g = np.loadtxt(path, delimiter=',', skiprows=1, usecols=(4, 5), ndmin=2)
+    merged = []
+    for g_from, g_to in g[(g[:, 1] >= t_from) & (g[:, 0] < t_to)]:
+        g_to = max(g_to, g_from + min_s)
+        if merged and g_from <= merged[-1][1] + min_s:
+            merged[-1][1] = max(merged[-1][1], g_to)
+        else:
+            merged.append([g_from, g_to])
+    return merged
+
+# Unit of the time axis for a span in seconds
+def time_unit(span):
+    if span > 3 * 3600:
+        return 3600.0, 'hours'
+    if span > 3 * 60:
+        return 60.0, 'minutes'
+    return 1.0, 'seconds'
+
+def render(recording, out, t_from, t_to, width, height):
+    base = os.path.splitext(recording)[0]
+    pyramid = Pyramid(recording)
+    level1 = pyramid.level(1)
+    if level1 is None or len(level1) == 0:
+        raise SystemExit('%s has no summary pyramid, build it with: start_reader pyramid %s' % (recording, recording))
+    with open(base + '_pyr1.bin', 'rb') as f:
+        header = f.read(32)
+    factor = int(np.frombuffer(header, '<u4', 1, 8)[0])
+    sample_rate = float(np.frombuffer(header, '<f4', 1, 24)[0])
+    t0 = float(level1['t_first'][0])
+    t_from = t0 + t_from
+    t_to = t0 + t_to if t_to is not None else float(level1['t_last'][-1]) + 1.0
+    pixels = int(width * 0.85)  # the plot area, without the labels
+
+    fig, axes = plt.subplots(4, 1, sharex=True, figsize=(width / DPI, height / DPI), dpi=DPI,
+                             gridspec_kw={'height_ratios': [2, 2, 1, 1]})
+    span = t_to - t_from
+    scale, unit = time_unit(span)
+    x = lambda t: (np.asarray(t) - t0) / scale
+
+    # Waveforms: one min/max band per entry of the level with about one entry per pixel
+    level, entries = pyramid.query(t_from, t_to, pixels)
+    for ax, c, label in ((axes[0], 0, 'Red'), (axes[1], 1, 'IR')):
+        ax.fill_between(x(entries['t_first']), entries['min'][:, c], entries['max'][:, c],
+                        step='post', color='k', lw=0.5)
+        ax.set_ylabel(label)
+
+    # Heart rate and SpO2 tracks
+    hr = hr_from_features(base, t_from, t_to, t0)
+    hr_source = 'beats'
+    if hr is None:
+        hr = hr_from_spectrogram(recording, t_from, t_to, pixels)
+        hr_source = 'spectrum'
+    if hr is not None:
+        axes[2].plot(*bucket_median(x(hr[0]), hr[1], pixels), c='k', lw=0.8)
+        axes[2].set_ylim(30, 200)
+    axes[2].set_ylabel('HR [bpm]')
+    spo2_entries = entries_spanning(pyramid, factor, sample_rate, t_from, t_to, SPO2_ENTRY_S)
+    axes[3].plot(*bucket_median(x(spo2_entries['t_first']), spo2_of_entries(spo2_entries), pixels), c='k', lw=0.8)
+    axes[3].set_ylim(80, 100)
+    axes[3].set_ylabel('SpO2 [%]')
+
+    # Gaps, at least one pixel wide so short ones stay visible
+    for g_from, g_to in gaps(base, t_from, t_to, span / pixels):
+        for ax in axes:
+            ax.axvspan(x(g_from), x(g_to), color='r', alpha=0.4, lw=0)
+
+    axes[0].set_xlim(x(t_from), x(t_to))
+    axes[-1].set_xlabel('%s since %s' % (unit, time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(t0))))
+    axes[0].set_title('%s, %.1f h, pyramid level %d, HR from %s' % (os.path.basename(recording), span / 3600,
+                                                                     level, hr_source if hr is not None else '-'))
+    fig.tight_layout()
+    fig.savefig(out)  # the format follows the extension, e.g. .png or .svg
+    plt.close(fig)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Render the overview of a recording to an image.')
+    parser.add_argument('recording', help='CSV, capture or EDF recording with its summary pyramid')
+    parser.add_argument('-o', '--out', help='image to write, .png or .svg (default <base>_overview.png)')
+    parser.add_argument('--from', dest='t_from', type=float, default=0.0, help='start in s after the first sample')
+    parser.add_argument('--to', dest='t_to', type=float, help='end in s after the first sample')
+    parser.add_argument('-W', '--width', type=int, default=WIDTH_PX, help='width in pixels')
+    parser.add_argument('-H', '--height', type=int, default=HEIGHT_PX, help='height in pixels')
+    args = parser.parse_args()
+    out = args.out or os.path.splitext(args.recording)[0] + '_overview.png'
+    t_start = time.monotonic()
+    render(args.recording, out, args.t_from, args.t_to, args.width, args.height)
+    print('%s written in %.2f s' % (out, time.monotonic() - t_start))
@@ -0,0 +1,208 @@
+# --------------------------------------------------------------
+# Python Script as part of the BioConnect Project Template
+#
+# Data sources of the live plot. Every source returns numpy arrays
+# of SAMPLE records:
+#   tail(n)  the newest n samples, called once at startup
+#   read()   the samples that arrived since the last call
+#
+# Missing values are nan: the CSV carries IR only, and heart rate
+# and SpO2 are unknown until the reader has estimated them. Sources
+# with spectrogram columns (live feed) also have read_columns().
+#
+# SharedMemorySource reads the binary records the UNIX reader
+# publishes with -l (live_feed.h), CsvSource follows the CSV file
+# the reader writes. open_source picks one from a string:
+#
+#   open_source('shm:bioconnect')      reader started with -l bioconnect
+#   open_source('../Export/data.csv')
+# --------------------------------------------------------------
+
+import os
+import numpy as np
+from multiprocessing import shared_memory, resource_tracker
+
+
+SAMPLE = np.dtype([('red', 'f8'), ('ir', 'f8'), ('hr', 'f8'), ('spo2', 'f8'), ('beat', '?')])
+
+# Layout of the live feed, see live_feed.h
+FEED_MAGIC = b'BLIV'
+FEED_VERSION = 3
+FEED_HEADER_BYTES = 64
+FEED_WRITE_COUNT_OFFSET = 16
+FEED_COLUMN_COUNT_OFFSET = 40
+FEED_VALID = 0x01
+FEED_BEAT = 0x04
+FEED_RECORD = np.dtype([('t', '<f8'), ('value', '<f4', (2,)), ('seq', '<u4'), ('flags', '<u4'),
+                        ('hr_bpm', '<f4'), ('spo2', '<f4')])
+
+
+
+def column_dtype(n_bins):
+    """Spectrogram column of the live feed and of <base>_stft.bin (sf_column_t)."""
+    return np.dtype([('t', '<f8'), ('channel', '<u4'), ('power_db', '<f4', (n_bins,))])
+
+
+def empty_samples(n):
+    s = np.zeros(n, SAMPLE)
+    for name in ('red', 'ir', 'hr', 'spo2'):
+        s[name] = np.nan
+    return s
+
+
+class SharedMemorySource:
+    """Samples of the running reader from its shared-memory ring.
+    Missing samples are nan. Records the reader overwrote before they
+    were read (viewer stalled for longer than the ring) are counted
+    in n_lost."""
+
+    def __init__(self, name):
+        self.shm = shared_memory.SharedMemory(name=name)
+        # Attaching registers the segment for removal at exit, it belongs to the reader
+        resource_tracker.unregister(self.shm._name, 'shared_memory')
+        buf = self.shm.buf
+        if bytes(buf[:4]) != FEED_MAGIC or int(np.frombuffer(buf, '<u2', 1, 4)[0]) != FEED_VERSION:
+            self.shm.close()
+            raise ValueError('%s is not a live feed of this version' % name)
+        self.capacity = int(np.frombuffer(buf, '<u4', 1, 8)[0])
+        self.sample_rate = float(np.frombuffer(buf, '<f4', 1, 12)[0])
+        self.write_count = np.frombuffer(buf, '<u8', 1, FEED_WRITE_COUNT_OFFSET)
+        self.records = np.frombuffer(buf, FEED_RECORD, self.capacity, FEED_HEADER_BYTES)
+        self.pos = int(self.write_count[0])
+        self.n_lost = 0
+
+        column_capacity, n_bins = (int(x) for x in np.frombuffer(buf, '<u4', 2, 32))
+        self.column_count = np.frombuffer(buf, '<u8', 1, FEED_COLUMN_COUNT_OFFSET)
+        self.columns = np.frombuffer(buf, column_dtype(n_bins), column_capacity,
+                                     FEED_HEADER_BYTES + self.capacity * FEED_RECORD.itemsize)
+        self.column_pos = int(self.column_count[0])
+
+    def _copy(self, ring, count, first, last):
+        """Entries first..last-1 of a ring, or fewer if some were overwritten during the copy.
+        Returns them and the number dropped."""
+        capacity = len(ring)
+        a, b = first % capacity, last % capacity
+        if last - first == 0:
+            return ring[:0].copy(), 0
+        if a < b:
+            rec = ring[a:b].copy()
+        else:
+            rec = np.concatenate((ring[a:], ring[:b]))
+        # The writer may be writing entry count, which replaces count - capacity
+        overwritten = min(int(count[0]) + 1 - capacity - first, len(rec))
+        if overwritten > 0:
+            return rec[overwritten:], overwritten
+        return rec, 0
+
+    @staticmethod
+    def _samples(rec):
+        s = np.empty(len(rec), SAMPLE)
+        s['red'] = rec['value'][:, 0]
+        s['ir'] = rec['value'][:, 1]
+        missing = (rec['flags'] & FEED_VALID) == 0
+        s['red'][missing] = np.nan
+        s['ir'][missing] = np.nan
+        s['hr'] = rec['hr_bpm']
+        s['spo2'] = rec['spo2']
+        s['beat'] = (rec['flags'] & FEED_BEAT) != 0
+        return s
+
+    def tail(self, n):
+        end = int(self.write_count[0])
+        first = max(end - min(n, self.capacity - 1), 0)
+        self.pos = end
+        rec, lost = self._copy(self.records, self.write_count, first, end)
+        self.n_lost += lost
+        return self._samples(rec)
+
+    def read(self):
+        end = int(self.write_count[0])
+        if end - self.pos > self.capacity - 1:
+            self.n_lost += end - self.pos - (self.capacity - 1)
+            self.pos = end - (self.capacity - 1)
+        rec, lost = self._copy(self.records, self.write_count, self.pos, end)
+        self.n_lost += lost
+        self.pos = end
+        return self._samples(rec)
+
+    def read_columns(self):
+        """Spectrogram columns published since the last call (column_dtype)."""
+        end = int(self.column_count[0])
+        first = max(self.column_pos, end - (len(self.columns) - 1))
+        cols, _ = self._copy(self.columns, self.column_count, first, end)
+        self.column_pos = end
+        return cols
+
+    def close(self):
+        self.records = self.write_count = self.columns = self.column_count = None
+        self.shm.close()
+
+
+class CsvSource:
+    """First column of the CSV file written by the reader. Startup
+    reads backwards from the end, so it takes the same time however
+    long the recording is; then only appended bytes are read."""
+
+    def __init__(self, path):
+        self.file = open(path, 'rb')
+        self.pending = b''  # incomplete last row
+
+    @staticmethod
+    def parse_value(row):
+        """First column of a CSV row, None for the header and empty rows."""
+        try:
+            return float(row.split(b',', 1)[0])
+        except ValueError:
+            return None
+
+    @staticmethod
+    def parse_rows(rows):
+        """IR samples of all rows. Converts the whole batch at once and
+        only falls back to row by row if it contains a header or an empty row."""
+        firsts = [row.split(b',', 1)[0] for row in rows]
+        try:
+            ir = np.array(firsts).astype(float)
+        except ValueError:
+            ir = np.array([v for v in map(CsvSource.parse_value, rows) if v is not None], dtype=float)
+        s = empty_samples(len(ir))
+        s['ir'] = ir
+        return s
+
+    def tail(self, n, block_size=2**16):
+        pos = self.file.seek(0, os.SEEK_END)
+        data, n_lines = b'', 0
+        while pos > 0 and n_lines <= n:
+            step = min(block_size, pos)
+            pos -= step
+            self.file.seek(pos)
+            block = self.file.read(step)
+            n_lines += block.count(b'\n')
+            data = block + data
+        complete = data.rfind(b'\n') + 1  # the last row may still be written
+        rows = data[:complete].split(b'\n')[:-1]
+        if pos > 0:
+            rows = rows[1:]  # starts inside a row
+        self.pending = data[complete:]
+        self.file.seek(0, os.SEEK_END)
+        return self.parse_rows(rows[-n:])
+
+    def read(self):
+        data = self.file.read()
+        if not data:
+            return empty_samples(0)
+        data = self.pending + data
+        complete = data.rfind(b'\n') + 1
+        self.pending = data[complete:]
+        if complete == 0:
+            return empty_samples(0)
+        return self.parse_rows(data[:complete - 1].split(b'\n'))
+
+    def close(self):
+        self.file.close()
+
+
+def open_source(spec):
+    """'shm:<name>' for the live feed of the reader, anything else is a CSV path."""
+    if spec.startswith('shm:'):
+        return SharedMemorySource(spec[4:])
+    return CsvSource(spec)
@@ -0,0 +1,170 @@
+/*
+ *  Title: bioConnect Wire Protocol
+ *  Description: The one definition of the frames the firmware sends over the UART and the readers
+ *               parse, included by the firmware and by the UNIX and Windows readers. Header only, so
+ *               every side compiles the same packer and unpacker.
+ *
+ *               Two encodings of a sample exist:
+ *
+ *                   text    "seq,tick,red,ir\r\n" (BC_TEXT_SAMPLE_FORMAT / BC_TEXT_SAMPLE_SCAN), and
+ *                           "red,ir\r\n" from firmware before sequence numbers
+ *                   binary  sync (2) | type (1) | length (1) | payload | Fletcher-16 (2)
+ *
+ *               Binary frames start with BC_SYNC_0, a byte no text frame contains, so a reader tells
+ *               them apart byte by byte. The payload layouts are generated from the field lists below
+ *               (BC_SAMPLE_FIELDS, ...) and checked at compile time; they are packed and little endian,
+ *               as on the Cortex-M4 and x86/ARM hosts, so the host decodes a payload by a cast in place.
+ *
+ *               Handshake: the firmware sends BC_FRAME_HELLO (version, channels, sample rate, the
+ *               encodings it can send and its highest baud rate) at boot and whenever the host sends
+ *               BC_FRAME_QUERY. The host answers with BC_FRAME_SELECT for the best mode both support;
+ *               the firmware confirms with a new hello at the old baud rate, then switches. Hello,
+ *               query and select are always binary, whatever encoding the samples use.
+ */
+
+#ifndef BC_PROTOCOL_H
+#define BC_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BC_PROTOCOL_VERSION 1
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "bc_protocol.h: the binary frames are little endian"
+#endif
+
+// Text encoding
+#define BC_TEXT_SAMPLE_FORMAT "%lu,%lu,%lu,%lu\r\n"  // seq, tick, red, ir as unsigned long (firmware)
+#define BC_TEXT_SAMPLE_SCAN "%lu,%lu,%d,%d"          // the same line on the host
+#define BC_TEXT_LEGACY_SCAN "%d,%d"                  // red, ir of firmware without sequence numbers
+
+// Binary encoding
+#define BC_SYNC_0 0xA5                               // not ASCII, never part of a text frame
+#define BC_SYNC_1 0x5A
+
+typedef enum {
+    BC_FRAME_SAMPLE = 1,                             // bc_sample_t, device to host
+    BC_FRAME_HELLO = 2,                              // bc_hello_t, device to host
+    BC_FRAME_QUERY = 3,                              // no payload, host to device: send a hello
+    BC_FRAME_SELECT = 4                              // bc_select_t, host to device
+} bc_frame_type_t;
+
+#define BC_ENCODING_TEXT 0x01                        // bits of bc_hello_t.encodings
+#define BC_ENCODING_BINARY 0x02
+
+#define BC_CHANNEL_RED 0x01                          // bits of bc_hello_t.channels
+#define BC_CHANNEL_IR 0x02
+
+// Sample payload, X(type, name, comment) per field in wire order
+#define BC_SAMPLE_FIELDS(X)                                                      \
+    X(uint32_t, seq,  "frame sequence number, +1 per ADC trigger")               \
+    X(uint32_t, tick, "HAL tick of the ADC trigger in ms")                       \
+    X(uint16_t, red,  "12-bit ADC value, dark level subtracted")                 \
+    X(uint16_t, ir,   "12-bit ADC value, dark level subtracted")
+
+// Hello payload
+#define BC_HELLO_FIELDS(X)                                                       \
+    X(uint8_t,  protocol_version, "BC_PROTOCOL_VERSION of the firmware")         \
+    X(uint8_t,  fw_major,         "firmware version")                            \
+    X(uint8_t,  fw_minor,         "")                                            \
+    X(uint8_t,  fw_patch,         "")                                            \
+    X(uint8_t,  channels,         "BC_CHANNEL_* bits, in the order of bc_sample_t") \
+    X(uint8_t,  encodings,        "BC_ENCODING_* bits the firmware can send")    \
+    X(uint8_t,  encoding,         "BC_ENCODING_* of the samples sent now")       \
+    X(uint8_t,  reserved,         "0")                                           \
+    X(uint32_t, sample_rate_mhz,  "nominal sample rate in mHz")                  \
+    X(uint32_t, max_baud,         "highest baud rate the firmware can switch to") \
+    X(uint32_t, baud,             "baud rate in use")
+
+// Select payload
+#define BC_SELECT_FIELDS(X)                                                      \
+    X(uint32_t, baud,             "baud rate to switch to")                      \
+    X(uint8_t,  encoding,         "one BC_ENCODING_* bit")
+
+#define BC_FIELD_DECLARE(type, name, comment) type name;
+#define BC_FIELD_SIZE(type, name, comment) + sizeof(type)
+
+typedef struct __attribute__((packed)) {
+    BC_SAMPLE_FIELDS(BC_FIELD_DECLARE)
+} bc_sample_t;
+
+typedef struct __attribute__((packed)) {
+    BC_HELLO_FIELDS(BC_FIELD_DECLARE)
+} bc_hello_t;
+
+typedef struct __attribute__((packed)) {
+    BC_SELECT_FIELDS(BC_FIELD_DECLARE)
+} bc_select_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];                                 // BC_SYNC_0, BC_SYNC_1
+    uint8_t type;                                    // bc_frame_type_t
+    uint8_t length;                                  // payload bytes
+} bc_frame_header_t;
+
+#define BC_CHECKSUM_BYTES 2
+#define BC_FRAME_BYTES(payload) (sizeof(bc_frame_header_t) + (payload) + BC_CHECKSUM_BYTES)
+#define BC_MAX_FRAME BC_FRAME_BYTES(255)
+
+_Static_assert(sizeof(bc_sample_t) == 0 BC_SAMPLE_FIELDS(BC_FIELD_SIZE), "sample payload has no padding");
+_Static_assert(sizeof(bc_sample_t) == 12, "sample payload layout");
+_Static_assert(sizeof(bc_hello_t) == 0 BC_HELLO_FIELDS(BC_FIELD_SIZE), "hello payload has no padding");
+_Static_assert(sizeof(bc_hello_t) == 20, "hello payload layout");
+_Static_assert(sizeof(bc_select_t) == 0 BC_SELECT_FIELDS(BC_FIELD_SIZE), "select payload has no padding");
+_Static_assert(sizeof(bc_select_t) == 5, "select payload layout");
+_Static_assert(sizeof(bc_frame_header_t) == 4, "frame header layout");
+
+// Fletcher-16 over the type, length and payload
+static inline uint16_t bc_checksum(const uint8_t *p, size_t n) {
+    uint16_t a = 0, b = 0;
+    for (size_t i = 0; i < n; ++i) {
+        a = (uint16_t)((a + p[i]) % 255);
+        b = (uint16_t)((b + a) % 255);
+    }
+    return (uint16_t)((b << 8) | a);
+}
+
+// Write a frame with the payload to out, which holds at least BC_FRAME_BYTES(length). Returns its size.
+static inline size_t bc_encode(uint8_t *out, bc_frame_type_t type, const void *payload, uint8_t length) {
+    bc_frame_header_t h = { { BC_SYNC_0, BC_SYNC_1 }, (uint8_t)type, length };
+    memcpy(out, &h, sizeof(h));
+    if (length > 0) memcpy(out + sizeof(h), payload, length);
+    uint16_t sum = bc_checksum(out + 2, 2 + (size_t)length);
+    out[sizeof(h) + length] = (uint8_t)(sum & 0xFF);
+    out[sizeof(h) + length + 1] = (uint8_t)(sum >> 8);
+    return BC_FRAME_BYTES(length);
+}
+
+typedef enum {
+    BC_PARSE_MORE = 0,                               // p holds the start of a frame, wait for more bytes
+    BC_PARSE_FRAME,                                  // a complete, valid frame of *size bytes
+    BC_PARSE_BAD                                     // p does not start a frame: resync after p[0]
+} bc_parse_t;
+
+// Check for a frame at the start of the n bytes at p. The payload of a frame is read in place with
+// bc_payload(), nothing is copied.
+static inline bc_parse_t bc_parse(const uint8_t *p, size_t n, size_t *size) {
+    if (n >= 1 && p[0] != BC_SYNC_0) return BC_PARSE_BAD;
+    if (n >= 2 && p[1] != BC_SYNC_1) return BC_PARSE_BAD;
+    if (n < sizeof(bc_frame_header_t)) return BC_PARSE_MORE;
+    size_t length = p[3];
+    if (n < BC_FRAME_BYTES(length)) return BC_PARSE_MORE;
+    uint16_t sum = bc_checksum(p + 2, 2 + length);
+    if (p[4 + length] != (sum & 0xFF) || p[5 + length] != (sum >> 8)) return BC_PARSE_BAD;
+    *size = BC_FRAME_BYTES(length);
+    return BC_PARSE_FRAME;
+}
+
+static inline bc_frame_type_t bc_type(const uint8_t *frame) {
+    return (bc_frame_type_t)((const bc_frame_header_t *)frame)->type;
+}
+
+// Payload of a frame bc_parse() accepted, NULL if it is not of the given type and size
+static inline const void *bc_payload(const uint8_t *frame, bc_frame_type_t type, size_t size) {
+    const bc_frame_header_t *h = (const bc_frame_header_t *)frame;
+    return (h->type == type && h->length == size) ? frame + sizeof(*h) : NULL;
+}
+
+#endif // BC_PROTOCOL_H
@@ -24,6 +24,7 @@
 #include "string.h"
 #include <stdio.h>
 #include <stdbool.h>
+#include "bc_protocol.h"
 //#include "stm3214xx_ll_tim.h"
 /* USER CODE END Includes */
 
@@ -36,6 +37,13 @@
 /* USER CODE BEGIN PD */
 #define ADC_TIMEOUT 1000
 #define UART_TIMEOUT 1000
+#define WIRE_DEFAULT_ENCODING BC_ENCODING_TEXT // after reset: text lines all readers parse, the handshake selects binary
+#define FW_VERSION_MAJOR 1
+#define FW_VERSION_MINOR 1
+#define FW_VERSION_PATCH 0
+#define SAMPLE_PERIOD_MS 10 // one Red/IR measurement every 10 ms
+#define MAX_BAUD 921600 // highest baud rate offered in the handshake
+#define RX_N 64
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -65,6 +73,26 @@ static volatile uint32_t buffer_IR[N]; // buffer memory
 static volatile int16_t tail_IR = 0; // index pointing to next empty storage space in buffer
 static volatile int16_t head_IR = 0; // index pointing to oldest element added
 
+// TIME BUFFER: sequence number and HAL tick (ms) of the ADC trigger of each Red/IR pair
+static volatile uint32_t buffer_Seq[N]; // buffer memory
+static volatile uint32_t buffer_Tick[N]; // buffer memory
+static volatile int16_t tail_Time = 0; // index pointing to next empty storage space in buffer
+static volatile int16_t head_Time = 0; // index pointing to oldest element added
+
+// sequence number and trigger time of the measurement currently running
+static volatile uint32_t trigger_seq = 0;
+static volatile uint32_t trigger_tick = 0;
+
+// HOST RX BUFFER: bytes received from the host, filled by the UART receive interrupt
+static volatile uint8_t buffer_Rx[RX_N]; // buffer memory
+static volatile int16_t tail_Rx = 0; // index pointing to next empty storage space in buffer
+static volatile int16_t head_Rx = 0; // index pointing to oldest element added
+static volatile uint8_t rx_overflow = 0; // bytes were dropped because the buffer was full
+static uint8_t rx_byte; // byte being received
+
+// encoding of the sample frames, changed by the handshake with the host
+static uint8_t wire_encoding = WIRE_DEFAULT_ENCODING;
+
 
 /* USER CODE END PM */
 
@@ -131,6 +159,25 @@ uint32_t Dequeue_IR(void)
 	return val;
 }
 
+void Enqueue_Time(uint32_t seq, uint32_t tick)
+{
+	buffer_Seq[tail_Time] = seq;
+	buffer_Tick[tail_Time] = tick;
+	tail_Time = (tail_Time + 1) % N;
+}
+
+void Dequeue_Time(uint32_t *seq, uint32_t *tick)
+{
+	*seq = 0;
+	*tick = 0;
+	if (head_Time != tail_Time)
+	{
+		*seq = buffer_Seq[head_Time];
+		*tick = buffer_Tick[head_Time];
+		head_Time = (head_Time + 1) % N;
+	}
+}
+
 bool isEmpty_Red(void)
 {
 return (tail_Red == head_Red);
@@ -140,6 +187,104 @@ bool isEmpty_IR(void)
 {
 return (tail_IR == head_IR);
 }
+
+// Announce firmware version, channels, sample rate and the encodings and baud rates on offer.
+// baud is the rate in use once this hello has been sent.
+void Send_Hello(uint32_t baud)
+{
+	bc_hello_t hello = {0};
+	hello.protocol_version = BC_PROTOCOL_VERSION;
+	hello.fw_major = FW_VERSION_MAJOR;
+	hello.fw_minor = FW_VERSION_MINOR;
+	hello.fw_patch = FW_VERSION_PATCH;
+	hello.channels = BC_CHANNEL_RED | BC_CHANNEL_IR;
+	hello.encodings = BC_ENCODING_TEXT | BC_ENCODING_BINARY;
+	hello.encoding = wire_encoding;
+	hello.sample_rate_mhz = 1000000 / SAMPLE_PERIOD_MS;
+	hello.max_baud = MAX_BAUD;
+	hello.baud = baud;
+	uint8_t frame[BC_FRAME_BYTES(sizeof(bc_hello_t))];
+	size_t frame_size = bc_encode(frame, BC_FRAME_HELLO, &hello, sizeof(hello));
+	HAL_UART_Transmit(&huart2, frame, frame_size, UART_TIMEOUT);
+}
+
+bool Baud_Supported(uint32_t baud)
+{
+	return baud == 115200 || baud == 230400 || baud == 460800 || baud == 921600;
+}
+
+// Reconfigure the UART, the hello confirming the change has been sent at the old rate
+void Switch_Baud(uint32_t baud)
+{
+	HAL_UART_AbortReceive(&huart2);
+	huart2.Init.BaudRate = baud;
+	if (HAL_UART_Init(&huart2) != HAL_OK)
+	{
+		Error_Handler();
+	}
+	HAL_UART_Receive_IT(&huart2, &rx_byte, 1);
+}
+
+// Handle one frame from the host: answer a query, apply a valid select and confirm it with a hello.
+// A select that cannot be applied is answered with a hello of the unchanged settings.
+void Handle_Host_Frame(const uint8_t *frame)
+{
+	uint32_t baud = huart2.Init.BaudRate;
+	const bc_select_t *select = bc_payload(frame, BC_FRAME_SELECT, sizeof(bc_select_t));
+	if (select != NULL)
+	{
+		if ((select->encoding == BC_ENCODING_TEXT || select->encoding == BC_ENCODING_BINARY)
+				&& select->baud <= MAX_BAUD && Baud_Supported(select->baud))
+		{
+			wire_encoding = select->encoding;
+			baud = select->baud;
+		}
+	}
+	else if (bc_type(frame) != BC_FRAME_QUERY)
+	{
+		return;
+	}
+	Send_Hello(baud);
+	if (baud != huart2.Init.BaudRate)
+	{
+		Switch_Baud(baud);
+	}
+}
+
+// Parse the bytes received from the host and handle the complete frames
+void Poll_Host(void)
+{
+	static uint8_t rx[BC_MAX_FRAME];
+	static size_t rx_len = 0;
+	if (rx_overflow)
+	{
+		// bytes are missing after the buffered ones: drop them all and resync on the next frame,
+		// the host asks again when it gets no answer
+		rx_overflow = 0;
+		head_Rx = tail_Rx;
+		rx_len = 0;
+	}
+	while (head_Rx != tail_Rx && rx_len < sizeof(rx))
+	{
+		rx[rx_len++] = buffer_Rx[head_Rx];
+		head_Rx = (head_Rx + 1) % RX_N;
+	}
+	while (rx_len > 0)
+	{
+		size_t frame_size = 1;
+		bc_parse_t r = bc_parse(rx, rx_len, &frame_size);
+		if (r == BC_PARSE_MORE)
+		{
+			break;
+		}
+		if (r == BC_PARSE_FRAME)
+		{
+			Handle_Host_Frame(rx);
+		}
+		memmove(rx, rx + frame_size, rx_len - frame_size); // a bad byte is dropped, then resync
+		rx_len -= frame_size;
+	}
+}
 /* USER CODE END 0 */
 
 /**
@@ -151,7 +296,7 @@ int main(void)
 
   /* USER CODE BEGIN 1 */
   uint32_t value_dac=0;
-  char msg[100] = "Hello, World"; //note that 100 chars is the maximum length of the message
+  char msg[100]; //note that 100 chars is the maximum length of the message
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -179,7 +324,8 @@ int main(void)
   /* USER CODE BEGIN 2 */
   HAL_DAC_Start(&hdac1,DAC_CHANNEL_2);
   HAL_ADCEx_Calibration_Start(&hadc1, ADC_SINGLE_ENDED);
-  HAL_UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg), 0xFFFF); //print a hello world to begin the program
+  Send_Hello(huart2.Init.BaudRate); //announce the firmware and its capabilities to the reader
+  HAL_UART_Receive_IT(&huart2, &rx_byte, 1); //receive the handshake of the reader
 
   //HAL_TIM_Base_Start_IT(&htim3); //transfer timer from Delay to interruption
 
@@ -222,14 +368,31 @@ int main(void)
 	  {
 		  uint32_t val_red = Dequeue_Red();
 		  uint32_t val_ir = Dequeue_IR();
-		  sprintf(msg, "%lu,%lu\r\n",val_red, val_ir);
-		  HAL_UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg), UART_TIMEOUT);
+		  uint32_t seq, tick;
+		  Dequeue_Time(&seq, &tick);
+		  //sequence number and trigger tick let the host detect lost frames and trace latency
+		  if (wire_encoding == BC_ENCODING_BINARY)
+		  {
+			  bc_sample_t sample = { seq, tick, (uint16_t)val_red, (uint16_t)val_ir };
+			  uint8_t frame[BC_FRAME_BYTES(sizeof(bc_sample_t))];
+			  size_t frame_size = bc_encode(frame, BC_FRAME_SAMPLE, &sample, sizeof(sample));
+			  HAL_UART_Transmit(&huart2, frame, frame_size, UART_TIMEOUT);
+		  }
+		  else
+		  {
+			  sprintf(msg, BC_TEXT_SAMPLE_FORMAT, seq, tick, val_red, val_ir);
+			  HAL_UART_Transmit(&huart2, (uint8_t*)msg, strlen(msg), UART_TIMEOUT);
+		  }
 
 	  }
 
-	  if (HAL_GetTick() - last_update >= 10 && measurement_state == 0)
+	  Poll_Host();
+
+	  if (HAL_GetTick() - last_update >= SAMPLE_PERIOD_MS && measurement_state == 0)
 	  {
 		  last_update = HAL_GetTick();
+		  trigger_seq++;
+		  trigger_tick = last_update;
 		  measurement_state = 3;
 		  Measure_interrupt();
 	  }
@@ -561,6 +724,7 @@ void HAL_ADC_ConvCpltCallback (ADC_HandleTypeDef* hadc)
 		//val_ir = (raw_val > val_dark) ? (raw_val - val_dark) : 0;
 		val = (raw_val > val_dark) ? (raw_val - val_dark) : 0;
 		Enqueue_IR(val);
+		Enqueue_Time(trigger_seq, trigger_tick);
 		//data_ready = 1;
 		measurement_state = 0;
 		Measure_interrupt();
@@ -603,6 +767,33 @@ void Measure_interrupt(void)
 //	}
 //}
 
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance == USART2)
+	{
+		int16_t next = (tail_Rx + 1) % RX_N;
+		if (next != head_Rx)
+		{
+			buffer_Rx[tail_Rx] = rx_byte;
+			tail_Rx = next;
+		}
+		else
+		{
+			rx_overflow = 1; // full: drop the byte rather than overwrite the oldest ones
+		}
+		HAL_UART_Receive_IT(&huart2, &rx_byte, 1);
+	}
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	// an overrun or framing error ends the reception, start it again
+	if (huart->Instance == USART2)
+	{
+		HAL_UART_Receive_IT(&huart2, &rx_byte, 1);
+	}
+}
+
 /* USER CODE END 4 */
 
 /**
@@ -4,13 +4,103 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../src/UNIX-Serial-2-CSV.c 
+../src/UNIX-Serial-2-CSV.c \
+../src/alloc_count.c \
+../src/arena.c \
+../src/capture_file.c \
+../src/capture_reader.c \
+../src/capture_segments.c \
+../src/clock_sync.c \
+../src/edf_writer.c \
+../src/gap_resample.c \
+../src/handshake.c \
+../src/latency_trace.c \
+../src/live_feed.c \
+../src/pipeline.c \
+../src/pipeline_stages.c \
+../src/ppg_codec.c \
+../src/ppg_dsp.c \
+../src/realtime.c \
+../src/sink.c \
+../src/sink_outputs.c \
+../src/spectrogram_file.c \
+../src/summary_pyramid.c \
+../src/tool_batch.c \
+../src/tool_capture_dump.c \
+../src/tool_codec_bench.c \
+../src/tool_pyramid.c \
+../src/tool_query.c \
+../src/tool_sched_bench.c \
+../src/tool_sink_bench.c \
+../src/tools.c \
+../src/uring_writer.c \
+../src/work_steal.c 
 
 C_DEPS += \
-./src/UNIX-Serial-2-CSV.d 
+./src/UNIX-Serial-2-CSV.d \
+./src/alloc_count.d \
+./src/arena.d \
+./src/capture_file.d \
+./src/capture_reader.d \
+./src/capture_segments.d \
+./src/clock_sync.d \
+./src/edf_writer.d \
+./src/gap_resample.d \
+./src/handshake.d \
+./src/latency_trace.d \
+./src/live_feed.d \
+./src/pipeline.d \
+./src/pipeline_stages.d \
+./src/ppg_codec.d \
+./src/ppg_dsp.d \
+./src/realtime.d \
+./src/sink.d \
+./src/sink_outputs.d \
+./src/spectrogram_file.d \
+./src/summary_pyramid.d \
+./src/tool_batch.d \
+./src/tool_capture_dump.d \
+./src/tool_codec_bench.d \
+./src/tool_pyramid.d \
+./src/tool_query.d \
+./src/tool_sched_bench.d \
+./src/tool_sink_bench.d \
+./src/tools.d \
+./src/uring_writer.d \
+./src/work_steal.d 
 
 OBJS += \
-./src/UNIX-Serial-2-CSV.o 
+./src/UNIX-Serial-2-CSV.o \
+./src/alloc_count.o \
+./src/arena.o \
+./src/capture_file.o \
+./src/capture_reader.o \
+./src/capture_segments.o \
+./src/clock_sync.o \
+./src/edf_writer.o \
+./src/gap_resample.o \
+./src/handshake.o \
+./src/latency_trace.o \
+./src/live_feed.o \
+./src/pipeline.o \
+./src/pipeline_stages.o \
+./src/ppg_codec.o \
+./src/ppg_dsp.o \
+./src/realtime.o \
+./src/sink.o \
+./src/sink_outputs.o \
+./src/spectrogram_file.o \
+./src/summary_pyramid.o \
+./src/tool_batch.o \
+./src/tool_capture_dump.o \
+./src/tool_codec_bench.o \
+./src/tool_pyramid.o \
+./src/tool_query.o \
+./src/tool_sched_bench.o \
+./src/tool_sink_bench.o \
+./src/tools.o \
+./src/uring_writer.o \
+./src/work_steal.o 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -25,7 +115,7 @@ src/%.o: ../src/%.c src/subdir.mk
 clean: clean-src
 
 clean-src:
-	-$(RM) ./src/UNIX-Serial-2-CSV.d ./src/UNIX-Serial-2-CSV.o
+	-$(RM) ./src/UNIX-Serial-2-CSV.d ./src/UNIX-Serial-2-CSV.o ./src/alloc_count.d ./src/alloc_count.o ./src/arena.d ./src/arena.o ./src/capture_file.d ./src/capture_file.o ./src/capture_reader.d ./src/capture_reader.o ./src/capture_segments.d ./src/capture_segments.o ./src/clock_sync.d ./src/clock_sync.o ./src/edf_writer.d ./src/edf_writer.o ./src/gap_resample.d ./src/gap_resample.o ./src/handshake.d ./src/handshake.o ./src/latency_trace.d ./src/latency_trace.o ./src/live_feed.d ./src/live_feed.o ./src/pipeline.d ./src/pipeline.o ./src/pipeline_stages.d ./src/pipeline_stages.o ./src/ppg_codec.d ./src/ppg_codec.o ./src/ppg_dsp.d ./src/ppg_dsp.o ./src/realtime.d ./src/realtime.o ./src/sink.d ./src/sink.o ./src/sink_outputs.d ./src/sink_outputs.o ./src/spectrogram_file.d ./src/spectrogram_file.o ./src/summary_pyramid.d ./src/summary_pyramid.o ./src/tool_batch.d ./src/tool_batch.o ./src/tool_capture_dump.d ./src/tool_capture_dump.o ./src/tool_codec_bench.d ./src/tool_codec_bench.o ./src/tool_pyramid.d ./src/tool_pyramid.o ./src/tool_query.d ./src/tool_query.o ./src/tool_sched_bench.d ./src/tool_sched_bench.o ./src/tool_sink_bench.d ./src/tool_sink_bench.o ./src/tools.d ./src/tools.o ./src/uring_writer.d ./src/uring_writer.o ./src/work_steal.d ./src/work_steal.o
 
 .PHONY: clean-src
 
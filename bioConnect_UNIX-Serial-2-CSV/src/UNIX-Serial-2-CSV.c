@@ -10,16 +10,117 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <signal.h>
 
 // Linux headers
 #include <fcntl.h> // Contains file controls like O_RDWR
 #include <errno.h> // Error integer and strerror() function
 #include <termios.h> // Contains POSIX terminal control definitions
-#include <unistd.h> // write(), read(), close()
+#include <unistd.h> // write(), read(), close(), getopt()
+
+// Project headers
+#include "../../bioConnect_STM32-MCU/Core/Inc/bc_protocol.h"  // wire format shared with the firmware
+#include "alloc_count.h"
+#include "clock_sync.h"
+#include "gap_resample.h"
+#include "handshake.h"
+#include "latency_trace.h"
+#include "live_feed.h"
+#include "pipeline.h"
+#include "realtime.h"
+#include "sink.h"
+#include "spectrogram_file.h"
+#include "tools.h"
 
 // Constants
 #define BUFFER_SIZE 1024          // Size of buffer for storing each complete value
 #define CHUNK_SIZE 256            // Number of bytes to read in each call
+#define FS 100.0f                 // Sample rate of firmware without a handshake: a measurement every 10 ms
+#define DRIFT_REPORT_EVERY 10     // Print the clock drift after every n clock-sync fits
+#define MAX_FILL_DEFAULT 10       // Gaps up to 100 ms are interpolated when resampling
+#define STFT_N_FFT 512            // Spectrogram frames of 5.12 s ...
+#define STFT_HOP 50               // ... every 0.5 s
+
+// Cleared by SIGINT so the read loop ends and files are closed properly
+static volatile sig_atomic_t keep_running = 1;
+
+static void handle_sigint(int sig) {
+    (void)sig;
+    keep_running = 0;
+}
+
+// Latency trace stamps of a received frame (-t), see latency_trace.h
+typedef struct {
+    uint32_t seq;
+    uint64_t rx_us;
+    uint64_t parse_us;
+    int64_t  transit_us;
+} frame_stamp_t;
+
+#define STAMP_RING 8           // stamps of the latest frames by sequence number, more than the resampler holds
+
+// The samples, gap records and messages go to the dsp sink, which runs the DSP graph and hands them on
+// to the sinks. The read loop writes nothing itself: the console and the gap file are sinks too.
+typedef struct {
+    sink_fanout_t dsp;
+    frame_stamp_t stamps[STAMP_RING];  // the resampler hands a frame on later than it was received
+} output_t;
+
+static void emit_sample(output_t *out, uint32_t seq, double t, const float *value, uint32_t flags,
+                        const frame_stamp_t *stamp) {
+    sink_sample_t s = { t, { value[0], value[1] }, seq, flags, NAN, NAN, 0, 0, -1 };  // vitals are added by the graph
+    if (stamp != NULL) {
+        s.rx_us = stamp->rx_us;
+        s.parse_us = stamp->parse_us;
+        s.transit_us = stamp->transit_us;
+    }
+    sink_fanout_sample(&out->dsp, &s);
+}
+
+static void write_sample(void *ctx, const gr_sample_t *s) {
+    output_t *out = (output_t *)ctx;
+    uint32_t flags = (s->flag != GR_SAMPLE_MISSING ? SINK_VALID : 0) | (s->flag == GR_SAMPLE_INTERPOLATED ? SINK_INTERPOLATED : 0);
+    const frame_stamp_t *stamp = &out->stamps[s->seq % STAMP_RING];
+    emit_sample(out, s->seq, s->t, s->value, flags, s->flag == GR_SAMPLE_REAL && stamp->seq == s->seq ? stamp : NULL);
+}
+
+static void write_gap(void *ctx, const gr_gap_t *g) {
+    sink_fanout_gap(&((output_t *)ctx)->dsp, g);
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [-p serial_port] [-b max_baud] [-o csv_file] [-O sink]... [-s max_MB] [-d max_seconds]\n"
+           "          [-t] [-r none|linear|cubic] [-g max_fill] [-a] [-l feed_name] [-c pipeline_file] [-m]\n"
+           "          [-P fifo_priority] [-C cpus] [-M]\n", prog);
+    printf("  -p  serial port to read from (default /dev/tty.usbmodem103)\n");
+    printf("  -b  highest baud rate the handshake may switch to (default %d)\n", HS_DEFAULT_BAUD);
+    printf("  -o  CSV file to write (default ../Export/data.csv), rows ir,t,red,seq; a .bcap name writes\n"
+           "      a compressed binary capture instead, a .edf name an EDF+ file; uring:file.csv writes the\n"
+           "      CSV asynchronously through io_uring (Linux)\n");
+    printf("  -O  also write to this sink, on its own thread: a .csv, .bcap or .edf file, udp:host:port\n"
+           "      (\"seq,t,red,ir,flags\" lines), uring:file.csv or null; may be given %d times\n", SINK_MAX - 6);
+    printf("  -s  record to segments data_NNNNN.csv rotated at this size, with index data_index.csv\n");
+    printf("  -d  record to segments rotated after this many seconds\n");
+    printf("  -t  trace per-stage latency and print percentiles on exit\n");
+    printf("  -r  fill lost samples: none writes nan (default), linear or cubic interpolate\n");
+    printf("  -g  longest gap in samples that is interpolated (default %d)\n", MAX_FILL_DEFAULT);
+    printf("  -a  annotate every beat with the heart rate in the EDF+ file\n");
+    printf("  -l  publish the samples in the shared-memory ring /feed_name for the plotter\n");
+    printf("  -c  process the samples with the DSP graph of this file instead of the built-in one (heart\n"
+           "      rate and SpO2), see pipeline.conf; its vitals stage feeds the sinks; stages:\n");
+    pl_print_stages(stdout);
+    printf("  -m  count heap allocations once running and report them on exit, the steady state should\n"
+           "      have none; needs LD_PRELOAD=%s (make -C Debug libs)\n", AC_SHIM_LIBRARY);
+    printf("  -P  run the read loop under SCHED_FIFO with this priority (1-99, needs CAP_SYS_NICE)\n");
+    printf("  -C  pin the read loop to the first CPU of the list, the other threads to the rest (2,3 or 2-5)\n");
+    printf("  -M  lock the memory of the reader and pre-fault the stack\n");
+    printf("      with -P, -C, -M or -t the wake-up delay of the read loop is reported on exit\n");
+    printf("\nA min/max/mean overview of both channels is written to data_pyr1.bin, data_pyr2.bin, ...\n");
+    printf("and their spectrogram to data_stft.bin\n");
+    printf("\nTools: %s <tool> [args], see %s <tool> -h\n", prog, prog);
+    tools_print(stdout);
+}
 
 int setup_serial_port(const char* port_name){
 
@@ -75,27 +176,176 @@ int setup_serial_port(const char* port_name){
 }
 
 
-int main(int argc, const char * argv[]) {
+int main(int argc, char * argv[]) {
+
+    // "start_reader <tool> ..." runs one of the offline tools instead of the reader
+    if (argc > 1 && argv[1][0] != '-') {
+        return tools_run(argc - 1, argv + 1);
+    }
+
+    const char *port_name = "/dev/tty.usbmodem103";  // Change this to your serial port !!! (or pass -p)
+    const char *export_file_name = "../Export/data.csv"; // "/data.csv"; //"../Export/data.csv"; // Export Filenames
+    int trace_latency = 0;
+    gr_mode_t fill_mode = GR_MODE_NONE;
+    int max_fill = MAX_FILL_DEFAULT;
+    double segment_mb = 0;      // 0 = no size limit
+    double segment_s = 0;       // 0 = no duration limit
+    int annotate_hr = 0;
+    const char *feed_name = NULL;
+    const char *pipeline_file = NULL;
+    int count_allocs = 0;
+    rt_options_t rt;           // scheduling, pinning and memory locking of the read loop
+    memset(&rt, 0, sizeof(rt));
+    uint32_t max_baud = HS_DEFAULT_BAUD;
+    const char *extra_sinks[SINK_MAX];
+    int n_extra_sinks = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:o:O:s:d:tr:g:al:c:mP:C:Mh")) != -1) {
+        switch (opt) {
+            case 'p': port_name = optarg; break;
+            case 'b': max_baud = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'o': export_file_name = optarg; break;
+            case 'O':
+                if (n_extra_sinks == SINK_MAX - 6) {  // the recording, its pyramid, spectrogram, gap file, live feed and console
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                extra_sinks[n_extra_sinks++] = optarg;
+                break;
+            case 's': segment_mb = atof(optarg); break;
+            case 'd': segment_s = atof(optarg); break;
+            case 't': trace_latency = 1; break;
+            case 'r':
+                if (strcmp(optarg, "linear") == 0) {
+                    fill_mode = GR_MODE_LINEAR;
+                } else if (strcmp(optarg, "cubic") == 0) {
+                    fill_mode = GR_MODE_CUBIC;
+                } else if (strcmp(optarg, "none") != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'g': max_fill = atoi(optarg); break;
+            case 'a': annotate_hr = 1; break;
+            case 'l': feed_name = optarg; break;
+            case 'c': pipeline_file = optarg; break;
+            case 'm': count_allocs = 1; break;
+            case 'P': rt.fifo_priority = atoi(optarg); break;
+            case 'C':
+                if (rt_parse_cpus(optarg, &rt) != 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'M': rt.lock_memory = 1; break;
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    rt_setup_threads(&rt);     // before the sink and pipeline threads start, they inherit the CPUs
 
-    char port_name[] = "/dev/tty.usbmodem103";  // Change this to your serial port !!!
     int serial_port = setup_serial_port(port_name);
 
-    // Open the CSV file for appending
-    char export_file_name[] = "../Export/data.csv"; // "/data.csv"; //"../Export/data.csv"; // Export Filenames
-    FILE *csvFile = fopen(export_file_name, "w");
-    if (csvFile == NULL) {
-        perror("Unable to open data.csv");
+    // Agree on encoding and baud rate with the device, older firmware keeps sending text
+    hs_link_t link;
+    if (hs_negotiate(serial_port, &link, BC_ENCODING_TEXT | BC_ENCODING_BINARY, max_baud) != 0) {
         close(serial_port);
         return 1;
     }
+    hs_print(&link, stdout);
+    float fs = hs_sample_rate(&link, FS);
+
+    // Open the recording (CSV, segments, capture or EDF+ by the extension) and the extra sinks. The
+    // recording is lossless: the samples wait for it rather than leave holes, the others may drop.
+    // With -t the recording marks the samples written once it has flushed them.
+    output_t output;
+    memset(&output, 0, sizeof(output));
+    sink_fanout_t sinks;       // recording, overview and the optional outputs, each on its own thread
+    sink_fanout_init(&sinks);
+    sink_fanout_init(&output.dsp);
+    latency_trace_t trace;     // Per-stage latency histograms (-t)
+    lt_init(&trace);
+    sink_config_t sink_config = { fs, segment_mb, segment_s };
+    for (int i = -1; i < n_extra_sinks; ++i) {
+        sink_t *sink = sink_open(i < 0 ? export_file_name : extra_sinks[i], &sink_config);
+        if (sink != NULL && i < 0 && trace_latency) {
+            sink->trace = &trace;
+        }
+        if (sink == NULL || sink_fanout_add(&sinks, sink, i < 0) != 0) {
+            sink_fanout_close(&sinks, NULL);
+            close(serial_port);
+            return 1;
+        }
+    }
+
+    // Files next to the recording are named after its path, without the sink prefix
+    const char *export_path = strncmp(export_file_name, "uring:", 6) == 0 ? export_file_name + 6 : export_file_name;
+    const char *slash = strrchr(export_path, '/');
+    const char *ext = strrchr(slash ? slash : export_path, '.');
 
 
     //  ----------------------- START DSP Initialization -----------------------
-    //  In this section you can initialize varialbes for your algorithm/filter.
+    //  The processing of the samples is the DSP graph of the dsp sink, opened below: the built-in one
+    //  (PL_DEFAULT_GRAPH in pipeline.h) or your own from a file (-c), see pipeline.conf.
+
+    clock_sync_t clock_sync;   // Maps device ticks onto the host timeline
+    cs_init(&clock_sync);
+    int n_fits = 0;
+
+    // Lost frames are detected from the sequence numbers, the CSV keeps one row per frame sent. Their
+    // records go to a file next to the recording, which waits for it as the recording does.
+    char gaps_file_name[512];
+    int base_len = ext ? (int)(ext - export_path) : (int)strlen(export_path);
+    snprintf(gaps_file_name, sizeof(gaps_file_name), "%.*s_gaps.csv", base_len, export_path);
+    sink_t *gaps = sink_open_gaps(gaps_file_name);
+    if (gaps != NULL) {
+        sink_fanout_add(&sinks, gaps, 1);
+    }
+
+    // The samples, vitals, gaps and messages are printed on a thread of their own, a slow terminal
+    // drops lines rather than hold up the read loop
+    sink_t *console = sink_open_console();
+    if (console != NULL) {
+        sink_fanout_add(&sinks, console, 0);
+    }
+
+    live_feed_t live;          // shared-memory ring for the plotter (-l), unused if not mapped
+    memset(&live, 0, sizeof(live));
+    if (feed_name != NULL && lf_open(&live, feed_name, fs) == 0) {
+        sink_t *live_sink = sink_open_live(&live);
+        if (live_sink != NULL && sink_fanout_add(&sinks, live_sink, 0) == 0) {
+            printf("Live feed: /%s\n", feed_name);
+        }
+    }
+
+    // A segmented recording goes on over sessions, its pyramid and spectrogram are continued with it.
+    // The spectrogram of Red and IR is taken from the resampled samples, so lost frames keep its hop.
+    int append = segment_mb > 0 || segment_s > 0;
+    sink_t *pyramid = sink_open_pyramid(export_path, fs, append);
+    if (pyramid != NULL) {
+        sink_fanout_add(&sinks, pyramid, 0);
+    }
+    sink_t *spectrogram = sink_open_spectrogram(export_path, fs, STFT_N_FFT, STFT_HOP, append,
+                                                live.header != NULL ? &live : NULL);
+    if (spectrogram != NULL) {
+        sink_fanout_add(&sinks, spectrogram, 0);
+    }
 
-    float scaling_factor = 10;
-    float offset = 1500;
+    // The graph runs on the thread of the dsp sink, which waits for the recording as the read loop
+    // waits for it
+    sink_t *dsp = sink_open_dsp(pipeline_file, fs, annotate_hr, &sinks);
+    if (dsp == NULL || sink_fanout_add(&output.dsp, dsp, 1) != 0) {
+        sink_fanout_close(&sinks, NULL);
+        lf_close(&live);
+        close(serial_port);
+        return 1;
+    }
 
+    gap_resampler_t resampler;
+    gr_init(&resampler, fill_mode, (uint32_t)max_fill, write_sample, write_gap, &output);
 
     //  ----------------------- END DSP Initialization -------------------------
 
@@ -105,91 +355,241 @@ int main(int argc, const char * argv[]) {
     char buffer[BUFFER_SIZE];  // Buffer to store the received value
     int buffer_index = 0;      // Index to track position in buffer
     char chunk[CHUNK_SIZE];    // Temporary buffer to read multiple bytes
+    char rescan[BC_MAX_FRAME + CHUNK_SIZE]; // Carried bytes of a broken frame and the rest of the chunk
+    uint8_t frame[BC_MAX_FRAME]; // Binary frame split across two reads
+    size_t frame_len = 0;
+    int resync = 0;            // Dropping the rest of a broken binary frame up to the next BC_SYNC_0
+    uint64_t n_bad_frames = 0; // Broken binary frames dropped ...
+    uint64_t n_bad_checksums = 0; // ... of which complete but with a wrong checksum
+    unsigned long seq = 0;     // Frame sequence number (firmware with timestamps only)
+    unsigned long dev_tick;    // Device time of the ADC trigger in ms (firmware with timestamps only)
     int red_val;               // Integer value of RED value (first value)
     int ir_val;				   // Integer value of IR value (second value)
-    float proc_val;            // Float value to write out
     ssize_t n_bytes;           // Number of bytes read
-
+    uint64_t rx_us;            // Time the current chunk was read
+    double rx_wall;            // Same instant on the host wall clock, for clock sync
+    double t_sample;           // Sample time on the corrected host timeline (timestamped frames only)
+    uint32_t legacy_seq = 0;   // Row number of legacy frames (binary capture, live feed)
+    uint64_t last_sample_us;   // Time the latest sample was read, for the link timeout
+    int renegotiate = 0;       // The device was reset: agree on encoding and baud rate again
+
+    rt_setup_loop(&rt);
+    rt_stats_t rt_stats;       // wake-up delay of the loop, context switches, port overruns
+    rt_stats_init(&rt_stats, serial_port);
+    int report_rt = trace_latency || rt.fifo_priority > 0 || rt.n_cpus > 0 || rt.lock_memory;
+
+    signal(SIGINT, handle_sigint);
     printf("Press CTRL+C to terminate...");
+    if (count_allocs) {
+        ac_start();  // everything above is set-up
+    }
+    last_sample_us = lt_now_us();
 
-    while (1) {
+    while (keep_running) {
         // Read one byte
         n_bytes = read(serial_port, chunk, CHUNK_SIZE);
+        rx_us = lt_now_us();
+        rx_wall = cs_wall_now();
 
         if (n_bytes > 0) {
 
             // Process each byte in the chunk
-            for (int i = 0; i < n_bytes; ++i) {
-                if (chunk[i] == '\n') {
+            char *data = chunk;
+            int n_data = (int)n_bytes;
+            for (int i = 0; i < n_data; ++i) {
+                // Binary frames start with BC_SYNC_0, which no text frame contains. A frame that is
+                // complete in the chunk is decoded in place, one split across reads is collected first.
+                const bc_sample_t *sample = NULL;
+                if (resync && frame_len == 0) {
+                    if ((uint8_t)data[i] != BC_SYNC_0) {
+                        continue;
+                    }
+                    resync = 0;
+                }
+                if (frame_len > 0 || (uint8_t)data[i] == BC_SYNC_0) {
+                    const uint8_t *p = (const uint8_t *)data + i;
+                    size_t avail = (size_t)(n_data - i), size = 0;
+                    size_t carried = frame_len;
+                    if (carried > 0) {
+                        size_t take = avail < sizeof(frame) - carried ? avail : sizeof(frame) - carried;
+                        memcpy(frame + carried, p, take);
+                        p = frame;
+                        avail = carried + take;
+                    }
+                    bc_parse_t r = bc_parse(p, avail, &size);
+                    if (r == BC_PARSE_MORE) {
+                        if (carried == 0) memcpy(frame, p, avail);
+                        frame_len = avail;
+                        break;  // the rest of the chunk is in frame
+                    }
+                    frame_len = 0;
+                    if (r == BC_PARSE_BAD) {
+                        // Both sync bytes and the whole frame arrived: only the checksum can be wrong
+                        n_bad_frames++;
+                        n_bad_checksums += avail >= 2 && p[1] == BC_SYNC_1;
+                        // Sent in binary, the bytes up to the next BC_SYNC_0 belong to the broken frame.
+                        // In text a lone BC_SYNC_0 is line noise and the text goes on after it.
+                        resync = link.encoding == BC_ENCODING_BINARY;
+                        if (carried > 1) {
+                            // Look at the carried bytes after the sync byte again, then the rest of the chunk
+                            memcpy(rescan, frame + 1, carried - 1);
+                            memcpy(rescan + carried - 1, data + i, (size_t)(n_data - i));
+                            n_data = (int)(carried - 1) + (n_data - i);
+                            data = rescan;
+                            i = -1;
+                        } else if (carried == 1) {
+                            --i;  // only the sync byte was carried, go on with this byte of the chunk
+                        }
+                        continue;
+                    }
+                    i += (int)(size - carried) - 1;
+                    sample = bc_payload(p, BC_FRAME_SAMPLE, sizeof(bc_sample_t));
+                    if (bc_payload(p, BC_FRAME_HELLO, sizeof(bc_hello_t)) != NULL) {
+                        // Sent at boot: the device was reset and is back to its default mode
+                        printf("\nDevice reset\n");
+                        renegotiate = 1;
+                        break;  // the rest of the chunk is dropped, the handshake starts over
+                    }
+                    if (sample == NULL) {
+                        continue;  // a frame type this reader does not use
+                    }
+                }
 
-                    // End of a value (newline detected)
-                    buffer[buffer_index] = '\0';  // Null-terminate the string
+                if (sample != NULL || data[i] == '\n') {
 
-                    if (sscanf(buffer, "%d,%d", &red_val, &ir_val) == 2)
+                    int n_fields;
+                    if (sample != NULL) {
+                        seq = sample->seq;
+                        dev_tick = sample->tick;
+                        red_val = sample->red;
+                        ir_val = sample->ir;
+                        n_fields = 4;
+                    } else {
+                        // End of a value (newline detected)
+                        buffer[buffer_index] = '\0';  // Null-terminate the string
+
+                        // Frames are "seq,tick,red,ir" (timestamped firmware) or "red,ir" (legacy firmware)
+                        n_fields = sscanf(buffer, BC_TEXT_SAMPLE_SCAN, &seq, &dev_tick, &red_val, &ir_val);
+                        if (n_fields != 4) {
+                            n_fields = sscanf(buffer, BC_TEXT_LEGACY_SCAN, &red_val, &ir_val);
+                        }
+                        buffer_index = 0;  // Reset buffer for the next value
+                    }
+
+                    if (n_fields == 2 || n_fields == 4)
 						{
+							last_sample_us = rx_us;
 							// Both values have been found!
-
-							printf("RED: %d, IR: %d\n", red_val, ir_val); // print both values
-
-							// Save in CSV (FOR NOW ONLY IR, THEN SCHOUL BOTH)
-							fprintf(csvFile, "%d\n", ir_val);
-							fflush(csvFile);
+							frame_stamp_t stamp = { (uint32_t)seq, 0, 0, -1 };
+							if (trace_latency) {
+								lt_mark_rx(&trace, rx_us);
+								if (n_fields == 4) {
+									lt_mark_device(&trace, (uint32_t)dev_tick);
+								}
+								lt_mark_parsed(&trace);
+								stamp.rx_us = trace.rx_us;
+								stamp.parse_us = trace.parse_us;
+								stamp.transit_us = trace.transit_us;
+							}
+
+							// Place the sample on the host timeline, correcting the drift of the MCU clock
+							t_sample = -1.0;
+							if (n_fields == 4) {
+								if (cs_add(&clock_sync, (uint32_t)dev_tick, rx_wall) && clock_sync.fitted
+										&& ++n_fits % DRIFT_REPORT_EVERY == 0) {
+									sink_fanout_message(&output.dsp, "Clock drift: %+.1f ppm (%d points, rms %.2f ms)",
+											cs_drift_ppm(&clock_sync), clock_sync.n_used, clock_sync.residual_rms * 1e3);
+								}
+								t_sample = cs_map(&clock_sync, (uint32_t)dev_tick);
+							}
+
+							// Hand both channels to the DSP graph and on to the sinks. Timestamped frames go through
+							// the resampler onto the grid of sequence numbers, legacy frames are numbered in order
+							// of arrival.
+							float values[SINK_CHANNELS] = { (float)red_val, (float)ir_val };
+							if (n_fields == 4) {
+								output.stamps[stamp.seq % STAMP_RING] = stamp;
+								gr_push(&resampler, (uint32_t)seq, t_sample, values);
+							} else {
+								emit_sample(&output, legacy_seq++, rx_wall, values, SINK_VALID, &stamp);
+							}
 						}
 						else
 						{
 							// If there wasn't two correct values
-							printf("Parsing error: %s\n", buffer);
+							sink_fanout_message(&output.dsp, "Parsing error: %s", buffer);
 						}
 
-                    //raw_val = atof(buffer);       // Convert string to float
-
-                    //  ----------------------- START Processing -------------------------
-                    /*
-                       Here you can implement your own algorithms or digital filter on the sensor data.
-					   The new measurement is provided in the variable raw_val (float). The processed value
-					   must be stored to the variable proc_val (float), which then will be appended to the
-					   CSV file.
-					*/
-
-                    // Dummy code removing signal offset and scaling the signal by an arbitrary scale factor.
-//                    printf("Raw value: %d\n", raw_val);  // Print the value
-//                    proc_val = raw_val - offset;
-//                    proc_val *= scaling_factor;
-//					// Dumm code END
-//
-//                    printf("Processed value: %f\n", proc_val);  // Print the value
-//                    //  ----------------------- END Processing -------------------------
-//
-//                    // saves the processed value to the end of the csv file.
-//                    fprintf(csvFile, "%f\n", proc_val);
-//                    fflush(csvFile);
-
-                    buffer_index = 0;  // Reset buffer for the next value
-
                 } else {
                     // Accumulate characters until newline is detected
                     if (buffer_index < BUFFER_SIZE - 1) {
-                        buffer[buffer_index++] = chunk[i];
+                        buffer[buffer_index++] = data[i];
 
                         // Handle buffer overflow
                     } else {
-                        fprintf(stderr, "Buffer overflow, discarding data\n");
+                        sink_fanout_message(&output.dsp, "Buffer overflow, discarding data");
                         buffer_index = 0;  // Reset buffer if overflow occurs
                     }
                 }
             }
+            sink_fanout_commit(&output.dsp);  // the graph and the sinks take the rows of this chunk in one batch
         } else {
-            if (n_bytes < 0) {
+            // The port is opened non-blocking, EAGAIN only means no data has arrived yet
+            if (n_bytes < 0 && errno != EAGAIN && errno != EINTR) {
                 perror("Error reading from the serial port");
-                continue;
             }
         }
+
+        // A reset device says hello at HS_DEFAULT_BAUD, which is not readable at a faster rate
+        if (!renegotiate && link.baud != HS_DEFAULT_BAUD && rx_us - last_sample_us > HS_LINK_TIMEOUT_MS * 1000ULL) {
+            printf("No samples for %d ms at %lu baud, asking the device again\n", HS_LINK_TIMEOUT_MS,
+                   (unsigned long)link.baud);
+            renegotiate = 1;
+        }
+        if (renegotiate) {
+            if (hs_negotiate(serial_port, &link, BC_ENCODING_TEXT | BC_ENCODING_BINARY, max_baud) != 0) {
+                break;
+            }
+            hs_print(&link, stdout);
+            frame_len = 0;
+            buffer_index = 0;
+            resync = 0;
+            renegotiate = 0;
+            last_sample_us = lt_now_us();
+        }
         // Pause Loop to receive data
-        usleep(10000);
+        rt_sleep(&rt_stats, 10000);
+    }
+
+    if (report_rt) {
+        rt_report(&rt_stats, stdout);
+    }
+    if (count_allocs) {
+        ac_report(stdout);
+    }
+    if (n_bad_frames > 0) {
+        printf("%llu broken binary frames dropped, %llu of them for a wrong checksum\n",
+               (unsigned long long)n_bad_frames, (unsigned long long)n_bad_checksums);
+    }
+    gr_flush(&resampler);
+    if (resampler.n_gaps > 0) {
+        printf("%llu gaps: %llu samples interpolated, %llu missing (see %s)\n",
+               (unsigned long long)resampler.n_gaps, (unsigned long long)resampler.n_interpolated,
+               (unsigned long long)resampler.n_missing, gaps_file_name);
+    }
+    if (clock_sync.fitted) {
+        printf("Clock drift: %+.1f ppm, effective sample rate %.3f Hz\n",
+               cs_drift_ppm(&clock_sync), fs / cs_scale(&clock_sync));
     }
 
     // when while loop get terminated properly close port and file
-    if (close(serial_port) == 0 && fclose(csvFile) == 0) {
+    sink_fanout_close(&output.dsp, stdout);  // hands its last samples on to the sinks
+    sink_fanout_close(&sinks, stdout);
+    if (trace_latency) {
+        lt_report(&trace, stdout);  // the recording has marked its last samples written
+    }
+    lf_close(&live);
+    if (close(serial_port) == 0) {
         printf("Serial Port and CSV file closed.\n");
     }
 
@@ -0,0 +1,136 @@
+/*
+ *  Title: Allocation Count
+ *  Description: Heap counters of the reader, see alloc_count.h. Built with AC_SHIM this file is the
+ *               preloaded library with the counting heap functions (libbcalloc.so, makefile.targets),
+ *               otherwise the part of the reader that finds it.
+ */
+
+#include "alloc_count.h"
+
+#if defined(AC_SHIM)
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+static atomic_int counting;
+static atomic_uint_fast64_t n_allocs, n_bytes, n_frees, n_allocs_here;
+static _Thread_local int here;         // set on the thread that called ac_shim_start()
+
+// The allocator of glibc under its own names
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void *p);
+
+static void count_alloc(size_t size) {
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&n_bytes, size, memory_order_relaxed);
+        if (here) {
+            atomic_fetch_add_explicit(&n_allocs_here, 1, memory_order_relaxed);
+        }
+    }
+}
+
+void *malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(p, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    count_alloc(size);
+    void *q = __libc_memalign(alignment, size);
+    if (q == NULL) {
+        return ENOMEM;
+    }
+    *p = q;
+    return 0;
+}
+
+void free(void *p) {
+    if (p != NULL && atomic_load_explicit(&counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&n_frees, 1, memory_order_relaxed);
+    }
+    __libc_free(p);
+}
+
+void ac_shim_start(void) {
+    here = 1;
+    atomic_store(&counting, 1);
+}
+
+void ac_shim_read(ac_counts_t *counts) {
+    counts->allocs = atomic_load(&n_allocs);
+    counts->bytes = atomic_load(&n_bytes);
+    counts->frees = atomic_load(&n_frees);
+    counts->allocs_here = atomic_load(&n_allocs_here);
+}
+
+#else
+
+#include <dlfcn.h>
+
+static void (*shim_start)(void);
+static void (*shim_read)(ac_counts_t *counts);
+
+int ac_available(void) {
+    if (shim_start == NULL || shim_read == NULL) {
+        shim_start = (void (*)(void))dlsym(RTLD_DEFAULT, "ac_shim_start");
+        shim_read = (void (*)(ac_counts_t *))dlsym(RTLD_DEFAULT, "ac_shim_read");
+    }
+    return shim_start != NULL && shim_read != NULL;
+}
+
+void ac_start(void) {
+    if (ac_available()) {
+        shim_start();
+    }
+}
+
+void ac_read(ac_counts_t *counts) {
+    if (ac_available()) {
+        shim_read(counts);
+    } else {
+        *counts = (ac_counts_t){ 0 };
+    }
+}
+
+void ac_report(FILE *f) {
+    if (!ac_available()) {
+        fprintf(f, "Allocations: not counted, run the reader with LD_PRELOAD=%s\n", AC_SHIM_LIBRARY);
+        return;
+    }
+    ac_counts_t c;
+    ac_read(&c);
+    fprintf(f, "Allocations while running: %llu (%llu bytes), %llu frees; %llu on the read loop, %llu on other threads%s\n",
+            (unsigned long long)c.allocs, (unsigned long long)c.bytes, (unsigned long long)c.frees,
+            (unsigned long long)c.allocs_here, (unsigned long long)(c.allocs - c.allocs_here),
+            c.allocs == 0 ? " - allocation free" : "");
+}
+
+#endif
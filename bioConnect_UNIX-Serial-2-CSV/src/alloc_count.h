@@ -0,0 +1,49 @@
+/*
+ *  Title: Allocation Count
+ *  Description: Counting hook on the heap of the reader, to check that the running session does not
+ *               allocate (-m). The hook is a library of its own, preloaded for such a run only, so the
+ *               reader keeps the allocator of the C library otherwise:
+ *
+ *                   make -C Debug libs
+ *                   LD_PRELOAD=../libbcalloc.so ./bioConnect_UNIX-Serial-2-CSV -m ...
+ *
+ *               With glibc the library takes malloc, calloc, realloc, memalign, aligned_alloc,
+ *               posix_memalign and free of the whole program, including those made inside the C
+ *               library, through counters before reaching the allocator of the C library.
+ *               Allocations are counted once ac_start() has been called, separately for the thread
+ *               that called it (the read loop) and for all other threads (sinks, pipeline workers).
+ *
+ *               Without the library preloaded ac_available() returns 0.
+ */
+
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define AC_SHIM_LIBRARY "libbcalloc.so"
+
+typedef struct {
+    uint64_t allocs;                   // malloc, calloc and realloc calls
+    uint64_t bytes;                    // requested by them
+    uint64_t frees;
+    uint64_t allocs_here;              // of which on the thread that called ac_start()
+} ac_counts_t;
+
+// The counting library is preloaded
+int ac_available(void);
+
+// Start counting: the session is set up
+void ac_start(void);
+
+void ac_read(ac_counts_t *counts);
+
+// One line with the counts since ac_start()
+void ac_report(FILE *f);
+
+// Exported by the counting library, found by the functions above
+void ac_shim_start(void);
+void ac_shim_read(ac_counts_t *counts);
+
+#endif // ALLOC_COUNT_H
@@ -0,0 +1,92 @@
+/*
+ *  Title: Arena
+ *  Description: Block chain of the session arena, see arena.h.
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block {
+    arena_block_t *next;
+    size_t         size;                   // usable bytes after the header
+    size_t         used;
+    unsigned char *data;                   // aligned start of the usable bytes
+};
+
+void arena_init(arena_t *a, size_t block_size) {
+    memset(a, 0, sizeof(*a));
+    a->block_size = block_size > 0 ? block_size : ARENA_BLOCK;
+}
+
+static arena_block_t *add_block(arena_t *a, size_t size) {
+    arena_block_t *b = malloc(sizeof(*b) + size + ARENA_ALIGN);
+    if (b == NULL) {
+        return NULL;
+    }
+    uintptr_t start = ((uintptr_t)(b + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+    b->data = (unsigned char *)start;
+    b->size = size;
+    b->used = 0;
+    a->n_blocks++;
+    a->bytes_reserved += size;
+    return b;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    if (a->sealed) {
+        a->n_late++;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) {
+        size = ARENA_ALIGN;
+    }
+    arena_block_t *b = a->blocks;
+    if (b == NULL || b->size - b->used < size) {
+        if (size > a->block_size / 4) {
+            // Large: a block of its own behind the current one, which keeps its free space
+            arena_block_t *big = add_block(a, size);
+            if (big == NULL) {
+                return NULL;
+            }
+            big->used = size;
+            if (b != NULL) {
+                big->next = b->next;
+                b->next = big;
+            } else {
+                big->next = NULL;
+                a->blocks = big;
+            }
+            a->bytes_used += size;
+            memset(big->data, 0, size);
+            return big->data;
+        }
+        b = add_block(a, a->block_size);
+        if (b == NULL) {
+            return NULL;
+        }
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    a->bytes_used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+void arena_seal(arena_t *a) {
+    a->sealed = 1;
+}
+
+void arena_free(arena_t *a) {
+    arena_block_t *b = a->blocks;
+    while (b != NULL) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    size_t block_size = a->block_size;
+    arena_init(a, block_size);
+}
@@ -0,0 +1,45 @@
+/*
+ *  Title: Arena
+ *  Description: Session memory of the host pipeline. Rings, stage states and stage buffers are taken
+ *               from large blocks while the session is set up and given back all at once when it
+ *               ends, so the running graph never calls malloc and no object has to be freed alone.
+ *
+ *               Allocations are zeroed, which touches their pages at start-up rather than on the
+ *               first sample, and aligned to a cache line so the states of stages running on
+ *               different threads never share one. After arena_seal() the session is running:
+ *               allocations still succeed but are counted in n_late, reported as a bug to fix.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 64                     // a cache line
+#define ARENA_BLOCK (256 << 10)            // default block size; larger requests get a block each
+
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    arena_block_t *blocks;                 // newest first, allocations come from the first one
+    size_t         block_size;
+    size_t         n_blocks;
+    size_t         bytes_used;             // handed out, including alignment
+    size_t         bytes_reserved;         // of all blocks
+    int            sealed;
+    uint64_t       n_late;                 // allocations after arena_seal()
+} arena_t;
+
+void arena_init(arena_t *a, size_t block_size);
+
+// size zeroed bytes aligned to ARENA_ALIGN, valid until arena_free(). NULL if out of memory.
+void *arena_alloc(arena_t *a, size_t size);
+
+// The session is set up: count later allocations
+void arena_seal(arena_t *a);
+
+// Give back every block
+void arena_free(arena_t *a);
+
+#endif // ARENA_H
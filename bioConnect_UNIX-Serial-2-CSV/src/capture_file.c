@@ -0,0 +1,152 @@
+/*
+ *  Title: Capture File
+ *  Description: Chunked, compressed binary capture writer, see capture_file.h.
+ */
+
+#include "capture_file.h"
+
+#include <string.h>
+
+#include "clock_sync.h"
+
+static void fill_file_header(const cap_writer_t *w, cap_file_header_t *h) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CAP_MAGIC, 4);
+    h->version = CAP_VERSION;
+    h->n_channels = CAP_CHANNELS;
+    h->chunk_samples = CAP_CHUNK_SAMPLES;
+    h->sample_rate = w->sample_rate;
+    h->t_created = cs_wall_now();
+    strcpy(h->channel_names[0], "red");
+    strcpy(h->channel_names[1], "ir");
+}
+
+int cap_writer_open(cap_writer_t *w, const char *path, capture_segments_t *segments, float sample_rate) {
+    memset(w, 0, sizeof(*w));
+    w->segments = segments;
+    w->sample_rate = sample_rate;
+
+    if (segments != NULL) {
+        return 0;  // every segment gets its header when it is started
+    }
+    w->file = fopen(path, "wb");
+    if (w->file == NULL) {
+        perror("Unable to open capture file");
+        return -1;
+    }
+    cap_file_header_t h;
+    fill_file_header(w, &h);
+    w->bytes_written += fwrite(&h, 1, sizeof(h), w->file);
+    return 0;
+}
+
+void cap_writer_flush(cap_writer_t *w) {
+    uint8_t *payload = w->payload;
+    cap_chunk_header_t h;
+
+    if (w->n == 0) {
+        return;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CAP_CHUNK_MAGIC, 4);
+    h.n_samples = (uint16_t)w->n;
+    h.n_valid = (uint16_t)w->n_valid;
+    h.seq_first = w->seq_first;
+    h.t_first = w->t_first;
+    h.t_last = w->t_last;
+
+    size_t len = 0;
+    if (w->n_valid < w->n) {
+        memcpy(payload, w->valid, CAP_BITMAP_BYTES);
+        len = CAP_BITMAP_BYTES;
+    }
+
+    for (int c = 0; c < CAP_CHANNELS; ++c) {
+        cap_stats_t *s = &h.stats[c];
+        int first = 1;
+        for (int i = 0; i < w->n; ++i) {
+            if (!(w->valid[i >> 3] & (1u << (i & 7)))) {
+                continue;
+            }
+            int32_t v = w->values[c][i];
+            if (first || v < s->min) s->min = v;
+            if (first || v > s->max) s->max = v;
+            s->sum += v;
+            first = 0;
+        }
+
+        size_t block = pc_encode_block(w->values[c], w->n, payload + len + 2);
+        payload[len] = (uint8_t)block;
+        payload[len + 1] = (uint8_t)(block >> 8);
+        len += 2 + block;
+    }
+    h.payload_bytes = (uint32_t)len;
+
+    FILE *f = w->file;
+    if (w->segments != NULL) {
+        f = seg_begin_record(w->segments, h.t_first);
+        if (f == NULL) {
+            w->n = 0;
+            return;
+        }
+        if (w->segments->bytes == 0) {
+            // New segment: every segment is a self-contained capture file
+            cap_file_header_t fh;
+            fill_file_header(w, &fh);
+            size_t hn = fwrite(&fh, 1, sizeof(fh), f);
+            seg_end_record(w->segments, (int)hn);
+            w->bytes_written += hn;
+            f = seg_begin_record(w->segments, h.t_first);
+        }
+    }
+
+    size_t n = fwrite(&h, 1, sizeof(h), f);
+    n += fwrite(payload, 1, len, f);
+    fflush(f);
+    if (w->segments != NULL) {
+        seg_end_record(w->segments, (int)n);
+    }
+    w->bytes_written += n;
+    w->chunks_written++;
+    w->n = 0;
+    w->n_valid = 0;
+}
+
+void cap_writer_add(cap_writer_t *w, uint32_t seq, double t, const int32_t *values, int valid) {
+    // A chunk covers consecutive sequence numbers only, start a new one after a reset
+    if (w->n > 0 && seq != w->seq_first + (uint32_t)w->n) {
+        cap_writer_flush(w);
+    }
+    if (w->n == 0) {
+        w->seq_first = seq;
+        w->t_first = t;
+        memset(w->valid, 0, sizeof(w->valid));
+    }
+
+    int i = w->n;
+    for (int c = 0; c < CAP_CHANNELS; ++c) {
+        // Missing rows repeat the last valid value so they cost no bits in the delta coding
+        if (valid) {
+            w->last[c] = values[c];
+        }
+        w->values[c][i] = w->last[c];
+    }
+    if (valid) {
+        w->valid[i >> 3] |= (uint8_t)(1u << (i & 7));
+        w->n_valid++;
+    }
+    w->t_last = t;
+    w->n++;
+
+    if (w->n == CAP_CHUNK_SAMPLES) {
+        cap_writer_flush(w);
+    }
+}
+
+void cap_writer_close(cap_writer_t *w) {
+    cap_writer_flush(w);
+    if (w->file != NULL) {
+        fclose(w->file);
+        w->file = NULL;
+    }
+}
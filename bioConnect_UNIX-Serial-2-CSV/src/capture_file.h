@@ -0,0 +1,95 @@
+/*
+ *  Title: Capture File
+ *  Description: Binary capture format (.bcap) holding the raw Red and IR channels in compressed
+ *               chunks of CAP_CHUNK_SAMPLES consecutive sequence numbers:
+ *
+ *                   cap_file_header_t                         once at the start of every file/segment
+ *                   cap_chunk_header_t + payload              repeated
+ *
+ *               The payload is an optional validity bitmap (only if samples are missing, which includes
+ *               the samples the reader interpolated: only measured ones are valid) followed by
+ *               one ppg_codec block per channel, each prefixed with its length (uint16). Chunk headers
+ *               carry the time range and per-channel min/max/sum, so a reader can skip chunks outside
+ *               a query without decoding them. All fields are little endian.
+ */
+
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capture_segments.h"
+#include "ppg_codec.h"
+
+#define CAP_MAGIC "BCAP"
+#define CAP_CHUNK_MAGIC "CHNK"
+#define CAP_VERSION 1
+#define CAP_CHANNELS 2                       // 0 = Red, 1 = IR
+#define CAP_CHUNK_SAMPLES PC_BLOCK_SIZE
+#define CAP_BITMAP_BYTES ((CAP_CHUNK_SAMPLES + 7) / 8)
+#define CAP_PAYLOAD_MAX (CAP_BITMAP_BYTES + CAP_CHANNELS * (2 + PC_BLOCK_MAX_BYTES))
+
+typedef struct {
+    char     magic[4];                       // CAP_MAGIC
+    uint16_t version;
+    uint16_t n_channels;
+    uint32_t chunk_samples;
+    float    sample_rate;                    // nominal rate in Hz
+    double   t_created;                      // host wall clock
+    char     channel_names[CAP_CHANNELS][8];
+    uint8_t  reserved[24];
+} cap_file_header_t;
+
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int64_t sum;                             // over valid samples
+} cap_stats_t;
+
+typedef struct {
+    char        magic[4];                    // CAP_CHUNK_MAGIC
+    uint16_t    n_samples;                   // rows in this chunk, one per sequence number
+    uint16_t    n_valid;                     // rows that are not missing; bitmap present if < n_samples
+    uint32_t    seq_first;
+    uint32_t    payload_bytes;
+    double      t_first;                     // host time of the first and last row
+    double      t_last;
+    cap_stats_t stats[CAP_CHANNELS];
+} cap_chunk_header_t;
+
+_Static_assert(sizeof(cap_file_header_t) == 64, "capture file header layout");
+_Static_assert(sizeof(cap_chunk_header_t) == 64, "capture chunk header layout");
+
+typedef struct {
+    FILE               *file;                // single file, or NULL when writing to segments
+    capture_segments_t *segments;
+    float               sample_rate;
+
+    // Chunk being filled
+    int      n;
+    int      n_valid;
+    uint32_t seq_first;
+    double   t_first;
+    double   t_last;
+    int32_t  values[CAP_CHANNELS][CAP_CHUNK_SAMPLES];
+    uint8_t  valid[CAP_BITMAP_BYTES];
+    int32_t  last[CAP_CHANNELS];             // last valid value, repeated for missing rows
+    uint8_t  payload[CAP_PAYLOAD_MAX];       // encoded chunk, one per writer as each sink has a thread
+
+    uint64_t chunks_written;
+    uint64_t bytes_written;
+} cap_writer_t;
+
+// Write to a single file (segments == NULL) or to rotated segments. Returns 0 on success.
+int cap_writer_open(cap_writer_t *w, const char *path, capture_segments_t *segments, float sample_rate);
+
+// Append one row. Rows must have consecutive sequence numbers, missing rows are passed with valid = 0.
+void cap_writer_add(cap_writer_t *w, uint32_t seq, double t, const int32_t *values, int valid);
+
+// Write the partially filled chunk, e.g. before closing or to bound the data at risk
+void cap_writer_flush(cap_writer_t *w);
+
+void cap_writer_close(cap_writer_t *w);
+
+#endif // CAPTURE_FILE_H
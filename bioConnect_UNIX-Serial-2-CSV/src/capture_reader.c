@@ -0,0 +1,354 @@
+/*
+ *  Title: Capture Reader
+ *  Description: Memory-mapped .bcap reader with lazy chunk decoding, see capture_reader.h.
+ */
+
+#include "capture_reader.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { CHUNK_ENCODED = 0, CHUNK_DECODING = 1, CHUNK_DECODED = 2, CHUNK_CORRUPT = -1 };
+
+// Reserve address space for a column; pages are only backed once a chunk is decoded into them
+static void *reserve(size_t bytes) {
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+static void release(void *p, size_t bytes) {
+    if (p != NULL) {
+        munmap(p, bytes);
+    }
+}
+
+// Returns 0 if the chunk list could be built
+static int scan_chunks(cap_reader_t *r) {
+    size_t cap = 0;
+    size_t off = sizeof(cap_file_header_t);
+
+    while (off + sizeof(cap_chunk_header_t) <= r->size) {
+        cap_chunk_header_t h;
+        memcpy(&h, r->base + off, sizeof(h));  // not aligned, it follows a payload of any length
+        if (memcmp(h.magic, CAP_CHUNK_MAGIC, 4) != 0) {
+            fprintf(stderr, "Capture: bad chunk header at offset %zu, ignoring the rest\n", off);
+            break;
+        }
+        size_t end = off + sizeof(h) + h.payload_bytes;
+        if (end > r->size) {
+            break;  // last chunk still being written
+        }
+        if (h.n_samples == 0 || h.n_samples > r->header->chunk_samples || h.n_samples > CAP_CHUNK_SAMPLES) {
+            fprintf(stderr, "Capture: bad chunk size at offset %zu, ignoring the rest\n", off);
+            break;
+        }
+
+        if (r->n_chunks == cap) {
+            cap = cap ? cap * 2 : 256;
+            cap_chunk_ref_t *chunks = realloc(r->chunks, cap * sizeof(*chunks));
+            if (chunks == NULL) {
+                return -1;
+            }
+            r->chunks = chunks;
+        }
+        cap_chunk_ref_t *c = &r->chunks[r->n_chunks++];
+        c->header = h;
+        c->payload = r->base + off + sizeof(h);
+        c->row_first = r->n_rows;
+        r->n_rows += h.n_samples;
+        off = end;
+    }
+    return 0;
+}
+
+int cap_reader_open(cap_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || (size_t)st.st_size < sizeof(cap_file_header_t)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        cap_reader_close(r);
+        return -1;
+    }
+    r->size = (size_t)st.st_size;
+    void *base = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Unable to map capture file");
+        r->size = 0;
+        cap_reader_close(r);
+        return -1;
+    }
+    r->base = base;
+    r->header = (const cap_file_header_t *)r->base;
+
+    if (memcmp(r->header->magic, CAP_MAGIC, 4) != 0 || r->header->version != CAP_VERSION
+            || r->header->n_channels != CAP_CHANNELS) {
+        fprintf(stderr, "%s: not a capture file or unsupported version\n", path);
+        cap_reader_close(r);
+        return -1;
+    }
+    if (scan_chunks(r) != 0) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        cap_reader_close(r);
+        return -1;
+    }
+
+    if (r->n_rows > 0) {
+        r->reserved_rows = r->n_rows;
+        for (int c = 0; c < CAP_CHANNELS; ++c) {
+            r->columns[c] = reserve(r->n_rows * sizeof(int32_t));
+        }
+        r->times = reserve(r->n_rows * sizeof(double));
+        r->valid = reserve(r->n_rows);
+        r->chunk_state = calloc(r->n_chunks, sizeof(int));
+        if (r->columns[0] == NULL || r->columns[1] == NULL || r->times == NULL || r->valid == NULL
+                || r->chunk_state == NULL) {
+            fprintf(stderr, "%s: out of memory\n", path);
+            cap_reader_close(r);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void cap_reader_close(cap_reader_t *r) {
+    for (int c = 0; c < CAP_CHANNELS; ++c) {
+        release(r->columns[c], r->reserved_rows * sizeof(int32_t));
+    }
+    release(r->times, r->reserved_rows * sizeof(double));
+    release(r->valid, r->reserved_rows);
+    free((void *)r->chunk_state);
+    free(r->chunks);
+    if (r->base != NULL) {
+        munmap((void *)r->base, r->size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+cap_reader_t *cap_reader_new(const char *path) {
+    cap_reader_t *r = malloc(sizeof(*r));
+    if (r != NULL && cap_reader_open(r, path) != 0) {
+        free(r);
+        r = NULL;
+    }
+    return r;
+}
+
+void cap_reader_free(cap_reader_t *r) {
+    if (r != NULL) {
+        cap_reader_close(r);
+        free(r);
+    }
+}
+
+const cap_file_header_t *cap_reader_header(const cap_reader_t *r) {
+    return r->header;
+}
+
+size_t cap_reader_rows(const cap_reader_t *r) {
+    return r->n_rows;
+}
+
+size_t cap_reader_chunk_count(const cap_reader_t *r) {
+    return r->n_chunks;
+}
+
+const cap_chunk_header_t *cap_reader_chunk(const cap_reader_t *r, size_t i) {
+    return (i < r->n_chunks) ? &r->chunks[i].header : NULL;
+}
+
+static double row_time(const cap_chunk_header_t *h, size_t i) {
+    if (h->n_samples < 2) {
+        return h->t_first;
+    }
+    return h->t_first + (h->t_last - h->t_first) * (double)i / (h->n_samples - 1);
+}
+
+size_t cap_reader_chunk_of_row(const cap_reader_t *r, size_t row) {
+    size_t lo = 0, hi = r->n_chunks;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (r->chunks[mid].row_first <= row) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t cap_reader_count_valid(const cap_reader_t *r, size_t row_begin, size_t row_end) {
+    size_t n = 0;
+    if (row_end > r->n_rows) {
+        row_end = r->n_rows;
+    }
+    for (size_t k = cap_reader_chunk_of_row(r, row_begin); k < r->n_chunks && r->chunks[k].row_first < row_end; ++k) {
+        const cap_chunk_ref_t *c = &r->chunks[k];
+        size_t b = (row_begin > c->row_first) ? row_begin - c->row_first : 0;
+        size_t e = row_end - c->row_first;
+        if (e > c->header.n_samples) {
+            e = c->header.n_samples;
+        }
+        if (c->header.n_valid == c->header.n_samples) {
+            n += e - b;
+        } else if (b == 0 && e == c->header.n_samples) {
+            n += c->header.n_valid;
+        } else if (c->header.payload_bytes >= CAP_BITMAP_BYTES) {
+            for (size_t i = b; i < e; ++i) {
+                n += (c->payload[i >> 3] >> (i & 7)) & 1;
+            }
+        }
+    }
+    return n;
+}
+
+// First row with t >= t0, n_rows if there is none
+static size_t first_row_at(const cap_reader_t *r, double t0) {
+    size_t lo = 0, hi = r->n_chunks;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (r->chunks[mid].header.t_last < t0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == r->n_chunks) {
+        return r->n_rows;
+    }
+
+    const cap_chunk_header_t *h = &r->chunks[lo].header;
+    size_t i = 0;
+    if (t0 > h->t_first && h->n_samples > 1) {
+        double dt = (h->t_last - h->t_first) / (h->n_samples - 1);
+        i = (size_t)((t0 - h->t_first) / dt);
+        while (i > 0 && row_time(h, i - 1) >= t0) i--;
+        while (i < (size_t)h->n_samples - 1 && row_time(h, i) < t0) i++;
+    }
+    return r->chunks[lo].row_first + i;
+}
+
+size_t cap_reader_find_time(const cap_reader_t *r, double t0, double t1, size_t *row_begin, size_t *row_end) {
+    size_t b = first_row_at(r, t0);
+    size_t e = (t1 > t0) ? first_row_at(r, t1) : b;
+    *row_begin = b;
+    *row_end = e;
+    return e - b;
+}
+
+static int decode_chunk(cap_reader_t *r, size_t k) {
+    const cap_chunk_ref_t *c = &r->chunks[k];
+    const cap_chunk_header_t *h = &c->header;
+    size_t n = h->n_samples;
+    size_t pos = 0;
+
+    uint8_t *valid = r->valid + c->row_first;
+    if (h->n_valid < h->n_samples) {
+        if (h->payload_bytes < CAP_BITMAP_BYTES) {
+            return -1;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            valid[i] = (c->payload[i >> 3] >> (i & 7)) & 1;
+        }
+        pos = CAP_BITMAP_BYTES;
+    } else {
+        memset(valid, 1, n);
+    }
+
+    for (int ch = 0; ch < CAP_CHANNELS; ++ch) {
+        if (pos + 2 > h->payload_bytes) {
+            return -1;
+        }
+        size_t len = c->payload[pos] | ((size_t)c->payload[pos + 1] << 8);
+        pos += 2;
+        if (pos + len > h->payload_bytes
+                || pc_decode_block(c->payload + pos, len, (int)n, r->columns[ch] + c->row_first) == 0) {
+            return -1;
+        }
+        pos += len;
+    }
+
+    double *t = r->times + c->row_first;
+    for (size_t i = 0; i < n; ++i) {
+        t[i] = row_time(h, i);
+    }
+    return 0;
+}
+
+// Make sure the chunks covering [row_begin, row_end) are decoded. A chunk is decoded by the first
+// thread that claims it; others asking for it at the same time wait for that thread.
+static int ensure_rows(cap_reader_t *r, size_t row_begin, size_t row_end) {
+    for (size_t k = cap_reader_chunk_of_row(r, row_begin); k < r->n_chunks && r->chunks[k].row_first < row_end; ++k) {
+        int expected = CHUNK_ENCODED;
+        if (__atomic_compare_exchange_n(&r->chunk_state[k], &expected, CHUNK_DECODING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            int state = (decode_chunk(r, k) == 0) ? CHUNK_DECODED : CHUNK_CORRUPT;
+            if (state == CHUNK_CORRUPT) {
+                fprintf(stderr, "Capture: chunk %zu is corrupt\n", k);
+            }
+            __atomic_store_n(&r->chunk_state[k], state, __ATOMIC_RELEASE);
+            expected = state;
+        }
+        while (expected == CHUNK_DECODING) {
+            sched_yield();
+            expected = __atomic_load_n(&r->chunk_state[k], __ATOMIC_ACQUIRE);
+        }
+        if (expected == CHUNK_CORRUPT) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int clamp_range(const cap_reader_t *r, size_t *row_begin, size_t *row_end) {
+    if (*row_end > r->n_rows) {
+        *row_end = r->n_rows;
+    }
+    return *row_begin < *row_end;
+}
+
+cap_span_i32_t cap_reader_channel(cap_reader_t *r, int channel, size_t row_begin, size_t row_end) {
+    cap_span_i32_t s = { NULL, 0 };
+    if (channel < 0 || channel >= CAP_CHANNELS || !clamp_range(r, &row_begin, &row_end)
+            || ensure_rows(r, row_begin, row_end) != 0) {
+        return s;
+    }
+    s.data = r->columns[channel] + row_begin;
+    s.len = row_end - row_begin;
+    return s;
+}
+
+cap_span_f64_t cap_reader_times(cap_reader_t *r, size_t row_begin, size_t row_end) {
+    cap_span_f64_t s = { NULL, 0 };
+    if (!clamp_range(r, &row_begin, &row_end) || ensure_rows(r, row_begin, row_end) != 0) {
+        return s;
+    }
+    s.data = r->times + row_begin;
+    s.len = row_end - row_begin;
+    return s;
+}
+
+cap_span_u8_t cap_reader_valid(cap_reader_t *r, size_t row_begin, size_t row_end) {
+    cap_span_u8_t s = { NULL, 0 };
+    if (!clamp_range(r, &row_begin, &row_end) || ensure_rows(r, row_begin, row_end) != 0) {
+        return s;
+    }
+    s.data = r->valid + row_begin;
+    s.len = row_end - row_begin;
+    return s;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Title: Capture Reader
+ *  Description: Random access to .bcap captures for offline analysis. The file is memory mapped and
+ *               only the chunk index is built on open; chunk headers (time range, statistics) are
+ *               copied into it, since a header follows a payload of any length and is not aligned in
+ *               the mapping. Channel data is decoded lazily, chunk by chunk, into per-column arrays
+ *               the first time a row range is requested, and is returned as spans pointing into
+ *               those arrays, so repeated queries and the Python bindings never copy.
+ *
+ *               Rows are numbered across the whole file in chunk order; every chunk covers
+ *               consecutive sequence numbers and its rows are spread evenly over [t_first, t_last].
+ *               Requests for different row ranges may come from several threads at once.
+ */
+
+#ifndef CAPTURE_READER_H
+#define CAPTURE_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capture_file.h"
+
+typedef struct { const int32_t *data; size_t len; } cap_span_i32_t;
+typedef struct { const double  *data; size_t len; } cap_span_f64_t;
+typedef struct { const uint8_t *data; size_t len; } cap_span_u8_t;
+
+typedef struct {
+    cap_chunk_header_t        header;      // copied out of the mapping
+    const uint8_t            *payload;
+    size_t                    row_first;
+} cap_chunk_ref_t;
+
+typedef struct {
+    int                       fd;
+    const uint8_t            *base;        // mapping of the whole file
+    size_t                    size;
+    const cap_file_header_t  *header;      // at the start of the mapping, so aligned
+
+    cap_chunk_ref_t          *chunks;
+    size_t                    n_chunks;
+    size_t                    n_rows;
+
+    // Lazily decoded columns, reserved for all rows but only touched pages use memory
+    int32_t                  *columns[CAP_CHANNELS];
+    double                   *times;
+    uint8_t                  *valid;
+    size_t                    reserved_rows;
+    volatile int             *chunk_state; // 0 = encoded, 1 = decoding, 2 = decoded, -1 = corrupt
+} cap_reader_t;
+
+// Map a capture. Returns 0 on success, -1 if the file cannot be opened or is not a capture.
+// A chunk cut off at the end of the file (recording still running) is ignored.
+int cap_reader_open(cap_reader_t *r, const char *path);
+void cap_reader_close(cap_reader_t *r);
+
+// Heap allocated variants for language bindings
+cap_reader_t *cap_reader_new(const char *path);
+void cap_reader_free(cap_reader_t *r);
+
+const cap_file_header_t *cap_reader_header(const cap_reader_t *r);
+size_t cap_reader_rows(const cap_reader_t *r);
+size_t cap_reader_chunk_count(const cap_reader_t *r);
+const cap_chunk_header_t *cap_reader_chunk(const cap_reader_t *r, size_t i);
+
+// Chunk holding a row
+size_t cap_reader_chunk_of_row(const cap_reader_t *r, size_t row);
+
+// Number of valid rows in [row_begin, row_end), from the chunk headers and bitmaps without decoding
+size_t cap_reader_count_valid(const cap_reader_t *r, size_t row_begin, size_t row_end);
+
+// Rows [*row_begin, *row_end) with t0 <= t < t1. Returns the number of rows.
+size_t cap_reader_find_time(const cap_reader_t *r, double t0, double t1, size_t *row_begin, size_t *row_end);
+
+// Views of rows [row_begin, row_end), decoding the chunks involved if needed. The data stays valid
+// until the reader is closed. An empty span is returned for a range outside the file.
+cap_span_i32_t cap_reader_channel(cap_reader_t *r, int channel, size_t row_begin, size_t row_end);
+cap_span_f64_t cap_reader_times(cap_reader_t *r, size_t row_begin, size_t row_end);
+cap_span_u8_t  cap_reader_valid(cap_reader_t *r, size_t row_begin, size_t row_end);
+
+#endif // CAPTURE_READER_H
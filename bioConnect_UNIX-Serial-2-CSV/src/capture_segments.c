@@ -0,0 +1,201 @@
+/*
+ *  Title: Capture Segments
+ *  Description: Size/duration rotated segment files with a time index, see capture_segments.h.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE  // fallocate()
+#endif
+
+#include "capture_segments.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// Reserve space for the segment without changing its visible size, so readers following the
+// file never see preallocated zeros.
+static void preallocate(FILE *f, int64_t len) {
+    if (len <= 0) {
+        return;
+    }
+#if defined(__linux__)
+    if (fallocate(fileno(f), FALLOC_FL_KEEP_SIZE, 0, (off_t)len) != 0) {
+        perror("fallocate (segment is written without preallocation)");
+    }
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)len, 0 };
+    if (fcntl(fileno(f), F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(f), F_PREALLOCATE, &store);
+    }
+#else
+    (void)f;
+#endif
+}
+
+static int64_t prealloc_size(const capture_segments_t *seg) {
+    int64_t len = seg->max_bytes;
+    if (len == 0 && seg->max_seconds > 0) {
+        len = (int64_t)(seg->max_seconds * SEG_PREALLOC_DURATION);
+    }
+    return (len > SEG_PREALLOC_MAX) ? SEG_PREALLOC_MAX : len;
+}
+
+static void segment_path(const capture_segments_t *seg, int number, char *name, char *path) {
+    snprintf(name, sizeof(seg->name), "%s_%05d%s", seg->base, number, seg->ext);
+    snprintf(path, 3 * SEG_NAME_SIZE, "%s%s", seg->dir, name);
+}
+
+static void write_index(capture_segments_t *seg, const char *kind, double t) {
+    fprintf(seg->index, "%s,%s,%lld,%lld,%.3f\n", kind, seg->name,
+            (long long)seg->bytes, (long long)seg->rows, t);
+    fflush(seg->index);
+}
+
+// End the started segment, the stream stays open for the next one
+static void end_segment(capture_segments_t *seg) {
+    write_index(seg, "end", seg->t_last);
+    fflush(seg->file);
+    // Give back the part of the preallocation that was not used
+    if (ftruncate(fileno(seg->file), (off_t)seg->bytes) != 0) {
+        perror("ftruncate segment");
+    }
+    seg->started = 0;
+    printf("Segment %s closed (%lld rows, %lld bytes)\n", seg->name, (long long)seg->rows, (long long)seg->bytes);
+}
+
+// Open the next free segment, on the stream of the last one if there is one
+static int open_segment(capture_segments_t *seg) {
+    char path[3 * SEG_NAME_SIZE];
+
+    // Skip segment numbers already used by earlier sessions
+    for (;;) {
+        segment_path(seg, seg->number, seg->name, path);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        seg->number++;
+    }
+
+    seg->file = (seg->file != NULL) ? freopen(path, "w", seg->file) : fopen(path, "w");
+    if (seg->file == NULL) {
+        perror("Unable to open segment");
+        return -1;
+    }
+    setvbuf(seg->file, seg->file_buffer, _IOFBF, SEG_BUFFER);
+    preallocate(seg->file, prealloc_size(seg));
+    seg->bytes = 0;
+    seg->rows = 0;
+    return 0;
+}
+
+static void start_segment(capture_segments_t *seg, double t) {
+    seg->started = 1;
+    seg->t_first = t;
+    seg->t_last = t;
+    seg->t_next_mark = t + SEG_MARK_INTERVAL_S;
+    write_index(seg, "start", t);
+    printf("Recording to segment %s\n", seg->name);
+}
+
+int seg_open(capture_segments_t *seg, const char *path, int64_t max_bytes, double max_seconds) {
+    memset(seg, 0, sizeof(*seg));
+    seg->max_bytes = max_bytes;
+    seg->max_seconds = max_seconds;
+
+    // "../Export/data.csv" -> dir "../Export/", base "data", ext ".csv"
+    const char *slash = strrchr(path, '/');
+    const char *file = slash ? slash + 1 : path;
+    const char *dot = strrchr(file, '.');
+    int dir_len = (int)(file - path);
+    int base_len = dot ? (int)(dot - file) : (int)strlen(file);
+    snprintf(seg->dir, sizeof(seg->dir), "%.*s", dir_len, path);
+    snprintf(seg->base, sizeof(seg->base), "%.*s", base_len, file);
+    snprintf(seg->ext, sizeof(seg->ext), "%s", dot ? dot : "");
+
+    char index_path[3 * SEG_NAME_SIZE];
+    snprintf(index_path, sizeof(index_path), "%s%s_index.csv", seg->dir, seg->base);
+    arena_init(&seg->arena, ARENA_BLOCK);
+    seg->file_buffer = arena_alloc(&seg->arena, SEG_BUFFER);
+    seg->index_buffer = arena_alloc(&seg->arena, SEG_BUFFER);
+    if (seg->file_buffer == NULL || seg->index_buffer == NULL) {
+        perror("Unable to allocate segment buffers");
+        arena_free(&seg->arena);
+        return -1;
+    }
+    int new_index = access(index_path, F_OK) != 0;
+    seg->index = fopen(index_path, "a");
+    if (seg->index == NULL) {
+        perror("Unable to open segment index");
+        arena_free(&seg->arena);
+        return -1;
+    }
+    setvbuf(seg->index, seg->index_buffer, _IOFBF, SEG_BUFFER);
+    if (new_index) {
+        fprintf(seg->index, "kind,segment,offset,row,t\n");
+        fflush(seg->index);
+    }
+    if (open_segment(seg) != 0) {
+        fclose(seg->index);
+        seg->index = NULL;
+        arena_free(&seg->arena);
+        return -1;
+    }
+    arena_seal(&seg->arena);
+    return 0;
+}
+
+FILE *seg_begin_record(capture_segments_t *seg, double t) {
+    if (seg->file == NULL) {
+        return NULL;  // the next segment could not be opened
+    }
+    if (seg->started) {
+        int full = seg->max_bytes > 0 && seg->bytes >= seg->max_bytes;
+        int long_enough = seg->max_seconds > 0 && (t - seg->t_first) >= seg->max_seconds;
+        if (full || long_enough) {
+            end_segment(seg);
+            if (open_segment(seg) != 0) {
+                return NULL;
+            }
+        }
+    }
+    if (!seg->started) {
+        start_segment(seg, t);
+    }
+
+    if (t >= seg->t_next_mark) {
+        write_index(seg, "mark", t);
+        seg->t_next_mark = t + SEG_MARK_INTERVAL_S;
+    }
+    seg->t_last = t;
+    return seg->file;
+}
+
+void seg_end_record(capture_segments_t *seg, int n_bytes) {
+    if (n_bytes > 0) {
+        seg->bytes += n_bytes;
+    }
+    seg->rows++;
+}
+
+void seg_close(capture_segments_t *seg) {
+    if (seg->file != NULL) {
+        if (seg->started) {
+            end_segment(seg);
+        }
+        fclose(seg->file);
+        seg->file = NULL;
+        if (seg->rows == 0) {
+            // Opened at the start of a session without a record: its number is free for the next one
+            char path[3 * SEG_NAME_SIZE];
+            segment_path(seg, seg->number, seg->name, path);
+            unlink(path);
+        }
+    }
+    if (seg->index != NULL) {
+        fclose(seg->index);
+        seg->index = NULL;
+    }
+    arena_free(&seg->arena);
+}
@@ -0,0 +1,75 @@
+/*
+ *  Title: Capture Segments
+ *  Description: Splits a recording into numbered segment files that are rotated by size or by
+ *               duration, e.g. data_00000.csv, data_00001.csv, ... Segments are preallocated so the
+ *               file system can keep them contiguous. A small index file (data_index.csv) maps time
+ *               to segment and byte offset, with a "mark" about every second:
+ *
+ *                   kind,segment,offset,row,t
+ *                   start,data_00000.csv,0,0,1733490000.000
+ *                   mark,data_00000.csv,10240,100,1733490001.000
+ *                   end,data_00000.csv,1048576,102400,1733491024.000
+ *
+ *               A time window is found by reading the index up to the last mark before its start
+ *               and seeking to that offset in the segment. Existing segments are never overwritten,
+ *               a new session continues with the next free segment number.
+ *
+ *               The first segment is opened with the index, rotation reopens the same stream on the
+ *               next segment and the stdio buffers of both come from an arena (arena.h), so recording
+ *               does not allocate.
+ */
+
+#ifndef CAPTURE_SEGMENTS_H
+#define CAPTURE_SEGMENTS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+#define SEG_NAME_SIZE 512
+#define SEG_BUFFER (64 << 10)               // stdio buffer of the segment and of the index
+#define SEG_MARK_INTERVAL_S 1.0             // Time between two index marks
+#define SEG_PREALLOC_MAX (64LL << 20)       // Never preallocate more than 64 MB per segment
+#define SEG_PREALLOC_DURATION 16            // Bytes per second preallocated for duration-only rotation (100 Hz * ~16 B)
+
+typedef struct {
+    // Configuration
+    char     dir[SEG_NAME_SIZE];            // directory of the segments, with trailing '/'
+    char     base[SEG_NAME_SIZE];           // file name prefix, e.g. "data"
+    char     ext[16];                       // extension incl. dot, e.g. ".csv"
+    int64_t  max_bytes;                     // rotate when a segment reaches this size (0 = no limit)
+    double   max_seconds;                   // rotate when a segment covers this much time (0 = no limit)
+
+    // Current segment
+    FILE    *file;                          // open from seg_open() on
+    FILE    *index;
+    int      started;                       // the segment has a record and its start in the index
+    int      number;
+    char     name[SEG_NAME_SIZE + 32];      // file name without directory
+    int64_t  bytes;                         // size of the segment at the start of the current record
+    int64_t  rows;                          // rows written to the segment
+    double   t_first;
+    double   t_last;
+    double   t_next_mark;
+
+    arena_t  arena;                         // stdio buffers
+    char    *file_buffer;
+    char    *index_buffer;
+} capture_segments_t;
+
+// Split path (e.g. "../Export/data.csv") into directory, base name and extension, open the index and
+// the first segment. Returns 0 on success, -1 if either cannot be opened.
+int seg_open(capture_segments_t *seg, const char *path, int64_t max_bytes, double max_seconds);
+
+// Start a record taken at time t (seconds). Rotates the segment if a limit is reached and returns
+// the file the record has to be written to, NULL on error.
+FILE *seg_begin_record(capture_segments_t *seg, double t);
+
+// Account for the record just written (n_bytes as returned by fprintf)
+void seg_end_record(capture_segments_t *seg, int n_bytes);
+
+// Close the current segment (trimming the preallocation, removing it if it has no record) and the index
+void seg_close(capture_segments_t *seg);
+
+#endif // CAPTURE_SEGMENTS_H
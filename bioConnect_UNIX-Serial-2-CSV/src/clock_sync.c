@@ -0,0 +1,175 @@
+/*
+ *  Title: Clock Sync
+ *  Description: Robust online line fit of device ticks against host receive times, see clock_sync.h.
+ */
+
+#include "clock_sync.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double cs_wall_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void cs_init(clock_sync_t *cs) {
+    memset(cs, 0, sizeof(*cs));
+    cs->slope = 1.0;
+}
+
+static int64_t unwrap_tick(clock_sync_t *cs, uint32_t tick) {
+    if (cs->started && tick < cs->last_tick && (cs->last_tick - tick) > 0x80000000u) {
+        cs->tick_wraps++;
+    }
+    cs->last_tick = tick;
+    return (int64_t)tick + (cs->tick_wraps << 32);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Least squares over the points selected by mask (all if mask == NULL)
+static int fit_line(const cs_point_t *p, int n, const unsigned char *mask, double *slope, double *offset) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (mask && !mask[i]) {
+            continue;
+        }
+        sx += p[i].x;
+        sy += p[i].y;
+        sxx += p[i].x * p[i].x;
+        sxy += p[i].x * p[i].y;
+        m++;
+    }
+    double den = m * sxx - sx * sx;
+    if (m < 2 || den <= 0.0) {
+        return 0;
+    }
+    *slope = (m * sxy - sx * sy) / den;
+    *offset = (sy - *slope * sx) / m;
+    return m;
+}
+
+// Refit from scratch over the whole ring. This runs once per CS_WINDOW_MS, and with the ring full
+// (CS_MAX_POINTS) the two sorts take about 50 us, so it is not made incremental.
+static void refit(clock_sync_t *cs) {
+    double resid[CS_MAX_POINTS];
+    double sorted[CS_MAX_POINTS];
+    unsigned char mask[CS_MAX_POINTS];
+    int n = cs->n_points;
+    double slope, offset;
+
+    if (n < CS_MIN_POINTS || !fit_line(cs->points, n, NULL, &slope, &offset)) {
+        return;
+    }
+
+    // Reject points far from the line on either side: above it for windows in which every frame
+    // was delayed, below it after a step of the host clock. One pass is enough for this data
+    for (int i = 0; i < n; ++i) {
+        resid[i] = cs->points[i].y - (offset + slope * cs->points[i].x);
+        sorted[i] = resid[i];
+    }
+    qsort(sorted, n, sizeof(double), compare_double);
+    double median = sorted[n / 2];
+    for (int i = 0; i < n; ++i) {
+        sorted[i] = fabs(resid[i] - median);
+    }
+    qsort(sorted, n, sizeof(double), compare_double);
+    double mad = sorted[n / 2] + 1e-6;  // tick quantisation keeps the MAD from being exactly 0
+
+    for (int i = 0; i < n; ++i) {
+        mask[i] = fabs(resid[i] - median) <= CS_REJECT_MAD * mad;
+    }
+    int used = fit_line(cs->points, n, mask, &slope, &offset);
+    if (!used) {
+        return;
+    }
+
+    double ss = 0;
+    for (int i = 0; i < n; ++i) {
+        if (mask[i]) {
+            double r = cs->points[i].y - (offset + slope * cs->points[i].x);
+            ss += r * r;
+        }
+    }
+    cs->slope = slope;
+    cs->offset = offset;
+    cs->n_used = used;
+    cs->residual_rms = sqrt(ss / used);
+    cs->fitted = 1;
+}
+
+int cs_add(clock_sync_t *cs, uint32_t device_tick_ms, double host_s) {
+    if (cs->started && device_tick_ms < cs->last_tick && (cs->last_tick - device_tick_ms) <= 0x80000000u) {
+        // The tick went back without wrapping: the device restarted and its clock has a new origin.
+        // The fit starts over from this frame, the drift of the same oscillator is kept meanwhile.
+        double slope = cs->fitted ? cs->slope : 1.0;
+        cs_init(cs);
+        cs->slope = slope;
+    }
+    int64_t dev_ms = unwrap_tick(cs, device_tick_ms);
+
+    if (!cs->started) {
+        cs->started = 1;
+        cs->dev_ref_ms = dev_ms;
+        cs->host_ref_s = host_s;
+        cs->window_start_ms = dev_ms;
+    }
+
+    cs_point_t p;
+    p.x = (double)(dev_ms - cs->dev_ref_ms) * 1e-3;
+    p.y = host_s - cs->host_ref_s;
+
+    int updated = 0;
+    if (dev_ms - cs->window_start_ms >= CS_WINDOW_MS) {
+        // Window complete: keep its minimum-delay point and refit
+        if (cs->window_has_point) {
+            cs->points[cs->next_point] = cs->window_min;
+            cs->next_point = (cs->next_point + 1) % CS_MAX_POINTS;
+            if (cs->n_points < CS_MAX_POINTS) {
+                cs->n_points++;
+            }
+            refit(cs);
+            updated = 1;
+        }
+        cs->window_start_ms = dev_ms;
+        cs->window_has_point = 0;
+    }
+
+    if (!cs->window_has_point || (p.y - p.x) < (cs->window_min.y - cs->window_min.x)) {
+        cs->window_min = p;
+        cs->window_has_point = 1;
+    }
+
+    // Until the first fit, place the timeline at the smallest delay seen so far
+    if (!cs->fitted && (p.y - p.x) < cs->offset) {
+        cs->offset = p.y - p.x;
+    }
+    return updated;
+}
+
+double cs_map(clock_sync_t *cs, uint32_t device_tick_ms) {
+    // Same wrap handling as cs_add(), without touching the unwrap state
+    int64_t dev_ms = (int64_t)device_tick_ms + (cs->tick_wraps << 32);
+    if (device_tick_ms > cs->last_tick && (device_tick_ms - cs->last_tick) > 0x80000000u) {
+        dev_ms -= (int64_t)1 << 32;
+    }
+    double x = (double)(dev_ms - cs->dev_ref_ms) * 1e-3;
+    return cs->host_ref_s + cs->offset + cs->slope * x;
+}
+
+double cs_drift_ppm(const clock_sync_t *cs) {
+    return (cs->slope - 1.0) * 1e6;
+}
+
+double cs_scale(const clock_sync_t *cs) {
+    return cs->slope;
+}
@@ -0,0 +1,72 @@
+/*
+ *  Title: Clock Sync
+ *  Description: Online estimation of the MCU clock (HAL tick, HSI derived) against the host clock.
+ *               Every frame gives a point (device tick, host receive time). The receive time is
+ *               the true send time plus a positive, jittery delay, so per window only the point
+ *               with the smallest delay is kept and a line is fitted through those minima with
+ *               outlier rejection. The fit maps device ticks onto the host timeline and gives the
+ *               drift of the MCU clock in ppm.
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+#define CS_WINDOW_MS 1000        // Device time covered by one minimum-delay point
+#define CS_MAX_POINTS 512        // Points kept for the fit (~8.5 min with 1 s windows)
+#define CS_MIN_POINTS 4          // Points needed before the slope is trusted
+#define CS_REJECT_MAD 3.0        // Residuals further than CS_REJECT_MAD * MAD from the median are rejected
+
+typedef struct {
+    double x;  // device time in s, relative to the first frame
+    double y;  // host time in s, relative to the first frame
+} cs_point_t;
+
+typedef struct {
+    // Reference of the relative coordinates
+    int      started;
+    int64_t  dev_ref_ms;         // unwrapped device tick of the first frame
+    double   host_ref_s;         // host time of the first frame
+
+    // Unwrapping of the 32 bit ms tick
+    uint32_t last_tick;
+    int64_t  tick_wraps;
+
+    // Minimum-delay point of the window currently being filled
+    int64_t    window_start_ms;
+    int        window_has_point;
+    cs_point_t window_min;
+
+    // Ring of completed window minima
+    cs_point_t points[CS_MAX_POINTS];
+    int        n_points;
+    int        next_point;
+
+    // Current fit: host = offset + slope * device (relative coordinates)
+    int    fitted;
+    double slope;
+    double offset;
+    int    n_used;               // points that survived outlier rejection
+    double residual_rms;         // of the used points, in s
+} clock_sync_t;
+
+// Host wall clock in seconds, shared by all readers on the machine
+double cs_wall_now(void);
+
+void cs_init(clock_sync_t *cs);
+
+// Add a frame received at host time host_s. Returns 1 if the fit was updated. A tick going back
+// (device restarted) starts the fit over.
+int cs_add(clock_sync_t *cs, uint32_t device_tick_ms, double host_s);
+
+// Map a device tick onto the corrected host timeline (wall clock seconds)
+double cs_map(clock_sync_t *cs, uint32_t device_tick_ms);
+
+// Drift of the device clock against the host clock in ppm (positive: device runs slow)
+double cs_drift_ppm(const clock_sync_t *cs);
+
+// Host seconds per device second, 1.0 until the first fit
+double cs_scale(const clock_sync_t *cs);
+
+#endif // CLOCK_SYNC_H
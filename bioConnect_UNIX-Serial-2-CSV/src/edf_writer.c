@@ -0,0 +1,215 @@
+/*
+ *  Title: EDF Writer
+ *  Description: Streaming EDF+ writer, see edf_writer.h.
+ */
+
+#include "edf_writer.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock_sync.h"
+
+#define EDF_SIGNALS (EDF_CHANNELS + 1)       // the channels and the annotations
+#define EDF_HEADER_BYTES (256 * (EDF_SIGNALS + 1))
+#define EDF_N_RECORDS_OFFSET 236             // position of the number of records in the header
+
+// Write a header field: ASCII, left aligned and padded with spaces
+static char *put_field(char *p, int len, const char *fmt, ...) {
+    char tmp[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > len) n = len;
+    memset(p, ' ', (size_t)len);
+    memcpy(p, tmp, (size_t)n);
+    return p + len;
+}
+
+static void write_header(edf_writer_t *w, double t) {
+    static const char *months[] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+                                    "JUL", "AUG", "SEP", "OCT", "NOV", "DEC" };
+    static const char *labels[EDF_SIGNALS] = { "PPG Red", "PPG IR", "EDF Annotations" };
+    char h[EDF_HEADER_BYTES];
+    char *p = h;
+
+    time_t secs = (time_t)floor(t);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    w->t_file = (double)secs;
+
+    p = put_field(p, 8, "0");
+    p = put_field(p, 80, "X X X X");
+    p = put_field(p, 80, "Startdate %02d-%s-%04d X X bioConnect", tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900);
+    p = put_field(p, 8, "%02d.%02d.%02d", tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+    p = put_field(p, 8, "%02d.%02d.%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+    p = put_field(p, 8, "%d", EDF_HEADER_BYTES);
+    p = put_field(p, 44, "EDF+D");
+    p = put_field(p, 8, "-1");
+    p = put_field(p, 8, "%d", EDF_RECORD_S);
+    p = put_field(p, 4, "%d", EDF_SIGNALS);
+
+    // Signal fields are stored field by field, each for all signals
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 16, "%s", labels[s]);
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 80, "%s", s < EDF_CHANNELS ? "Photodiode" : "");
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 8, "%s", s < EDF_CHANNELS ? "mV" : "");
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 8, "%d", s < EDF_CHANNELS ? 0 : -1);
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 8, "%d", s < EDF_CHANNELS ? EDF_PHYSICAL_MAX_MV : 1);
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 8, "%d", s < EDF_CHANNELS ? 0 : -32768);
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 8, "%d", s < EDF_CHANNELS ? EDF_DIGITAL_MAX : 32767);
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 80, "%s", s < EDF_CHANNELS ? "dark level subtracted" : "");
+    for (int s = 0; s < EDF_SIGNALS; ++s) {
+        p = put_field(p, 8, "%d", s < EDF_CHANNELS ? w->samples_per_record : EDF_ANNOT_BYTES / 2);
+    }
+    for (int s = 0; s < EDF_SIGNALS; ++s) p = put_field(p, 32, "");
+
+    w->bytes_written += fwrite(h, 1, sizeof(h), w->file);
+}
+
+int edf_writer_open(edf_writer_t *w, const char *path, float sample_rate) {
+    memset(w, 0, sizeof(*w));
+    w->sample_rate = sample_rate;
+    w->samples_per_record = (int)lrintf(sample_rate * EDF_RECORD_S);
+    w->t_start = NAN;
+    w->record_bytes = (size_t)EDF_CHANNELS * w->samples_per_record * sizeof(int16_t) + EDF_ANNOT_BYTES;
+    w->record = malloc(w->record_bytes);
+    if (w->record == NULL) {
+        perror("Unable to allocate the EDF record");
+        return -1;
+    }
+    w->file = fopen(path, "wb");
+    if (w->file == NULL) {
+        perror("Unable to open EDF file");
+        free(w->record);
+        w->record = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Format one TAL (time-stamped annotation list) at p. Returns its length, 0 if it does not fit.
+static int format_tal(char *p, int room, double onset, double duration, const char *text) {
+    char tmp[EDF_ANNOT_BYTES];
+    int n;
+    if (duration > 0) {
+        n = snprintf(tmp, sizeof(tmp), "%+.3f\x15%.3f\x14%s\x14", onset, duration, text);
+    } else {
+        n = snprintf(tmp, sizeof(tmp), "%+.3f\x14%s\x14", onset, text);
+    }
+    if (n < 0 || n + 1 > room) {
+        return 0;
+    }
+    memcpy(p, tmp, (size_t)n + 1);  // each TAL ends with a 0 byte
+    return n + 1;
+}
+
+static void write_record(edf_writer_t *w) {
+    char *annot = (char *)(w->record + EDF_CHANNELS * w->samples_per_record);
+    memset(annot, 0, EDF_ANNOT_BYTES);
+
+    // Time-keeping TAL with the onset of this record, then as many queued annotations as fit
+    int len = format_tal(annot, EDF_ANNOT_BYTES, w->onset, 0, "");
+    while (w->queue_len > 0) {
+        const edf_annotation_t *a = &w->queue[w->queue_head];
+        int n = format_tal(annot + len, EDF_ANNOT_BYTES - len, a->onset - w->t_file, a->duration, a->text);
+        if (n == 0) {
+            break;  // the rest goes into the next record
+        }
+        len += n;
+        w->queue_head = (w->queue_head + 1) % EDF_ANNOT_QUEUE;
+        w->queue_len--;
+        w->annotations_written++;
+    }
+
+    w->bytes_written += fwrite(w->record, 1, w->record_bytes, w->file);
+    fflush(w->file);
+    w->records_written++;
+    w->n = 0;
+    w->onset += EDF_RECORD_S;
+}
+
+void edf_writer_add(edf_writer_t *w, double t, const float *values, int valid) {
+    if (w->file == NULL) {
+        return;
+    }
+    if (isnan(w->t_start)) {
+        w->t_start = t;
+        write_header(w, t);
+        w->onset = t - w->t_file;
+    }
+    if (w->broken && w->n == 0) {
+        // After a break the record starts at its first sample, never before the end of the last one
+        w->onset = fmax(w->onset, t - w->t_file);
+        w->broken = 0;
+    }
+    for (int c = 0; c < EDF_CHANNELS; ++c) {
+        if (valid) {
+            long v = lrintf(values[c]);
+            w->last[c] = (int16_t)(v < 0 ? 0 : v > EDF_DIGITAL_MAX ? EDF_DIGITAL_MAX : v);
+        }
+        w->record[c * w->samples_per_record + w->n] = w->last[c];
+    }
+    if (++w->n == w->samples_per_record) {
+        write_record(w);
+    }
+}
+
+void edf_writer_break(edf_writer_t *w) {
+    if (w->file == NULL || isnan(w->t_start)) {
+        return;
+    }
+    if (w->n > 0) {
+        double t_pad = w->t_file + w->onset + (double)w->n / w->sample_rate;
+        double pad_s = (double)(w->samples_per_record - w->n) / w->sample_rate;
+        edf_writer_annotate(w, t_pad, pad_s, "Padding, no samples");
+        float none[EDF_CHANNELS] = { 0 };
+        while (w->n > 0) {
+            edf_writer_add(w, t_pad, none, 0);
+        }
+    }
+    w->broken = 1;
+}
+
+void edf_writer_annotate(edf_writer_t *w, double onset, double duration, const char *text) {
+    if (w->queue_len == EDF_ANNOT_QUEUE) {
+        w->annotations_dropped++;
+        return;
+    }
+    edf_annotation_t *a = &w->queue[(w->queue_head + w->queue_len) % EDF_ANNOT_QUEUE];
+    a->onset = onset;
+    a->duration = duration;
+    snprintf(a->text, sizeof(a->text), "%s", text);
+    w->queue_len++;
+}
+
+void edf_writer_close(edf_writer_t *w) {
+    if (w->file == NULL) {
+        return;
+    }
+    if (isnan(w->t_start)) {
+        write_header(w, cs_wall_now());  // no samples, an empty recording
+    }
+    if (w->n > 0) {
+        float none[EDF_CHANNELS] = { 0 };
+        for (int i = w->n; i < w->samples_per_record; ++i) {
+            edf_writer_add(w, w->t_start, none, 0);
+        }
+    }
+    w->annotations_dropped += (uint64_t)w->queue_len;
+
+    char n_records[9];
+    snprintf(n_records, sizeof(n_records), "%-8lld", (long long)w->records_written);
+    if (fseek(w->file, EDF_N_RECORDS_OFFSET, SEEK_SET) != 0 || fwrite(n_records, 1, 8, w->file) != 8) {
+        perror("Unable to complete the EDF header");
+    }
+    if (fclose(w->file) != 0) {
+        perror("Error closing EDF file");
+    }
+    w->file = NULL;
+    free(w->record);
+    w->record = NULL;
+}
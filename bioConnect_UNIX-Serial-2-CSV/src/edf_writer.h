@@ -0,0 +1,83 @@
+/*
+ *  Title: EDF Writer
+ *  Description: Streaming EDF+ (European Data Format) writer for the Red and IR channels. Samples are
+ *               collected into data records of EDF_RECORD_S seconds, which are written as soon as they
+ *               are full, so a recording needs no intermediate files. The third signal is the
+ *               "EDF Annotations" channel: it holds the onset of every record, followed by the
+ *               annotations added with edf_writer_annotate (gaps, heart rate).
+ *
+ *               Values are the 12-bit ADC counts of the STM32 (dark level subtracted), stored as
+ *               digital 0..4095 with a physical range of 0..3300 mV. The start time is the wall clock
+ *               of the first sample in local time: whole seconds in the header, the fraction in the
+ *               onset of the first record. The header is written with the number of records unknown
+ *               (-1) and completed on close. Missing rows repeat the last value and should be
+ *               annotated by the caller.
+ *
+ *               The file is EDF+D (interrupted): records follow each other without a gap while the
+ *               samples are continuous, and edf_writer_break() starts the next record at the time of
+ *               the next sample after a reset of the device or a long discontinuity. The record cut
+ *               short by the break is padded with the last value and annotated.
+ */
+
+#ifndef EDF_WRITER_H
+#define EDF_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define EDF_RECORD_S 1                       // duration of a data record in seconds
+#define EDF_CHANNELS 2                       // 0 = Red, 1 = IR
+#define EDF_DIGITAL_MAX 4095                 // 12-bit ADC
+#define EDF_PHYSICAL_MAX_MV 3300             // ADC reference voltage
+#define EDF_ANNOT_BYTES 128                  // annotation bytes per record
+#define EDF_ANNOT_TEXT 32
+#define EDF_ANNOT_QUEUE 64                   // annotations waiting for room in a record
+
+typedef struct {
+    double onset;                            // host time
+    double duration;                         // in s, 0 = none
+    char   text[EDF_ANNOT_TEXT];
+} edf_annotation_t;
+
+typedef struct {
+    FILE    *file;
+    float    sample_rate;
+    int      samples_per_record;
+    double   t_start;                        // host time of the first sample, nan before
+    double   t_file;                         // start time in the header (whole seconds)
+    double   onset;                          // of the record being filled, relative to t_file
+    int      broken;                         // the next sample starts a record at its own time
+
+    // Record being filled: Red, IR, then the annotation bytes
+    int      n;
+    int16_t *record;
+    size_t   record_bytes;
+    int16_t  last[EDF_CHANNELS];             // last valid value, repeated for missing rows
+
+    edf_annotation_t queue[EDF_ANNOT_QUEUE];
+    int      queue_head;
+    int      queue_len;
+
+    int64_t  records_written;
+    uint64_t annotations_written;
+    uint64_t annotations_dropped;            // queue full
+    uint64_t bytes_written;
+} edf_writer_t;
+
+// Create the file. The header is written with the first sample. Returns 0 on success.
+int edf_writer_open(edf_writer_t *w, const char *path, float sample_rate);
+
+// Append one row taken at host time t. Missing rows are passed with valid = 0.
+void edf_writer_add(edf_writer_t *w, double t, const float *values, int valid);
+
+// The next sample does not continue the samples so far (reset, discontinuity): complete the record
+// with the last value and start the next one at the time of that sample
+void edf_writer_break(edf_writer_t *w);
+
+// Queue an annotation at host time onset. It is written with the next record.
+void edf_writer_annotate(edf_writer_t *w, double onset, double duration, const char *text);
+
+// Complete the last record (repeating the last value), write the number of records and close
+void edf_writer_close(edf_writer_t *w);
+
+#endif // EDF_WRITER_H
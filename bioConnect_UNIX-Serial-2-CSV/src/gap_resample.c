@@ -0,0 +1,143 @@
+/*
+ *  Title: Gap Resample
+ *  Description: Sequence-gap detection and gap-aware resampling, see gap_resample.h.
+ */
+
+#include "gap_resample.h"
+
+#include <math.h>
+#include <string.h>
+
+const char *gr_gap_kind_name(gr_gap_kind_t kind) {
+    switch (kind) {
+        case GR_GAP_LOST:          return "lost";
+        case GR_GAP_RESET:         return "reset";
+        case GR_GAP_DISCONTINUITY: return "discontinuity";
+        case GR_GAP_DROPPED:       return "dropped";
+    }
+    return "?";
+}
+
+void gr_init(gap_resampler_t *gr, gr_mode_t mode, uint32_t max_fill,
+             gr_sample_fn on_sample, gr_gap_fn on_gap, void *ctx) {
+    memset(gr, 0, sizeof(*gr));
+    gr->mode = mode;
+    gr->max_fill = max_fill;
+    gr->on_sample = on_sample;
+    gr->on_gap = on_gap;
+    gr->ctx = ctx;
+}
+
+static void emit(gap_resampler_t *gr, const gr_sample_t *s) {
+    switch (s->flag) {
+        case GR_SAMPLE_REAL:         gr->n_real++; break;
+        case GR_SAMPLE_INTERPOLATED: gr->n_interpolated++; break;
+        case GR_SAMPLE_MISSING:      gr->n_missing++; break;
+    }
+    if (gr->on_sample) {
+        gr->on_sample(gr->ctx, s);
+    }
+}
+
+static void report_gap(gap_resampler_t *gr, const gr_sample_t *b, const gr_sample_t *c,
+                       uint32_t missing, gr_gap_kind_t kind) {
+    gr_gap_t g = { b->seq, c->seq, missing, b->t, c->t, kind };
+    gr->n_gaps++;
+    if (gr->on_gap) {
+        gr->on_gap(gr->ctx, &g);
+    }
+}
+
+// Emit the rows after b up to and including c. a and d are the outer neighbours used for the
+// cubic tangents and may be NULL.
+static void emit_segment(gap_resampler_t *gr, const gr_sample_t *a, const gr_sample_t *b,
+                         const gr_sample_t *c, const gr_sample_t *d) {
+    uint32_t delta = c->seq - b->seq;
+    int fill = gr->mode != GR_MODE_NONE && (delta - 1) <= gr->max_fill;
+
+    // Tangents in value per sequence step, one sided at the ends
+    double mb[GR_CHANNELS], mc[GR_CHANNELS];
+    for (int ch = 0; ch < GR_CHANNELS; ++ch) {
+        double secant = (double)(c->value[ch] - b->value[ch]) / delta;
+        mb[ch] = a ? (double)(c->value[ch] - a->value[ch]) / (double)(c->seq - a->seq) : secant;
+        mc[ch] = d ? (double)(d->value[ch] - b->value[ch]) / (double)(d->seq - b->seq) : secant;
+    }
+
+    for (uint32_t k = 1; k < delta; ++k) {
+        double u = (double)k / delta;
+        gr_sample_t s;
+        s.seq = b->seq + k;
+        s.t = b->t + u * (c->t - b->t);
+        s.flag = fill ? GR_SAMPLE_INTERPOLATED : GR_SAMPLE_MISSING;
+
+        // Cubic Hermite basis on [b, c]
+        double u2 = u * u, u3 = u2 * u;
+        double h00 = 2 * u3 - 3 * u2 + 1;
+        double h10 = u3 - 2 * u2 + u;
+        double h01 = -2 * u3 + 3 * u2;
+        double h11 = u3 - u2;
+
+        for (int ch = 0; ch < GR_CHANNELS; ++ch) {
+            if (!fill) {
+                s.value[ch] = NAN;
+            } else if (gr->mode == GR_MODE_LINEAR) {
+                s.value[ch] = (float)(b->value[ch] + u * (c->value[ch] - b->value[ch]));
+            } else {
+                s.value[ch] = (float)(h00 * b->value[ch] + h10 * delta * mb[ch]
+                                      + h01 * c->value[ch] + h11 * delta * mc[ch]);
+            }
+        }
+        emit(gr, &s);
+    }
+    emit(gr, c);
+}
+
+void gr_flush(gap_resampler_t *gr) {
+    int n = gr->n_hist;
+    if (gr->mode == GR_MODE_CUBIC && n >= 2) {
+        emit_segment(gr, (n >= 3) ? &gr->hist[n - 3] : NULL, &gr->hist[n - 2], &gr->hist[n - 1], NULL);
+    }
+    gr->n_hist = 0;
+}
+
+void gr_push(gap_resampler_t *gr, uint32_t seq, double t, const float *value) {
+    gr_sample_t s = { seq, t, { 0 }, GR_SAMPLE_REAL };
+    memcpy(s.value, value, sizeof(s.value));
+
+    if (gr->n_hist > 0) {
+        gr_sample_t last = gr->hist[gr->n_hist - 1];
+        int32_t delta = (int32_t)(seq - last.seq);
+
+        if (delta == 0) {
+            return;  // duplicate frame
+        }
+        if (delta < 0 || (uint32_t)delta > GR_MAX_GAP_ROWS) {
+            // Restart from this sample, the grid cannot be continued across this jump
+            gr_flush(gr);
+            report_gap(gr, &last, &s, 0, (delta < 0) ? GR_GAP_RESET : GR_GAP_DISCONTINUITY);
+        } else if (delta > 1) {
+            report_gap(gr, &last, &s, (uint32_t)delta - 1, GR_GAP_LOST);
+        }
+    }
+
+    if (gr->n_hist == 0) {
+        gr->hist[0] = s;
+        gr->n_hist = 1;
+        emit(gr, &s);
+        return;
+    }
+
+    if (gr->n_hist == 4) {
+        memmove(&gr->hist[0], &gr->hist[1], 3 * sizeof(gr_sample_t));
+        gr->n_hist = 3;
+    }
+    gr->hist[gr->n_hist++] = s;
+    int n = gr->n_hist;
+
+    if (gr->mode != GR_MODE_CUBIC) {
+        emit_segment(gr, NULL, &gr->hist[n - 2], &gr->hist[n - 1], NULL);
+    } else if (n >= 3) {
+        // The segment before the newest sample now has both neighbours
+        emit_segment(gr, (n >= 4) ? &gr->hist[n - 4] : NULL, &gr->hist[n - 3], &gr->hist[n - 2], &gr->hist[n - 1]);
+    }
+}
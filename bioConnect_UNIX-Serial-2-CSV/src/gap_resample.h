@@ -0,0 +1,85 @@
+/*
+ *  Title: Gap Resample
+ *  Description: Detects lost frames from the firmware sequence numbers and keeps the output on a
+ *               uniform grid of one row per sequence number. Missing samples are either written as
+ *               NaN or, for gaps up to max_fill samples, interpolated linearly or with a cubic
+ *               Hermite spline through the neighbouring samples. Every gap is also reported as an
+ *               explicit record so it can be logged next to the data.
+ */
+
+#ifndef GAP_RESAMPLE_H
+#define GAP_RESAMPLE_H
+
+#include <stdint.h>
+
+#define GR_MAX_GAP_ROWS 30000    // Longer jumps (5 min at 100 Hz) are a discontinuity, not filled row by row
+#define GR_CHANNELS 2            // Red, IR
+
+typedef enum {
+    GR_MODE_NONE = 0,            // only mark missing samples (NaN)
+    GR_MODE_LINEAR,
+    GR_MODE_CUBIC                // output lags one received sample behind
+} gr_mode_t;
+
+typedef enum {
+    GR_SAMPLE_REAL = 0,
+    GR_SAMPLE_INTERPOLATED,
+    GR_SAMPLE_MISSING
+} gr_flag_t;
+
+typedef enum {
+    GR_GAP_LOST = 0,             // sequence numbers skipped
+    GR_GAP_RESET,                // sequence went backwards (MCU restarted)
+    GR_GAP_DISCONTINUITY,        // jump larger than GR_MAX_GAP_ROWS
+    GR_GAP_DROPPED               // samples a sink fell too far behind to take (sink.h), not in its output
+} gr_gap_kind_t;
+
+typedef struct {
+    uint32_t  seq;
+    double    t;                 // host time, linear between the neighbours for non-real samples
+    float     value[GR_CHANNELS]; // NaN for missing samples
+    gr_flag_t flag;
+} gr_sample_t;
+
+typedef struct {
+    uint32_t      seq_from;      // last sequence number received before the gap
+    uint32_t      seq_to;        // first sequence number received after the gap
+    uint32_t      missing;
+    double        t_from;
+    double        t_to;
+    gr_gap_kind_t kind;
+} gr_gap_t;
+
+typedef void (*gr_sample_fn)(void *ctx, const gr_sample_t *s);
+typedef void (*gr_gap_fn)(void *ctx, const gr_gap_t *g);
+
+typedef struct {
+    gr_mode_t    mode;
+    uint32_t     max_fill;       // gaps up to this many samples are interpolated
+    gr_sample_fn on_sample;
+    gr_gap_fn    on_gap;
+    void        *ctx;
+
+    // Last received samples, hist[n_hist - 1] is the newest
+    gr_sample_t hist[4];
+    int         n_hist;
+
+    // Session statistics
+    uint64_t n_real;
+    uint64_t n_interpolated;
+    uint64_t n_missing;
+    uint64_t n_gaps;
+} gap_resampler_t;
+
+const char *gr_gap_kind_name(gr_gap_kind_t kind);
+
+void gr_init(gap_resampler_t *gr, gr_mode_t mode, uint32_t max_fill,
+             gr_sample_fn on_sample, gr_gap_fn on_gap, void *ctx);
+
+// Feed one received sample. on_sample is called for every grid row that became final.
+void gr_push(gap_resampler_t *gr, uint32_t seq, double t, const float *value);
+
+// Emit rows still held back (cubic mode) at the end of a session
+void gr_flush(gap_resampler_t *gr);
+
+#endif // GAP_RESAMPLE_H
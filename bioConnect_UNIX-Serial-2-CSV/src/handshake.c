@@ -0,0 +1,202 @@
+/*
+ *  Title: Handshake
+ *  Description: Hello/select negotiation of encoding and baud rate, see handshake.h.
+ */
+
+#include "handshake.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Baud rates the firmware accepts, from the fastest: selected from the first, probed from the last
+static const uint32_t baud_rates[] = { 921600, 460800, 230400, 115200 };
+#define N_BAUD_RATES (sizeof(baud_rates) / sizeof(baud_rates[0]))
+
+static speed_t speed_of(uint32_t baud) {
+    switch (baud) {
+#ifdef B921600
+        case 921600: return B921600;
+#endif
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B230400
+        case 230400: return B230400;
+#endif
+        case 115200: return B115200;
+        default: return 0;
+    }
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int send_frame(int fd, bc_frame_type_t type, const void *payload, uint8_t length) {
+    uint8_t frame[BC_MAX_FRAME];
+    size_t size = bc_encode(frame, type, payload, length);
+    if (write(fd, frame, size) != (ssize_t)size) {
+        perror("Unable to send handshake frame");
+        return -1;
+    }
+    tcdrain(fd);
+    return 0;
+}
+
+// Read until a hello arrives or timeout_ms pass. Samples and other bytes on the way are dropped.
+// Returns 1 with *hello set, 0 on timeout, -1 on an error.
+static int wait_hello(int fd, bc_hello_t *hello, int timeout_ms) {
+    uint8_t buf[BC_MAX_FRAME];
+    size_t len = 0;
+    long deadline = now_ms() + timeout_ms;
+    for (;;) {
+        long left = deadline - now_ms();
+        if (left <= 0) return 0;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int r = poll(&pfd, 1, (int)left);
+        if (r < 0 && errno != EINTR) {
+            perror("Unable to wait for the device");
+            return -1;
+        }
+        if (r <= 0) continue;
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("Unable to read from the device");
+            return -1;
+        }
+        if (n <= 0) continue;
+        len += (size_t)n;
+
+        // Drop everything before the next frame, keep a partial frame for the next read
+        while (len > 0) {
+            size_t size = 1;
+            bc_parse_t p = bc_parse(buf, len, &size);
+            if (p == BC_PARSE_MORE) break;
+            if (p == BC_PARSE_FRAME) {
+                const bc_hello_t *h = bc_payload(buf, BC_FRAME_HELLO, sizeof(bc_hello_t));
+                if (h != NULL) {
+                    memcpy(hello, h, sizeof(*hello));
+                    return 1;
+                }
+            }
+            memmove(buf, buf + size, len - size);
+            len -= size;
+        }
+    }
+}
+
+static int set_baud(int fd, uint32_t baud) {
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        perror("Unable to read the serial port settings");
+        return -1;
+    }
+    cfsetispeed(&tty, speed_of(baud));
+    cfsetospeed(&tty, speed_of(baud));
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        perror("Unable to set the baud rate");
+        return -1;
+    }
+    tcflush(fd, TCIFLUSH);  // bytes received during the switch are garbled
+    return 0;
+}
+
+// Ask for the hello at every rate the device may be running at, HS_DEFAULT_BAUD first. Returns 1
+// with the port at the rate of the device, 0 (port at HS_DEFAULT_BAUD) if none answered, -1 on an error.
+static int probe(int fd, bc_hello_t *hello) {
+    for (int k = (int)N_BAUD_RATES - 1; k >= 0; --k) {
+        if (speed_of(baud_rates[k]) == 0 || set_baud(fd, baud_rates[k]) != 0) continue;
+        int queries = baud_rates[k] == HS_DEFAULT_BAUD ? HS_QUERIES : 1;
+        for (int q = 0; q < queries; ++q) {
+            if (send_frame(fd, BC_FRAME_QUERY, NULL, 0) != 0) return -1;
+            int r = wait_hello(fd, hello, HS_TIMEOUT_MS);
+            if (r != 0) return r;
+        }
+    }
+    return set_baud(fd, HS_DEFAULT_BAUD) == 0 ? 0 : -1;
+}
+
+int hs_negotiate(int fd, hs_link_t *link, uint8_t host_encodings, uint32_t max_baud) {
+    memset(link, 0, sizeof(*link));
+    link->encoding = BC_ENCODING_TEXT;
+    link->baud = HS_DEFAULT_BAUD;
+
+    // The device also sends a hello at boot, but that one is usually missed: ask for it
+    int r = probe(fd, &link->hello);
+    if (r <= 0) return r;
+    link->found = 1;
+    link->encoding = link->hello.encoding;
+    link->baud = link->hello.baud;
+
+    // Most efficient encoding and fastest baud rate both sides support
+    uint8_t common = link->hello.encodings & host_encodings;
+    bc_select_t select = { link->baud, (common & BC_ENCODING_BINARY) ? BC_ENCODING_BINARY : BC_ENCODING_TEXT };
+    for (size_t i = 0; i < N_BAUD_RATES; ++i) {
+        if (baud_rates[i] <= link->hello.max_baud && baud_rates[i] <= max_baud && speed_of(baud_rates[i]) != 0) {
+            select.baud = baud_rates[i];
+            break;
+        }
+    }
+    if (select.baud == link->baud && select.encoding == link->encoding) return 0;
+
+    // The device confirms with a hello at the old baud rate, then switches. A hello still on its way
+    // from a query is dropped with the input, and one arriving anyway is not taken for the
+    // confirmation: only a hello of the selected mode is, else the last one (the device refused).
+    tcflush(fd, TCIFLUSH);
+    if (send_frame(fd, BC_FRAME_SELECT, &select, sizeof(select)) != 0) return -1;
+    long deadline = now_ms() + HS_TIMEOUT_MS;
+    int seen = 0, confirmed = 0;
+    while (!confirmed && deadline - now_ms() > 0) {
+        bc_hello_t hello;
+        r = wait_hello(fd, &hello, (int)(deadline - now_ms()));
+        if (r < 0) return -1;
+        if (r == 0) break;
+        memcpy(&link->hello, &hello, sizeof(hello));
+        seen = 1;
+        confirmed = hello.baud == select.baud && hello.encoding == select.encoding;
+    }
+    if (!seen) {
+        printf("Device did not confirm %lu baud, %s: reading as before\n", (unsigned long)select.baud,
+               select.encoding == BC_ENCODING_BINARY ? "binary" : "text");
+        return 0;
+    }
+    if (!confirmed) {
+        printf("Device refused %lu baud, %s\n", (unsigned long)select.baud,
+               select.encoding == BC_ENCODING_BINARY ? "binary" : "text");
+    }
+    link->encoding = link->hello.encoding;
+    if (link->hello.baud != link->baud) {
+        // Not passed on as B0, which would hang up the line: the port stays at the current rate
+        if (speed_of(link->hello.baud) == 0) {
+            printf("Device reports %lu baud, which this host cannot set: staying at %lu baud\n",
+                   (unsigned long)link->hello.baud, (unsigned long)link->baud);
+            return 0;
+        }
+        if (set_baud(fd, link->hello.baud) != 0) return -1;
+        link->baud = link->hello.baud;
+    }
+    return 0;
+}
+
+float hs_sample_rate(const hs_link_t *link, float fallback) {
+    return (link->found && link->hello.sample_rate_mhz > 0) ? link->hello.sample_rate_mhz / 1000.0f : fallback;
+}
+
+void hs_print(const hs_link_t *link, FILE *f) {
+    if (!link->found) {
+        fprintf(f, "Device without handshake (older firmware): text at %lu baud\n", (unsigned long)link->baud);
+        return;
+    }
+    const bc_hello_t *h = &link->hello;
+    fprintf(f, "Device firmware %u.%u.%u, protocol %u, channels%s%s, %.3g Hz: %s at %lu baud\n",
+            h->fw_major, h->fw_minor, h->fw_patch, h->protocol_version,
+            (h->channels & BC_CHANNEL_RED) ? " Red" : "", (h->channels & BC_CHANNEL_IR) ? " IR" : "",
+            h->sample_rate_mhz / 1000.0, link->encoding == BC_ENCODING_BINARY ? "binary" : "text",
+            (unsigned long)link->baud);
+}
@@ -0,0 +1,44 @@
+/*
+ *  Title: Handshake
+ *  Description: Capability handshake with the firmware at connect time, see bc_protocol.h. The reader
+ *               queries the hello of the device, picks the most efficient encoding and the highest
+ *               baud rate both sides support, selects them and switches the serial port once the
+ *               device has confirmed. A device that does not answer at 115200 baud is asked at the
+ *               other rates, it may still run at the rate of an earlier reader. One that answers at
+ *               none is older firmware: it sends text at 115200 baud and is read as before, so
+ *               readers and firmware can be updated in any order.
+ */
+
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../bioConnect_STM32-MCU/Core/Inc/bc_protocol.h"
+
+#define HS_TIMEOUT_MS 300            // Wait for a hello this long per query
+#define HS_QUERIES 2                 // Queries sent at HS_DEFAULT_BAUD, one more at each other rate
+#define HS_DEFAULT_BAUD 115200       // Baud rate after reset and of firmware without a handshake
+#define HS_LINK_TIMEOUT_MS 2000      // No sample for this long above HS_DEFAULT_BAUD: the device may
+                                     // have been reset, its hello at HS_DEFAULT_BAUD was not readable
+
+typedef struct {
+    int        found;                // the device answered with a hello
+    bc_hello_t hello;                // its latest hello
+    uint8_t    encoding;             // BC_ENCODING_* of the samples
+    uint32_t   baud;                 // baud rate in use
+} hs_link_t;
+
+// Negotiate with the device on the open serial port fd, also again after a reset of the device (the
+// port is set back to HS_DEFAULT_BAUD first). host_encodings are the BC_ENCODING_* bits the reader
+// decodes, max_baud the highest rate it accepts. Returns 0 (link describes the mode in use,
+// link->found = 0 for a device without a handshake) or -1 on an error of the serial port.
+int hs_negotiate(int fd, hs_link_t *link, uint8_t host_encodings, uint32_t max_baud);
+
+// Sample rate the device announced in Hz, or fallback without a hello
+float hs_sample_rate(const hs_link_t *link, float fallback);
+
+void hs_print(const hs_link_t *link, FILE *f);
+
+#endif // HANDSHAKE_H
@@ -0,0 +1,146 @@
+/*
+ *  Title: Latency Trace
+ *  Description: Per-stage latency histograms and percentile report, see latency_trace.h.
+ */
+
+#include "latency_trace.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char *stage_names[LT_STAGE_COUNT] = {
+    "transit (ADC->rx)",
+    "parse   (rx->parsed)",
+    "write   (parsed->file)",
+    "host    (rx->file)",
+    "age     (ADC->file)",
+};
+
+uint64_t lt_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// Log-linear bucket index: values below LT_SUB_BUCKETS map 1:1, above that every power of
+// two is split into LT_SUB_BUCKETS equally sized buckets.
+static int bucket_of(uint64_t v) {
+    if (v > 0xFFFFFFFFu) {
+        v = 0xFFFFFFFFu;
+    }
+    if (v < LT_SUB_BUCKETS) {
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int octave = msb - 2;                          // log2(LT_SUB_BUCKETS) == 3
+    int sub = (int)(v >> (msb - 3)) - LT_SUB_BUCKETS;
+    return octave * LT_SUB_BUCKETS + sub;
+}
+
+// Largest value that still falls into bucket b
+static uint64_t bucket_upper(int b) {
+    if (b < LT_SUB_BUCKETS) {
+        return (uint64_t)b;
+    }
+    int octave = b / LT_SUB_BUCKETS;
+    int sub = b % LT_SUB_BUCKETS;
+    return ((uint64_t)(LT_SUB_BUCKETS + sub + 1) << (octave - 1)) - 1;
+}
+
+void lt_hist_add(lt_histogram_t *h, uint64_t v) {
+    if (h->count == 0 || v < h->min_us) {
+        h->min_us = v;
+    }
+    if (v > h->max_us) {
+        h->max_us = v;
+    }
+    h->count++;
+    h->sum_us += v;
+    h->buckets[bucket_of(v)]++;
+}
+
+uint64_t lt_percentile(const lt_histogram_t *h, double p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < LT_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t v = bucket_upper(b);
+            return (v > h->max_us) ? h->max_us : v;
+        }
+    }
+    return h->max_us;
+}
+
+void lt_init(latency_trace_t *lt) {
+    memset(lt, 0, sizeof(*lt));
+}
+
+void lt_mark_rx(latency_trace_t *lt, uint64_t rx_us) {
+    lt->rx_us = rx_us;
+    lt->have_device_ts = 0;
+    lt->transit_us = -1;
+}
+
+void lt_mark_device(latency_trace_t *lt, uint32_t device_tick_ms) {
+    lt->device_us = (uint64_t)device_tick_ms * 1000u;
+    lt->have_device_ts = 1;
+
+    // The clocks are not synchronised, so the absolute offset is unknown. The smallest offset
+    // seen approximates a sample that went through with no queuing; everything above it is delay.
+    int64_t offset = (int64_t)lt->rx_us - (int64_t)lt->device_us;
+    if (!lt->have_offset || offset < lt->min_offset_us) {
+        lt->min_offset_us = offset;
+        lt->have_offset = 1;
+    }
+    lt->transit_us = offset - lt->min_offset_us;
+    lt_hist_add(&lt->stage[LT_STAGE_TRANSIT], (uint64_t)lt->transit_us);
+}
+
+void lt_mark_parsed(latency_trace_t *lt) {
+    lt->parse_us = lt_now_us();
+    lt_hist_add(&lt->stage[LT_STAGE_PARSE], lt->parse_us - lt->rx_us);
+}
+
+void lt_mark_written(latency_trace_t *lt, uint64_t written_us, uint64_t rx_us, uint64_t parse_us,
+                     int64_t transit_us) {
+    lt_hist_add(&lt->stage[LT_STAGE_WRITE], written_us - parse_us);
+    lt_hist_add(&lt->stage[LT_STAGE_HOST], written_us - rx_us);
+
+    // The transit was taken against the smallest offset seen by then, later ones are not applied
+    if (transit_us >= 0) {
+        lt_hist_add(&lt->stage[LT_STAGE_AGE], (uint64_t)transit_us + (written_us - rx_us));
+    }
+}
+
+void lt_report(const latency_trace_t *lt, FILE *out) {
+    fprintf(out, "\nLatency per stage in us (%llu samples):\n",
+            (unsigned long long)lt->stage[LT_STAGE_HOST].count);
+    fprintf(out, "%-24s %10s %10s %10s %10s %10s %10s\n",
+            "stage", "min", "mean", "p50", "p90", "p99", "max");
+
+    for (int s = 0; s < LT_STAGE_COUNT; ++s) {
+        const lt_histogram_t *h = &lt->stage[s];
+        if (h->count == 0) {
+            fprintf(out, "%-24s %10s\n", stage_names[s], "-");
+            continue;
+        }
+        fprintf(out, "%-24s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                stage_names[s],
+                (unsigned long long)h->min_us,
+                (unsigned long long)(h->sum_us / h->count),
+                (unsigned long long)lt_percentile(h, 50.0),
+                (unsigned long long)lt_percentile(h, 90.0),
+                (unsigned long long)lt_percentile(h, 99.0),
+                (unsigned long long)h->max_us);
+    }
+    if (lt->stage[LT_STAGE_TRANSIT].count == 0) {
+        fprintf(out, "No device timestamps received (legacy firmware?), transit/age unavailable.\n");
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ *  Title: Latency Trace
+ *  Description: Per-stage latency accounting for samples travelling from the ADC trigger on the MCU
+ *               to the CSV file on the host. Each stage keeps a log-linear histogram so percentiles
+ *               can be reported over a whole session without storing every sample.
+ *
+ *               The first stages are marked on the read loop. The samples carry their stamps through
+ *               the sink queues, and the last stages are marked on the thread of the recording sink
+ *               once it has written and flushed them, so they include the wait in the queues.
+ */
+
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LT_SUB_BUCKETS 8                      // Sub-buckets per power of two (~12% resolution)
+#define LT_BUCKETS (33 * LT_SUB_BUCKETS)      // Covers 0 us .. 2^32 us (~71 min)
+
+// Stages a sample passes on its way to the file
+typedef enum {
+    LT_STAGE_TRANSIT = 0,   // ADC trigger -> host read() returned (above the session minimum)
+    LT_STAGE_PARSE,         // read() returned -> line parsed
+    LT_STAGE_WRITE,         // line parsed -> written and flushed by the recording sink
+    LT_STAGE_HOST,          // read() returned -> written
+    LT_STAGE_AGE,           // ADC trigger -> written (transit + host)
+    LT_STAGE_COUNT
+} lt_stage_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t buckets[LT_BUCKETS];
+} lt_histogram_t;
+
+typedef struct {
+    lt_histogram_t stage[LT_STAGE_COUNT];
+
+    // Device clock vs. host clock: only differences against the smallest offset seen are meaningful
+    int     have_offset;
+    int64_t min_offset_us;  // min(host_rx - device_tick) over the session
+
+    // Timestamps of the sample currently in flight
+    int      have_device_ts;
+    uint64_t device_us;     // ADC trigger time in device clock
+    uint64_t rx_us;         // read() returned
+    uint64_t parse_us;      // line parsed
+    int64_t  transit_us;    // of this sample, -1 without a device timestamp
+} latency_trace_t;
+
+uint64_t lt_now_us(void);
+
+void lt_init(latency_trace_t *lt);
+
+// Mark the stages of one sample. lt_mark_rx() is called with the time the chunk containing
+// the line was read, lt_mark_device() only if the frame carried a device timestamp.
+void lt_mark_rx(latency_trace_t *lt, uint64_t rx_us);
+void lt_mark_device(latency_trace_t *lt, uint32_t device_tick_ms);
+void lt_mark_parsed(latency_trace_t *lt);
+
+// Mark a sample written at written_us, on the thread of the recording sink, with the stamps it was
+// given on the read loop. The read loop only adds to the transit and parse stages meanwhile.
+void lt_mark_written(latency_trace_t *lt, uint64_t written_us, uint64_t rx_us, uint64_t parse_us,
+                     int64_t transit_us);
+
+// Add one value in us to a histogram, for other measurements of the reader
+void lt_hist_add(lt_histogram_t *h, uint64_t v);
+
+uint64_t lt_percentile(const lt_histogram_t *h, double p);
+
+void lt_report(const latency_trace_t *lt, FILE *out);
+
+#endif // LATENCY_TRACE_H
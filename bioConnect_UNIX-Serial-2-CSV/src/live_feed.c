@@ -0,0 +1,107 @@
+/*
+ *  Title: Live Feed
+ *  Description: Shared-memory ring of the live samples, see live_feed.h.
+ */
+
+#include "live_feed.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "clock_sync.h"
+
+int lf_open(live_feed_t *lf, const char *name, float sample_rate) {
+    memset(lf, 0, sizeof(*lf));
+    snprintf(lf->name, sizeof(lf->name), "/%s", name);
+    lf->size = sizeof(lf_header_t) + (size_t)LF_CAPACITY * sizeof(lf_record_t) + (size_t)LF_COLUMNS * sizeof(sf_column_t);
+
+    shm_unlink(lf->name);  // a segment left by a reader that was killed
+    int fd = shm_open(lf->name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("Unable to create the live feed");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)lf->size) != 0) {
+        perror("Unable to size the live feed");
+        close(fd);
+        shm_unlink(lf->name);
+        return -1;
+    }
+    void *base = mmap(NULL, lf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Unable to map the live feed");
+        shm_unlink(lf->name);
+        return -1;
+    }
+    lf->header = (lf_header_t *)base;
+    lf->records = (lf_record_t *)(lf->header + 1);
+    lf->columns = (sf_column_t *)(lf->records + LF_CAPACITY);
+    lf->hr_bpm = NAN;
+    lf->spo2 = NAN;
+
+    lf_header_t *h = lf->header;
+    h->version = LF_VERSION;
+    h->record_bytes = sizeof(lf_record_t);
+    h->capacity = LF_CAPACITY;
+    h->sample_rate = sample_rate;
+    h->t_created = cs_wall_now();
+    h->column_capacity = LF_COLUMNS;
+    h->column_bins = SF_BINS;
+    __atomic_store_n(&h->write_count, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->column_count, 0, __ATOMIC_RELEASE);
+    memcpy(h->magic, LF_MAGIC, 4);  // last, a reader checks it before anything else
+    return 0;
+}
+
+void lf_add(live_feed_t *lf, uint32_t seq, double t, const float *values, uint32_t flags) {
+    if (lf->header == NULL) {
+        return;
+    }
+    uint64_t n = lf->header->write_count;  // only this process writes it
+    lf_record_t *r = &lf->records[n & (LF_CAPACITY - 1)];
+    r->t = t;
+    r->value[0] = values[0];
+    r->value[1] = values[1];
+    r->seq = seq;
+    r->flags = flags | (lf->beat ? LF_BEAT : 0);
+    r->hr_bpm = lf->hr_bpm;
+    r->spo2 = lf->spo2;
+    lf->beat = 0;
+    __atomic_store_n(&lf->header->write_count, n + 1, __ATOMIC_RELEASE);
+}
+
+void lf_add_column(live_feed_t *lf, double t, int channel, const float *power_db, int n_bins) {
+    if (lf->header == NULL) {
+        return;
+    }
+    uint64_t n = lf->header->column_count;
+    sf_column_t *c = &lf->columns[n & (LF_COLUMNS - 1)];
+    c->t = t;
+    c->channel = (uint32_t)channel;
+    for (int k = 0; k < SF_BINS; ++k) {
+        c->power_db[k] = (k < n_bins) ? power_db[k] : NAN;
+    }
+    __atomic_store_n(&lf->header->column_count, n + 1, __ATOMIC_RELEASE);
+}
+
+void lf_set_vitals(live_feed_t *lf, float hr_bpm, float spo2, int beat) {
+    lf->hr_bpm = hr_bpm;
+    lf->spo2 = spo2;
+    lf->beat |= beat;
+}
+
+void lf_close(live_feed_t *lf) {
+    if (lf->header == NULL) {
+        return;
+    }
+    munmap(lf->header, lf->size);
+    shm_unlink(lf->name);
+    lf->header = NULL;
+    lf->records = NULL;
+    lf->columns = NULL;
+}
@@ -0,0 +1,95 @@
+/*
+ *  Title: Live Feed
+ *  Description: Publishes the samples of the running reader in a POSIX shared-memory ring, so the
+ *               plotter and other viewers read binary records directly instead of polling the CSV.
+ *               The segment (/dev/shm/<name> on Linux) holds lf_header_t followed by LF_CAPACITY
+ *               records of lf_record_t. There is one writer and any number of readers, which never
+ *               block it:
+ *
+ *                   - the writer stores record number n at n % LF_CAPACITY, then sets write_count
+ *                     to n + 1 (release), so records below write_count are complete
+ *                   - a reader copies the records it has not seen yet and reads write_count again;
+ *                     records below write_count + 1 - LF_CAPACITY may have been overwritten
+ *                     meanwhile and are discarded: while record write_count is being stored, the
+ *                     writer already overwrites the slot of write_count - LF_CAPACITY
+ *
+ *               Every record also carries the latest heart rate and SpO2 estimate of the reader, and
+ *               LF_BEAT marks the record written after a beat was detected.
+ *
+ *               The records are followed by a second ring of LF_COLUMNS spectrogram columns
+ *               (sf_column_t, both channels interleaved) with its own column_count, published the
+ *               same way. All fields are little endian.
+ */
+
+#ifndef LIVE_FEED_H
+#define LIVE_FEED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spectrogram_file.h"
+
+#define LF_MAGIC "BLIV"
+#define LF_VERSION 3
+#define LF_CAPACITY 65536                    // records, 655 s at 100 Hz; a power of two
+#define LF_CHANNELS 2                        // 0 = Red, 1 = IR
+#define LF_COLUMNS 512                       // spectrogram columns, a power of two
+
+#define LF_VALID 0x01                        // not a missing sample
+#define LF_INTERPOLATED 0x02
+#define LF_BEAT 0x04                         // a beat was detected since the previous record
+
+typedef struct {
+    char     magic[4];                       // LF_MAGIC
+    uint16_t version;
+    uint16_t record_bytes;
+    uint32_t capacity;
+    float    sample_rate;                    // nominal rate in Hz
+    uint64_t write_count;                    // records written so far
+    double   t_created;                      // host wall clock
+    uint32_t column_capacity;                // LF_COLUMNS
+    uint32_t column_bins;                    // SF_BINS
+    uint64_t column_count;                   // spectrogram columns written so far
+    uint8_t  reserved[16];
+} lf_header_t;
+
+typedef struct {
+    double   t;                              // host time
+    float    value[LF_CHANNELS];             // nan if missing
+    uint32_t seq;
+    uint32_t flags;                          // LF_VALID, LF_INTERPOLATED, LF_BEAT
+    float    hr_bpm;                         // nan until the first estimate
+    float    spo2;                           // in %, nan until the first window with a pulse
+} lf_record_t;
+
+_Static_assert(sizeof(lf_header_t) == 64, "live feed header layout");
+_Static_assert(sizeof(lf_record_t) == 32, "live feed record layout");
+
+typedef struct {
+    char         name[64];                   // shared-memory name, with the leading '/'
+    lf_header_t *header;
+    lf_record_t *records;
+    sf_column_t *columns;
+    size_t       size;
+
+    // Estimates attached to the next records, set with lf_set_vitals
+    float        hr_bpm;
+    float        spo2;
+    int          beat;
+} live_feed_t;
+
+// Create (or replace) the shared-memory segment "/<name>". Returns 0 on success.
+int lf_open(live_feed_t *lf, const char *name, float sample_rate);
+
+void lf_add(live_feed_t *lf, uint32_t seq, double t, const float *values, uint32_t flags);
+
+// Publish one spectrogram column of a channel, n_bins values of ppg_stft_t.power_db
+void lf_add_column(live_feed_t *lf, double t, int channel, const float *power_db, int n_bins);
+
+// Update the heart rate and SpO2 (nan = unknown) and mark a beat (beat != 0) on the next record
+void lf_set_vitals(live_feed_t *lf, float hr_bpm, float spo2, int beat);
+
+// Unmap and remove the segment; readers that still have it mapped keep their view
+void lf_close(live_feed_t *lf);
+
+#endif // LIVE_FEED_H
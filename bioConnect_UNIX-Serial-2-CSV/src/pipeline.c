@@ -0,0 +1,396 @@
+/*
+ *  Title: Pipeline
+ *  Description: Loading, scheduling and timing of the DSP graph, see pipeline.h.
+ */
+
+#include "pipeline.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void run_stage(pl_stage_t *st) {
+    uint64_t before = 0, after = 0;
+    for (int i = 0; i < st->n_in; ++i) {
+        before += st->read[i];
+    }
+    uint64_t t0 = now_ns();
+    st->ops->run(st);
+    uint64_t ns = now_ns() - t0;
+    for (int i = 0; i < st->n_in; ++i) {
+        after += st->read[i];
+    }
+    st->runs++;
+    st->n_values += after - before;
+    st->ns_total += ns;
+    if (ns > st->ns_max) {
+        st->ns_max = ns;
+    }
+}
+
+static void stage_task(ws_task_t *task) {
+    run_stage((pl_stage_t *)task->arg);
+}
+
+// Run the n stages of one depth, which only read from shallower stages
+static void run_depth(ws_pool_t *pool, pl_stage_t *stages, int n) {
+    if (pool == NULL || n == 1) {
+        for (int i = 0; i < n; ++i) {
+            run_stage(&stages[i]);
+        }
+        return;
+    }
+    // The calling thread takes the first stage and then helps with the others
+    ws_group_t group = { 0 };
+    ws_task_t tasks[PL_MAX_STAGES];
+    for (int i = 1; i < n; ++i) {
+        tasks[i] = (ws_task_t){ stage_task, &stages[i], &group };
+        ws_submit(pool, &tasks[i]);
+    }
+    run_stage(&stages[0]);
+    ws_wait(pool, &group);
+}
+
+// ------------------------------------------------------------------ Loading
+
+static pl_ring_t *find_ring(pipeline_t *pl, const char *name, int *index) {
+    for (int i = 0; i < pl->n_rings; ++i) {
+        if (strcmp(pl->rings[i]->name, name) == 0) {
+            *index = i;
+            return pl->rings[i];
+        }
+    }
+    return NULL;
+}
+
+static pl_ring_t *add_ring(pipeline_t *pl, const char *name, pl_type_t type) {
+    pl_ring_t *ring = arena_alloc(&pl->arena, sizeof(*ring));
+    if (ring != NULL) {
+        snprintf(ring->name, sizeof(ring->name), "%s", name);
+        ring->type = type;
+        pl->rings[pl->n_rings++] = ring;
+    }
+    return ring;
+}
+
+static const char *type_name(pl_type_t type) {
+    return type == PL_SIGNAL ? "signal" : "event";
+}
+
+static int key_allowed(const pl_stage_ops_t *ops, const char *key) {
+    for (const char *const *k = ops->keys; k != NULL && *k != NULL; ++k) {
+        if (strcmp(*k, key) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse "name = type input... key=value..." into the next stage. Returns -1 with the reason printed.
+static int parse_stage(pipeline_t *pl, char *line, const char *path, int line_no, int *ring_depth) {
+    char *tokens[PL_MAX_INPUTS + PL_MAX_PARAMS + 3];
+    int n_tokens = 0;
+    for (char *tok = strtok(line, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+        if (n_tokens == (int)(sizeof(tokens) / sizeof(tokens[0]))) {
+            printf("%s:%d: too many inputs and parameters\n", path, line_no);
+            return -1;
+        }
+        tokens[n_tokens++] = tok;
+    }
+    if (n_tokens < 3 || strcmp(tokens[1], "=") != 0) {
+        printf("%s:%d: expected \"name = type input... key=value...\"\n", path, line_no);
+        return -1;
+    }
+    int unused;
+    if (strlen(tokens[0]) >= PL_NAME || find_ring(pl, tokens[0], &unused) != NULL) {
+        printf("%s:%d: %s is defined twice or longer than %d characters\n", path, line_no, tokens[0], PL_NAME - 1);
+        return -1;
+    }
+    for (int i = 0; i < pl->n_stages; ++i) {
+        if (strcmp(pl->stages[i].name, tokens[0]) == 0) {
+            printf("%s:%d: %s is defined twice\n", path, line_no, tokens[0]);
+            return -1;
+        }
+    }
+    const pl_stage_ops_t *ops = pl_find_stage(tokens[2]);
+    if (ops == NULL) {
+        printf("%s:%d: unknown stage type %s, the types are:\n", path, line_no, tokens[2]);
+        pl_print_stages(stdout);
+        return -1;
+    }
+    if (pl->n_stages == PL_MAX_STAGES) {
+        printf("%s:%d: more than %d stages\n", path, line_no, PL_MAX_STAGES);
+        return -1;
+    }
+
+    pl_stage_t *st = &pl->stages[pl->n_stages];
+    memset(st, 0, sizeof(*st));
+    st->ops = ops;
+    st->line = line_no;
+    snprintf(st->name, sizeof(st->name), "%s", tokens[0]);
+    for (int i = 3; i < n_tokens; ++i) {
+        char *eq = strchr(tokens[i], '=');
+        if (eq != NULL) {
+            *eq = '\0';
+            if (!key_allowed(ops, tokens[i]) || st->n_params == PL_MAX_PARAMS) {
+                printf("%s:%d: %s takes no parameter %s (%s)\n", path, line_no, ops->type, tokens[i], ops->help);
+                return -1;
+            }
+            snprintf(st->params[st->n_params].key, PL_NAME, "%s", tokens[i]);
+            snprintf(st->params[st->n_params].value, sizeof(st->params[0].value), "%s", eq + 1);
+            st->n_params++;
+            continue;
+        }
+        int index;
+        pl_ring_t *ring = find_ring(pl, tokens[i], &index);
+        if (ring == NULL) {
+            printf("%s:%d: %s is not defined above\n", path, line_no, tokens[i]);
+            return -1;
+        }
+        if (ring->type != ops->input_type) {
+            printf("%s:%d: %s takes %s inputs, %s is %s %s\n", path, line_no, ops->type, type_name(ops->input_type),
+                   tokens[i], ring->type == PL_SIGNAL ? "a" : "an", type_name(ring->type));
+            return -1;
+        }
+        if (st->n_in == ops->max_inputs) {
+            printf("%s:%d: %s takes at most %d inputs\n", path, line_no, ops->type, ops->max_inputs);
+            return -1;
+        }
+        st->in[st->n_in++] = ring;
+        if (ring_depth[index] + 1 > st->depth) {
+            st->depth = ring_depth[index] + 1;
+        }
+    }
+    if (st->n_in < ops->min_inputs) {
+        printf("%s:%d: %s takes at least %d inputs (%s)\n", path, line_no, ops->type, ops->min_inputs, ops->help);
+        return -1;
+    }
+    if (ops->has_output) {
+        st->out = add_ring(pl, st->name, ops->output_type);
+        if (st->out == NULL) {
+            return -1;
+        }
+        ring_depth[pl->n_rings - 1] = st->depth;
+    }
+    if (st->depth > pl->max_depth) {
+        pl->max_depth = st->depth;
+    }
+    pl->n_stages++;
+    return 0;
+}
+
+static int compare_depth(const void *a, const void *b) {
+    const pl_stage_t *sa = a, *sb = b;
+    if (sa->depth != sb->depth) {
+        return sa->depth - sb->depth;
+    }
+    return sa->line - sb->line;
+}
+
+// Read the graph from f, path names it in messages. Closes f.
+static pipeline_t *load(FILE *f, const char *path, float sample_rate) {
+    pipeline_t *pl = calloc(1, sizeof(*pl));
+    if (pl != NULL) {
+        arena_init(&pl->arena, ARENA_BLOCK);
+    }
+    if (pl == NULL || add_ring(pl, "red", PL_SIGNAL) == NULL || add_ring(pl, "ir", PL_SIGNAL) == NULL) {
+        fclose(f);
+        pl_close(pl, NULL);
+        return NULL;
+    }
+    int ring_depth[PL_MAX_STAGES + 2] = { 0 };
+    int n_threads = 1;
+    char line[1024];
+    int line_no = 0, failed = 0;
+    while (!failed && fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        char *p = line;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        size_t len = strlen(p);
+        while (len > 0 && isspace((unsigned char)p[len - 1])) {
+            p[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (strncmp(p, "threads", 7) == 0 && isspace((unsigned char)p[7])) {
+            n_threads = atoi(p + 8);
+            if (n_threads < 1 || n_threads > PL_MAX_THREADS) {
+                printf("%s:%d: threads must be 1 to %d\n", path, line_no, PL_MAX_THREADS);
+                failed = 1;
+            }
+            continue;
+        }
+        failed = parse_stage(pl, p, path, line_no, ring_depth) != 0;
+    }
+    fclose(f);
+    if (!failed && pl->n_stages == 0) {
+        printf("%s: no stages\n", path);
+        failed = 1;
+    }
+
+    // Allocate and initialise the stages, in the order of the file so errors come in order
+    for (int i = 0; i < pl->n_stages && !failed; ++i) {
+        pl_stage_t *st = &pl->stages[i];
+        st->state = arena_alloc(&pl->arena, st->ops->state_size);
+        if (st->state == NULL || st->ops->init(st, sample_rate) != 0) {
+            printf("%s:%d: stage %s not started\n", path, st->line, st->name);
+            st->state = NULL;
+            failed = 1;
+        }
+    }
+    if (failed) {
+        pl_close(pl, NULL);
+        return NULL;
+    }
+    qsort(pl->stages, (size_t)pl->n_stages, sizeof(pl->stages[0]), compare_depth);
+    if (n_threads > 1) {
+        pl->pool = ws_start(n_threads - 1);  // the thread calling pl_run works too
+    }
+    arena_seal(&pl->arena);
+    return pl;
+}
+
+pipeline_t *pl_load(const char *path, float sample_rate) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror("Unable to open pipeline file");
+        return NULL;
+    }
+    return load(f, path, sample_rate);
+}
+
+pipeline_t *pl_load_text(const char *text, const char *name, float sample_rate) {
+    FILE *f = fmemopen((void *)text, strlen(text), "r");
+    if (f == NULL) {
+        perror("Unable to read pipeline");
+        return NULL;
+    }
+    return load(f, name, sample_rate);
+}
+
+void pl_set_output(pipeline_t *pl, pl_output_fn output, void *ctx) {
+    for (int i = 0; i < pl->n_stages; ++i) {
+        pl->stages[i].output = output;
+        pl->stages[i].output_ctx = ctx;
+    }
+}
+
+// ------------------------------------------------------------------ Running
+
+void pl_write(pl_ring_t *ring, double t, float v) {
+    pl_value_t *slot = &ring->data[ring->written & (PL_RING - 1)];
+    slot->t = t;
+    slot->v = v;
+    ring->written++;
+}
+
+void pl_push(pipeline_t *pl, double t, float red, float ir) {
+    pl_write(pl->rings[0], t, red);
+    pl_write(pl->rings[1], t, ir);
+    if (++pl->n_pending >= PL_BLOCK) {
+        pl_run(pl);
+    }
+}
+
+void pl_run(pipeline_t *pl) {
+    if (pl->n_pending == 0) {
+        return;
+    }
+    int first = 0;
+    for (int depth = 1; depth <= pl->max_depth; ++depth) {
+        int n = 0;
+        while (first + n < pl->n_stages && pl->stages[first + n].depth == depth) {
+            n++;
+        }
+        run_depth(pl->pool, &pl->stages[first], n);
+        first += n;
+    }
+    pl->n_pending = 0;
+}
+
+double pl_param(const pl_stage_t *st, const char *key, double fallback) {
+    const char *v = pl_param_str(st, key, NULL);
+    return v != NULL ? atof(v) : fallback;
+}
+
+const char *pl_param_str(const pl_stage_t *st, const char *key, const char *fallback) {
+    for (int i = 0; i < st->n_params; ++i) {
+        if (strcmp(st->params[i].key, key) == 0) {
+            return st->params[i].value;
+        }
+    }
+    return fallback;
+}
+
+static void report(const pipeline_t *pl, FILE *f) {
+    uint64_t ns_all = 0;
+    for (int i = 0; i < pl->n_stages; ++i) {
+        ns_all += pl->stages[i].ns_total;
+    }
+    fprintf(f, "Pipeline (%d stages, depth %d, %d threads, %zu kB in %zu arena blocks):\n", pl->n_stages,
+            pl->max_depth, pl->pool != NULL ? pl->pool->n_workers + 1 : 1, pl->arena.bytes_used >> 10,
+            pl->arena.n_blocks);
+    fprintf(f, "  %-16s %-14s %8s %10s %10s %10s %10s %6s\n",
+            "stage", "type", "runs", "values", "total ms", "ns/value", "max us", "share");
+    // In the order of the file
+    for (int line = 0, done = 0; done < pl->n_stages; ++line) {
+        for (int i = 0; i < pl->n_stages; ++i) {
+            const pl_stage_t *st = &pl->stages[i];
+            if (st->line != line) {
+                continue;
+            }
+            fprintf(f, "  %-16s %-14s %8llu %10llu %10.3f %10.1f %10.1f %5.1f%%\n", st->name, st->ops->type,
+                    (unsigned long long)st->runs, (unsigned long long)st->n_values, st->ns_total * 1e-6,
+                    st->n_values > 0 ? (double)st->ns_total / (double)st->n_values : 0.0, st->ns_max * 1e-3,
+                    ns_all > 0 ? 100.0 * (double)st->ns_total / (double)ns_all : 0.0);
+            done++;
+        }
+    }
+}
+
+void pl_close(pipeline_t *pl, FILE *f) {
+    if (pl == NULL) {
+        return;
+    }
+    int started = 1;
+    for (int i = 0; i < pl->n_stages; ++i) {
+        started &= pl->stages[i].state != NULL;
+    }
+    if (started) {
+        pl_run(pl);
+        if (f != NULL) {
+            report(pl, f);
+            if (pl->pool != NULL) {
+                ws_report(pl->pool, f);
+            }
+        }
+    }
+    if (pl->pool != NULL) {
+        ws_stop(pl->pool);
+    }
+    for (int i = 0; i < pl->n_stages; ++i) {
+        pl_stage_t *st = &pl->stages[i];
+        if (st->state != NULL && st->ops->close != NULL) {
+            st->ops->close(st);
+        }
+    }
+    if (pl->arena.n_late > 0) {
+        printf("Pipeline: %llu allocations while running\n", (unsigned long long)pl->arena.n_late);
+    }
+    arena_free(&pl->arena);
+    free(pl);
+}
@@ -0,0 +1,167 @@
+/*
+ *  Title: Pipeline
+ *  Description: DSP graph of the reader, the built-in one (PL_DEFAULT_GRAPH) or one read from a
+ *               config file (-c), so processing can be changed without recompiling. Each line defines
+ *               one stage and the signal it produces:
+ *
+ *                   ir_s   = ema ir alpha=0.1
+ *                   hr     = beats ir threshold=5
+ *                   spo2   = spo2 red ir window=4
+ *                   sinks  = vitals hr spo2
+ *                   out    = csv ir ir_s file=../Export/pipeline.csv
+ *
+ *               The sources red and ir are the resampled samples, nan where one is missing; the stages
+ *               skip those. Stages are connected by typed ring buffers: a signal carries one value per
+ *               sample, an event one value when something was detected (a beat with its heart rate, an
+ *               SpO2 window, a spectral peak). Each stage type takes inputs of one type, checked when
+ *               the file is loaded; the stage types and their parameters are listed in
+ *               pipeline_stages.c and by pl_print_stages(). The vitals stage hands its events to the
+ *               output function of the graph, with which the dsp sink attaches them to the samples of
+ *               the other sinks (sink.h).
+ *
+ *               Samples are pushed one by one and the graph runs once per batch of samples. Stages run in
+ *               order of their depth in the graph; "threads N" in the file runs the stages of one depth
+ *               on N threads of the work-stealing scheduler, see work_steal.h. The time spent per stage
+ *               is measured and reported on close. Rings and stage states come from an arena when the
+ *               file is loaded (arena.h), running the graph does not allocate.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "work_steal.h"
+
+#define PL_NAME 32
+#define PL_RING 4096                 // values per ring, a power of two
+#define PL_BLOCK 1024                // samples pushed before the graph runs at the latest
+#define PL_MAX_STAGES 32
+#define PL_MAX_INPUTS 4
+#define PL_MAX_PARAMS 8
+#define PL_MAX_THREADS 8
+
+typedef enum {
+    PL_SIGNAL = 0,                   // one value per sample
+    PL_EVENT                         // one value per detection
+} pl_type_t;
+
+typedef struct {
+    double t;                        // sample time in s
+    float  v;
+} pl_value_t;
+
+typedef struct {
+    char       name[PL_NAME];
+    pl_type_t  type;
+    uint64_t   written;              // values written so far, value n is at n % PL_RING
+    pl_value_t data[PL_RING];
+} pl_ring_t;
+
+typedef struct {
+    char key[PL_NAME];
+    char value[256];
+} pl_param_t;
+
+typedef struct pl_stage pl_stage_t;
+
+// Outputs of the vitals stage
+typedef enum {
+    PL_OUT_HR = 0,                   // heart rate in bpm, at the time of the beat
+    PL_OUT_SPO2                      // SpO2 in %, at the end of its window
+} pl_output_t;
+
+typedef void (*pl_output_fn)(void *ctx, pl_output_t output, double t, float v);
+
+typedef struct {
+    const char        *type;
+    const char        *help;         // inputs, output and parameters
+    int                min_inputs;
+    int                max_inputs;
+    pl_type_t          input_type;
+    int                has_output;   // sinks have none
+    pl_type_t          output_type;
+    size_t             state_size;   // zeroed state from the arena of the pipeline for every stage
+    const char *const *keys;         // parameters accepted, NULL terminated
+    int  (*init)(pl_stage_t *st, float sample_rate);  // returns -1 with the reason printed
+    void (*run)(pl_stage_t *st);     // consume every new input value
+    void (*close)(pl_stage_t *st);   // may be NULL
+} pl_stage_ops_t;
+
+struct pl_stage {
+    const pl_stage_ops_t *ops;
+    char        name[PL_NAME];
+    pl_ring_t  *in[PL_MAX_INPUTS];
+    uint64_t    read[PL_MAX_INPUTS]; // values of each input consumed
+    int         n_in;
+    pl_ring_t  *out;                 // NULL for sinks
+    pl_param_t  params[PL_MAX_PARAMS];
+    int         n_params;
+    void       *state;
+    int         depth;               // 1 + the deepest stage it reads from, sources are 0
+    int         line;                // of its definition in the file
+    pl_output_fn output;             // of the graph, NULL until pl_set_output()
+    void        *output_ctx;
+
+    // Timing
+    uint64_t    runs;
+    uint64_t    n_values;            // input values consumed
+    uint64_t    ns_total;
+    uint64_t    ns_max;
+};
+
+typedef struct {
+    pl_ring_t  *rings[PL_MAX_STAGES + 2];  // red, ir and one per stage with an output
+    int         n_rings;
+    pl_stage_t  stages[PL_MAX_STAGES];     // sorted by depth
+    int         n_stages;
+    int         max_depth;
+    uint64_t    n_pending;                 // samples pushed since the last run
+    arena_t     arena;                     // rings and stage states, sealed once loaded
+    ws_pool_t  *pool;                      // NULL without "threads"
+} pipeline_t;
+
+// Processing of the reader without -c: heart rate and SpO2 with the defaults of ppg_dsp.h
+#define PL_DEFAULT_GRAPH \
+    "hr    = beats ir\n" \
+    "spo2  = spo2 red ir window=4\n" \
+    "sinks = vitals hr spo2\n"
+
+// Read the graph from path. Returns NULL with the line at fault printed.
+pipeline_t *pl_load(const char *path, float sample_rate);
+
+// The same from the text of a graph, name stands for the path in messages
+pipeline_t *pl_load_text(const char *text, const char *name, float sample_rate);
+
+// Where the vitals stages hand their events, called on the thread running the graph
+void pl_set_output(pipeline_t *pl, pl_output_fn output, void *ctx);
+
+// Add one received sample, running the graph if PL_BLOCK samples are waiting
+void pl_push(pipeline_t *pl, double t, float red, float ir);
+
+// Run every stage over the samples pushed since the last run
+void pl_run(pipeline_t *pl);
+
+// Run the remaining samples, report the time per stage (report may be NULL), close the stages and
+// free the graph
+void pl_close(pipeline_t *pl, FILE *report);
+
+// For the stage implementations (pipeline_stages.c)
+const pl_stage_ops_t *pl_find_stage(const char *type);
+void pl_print_stages(FILE *f);
+double pl_param(const pl_stage_t *st, const char *key, double fallback);
+const char *pl_param_str(const pl_stage_t *st, const char *key, const char *fallback);
+void pl_write(pl_ring_t *ring, double t, float v);
+
+// Values of input i not consumed yet, and the n-th of them
+static inline uint64_t pl_available(const pl_stage_t *st, int i) {
+    return st->in[i]->written - st->read[i];
+}
+
+static inline const pl_value_t *pl_input(const pl_stage_t *st, int i, uint64_t n) {
+    return &st->in[i]->data[(st->read[i] + n) & (PL_RING - 1)];
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,407 @@
+/*
+ *  Title: Pipeline Stages
+ *  Description: The stage types of the pipeline config file, see pipeline.h. The filters and
+ *               detectors wrap the streaming functions of ppg_dsp.h, so a graph computes what the
+ *               tools computing with those do.
+ *
+ *                   filters    ema, baseline, moving_average, gain    signal -> signal
+ *                   detectors  beats                                  IR -> event (bpm per beat)
+ *                              spo2                                   red, ir -> event (% per window)
+ *                              spectrum                               signal -> event (bpm per column)
+ *                   sinks      vitals                                 events -> the sinks of the reader
+ *                              csv                                    signals -> file
+ *                              print                                  events -> stdout
+ *
+ *               Missing samples (nan) give nan in the filters and are skipped by the detectors.
+ */
+
+#include "pipeline.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppg_dsp.h"
+
+#define MA_MAX 256                   // Longest moving average
+
+// ------------------------------------------------------------------ Filters
+
+typedef struct {
+    float alpha;
+    float k;                         // gain: y = k * x + offset
+    float offset;
+    int   started;
+    float y;
+} filter_t;
+
+static int ema_init(pl_stage_t *st, float sample_rate) {
+    (void)sample_rate;
+    filter_t *f = st->state;
+    f->alpha = (float)pl_param(st, "alpha", 0.2);
+    if (f->alpha <= 0.0f || f->alpha > 1.0f) {
+        printf("%s: alpha must be in (0, 1]\n", st->name);
+        return -1;
+    }
+    return 0;
+}
+
+// The smoothing of ppg_dsp_process, started at the first value
+static float ema_step(filter_t *f, float x) {
+    if (!f->started) {
+        f->y = x;
+        f->started = 1;
+    }
+    f->y = ppg_ema(f->y, f->alpha, x);
+    return f->y;
+}
+
+static void ema_run(pl_stage_t *st) {
+    filter_t *f = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        pl_write(st->out, x->t, isnan(x->v) ? NAN : ema_step(f, x->v));
+    }
+    st->read[0] += n;
+}
+
+// The input minus its slow moving average: removes the DC level and drift
+static void baseline_run(pl_stage_t *st) {
+    filter_t *f = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        pl_write(st->out, x->t, isnan(x->v) ? NAN : x->v - ema_step(f, x->v));
+    }
+    st->read[0] += n;
+}
+
+static int baseline_init(pl_stage_t *st, float sample_rate) {
+    if (pl_param_str(st, "alpha", NULL) == NULL) {
+        ((filter_t *)st->state)->alpha = 0.01f;
+        return 0;
+    }
+    return ema_init(st, sample_rate);
+}
+
+typedef struct {
+    int    n;
+    int    filled;
+    int    pos;
+    double sum;
+    float  window[MA_MAX];
+} moving_average_t;
+
+static int moving_average_init(pl_stage_t *st, float sample_rate) {
+    (void)sample_rate;
+    moving_average_t *m = st->state;
+    m->n = (int)pl_param(st, "n", 5);
+    if (m->n < 1 || m->n > MA_MAX) {
+        printf("%s: n must be 1 to %d\n", st->name, MA_MAX);
+        return -1;
+    }
+    return 0;
+}
+
+static void moving_average_run(pl_stage_t *st) {
+    moving_average_t *m = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        if (isnan(x->v)) {
+            pl_write(st->out, x->t, NAN);
+            continue;
+        }
+        if (m->filled == m->n) {
+            m->sum -= m->window[m->pos];
+        } else {
+            m->filled++;
+        }
+        m->window[m->pos] = x->v;
+        m->sum += x->v;
+        m->pos = (m->pos + 1) % m->n;
+        pl_write(st->out, x->t, (float)(m->sum / m->filled));
+    }
+    st->read[0] += n;
+}
+
+static int gain_init(pl_stage_t *st, float sample_rate) {
+    (void)sample_rate;
+    filter_t *f = st->state;
+    f->k = (float)pl_param(st, "k", 1.0);
+    f->offset = (float)pl_param(st, "offset", 0.0);
+    return 0;
+}
+
+static void gain_run(pl_stage_t *st) {
+    filter_t *f = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        pl_write(st->out, x->t, f->k * x->v + f->offset);
+    }
+    st->read[0] += n;
+}
+
+// ------------------------------------------------------------------ Detectors
+
+// ppg_dsp_process on the raw IR signal: smoothing, baseline and threshold crossings with a refractory
+// time. Every accepted beat gives the smoothed heart rate.
+static int beats_init(pl_stage_t *st, float sample_rate) {
+    ppg_dsp_t *dsp = st->state;
+    ppg_dsp_init(dsp, sample_rate);
+    dsp->alpha_filt = (float)pl_param(st, "alpha_filt", dsp->alpha_filt);
+    dsp->alpha_base = (float)pl_param(st, "alpha_base", dsp->alpha_base);
+    dsp->peak_thr = (float)pl_param(st, "threshold", dsp->peak_thr);
+    dsp->refractory_s = (float)pl_param(st, "refractory", dsp->refractory_s);
+    dsp->min_hr_bpm = (float)pl_param(st, "min_bpm", dsp->min_hr_bpm);
+    dsp->max_hr_bpm = (float)pl_param(st, "max_bpm", dsp->max_hr_bpm);
+    dsp->alpha_hr = (float)pl_param(st, "alpha_hr", dsp->alpha_hr);
+    if (dsp->alpha_filt <= 0.0f || dsp->alpha_filt > 1.0f || dsp->alpha_base <= 0.0f || dsp->alpha_base > 1.0f) {
+        printf("%s: alpha_filt and alpha_base must be in (0, 1]\n", st->name);
+        return -1;
+    }
+    return 0;
+}
+
+static void beats_run(pl_stage_t *st) {
+    ppg_dsp_t *dsp = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        float filtered;
+        if (!isnan(x->v) && ppg_dsp_process(dsp, 0.0f, x->v, x->t, &filtered)) {
+            pl_write(st->out, dsp->last_peak_t, dsp->hr_bpm_filt);
+        }
+    }
+    st->read[0] += n;
+}
+
+typedef struct {
+    ppg_spo2_t spo2;
+    long       window;               // samples per window
+    long       n;
+} spo2_stage_t;
+
+static int spo2_init(pl_stage_t *st, float sample_rate) {
+    spo2_stage_t *s = st->state;
+    ppg_spo2_init(&s->spo2);
+    s->spo2.min_pi = (float)pl_param(st, "min_pi", s->spo2.min_pi);
+    s->window = lround(pl_param(st, "window", 4.0) * sample_rate);
+    if (s->window < 2) {
+        printf("%s: window too short\n", st->name);
+        return -1;
+    }
+    return 0;
+}
+
+static void spo2_run(pl_stage_t *st) {
+    spo2_stage_t *s = st->state;
+    uint64_t n = pl_available(st, 0) < pl_available(st, 1) ? pl_available(st, 0) : pl_available(st, 1);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *red = pl_input(st, 0, i), *ir = pl_input(st, 1, i);
+        ppg_spo2_add_block(&s->spo2, &red->v, &ir->v, 1);  // windows are counted in samples on the grid
+        float spo2, perfusion;
+        if (++s->n == s->window) {
+            if (ppg_spo2_window(&s->spo2, &spo2, &perfusion)) {
+                pl_write(st->out, ir->t, spo2);
+            }
+            s->n = 0;
+        }
+    }
+    st->read[0] += n;
+    st->read[1] += n;
+}
+
+// Dominant frequency of each spectrogram column in a band, refined by a parabola through the dB values.
+// Missing samples repeat the last value, as in the spectrogram sink, so the columns keep their hop.
+typedef struct {
+    ppg_stft_t stft;
+    float      last;                 // nan before the first value
+    int        bin_from;
+    int        bin_to;
+    float      hz_per_bin;
+} spectrum_t;
+
+static int spectrum_init(pl_stage_t *st, float sample_rate) {
+    spectrum_t *s = st->state;
+    if (ppg_stft_init(&s->stft, (int)pl_param(st, "n_fft", 512), (int)pl_param(st, "hop", 50)) != 0) {
+        printf("%s: n_fft must be a power of two up to %d, hop positive\n", st->name, PPG_STFT_MAX_FFT);
+        return -1;
+    }
+    s->last = NAN;
+    s->hz_per_bin = sample_rate / (float)s->stft.n_fft;
+    s->bin_from = (int)ceil(pl_param(st, "min_bpm", 36.0) / 60.0 / s->hz_per_bin);
+    s->bin_to = (int)floor(pl_param(st, "max_bpm", 210.0) / 60.0 / s->hz_per_bin);
+    if (s->bin_from < 1) {
+        s->bin_from = 1;
+    }
+    if (s->bin_to > s->stft.n_bins - 2) {
+        s->bin_to = s->stft.n_bins - 2;
+    }
+    if (s->bin_from > s->bin_to) {
+        printf("%s: min_bpm to max_bpm covers no bin\n", st->name);
+        return -1;
+    }
+    return 0;
+}
+
+static void spectrum_run(pl_stage_t *st) {
+    spectrum_t *s = st->state;
+    uint64_t n = pl_available(st, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        const pl_value_t *x = pl_input(st, 0, i);
+        if (!isnan(x->v)) {
+            s->last = x->v;
+        }
+        if (isnan(s->last) || !ppg_stft_add(&s->stft, s->last)) {
+            continue;
+        }
+        const float *p = s->stft.power_db;
+        int k = s->bin_from;
+        for (int j = s->bin_from + 1; j <= s->bin_to; ++j) {
+            if (p[j] > p[k]) {
+                k = j;
+            }
+        }
+        float a = p[k - 1], b = p[k], c = p[k + 1], shift = 0.0f;
+        if (a - 2.0f * b + c < 0.0f) {
+            shift = 0.5f * (a - c) / (a - 2.0f * b + c);
+        }
+        pl_write(st->out, x->t, 60.0f * (k + shift) * s->hz_per_bin);
+    }
+    st->read[0] += n;
+}
+
+// ------------------------------------------------------------------ Sinks
+
+static int vitals_init(pl_stage_t *st, float sample_rate) {
+    (void)st;
+    (void)sample_rate;
+    return 0;
+}
+
+// Heart rate per beat from the first input, SpO2 per window from the second
+static void vitals_run(pl_stage_t *st) {
+    for (int i = 0; i < st->n_in; ++i) {
+        uint64_t n = pl_available(st, i);
+        for (uint64_t j = 0; j < n && st->output != NULL; ++j) {
+            const pl_value_t *x = pl_input(st, i, j);
+            st->output(st->output_ctx, i == 0 ? PL_OUT_HR : PL_OUT_SPO2, x->t, x->v);
+        }
+        st->read[i] += n;
+    }
+}
+
+static int csv_init(pl_stage_t *st, float sample_rate) {
+    (void)sample_rate;
+    const char *path = pl_param_str(st, "file", NULL);
+    if (path == NULL) {
+        printf("%s: csv needs file=path\n", st->name);
+        return -1;
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror("Unable to open pipeline CSV file");
+        return -1;
+    }
+    fprintf(f, "t");
+    for (int i = 0; i < st->n_in; ++i) {
+        fprintf(f, ",%s", st->in[i]->name);
+    }
+    fprintf(f, "\n");
+    *(FILE **)st->state = f;
+    return 0;
+}
+
+// One row per sample, the signals of one sample side by side
+static void csv_run(pl_stage_t *st) {
+    FILE *f = *(FILE **)st->state;
+    uint64_t n = pl_available(st, 0);
+    for (int i = 1; i < st->n_in; ++i) {
+        if (pl_available(st, i) < n) {
+            n = pl_available(st, i);
+        }
+    }
+    for (uint64_t j = 0; j < n; ++j) {
+        fprintf(f, "%.3f", pl_input(st, 0, j)->t);
+        for (int i = 0; i < st->n_in; ++i) {
+            fprintf(f, ",%.6g", pl_input(st, i, j)->v);
+        }
+        fputc('\n', f);
+    }
+    for (int i = 0; i < st->n_in; ++i) {
+        st->read[i] += n;
+    }
+    fflush(f);
+}
+
+static void csv_close(pl_stage_t *st) {
+    fclose(*(FILE **)st->state);
+}
+
+static int print_init(pl_stage_t *st, float sample_rate) {
+    (void)st;
+    (void)sample_rate;
+    return 0;
+}
+
+static void print_run(pl_stage_t *st) {
+    for (int i = 0; i < st->n_in; ++i) {
+        uint64_t n = pl_available(st, i);
+        for (uint64_t j = 0; j < n; ++j) {
+            printf("%s ≈ %.1f\n", st->in[i]->name, pl_input(st, i, j)->v);
+        }
+        st->read[i] += n;
+    }
+}
+
+// ------------------------------------------------------------------ Registry
+
+static const char *const filter_keys[] = { "alpha", NULL };
+static const char *const ma_keys[] = { "n", NULL };
+static const char *const gain_keys[] = { "k", "offset", NULL };
+static const char *const beats_keys[] = { "alpha_filt", "alpha_base", "threshold", "refractory", "min_bpm",
+                                          "max_bpm", "alpha_hr", NULL };
+static const char *const spo2_keys[] = { "window", "min_pi", NULL };
+static const char *const spectrum_keys[] = { "n_fft", "hop", "min_bpm", "max_bpm", NULL };
+static const char *const csv_keys[] = { "file", NULL };
+
+static const pl_stage_ops_t stages[] = {
+    { "ema", "signal -> signal, alpha=0.2", 1, 1, PL_SIGNAL, 1, PL_SIGNAL, sizeof(filter_t),
+      filter_keys, ema_init, ema_run, NULL },
+    { "baseline", "signal -> signal minus its slow average, alpha=0.01", 1, 1, PL_SIGNAL, 1, PL_SIGNAL,
+      sizeof(filter_t), filter_keys, baseline_init, baseline_run, NULL },
+    { "moving_average", "signal -> signal, n=5", 1, 1, PL_SIGNAL, 1, PL_SIGNAL, sizeof(moving_average_t),
+      ma_keys, moving_average_init, moving_average_run, NULL },
+    { "gain", "signal -> k * signal + offset, k=1 offset=0", 1, 1, PL_SIGNAL, 1, PL_SIGNAL, sizeof(filter_t),
+      gain_keys, gain_init, gain_run, NULL },
+    { "beats", "IR -> bpm per beat (ppg_dsp_process), alpha_filt=0.2 alpha_base=0.01 threshold=10 refractory=0.3 "
+      "min_bpm=40 max_bpm=200 alpha_hr=0.3", 1, 1, PL_SIGNAL, 1, PL_EVENT, sizeof(ppg_dsp_t), beats_keys,
+      beats_init, beats_run, NULL },
+    { "spo2", "red ir -> SpO2 in % per window, window=4 min_pi=0.02", 2, 2, PL_SIGNAL, 1, PL_EVENT,
+      sizeof(spo2_stage_t), spo2_keys, spo2_init, spo2_run, NULL },
+    { "spectrum", "signal -> bpm of the spectral peak per column, n_fft=512 hop=50 min_bpm=36 max_bpm=210",
+      1, 1, PL_SIGNAL, 1, PL_EVENT, sizeof(spectrum_t), spectrum_keys, spectrum_init, spectrum_run, NULL },
+    { "vitals", "hr [spo2] events -> heart rate, beats and SpO2 of the samples of the sinks", 1, 2, PL_EVENT, 0,
+      PL_EVENT, 0, NULL, vitals_init, vitals_run, NULL },
+    { "csv", "signals -> file=path, one row per sample", 1, PL_MAX_INPUTS, PL_SIGNAL, 0, PL_SIGNAL,
+      sizeof(FILE *), csv_keys, csv_init, csv_run, csv_close },
+    { "print", "events -> stdout", 1, PL_MAX_INPUTS, PL_EVENT, 0, PL_EVENT, 0, NULL, print_init, print_run, NULL },
+};
+
+const pl_stage_ops_t *pl_find_stage(const char *type) {
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+        if (strcmp(stages[i].type, type) == 0) {
+            return &stages[i];
+        }
+    }
+    return NULL;
+}
+
+void pl_print_stages(FILE *f) {
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+        fprintf(f, "  %-16s %s\n", stages[i].type, stages[i].help);
+    }
+}
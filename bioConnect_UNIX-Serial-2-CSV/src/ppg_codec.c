@@ -0,0 +1,230 @@
+/*
+ *  Title: PPG Codec
+ *  Description: Delta / delta-of-delta + zig-zag + bit-packing block codec, see ppg_codec.h.
+ */
+
+#include "ppg_codec.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+static int use_simd = 1;
+
+int pc_set_simd(int enabled) {
+    use_simd = enabled;
+    return 1;
+}
+#else
+int pc_set_simd(int enabled) {
+    (void)enabled;
+    return 0;
+}
+#endif
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int bit_width(uint32_t v) {
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static inline void store32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    return (uint64_t)load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+size_t pc_encode_block(const int32_t *in, int n, uint8_t *out) {
+    uint32_t res_delta[PC_BLOCK_SIZE];
+    uint32_t res_dod[PC_BLOCK_SIZE];
+    uint32_t or_delta = 0, or_dod = 0;
+
+    // Residuals of both predictors, wrapping arithmetic keeps the codec lossless for any int32
+    int32_t first_delta = (n > 1) ? (int32_t)((uint32_t)in[1] - (uint32_t)in[0]) : 0;
+    for (int i = 0; i + 1 < n; ++i) {
+        int32_t d = (int32_t)((uint32_t)in[i + 1] - (uint32_t)in[i]);
+        res_delta[i] = zigzag(d);
+        or_delta |= res_delta[i];
+        if (i > 0) {
+            int32_t prev = (int32_t)((uint32_t)in[i] - (uint32_t)in[i - 1]);
+            res_dod[i - 1] = zigzag((int32_t)((uint32_t)d - (uint32_t)prev));
+            or_dod |= res_dod[i - 1];
+        }
+    }
+
+    int w_delta = bit_width(or_delta);
+    int w_dod = bit_width(or_dod);
+    int n_delta = (n > 1) ? n - 1 : 0;
+    int n_dod = (n > 2) ? n - 2 : 0;
+
+    // Pick the predictor with the smaller output (delta of delta costs 4 extra header bytes)
+    int use_dod = n > 2 && (4 * 8 + n_dod * w_dod) < (n_delta * w_delta);
+    const uint32_t *res = use_dod ? res_dod : res_delta;
+    int n_res = use_dod ? n_dod : n_delta;
+    int w = use_dod ? w_dod : w_delta;
+
+    uint8_t *p = out;
+    *p++ = use_dod ? PC_MODE_DOD : PC_MODE_DELTA;
+    *p++ = (uint8_t)w;
+    store32(p, (uint32_t)in[0]);
+    p += 4;
+    if (use_dod) {
+        store32(p, (uint32_t)first_delta);
+        p += 4;
+    }
+
+    // Bit-pack LSB first through a 64-bit accumulator
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    for (int i = 0; i < n_res; ++i) {
+        acc |= (uint64_t)res[i] << acc_bits;
+        acc_bits += w;
+        while (acc_bits >= 8) {
+            *p++ = (uint8_t)acc;
+            acc >>= 8;
+            acc_bits -= 8;
+        }
+    }
+    if (acc_bits > 0) {
+        *p++ = (uint8_t)acc;
+    }
+    return (size_t)(p - out);
+}
+
+// Unpack n codes of w bits. src must be readable 8 bytes past the last code.
+static void unpack(const uint8_t *src, int w, int n, uint32_t *codes) {
+    if (w == 0) {
+        memset(codes, 0, (size_t)n * sizeof(uint32_t));
+        return;
+    }
+    uint64_t mask = (w == 32) ? 0xFFFFFFFFu : ((1u << w) - 1);
+    size_t bitpos = 0;
+    for (int i = 0; i < n; ++i) {
+        codes[i] = (uint32_t)((load64(src + (bitpos >> 3)) >> (bitpos & 7)) & mask);
+        bitpos += (size_t)w;
+    }
+}
+
+// out[i] = carry + sum(unzigzag(codes[0..i]))
+static void unzigzag_prefix_sum(const uint32_t *codes, int n, int32_t carry, int32_t *out) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i c = _mm_set1_epi32(carry);
+    const __m128i one = _mm_set1_epi32(1);
+    for (; use_simd && i + 4 <= n; i += 4) {
+        __m128i z = _mm_loadu_si128((const __m128i *)(codes + i));
+        __m128i v = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, one)));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, c);
+        _mm_storeu_si128((__m128i *)(out + i), v);
+        c = _mm_shuffle_epi32(v, 0xFF);
+    }
+    carry = _mm_cvtsi128_si32(c);
+#elif defined(__ARM_NEON)
+    int32x4_t c = vdupq_n_s32(carry);
+    const int32x4_t zero = vdupq_n_s32(0);
+    for (; use_simd && i + 4 <= n; i += 4) {
+        uint32x4_t z = vld1q_u32(codes + i);
+        int32x4_t v = veorq_s32(vreinterpretq_s32_u32(vshrq_n_u32(z, 1)),
+                                vnegq_s32(vreinterpretq_s32_u32(vandq_u32(z, vdupq_n_u32(1)))));
+        v = vaddq_s32(v, vextq_s32(zero, v, 3));
+        v = vaddq_s32(v, vextq_s32(zero, v, 2));
+        v = vaddq_s32(v, c);
+        vst1q_s32(out + i, v);
+        c = vdupq_n_s32(vgetq_lane_s32(v, 3));
+    }
+    carry = vgetq_lane_s32(c, 0);
+#endif
+    for (; i < n; ++i) {
+        int32_t d = (int32_t)((codes[i] >> 1) ^ (0u - (codes[i] & 1u)));
+        carry = (int32_t)((uint32_t)carry + (uint32_t)d);
+        out[i] = carry;
+    }
+}
+
+// out[i] = carry + sum(in[0..i]), the second pass of delta-of-delta decoding
+static void prefix_sum(const int32_t *in, int n, int32_t carry, int32_t *out) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i c = _mm_set1_epi32(carry);
+    for (; use_simd && i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, c);
+        _mm_storeu_si128((__m128i *)(out + i), v);
+        c = _mm_shuffle_epi32(v, 0xFF);
+    }
+    carry = _mm_cvtsi128_si32(c);
+#elif defined(__ARM_NEON)
+    int32x4_t c = vdupq_n_s32(carry);
+    const int32x4_t zero = vdupq_n_s32(0);
+    for (; use_simd && i + 4 <= n; i += 4) {
+        int32x4_t v = vld1q_s32(in + i);
+        v = vaddq_s32(v, vextq_s32(zero, v, 3));
+        v = vaddq_s32(v, vextq_s32(zero, v, 2));
+        v = vaddq_s32(v, c);
+        vst1q_s32(out + i, v);
+        c = vdupq_n_s32(vgetq_lane_s32(v, 3));
+    }
+    carry = vgetq_lane_s32(c, 0);
+#endif
+    for (; i < n; ++i) {
+        carry = (int32_t)((uint32_t)carry + (uint32_t)in[i]);
+        out[i] = carry;
+    }
+}
+
+size_t pc_decode_block(const uint8_t *in, size_t len, int n, int32_t *out) {
+    uint8_t padded[PC_BLOCK_SIZE * 4 + 8];
+    uint32_t codes[PC_BLOCK_SIZE];
+    int32_t deltas[PC_BLOCK_SIZE];
+
+    if (n < 1 || n > PC_BLOCK_SIZE || len < 6) {
+        return 0;
+    }
+    int mode = in[0];
+    int w = in[1];
+    int header = (mode == PC_MODE_DOD) ? 10 : 6;
+    int n_res = (mode == PC_MODE_DOD) ? n - 2 : n - 1;
+    if (w > 32 || (mode != PC_MODE_DELTA && mode != PC_MODE_DOD) || n_res < 0 || len < (size_t)header) {
+        return 0;
+    }
+    size_t payload = ((size_t)n_res * (size_t)w + 7) / 8;
+    if (len < header + payload) {
+        return 0;
+    }
+
+    out[0] = (int32_t)load32(in + 2);
+
+    // Zero padded copy so the 64-bit loads of the unpacker never read past the block
+    memcpy(padded, in + header, payload);
+    memset(padded + payload, 0, 8);
+    unpack(padded, w, n_res, codes);
+
+    if (mode == PC_MODE_DELTA) {
+        unzigzag_prefix_sum(codes, n_res, out[0], out + 1);
+    } else {
+        deltas[0] = (int32_t)load32(in + 6);
+        unzigzag_prefix_sum(codes, n_res, deltas[0], deltas + 1);
+        prefix_sum(deltas, n - 1, out[0], out + 1);
+    }
+    return header + payload;
+}
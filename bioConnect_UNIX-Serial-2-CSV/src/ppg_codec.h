@@ -0,0 +1,42 @@
+/*
+ *  Title: PPG Codec
+ *  Description: Lossless block codec for slowly changing ADC samples. A block of up to PC_BLOCK_SIZE
+ *               values is stored as its first value followed by the deltas (or deltas of deltas,
+ *               whichever needs fewer bits), zig-zag encoded and bit-packed with one common width:
+ *
+ *                   byte 0      mode (PC_MODE_DELTA or PC_MODE_DOD)
+ *                   byte 1      bit width w of the packed residuals (0..32)
+ *                   bytes 2-5   first value (int32, little endian)
+ *                   bytes 6-9   first delta (PC_MODE_DOD only)
+ *                   ...         residuals, w bits each, LSB first, padded to a full byte
+ *
+ *               A 12-bit PPG signal sampled at 100 Hz typically needs 4-6 bits per sample instead
+ *               of the 5-6 bytes of a CSV line. Decoding unpacks with 64-bit loads and undoes the
+ *               zig-zag and prefix sums with SSE2 or NEON where available.
+ */
+
+#ifndef PPG_CODEC_H
+#define PPG_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PC_BLOCK_SIZE 256
+#define PC_HEADER_MAX 10
+#define PC_BLOCK_MAX_BYTES (PC_HEADER_MAX + PC_BLOCK_SIZE * 4)  // worst case, 32 bit residuals
+
+#define PC_MODE_DELTA 0
+#define PC_MODE_DOD 1
+
+// Encode n (1..PC_BLOCK_SIZE) values into out (at least PC_BLOCK_MAX_BYTES). Returns the encoded size.
+size_t pc_encode_block(const int32_t *in, int n, uint8_t *out);
+
+// Use the SSE2/NEON paths of the decoder (the default), or the scalar code only, to compare them.
+// Returns 0 if the build has no SIMD path.
+int pc_set_simd(int enabled);
+
+// Decode a block of n values encoded with pc_encode_block(). Returns the number of bytes consumed,
+// 0 if the block is malformed or longer than len.
+size_t pc_decode_block(const uint8_t *in, size_t len, int n, int32_t *out);
+
+#endif // PPG_CODEC_H
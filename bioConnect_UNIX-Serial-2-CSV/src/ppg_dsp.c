@@ -0,0 +1,266 @@
+/*
+ *  Title: PPG DSP
+ *  Description: Streaming IR smoothing and heart-rate detection, see ppg_dsp.h.
+ */
+
+#include "ppg_dsp.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+void ppg_dsp_init(ppg_dsp_t *dsp, float fs) {
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->fs           = fs;
+    dsp->alpha_filt   = 0.2f;
+    dsp->alpha_base   = 0.01f;
+    dsp->peak_thr     = 10.0f;
+    dsp->min_hr_bpm   = 40.0f;
+    dsp->max_hr_bpm   = 200.0f;
+    dsp->refractory_s = 0.3f;
+    dsp->alpha_hr     = 0.3f;
+    dsp->last_peak_t  = -1.0;
+    dsp->prev_peak_t  = -1.0;
+}
+
+int ppg_dsp_process(ppg_dsp_t *dsp, float red_raw, float ir_raw, double t_s, float *proc_val) {
+    (void)red_raw;  // only IR is used for the heart rate for now
+    int beat = 0;
+
+    if (t_s < 0.0) {
+        t_s = (double)dsp->sample_idx / dsp->fs;  // in float the index would round after 2^24 samples
+    }
+
+    // 1) Simple filtering of IR to get a smoother PPG for peak detection
+    if (dsp->sample_idx == 0) {
+        dsp->ir_filt = ir_raw;
+        dsp->ir_base = ir_raw;
+    }
+    dsp->ir_filt = ppg_ema(dsp->ir_filt, dsp->alpha_filt, ir_raw);
+    dsp->ir_base = ppg_ema(dsp->ir_base, dsp->alpha_base, dsp->ir_filt);
+    float ir_ac = dsp->ir_filt - dsp->ir_base;
+
+    // 2) Heart-rate peak detection on filtered IR:
+    //    detect upward crossing of threshold with refractory time
+    if (dsp->prev_ir_ac < dsp->peak_thr && ir_ac >= dsp->peak_thr) {
+        if (dsp->last_peak_t < 0.0 || (t_s - dsp->last_peak_t) > dsp->refractory_s) {
+
+            dsp->prev_peak_t = dsp->last_peak_t;
+            dsp->last_peak_t = t_s;
+
+            if (dsp->prev_peak_t >= 0.0) {
+                float period_sec = (float)(dsp->last_peak_t - dsp->prev_peak_t);
+                float inst_hr    = 60.0f / period_sec;
+
+                // Accept only plausible HR values
+                if (inst_hr > dsp->min_hr_bpm && inst_hr < dsp->max_hr_bpm) {
+                    dsp->hr_bpm = inst_hr;
+                    if (dsp->hr_bpm_filt == 0.0f) {
+                        dsp->hr_bpm_filt = inst_hr;  // first beat, nothing to smooth yet
+                    }
+                    dsp->hr_bpm_filt = dsp->hr_bpm_filt + dsp->alpha_hr * (dsp->hr_bpm - dsp->hr_bpm_filt);
+                    beat = 1;
+                }
+            }
+        }
+    }
+    dsp->prev_ir_ac = ir_ac;
+
+    *proc_val = dsp->ir_filt;
+    dsp->sample_idx++;
+    return beat;
+}
+
+size_t ppg_dsp_process_block(ppg_dsp_t *dsp, const float *red, const float *ir, const double *t, size_t n,
+                             float *proc, float *hr_bpm, uint8_t *beat) {
+    size_t beats = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int b = 0;
+        if (isnan(ir[i])) {
+            proc[i] = NAN;
+        } else {
+            b = ppg_dsp_process(dsp, red ? red[i] : 0.0f, ir[i], t ? t[i] : -1.0, &proc[i]);
+            beats += (size_t)b;
+        }
+        if (hr_bpm != NULL) hr_bpm[i] = dsp->hr_bpm_filt;
+        if (beat != NULL) beat[i] = (uint8_t)b;
+    }
+    return beats;
+}
+
+void ppg_spo2_init(ppg_spo2_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->alpha_base = 0.01f;
+    s->min_pi     = 0.02f;
+}
+
+void ppg_spo2_add(ppg_spo2_t *s, float red_raw, float ir_raw) {
+    float x[2] = { red_raw, ir_raw };
+    for (int c = 0; c < 2; ++c) {
+        if (s->n_seen == 0) {
+            s->base[c] = x[c];
+        }
+        s->base[c] += s->alpha_base * (x[c] - s->base[c]);
+        double ac = x[c] - s->base[c];
+        s->sum_dc[c] += s->base[c];
+        s->sum_ac2[c] += ac * ac;
+    }
+    s->n_seen++;
+    s->n++;
+}
+
+void ppg_spo2_add_block(ppg_spo2_t *s, const float *red, const float *ir, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (!isnan(red[i]) && !isnan(ir[i])) {
+            ppg_spo2_add(s, red[i], ir[i]);
+        }
+    }
+}
+
+int ppg_spo2_window(ppg_spo2_t *s, float *spo2, float *perfusion) {
+    int ok = 0;
+    // The baseline needs about 1 / alpha_base samples to settle
+    if (s->n >= 2 && s->n_seen >= (long)(1.0f / s->alpha_base)) {
+        double dc_red = s->sum_dc[0] / s->n, dc_ir = s->sum_dc[1] / s->n;
+        double ac_red = sqrt(s->sum_ac2[0] / s->n), ac_ir = sqrt(s->sum_ac2[1] / s->n);
+        if (dc_red > 0 && dc_ir > 0 && ac_ir > 0) {
+            double pi = 100.0 * ac_ir / dc_ir;
+            double r = (ac_red / dc_red) / (ac_ir / dc_ir);
+            *perfusion = (float)pi;
+            *spo2 = (float)fmin(100.0, fmax(0.0, 110.0 - 25.0 * r));
+            ok = pi >= s->min_pi;
+        }
+    }
+    s->sum_dc[0] = s->sum_dc[1] = 0;
+    s->sum_ac2[0] = s->sum_ac2[1] = 0;
+    s->n = 0;
+    return ok;
+}
+
+int ppg_stft_init(ppg_stft_t *s, int n_fft, int hop) {
+    if (n_fft < 2 || n_fft > PPG_STFT_MAX_FFT || (n_fft & (n_fft - 1)) != 0 || hop < 1) {
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->n_fft = n_fft;
+    s->hop = hop;
+    s->n_bins = n_fft / 2 + 1;
+    for (int i = 0; i < n_fft; ++i) {
+        s->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / n_fft);
+        s->window_power += s->window[i] * s->window[i];
+    }
+    for (int i = 0; i < n_fft / 2; ++i) {
+        s->cos_tab[i] = cosf(2.0f * (float)M_PI * i / n_fft);
+        s->sin_tab[i] = -sinf(2.0f * (float)M_PI * i / n_fft);
+    }
+    return 0;
+}
+
+// In-place radix-2 FFT of re/im
+static void stft_fft(ppg_stft_t *s) {
+    int n = s->n_fft;
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float t = s->re[i]; s->re[i] = s->re[j]; s->re[j] = t;
+            t = s->im[i]; s->im[i] = s->im[j]; s->im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len >> 1, step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; ++k) {
+                float wr = s->cos_tab[k * step], wi = s->sin_tab[k * step];
+                int a = i + k, b = a + half;
+                float xr = s->re[b] * wr - s->im[b] * wi;
+                float xi = s->re[b] * wi + s->im[b] * wr;
+                s->re[b] = s->re[a] - xr;
+                s->im[b] = s->im[a] - xi;
+                s->re[a] += xr;
+                s->im[a] += xi;
+            }
+        }
+    }
+}
+
+int ppg_stft_add(ppg_stft_t *s, float x) {
+    int n = s->n_fft;
+    s->ring[s->n_seen % n] = x;
+    s->n_seen++;
+    if (++s->since_column < s->hop || s->n_seen < n) {
+        return 0;
+    }
+    s->since_column = 0;
+
+    // Oldest sample first: the ring position of the next write
+    int start = (int)(s->n_seen % n);
+    double mean = 0;
+    for (int i = 0; i < n; ++i) {
+        mean += s->ring[i];
+    }
+    mean /= n;
+    for (int i = 0; i < n; ++i) {
+        s->re[i] = (s->ring[(start + i) % n] - (float)mean) * s->window[i];
+        s->im[i] = 0.0f;
+    }
+    stft_fft(s);
+    for (int k = 0; k < s->n_bins; ++k) {
+        float p = (s->re[k] * s->re[k] + s->im[k] * s->im[k]) / s->window_power;
+        s->power_db[k] = 10.0f * log10f(p + 1e-12f);
+    }
+    return 1;
+}
+
+size_t ppg_stft_add_block(ppg_stft_t *s, const float *x, size_t n, float *columns, size_t max_columns) {
+    size_t n_columns = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (ppg_stft_add(s, x[i]) && n_columns < max_columns) {
+            memcpy(columns + n_columns * (size_t)s->n_bins, s->power_db, (size_t)s->n_bins * sizeof(float));
+            n_columns++;
+        }
+    }
+    return n_columns;
+}
+
+typedef struct {
+    const char *type;
+    const char *field;                       // NULL for the size of the type
+    size_t      value;
+} ppg_layout_t;
+
+#define PPG_SIZE(t) { #t, NULL, sizeof(t) }
+#define PPG_FIELD(t, f) { #t, #f, offsetof(t, f) }
+
+static const ppg_layout_t layout[] = {
+    PPG_SIZE(ppg_dsp_t),
+    PPG_FIELD(ppg_dsp_t, fs), PPG_FIELD(ppg_dsp_t, alpha_filt), PPG_FIELD(ppg_dsp_t, alpha_base),
+    PPG_FIELD(ppg_dsp_t, peak_thr), PPG_FIELD(ppg_dsp_t, min_hr_bpm), PPG_FIELD(ppg_dsp_t, max_hr_bpm),
+    PPG_FIELD(ppg_dsp_t, refractory_s), PPG_FIELD(ppg_dsp_t, alpha_hr), PPG_FIELD(ppg_dsp_t, sample_idx),
+    PPG_FIELD(ppg_dsp_t, ir_filt), PPG_FIELD(ppg_dsp_t, ir_base), PPG_FIELD(ppg_dsp_t, prev_ir_ac),
+    PPG_FIELD(ppg_dsp_t, last_peak_t), PPG_FIELD(ppg_dsp_t, prev_peak_t), PPG_FIELD(ppg_dsp_t, hr_bpm),
+    PPG_FIELD(ppg_dsp_t, hr_bpm_filt),
+    PPG_SIZE(ppg_spo2_t),
+    PPG_FIELD(ppg_spo2_t, alpha_base), PPG_FIELD(ppg_spo2_t, min_pi), PPG_FIELD(ppg_spo2_t, n_seen),
+    PPG_FIELD(ppg_spo2_t, base), PPG_FIELD(ppg_spo2_t, sum_dc), PPG_FIELD(ppg_spo2_t, sum_ac2),
+    PPG_FIELD(ppg_spo2_t, n),
+    PPG_SIZE(ppg_stft_t),
+    PPG_FIELD(ppg_stft_t, n_fft), PPG_FIELD(ppg_stft_t, hop), PPG_FIELD(ppg_stft_t, n_bins),
+    PPG_FIELD(ppg_stft_t, window), PPG_FIELD(ppg_stft_t, window_power), PPG_FIELD(ppg_stft_t, n_seen),
+    PPG_FIELD(ppg_stft_t, since_column), PPG_FIELD(ppg_stft_t, ring), PPG_FIELD(ppg_stft_t, power_db),
+    PPG_FIELD(ppg_stft_t, re), PPG_FIELD(ppg_stft_t, im), PPG_FIELD(ppg_stft_t, cos_tab),
+    PPG_FIELD(ppg_stft_t, sin_tab),
+};
+
+size_t ppg_layout(const char *type, const char *field) {
+    for (size_t i = 0; i < sizeof(layout) / sizeof(layout[0]); ++i) {
+        if (strcmp(layout[i].type, type) == 0
+                && (field == NULL ? layout[i].field == NULL : layout[i].field != NULL && strcmp(layout[i].field, field) == 0)) {
+            return layout[i].value;
+        }
+    }
+    return (size_t)-1;
+}
@@ -0,0 +1,124 @@
+/*
+ *  Title: PPG DSP
+ *  Description: Streaming PPG processing shared by the host tools: smoothing of the IR channel and
+ *               heart-rate estimation from threshold crossings with a refractory time. Same algorithm
+ *               as the processing section of the Windows reader, with the DC level of the IR signal
+ *               removed before the threshold and beat intervals measured on the sample timeline, so
+ *               a drifting device clock or lost samples do not skew the heart rate.
+ *
+ *               SpO2 is estimated per window with the ratio of ratios of the Red and IR channels,
+ *               R = (AC_red / DC_red) / (AC_ir / DC_ir), and the generic curve SpO2 = 110 - 25 R.
+ *               The sensor is not calibrated, so absolute values are indicative only.
+ *
+ *               The streaming STFT keeps the last n_fft samples in a ring and computes one spectrum
+ *               column every hop samples from the Hann-windowed frame, so overlapping frames share
+ *               the buffered samples and the cost is one n_fft point FFT per hop.
+ */
+
+#ifndef PPG_DSP_H
+#define PPG_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    // Parameters
+    float fs;                 // nominal sample rate in Hz (pairs per second)
+    float alpha_filt;         // 0<alpha<1; higher = less smoothing
+    float alpha_base;         // baseline tracker, much slower than alpha_filt
+    float peak_thr;           // threshold on the AC part of the filtered IR
+    float min_hr_bpm;
+    float max_hr_bpm;
+    float refractory_s;       // 300 ms refractory
+    float alpha_hr;           // smoothing of the reported heart rate
+
+    // State
+    long   sample_idx;        // counts IR samples (pairs)
+    float  ir_filt;
+    float  ir_base;
+    float  prev_ir_ac;
+    double last_peak_t;       // time of the last accepted crossing in s, < 0 if none yet
+    double prev_peak_t;
+    float  hr_bpm;
+    float  hr_bpm_filt;
+} ppg_dsp_t;
+
+void ppg_dsp_init(ppg_dsp_t *dsp, float fs);
+
+// One step of the exponential smoothing used for the filtered IR and its baseline: y moves by alpha
+// towards x. Shared with the ema and baseline stages of the pipeline.
+static inline float ppg_ema(float y, float alpha, float x) {
+    return y + alpha * (x - y);
+}
+
+// Process one Red/IR pair taken at time t_s (seconds on any monotonic timeline). Pass t_s < 0 to use
+// sample_idx / fs instead. The filtered IR value is stored to *proc_val.
+// Returns 1 if a beat was detected and hr_bpm_filt was updated.
+int ppg_dsp_process(ppg_dsp_t *dsp, float red_raw, float ir_raw, double t_s, float *proc_val);
+
+// Process n pairs at once (Python bindings). red and t may be NULL, as may hr_bpm (hr_bpm_filt after
+// each pair) and beat (1 where a beat was detected). Pairs with a nan IR value are skipped and give
+// nan in proc; pass t so the beat intervals stay right across them. Returns the number of beats.
+size_t ppg_dsp_process_block(ppg_dsp_t *dsp, const float *red, const float *ir, const double *t, size_t n,
+                             float *proc, float *hr_bpm, uint8_t *beat);
+
+typedef struct {
+    float  alpha_base;        // baseline (DC) tracker of both channels
+    float  min_pi;            // perfusion index in % below which there is no usable pulse
+
+    long   n_seen;
+    double base[2];           // Red, IR
+    double sum_dc[2];         // over the current window
+    double sum_ac2[2];
+    long   n;
+} ppg_spo2_t;
+
+void ppg_spo2_init(ppg_spo2_t *s);
+
+void ppg_spo2_add(ppg_spo2_t *s, float red_raw, float ir_raw);
+
+// Add n pairs, pairs with a nan value are skipped
+void ppg_spo2_add_block(ppg_spo2_t *s, const float *red, const float *ir, size_t n);
+
+// Close the current window: stores SpO2 in % and the IR perfusion index (AC/DC in %) of the samples
+// added since the last call. Returns 0 if the window had too few samples or no pulse.
+int ppg_spo2_window(ppg_spo2_t *s, float *spo2, float *perfusion);
+
+#define PPG_STFT_MAX_FFT 1024
+
+typedef struct {
+    int   n_fft;              // frame length, a power of two
+    int   hop;                // samples between two columns
+    int   n_bins;             // n_fft / 2 + 1, from 0 Hz to fs / 2
+    float window[PPG_STFT_MAX_FFT];
+    float window_power;       // sum of the squared window, normalises the power
+
+    long  n_seen;
+    int   since_column;
+    float ring[PPG_STFT_MAX_FFT];          // the last n_fft samples
+    float power_db[PPG_STFT_MAX_FFT / 2 + 1];  // latest column, power per bin in dB
+
+    // FFT work space and tables
+    float re[PPG_STFT_MAX_FFT];
+    float im[PPG_STFT_MAX_FFT];
+    float cos_tab[PPG_STFT_MAX_FFT / 2];
+    float sin_tab[PPG_STFT_MAX_FFT / 2];
+} ppg_stft_t;
+
+// Returns -1 if n_fft is not a power of two up to PPG_STFT_MAX_FFT or hop is not positive
+int ppg_stft_init(ppg_stft_t *s, int n_fft, int hop);
+
+// Add one sample. Returns 1 if a new column is in power_db; it covers the last n_fft samples.
+// The mean of the frame is removed first, so the DC level does not leak into the low bins.
+int ppg_stft_add(ppg_stft_t *s, float x);
+
+// Add n samples and copy every new column (n_bins values) to columns, at most max_columns of them;
+// n / hop + 1 is always enough. Returns the number of columns copied.
+size_t ppg_stft_add_block(ppg_stft_t *s, const float *x, size_t n, float *columns, size_t max_columns);
+
+// Layout of the structs above for bindings that declare them again (bcdsp.py): the size of type
+// ("ppg_dsp_t", "ppg_spo2_t" or "ppg_stft_t") with field NULL, else the offset of the field.
+// Returns (size_t)-1 for an unknown type or field.
+size_t ppg_layout(const char *type, const char *field);
+
+#endif // PPG_DSP_H
@@ -0,0 +1,200 @@
+/*
+ *  Title: Real-Time
+ *  Description: Scheduling, pinning and memory locking of the read loop, see realtime.h.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE  // sched_setaffinity(), CPU_SET(), RUSAGE_THREAD
+#endif
+
+#include "realtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/serial.h>  // struct serial_icounter_struct
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>        // mallopt()
+#endif
+
+int rt_parse_cpus(const char *list, rt_options_t *o) {
+    o->n_cpus = 0;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+        }
+        for (long c = first; c <= last; ++c) {
+            if (o->n_cpus == RT_MAX_CPUS) {
+                return -1;
+            }
+            o->cpus[o->n_cpus++] = (int)c;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    return o->n_cpus > 0 ? 0 : -1;
+}
+
+// Restrict the calling thread to the n CPUs in cpus
+static int pin(const int *cpus, int n) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < n; ++i) {
+        if (cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Unable to pin to the CPUs (-C)");
+        return -1;
+    }
+    return 0;
+#else
+    (void)cpus;
+    (void)n;
+    printf("CPU pinning (-C) is not supported on this system\n");
+    return -1;
+#endif
+}
+
+void rt_setup_threads(const rt_options_t *o) {
+    if (o->n_cpus > 1) {
+        pin(o->cpus + 1, o->n_cpus - 1);
+    } else if (o->n_cpus == 1) {
+        pin(o->cpus, 1);  // a single CPU is shared by the loop and the threads
+    }
+}
+
+// Touch a stack frame of RT_STACK_PREFAULT bytes so the loop never grows the stack into new pages
+static void __attribute__((noinline)) prefault_stack(void) {
+    volatile unsigned char frame[RT_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(frame); i += 4096) {
+        frame[i] = 0;
+    }
+}
+
+void rt_setup_loop(const rt_options_t *o) {
+    if (o->n_cpus > 0 && pin(o->cpus, 1) == 0) {
+        printf("Read loop on CPU %d", o->cpus[0]);
+        if (o->n_cpus > 1) {
+            printf(", threads on %d CPUs from %d", o->n_cpus - 1, o->cpus[1]);
+        }
+        printf("\n");
+    }
+    if (o->lock_memory) {
+#if defined(__GLIBC__)
+        // Keep freed heap memory mapped and locked instead of returning and faulting it again
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+#endif
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            perror("Unable to lock memory (-M), see ulimit -l");
+        } else {
+            prefault_stack();
+            printf("Memory locked\n");
+        }
+    }
+    if (o->fifo_priority > 0) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = o->fifo_priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err != 0) {
+            printf("Unable to run under SCHED_FIFO %d (-P): %s%s\n", o->fifo_priority, strerror(err),
+                   err == EPERM ? ", needs CAP_SYS_NICE or ulimit -r" : "");
+        } else {
+            printf("Read loop under SCHED_FIFO priority %d\n", o->fifo_priority);
+        }
+    }
+}
+
+// ------------------------------------------------------------------ Statistics
+
+static void switches(long *voluntary, long *involuntary) {
+    struct rusage ru;
+#if defined(RUSAGE_THREAD)
+    int who = RUSAGE_THREAD;
+#else
+    int who = RUSAGE_SELF;  // the whole process where threads are not counted alone
+#endif
+    if (getrusage(who, &ru) == 0) {
+        *voluntary = ru.ru_nvcsw;
+        *involuntary = ru.ru_nivcsw;
+    } else {
+        *voluntary = *involuntary = 0;
+    }
+}
+
+static int port_overruns(int fd, int *overrun, int *buf_overrun) {
+#if defined(__linux__) && defined(TIOCGICOUNT)
+    struct serial_icounter_struct ic;
+    if (ioctl(fd, TIOCGICOUNT, &ic) == 0) {
+        *overrun = ic.overrun;
+        *buf_overrun = ic.buf_overrun;
+        return 1;
+    }
+#else
+    (void)fd;
+#endif
+    *overrun = *buf_overrun = 0;
+    return 0;
+}
+
+void rt_stats_init(rt_stats_t *s, int serial_fd) {
+    memset(s, 0, sizeof(*s));
+    s->fd = serial_fd;
+    switches(&s->nvcsw, &s->nivcsw);
+    s->have_icount = port_overruns(serial_fd, &s->overrun, &s->buf_overrun);
+}
+
+void rt_sleep(rt_stats_t *s, uint32_t us) {
+    uint64_t t0 = lt_now_us();
+    usleep(us);
+    uint64_t slept = lt_now_us() - t0;
+    lt_hist_add(&s->delay, slept > us ? slept - us : 0);
+}
+
+void rt_report(const rt_stats_t *s, FILE *out) {
+    const lt_histogram_t *h = &s->delay;
+    if (h->count == 0) {
+        return;
+    }
+    fprintf(out, "\nWake-up delay of the read loop in us (%llu pauses):\n", (unsigned long long)h->count);
+    fprintf(out, "%10s %10s %10s %10s %10s %10s %10s\n", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    fprintf(out, "%10llu %10llu %10llu %10llu %10llu %10llu %10llu\n", (unsigned long long)h->min_us,
+            (unsigned long long)(h->sum_us / h->count), (unsigned long long)lt_percentile(h, 50.0),
+            (unsigned long long)lt_percentile(h, 90.0), (unsigned long long)lt_percentile(h, 99.0),
+            (unsigned long long)lt_percentile(h, 99.9), (unsigned long long)h->max_us);
+    long nvcsw, nivcsw;
+    switches(&nvcsw, &nivcsw);
+    fprintf(out, "Context switches: %ld voluntary, %ld involuntary (preempted)\n", nvcsw - s->nvcsw,
+            nivcsw - s->nivcsw);
+    int overrun, buf_overrun;
+    if (s->have_icount && port_overruns(s->fd, &overrun, &buf_overrun)) {
+        fprintf(out, "Port overruns: %d UART, %d tty buffer\n", overrun - s->overrun, buf_overrun - s->buf_overrun);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ *  Title: Real-Time
+ *  Description: Options that keep the read loop of the reader running on a loaded machine, where a
+ *               preempted loop lets the kernel tty buffer overflow at high baud rates:
+ *
+ *                   -P prio  run the read loop under SCHED_FIFO with this priority (needs CAP_SYS_NICE
+ *                            or an rtprio limit, see ulimit -r)
+ *                   -C cpus  pin the read loop to the first CPU of the list and the sink and pipeline
+ *                            threads to the others ("2,3" or "2-5"; Linux only)
+ *                   -M       lock the memory of the process (mlockall) and pre-fault the stack, so no
+ *                            page fault or swap-in stalls the loop
+ *
+ *               The delay with which the loop wakes up after each pause is kept in a histogram, with
+ *               the context switches of the loop and the overrun counters of the port, so the effect
+ *               of the options can be compared on the same machine.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latency_trace.h"
+
+#define RT_MAX_CPUS 64
+#define RT_STACK_PREFAULT (512 << 10)        // stack touched before the loop with -M
+
+typedef struct {
+    int fifo_priority;                       // 0 = normal scheduling
+    int cpus[RT_MAX_CPUS];                   // cpus[0] runs the read loop, the others the threads
+    int n_cpus;                              // 0 = no pinning
+    int lock_memory;
+} rt_options_t;
+
+// Parse a CPU list like "2", "2,3" or "2-5" into o. Returns -1 if malformed.
+int rt_parse_cpus(const char *list, rt_options_t *o);
+
+// Before any thread is started: threads created from now on inherit the CPUs after the first
+void rt_setup_threads(const rt_options_t *o);
+
+// On the read loop once everything is set up: pin it, switch it to SCHED_FIFO, lock and pre-fault
+// memory. Options that cannot be applied are reported and skipped.
+void rt_setup_loop(const rt_options_t *o);
+
+typedef struct {
+    lt_histogram_t delay;                    // wake-up later than asked, in us
+    long           nvcsw, nivcsw;            // context switches of the loop when counting started
+    int            fd;                       // serial port, for its overrun counters
+    int            have_icount;
+    int            overrun, buf_overrun;     // counters of the port when counting started
+} rt_stats_t;
+
+void rt_stats_init(rt_stats_t *s, int serial_fd);
+
+// Pause the loop for us microseconds and record how late it woke up
+void rt_sleep(rt_stats_t *s, uint32_t us);
+
+void rt_report(const rt_stats_t *s, FILE *out);
+
+#endif // REALTIME_H
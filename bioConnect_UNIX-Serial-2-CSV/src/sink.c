@@ -0,0 +1,284 @@
+/*
+ *  Title: Sinks
+ *  Description: Fan-out of the reader output to the sinks, one thread and bounded queue per sink,
+ *               see sink.h.
+ */
+
+#include "sink.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+void sink_fanout_init(sink_fanout_t *fo) {
+    memset(fo, 0, sizeof(*fo));
+}
+
+// Hand the samples of one batch to the sink
+static void write_batch(sink_lane_t *lane, const sink_sample_t *batch, size_t n) {
+    if (n > 0) {
+        lane->sink->ops->write(lane->sink, batch, n);
+        lane->n_samples += n;
+    }
+}
+
+static void *lane_thread(void *arg) {
+    sink_lane_t *lane = (sink_lane_t *)arg;
+    sink_t *sink = lane->sink;
+    sink_sample_t batch[SINK_BATCH];
+
+    for (;;) {
+        uint64_t taken = atomic_load_explicit(&lane->n_taken, memory_order_relaxed);
+        pthread_mutex_lock(&lane->lock);
+        while (atomic_load_explicit(&lane->n_pushed, memory_order_acquire) == taken && !lane->closing) {
+            pthread_cond_wait(&lane->wake, &lane->lock);
+        }
+        int closing = lane->closing;
+        pthread_mutex_unlock(&lane->lock);
+
+        // Everything queued so far, consecutive samples in batches of up to SINK_BATCH
+        uint64_t pushed = atomic_load_explicit(&lane->n_pushed, memory_order_acquire);
+        if (pushed == taken && closing) {
+            break;
+        }
+        size_t n = 0;
+        uint64_t first = taken;
+        for (; taken < pushed; ++taken) {
+            const sink_event_t *e = &lane->queue[taken & (SINK_QUEUE - 1)];
+            if (e->kind == SINK_EVENT_SAMPLE) {
+                batch[n++] = e->sample;
+                if (n == SINK_BATCH) {
+                    write_batch(lane, batch, n);
+                    n = 0;
+                }
+                continue;
+            }
+            write_batch(lane, batch, n);  // keep the order of samples and records
+            n = 0;
+            if (e->kind == SINK_EVENT_GAP && sink->ops->gap != NULL) {
+                sink->ops->gap(sink, &e->gap);
+            } else if (e->kind == SINK_EVENT_ANNOTATION && sink->ops->annotate != NULL) {
+                sink->ops->annotate(sink, &e->annotation);
+            } else if (e->kind == SINK_EVENT_MESSAGE && sink->ops->message != NULL) {
+                sink->ops->message(sink, e->message);
+            }
+        }
+        write_batch(lane, batch, n);
+        if (sink->trace != NULL) {
+            // Traced: flushed before the entries are handed back, whose stamps are read here
+            if (sink->ops->flush != NULL) {
+                sink->ops->flush(sink);
+            }
+            uint64_t now = lt_now_us();
+            for (uint64_t k = first; k < taken; ++k) {
+                const sink_event_t *e = &lane->queue[k & (SINK_QUEUE - 1)];
+                if (e->kind == SINK_EVENT_SAMPLE && e->sample.rx_us != 0) {
+                    lt_mark_written(sink->trace, now, e->sample.rx_us, e->sample.parse_us, e->sample.transit_us);
+                }
+            }
+        }
+        atomic_store_explicit(&lane->n_taken, taken, memory_order_release);
+        pthread_mutex_lock(&lane->lock);
+        if (lane->waiting) {
+            pthread_cond_signal(&lane->room);
+        }
+        pthread_mutex_unlock(&lane->lock);
+        if (sink->trace == NULL && sink->ops->flush != NULL) {
+            sink->ops->flush(sink);
+        }
+    }
+    return NULL;
+}
+
+int sink_fanout_add(sink_fanout_t *fo, sink_t *sink, int lossless) {
+    if (fo->n_lanes == SINK_MAX) {
+        printf("More than %d sinks, %s not opened\n", SINK_MAX, sink->name);
+        sink->ops->close(sink);
+        return -1;
+    }
+    sink_lane_t *lane = &fo->lanes[fo->n_lanes];
+    memset(lane, 0, sizeof(*lane));
+    lane->sink = sink;
+    lane->lossless = lossless;
+    lane->last_t = NAN;
+    lane->queue = malloc(SINK_QUEUE * sizeof(sink_event_t));
+    if (lane->queue == NULL) {
+        perror("Unable to allocate sink queue");
+        sink->ops->close(sink);
+        return -1;
+    }
+    pthread_mutex_init(&lane->lock, NULL);
+    pthread_cond_init(&lane->wake, NULL);
+    pthread_cond_init(&lane->room, NULL);
+    if (pthread_create(&lane->thread, NULL, lane_thread, lane) != 0) {
+        perror("Unable to start sink thread");
+        pthread_cond_destroy(&lane->room);
+        pthread_cond_destroy(&lane->wake);
+        pthread_mutex_destroy(&lane->lock);
+        free(lane->queue);
+        sink->ops->close(sink);
+        return -1;
+    }
+    fo->n_lanes++;
+    return 0;
+}
+
+// Check for room for n more events in the queue of a lane. A lossless lane is woken, since the events
+// of this chunk are not committed yet, and waited for; any other returns 0 if it is too far behind.
+static int has_room(sink_lane_t *lane, uint64_t n) {
+    uint64_t pushed = atomic_load_explicit(&lane->n_pushed, memory_order_relaxed);
+    uint64_t depth = pushed - atomic_load_explicit(&lane->n_taken, memory_order_acquire);
+    if (depth + n > SINK_QUEUE && lane->lossless) {
+        lane->n_waits++;
+        pthread_mutex_lock(&lane->lock);
+        lane->waiting = 1;
+        pthread_cond_signal(&lane->wake);
+        while ((depth = pushed - atomic_load_explicit(&lane->n_taken, memory_order_acquire)) + n > SINK_QUEUE) {
+            pthread_cond_wait(&lane->room, &lane->lock);
+        }
+        lane->waiting = 0;
+        pthread_mutex_unlock(&lane->lock);
+    }
+    if (depth + n > SINK_QUEUE) {
+        return 0;
+    }
+    if (depth + n > lane->max_depth) {
+        lane->max_depth = depth + n;
+    }
+    return 1;
+}
+
+// Next queue entry of a lane that has room, visible to its thread after publish()
+static sink_event_t *push(sink_lane_t *lane) {
+    uint64_t pushed = atomic_load_explicit(&lane->n_pushed, memory_order_relaxed);
+    return &lane->queue[pushed & (SINK_QUEUE - 1)];
+}
+
+static void publish(sink_lane_t *lane) {
+    atomic_fetch_add_explicit(&lane->n_pushed, 1, memory_order_release);
+}
+
+// Count an event the lane has no room for. Samples and gap records it loses are covered by a gap
+// record from the last sample it got to the next one.
+static void drop(sink_lane_t *lane, sink_event_kind_t kind) {
+    lane->n_dropped++;
+    if (kind == SINK_EVENT_ANNOTATION || kind == SINK_EVENT_MESSAGE) {
+        return;
+    }
+    if (!lane->dropping) {
+        lane->dropping = 1;
+        memset(&lane->dropped, 0, sizeof(lane->dropped));
+        lane->dropped.kind = GR_GAP_DROPPED;
+        lane->dropped.seq_from = lane->last_seq;
+        lane->dropped.t_from = lane->last_t;
+    }
+    lane->dropped.missing += kind == SINK_EVENT_SAMPLE;
+}
+
+void sink_fanout_sample(sink_fanout_t *fo, const sink_sample_t *s) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_lane_t *lane = &fo->lanes[i];
+        if (!has_room(lane, lane->dropping ? 2 : 1)) {
+            drop(lane, SINK_EVENT_SAMPLE);
+            continue;
+        }
+        if (lane->dropping) {
+            lane->dropped.seq_to = s->seq;
+            lane->dropped.t_to = s->t;
+            sink_event_t *g = push(lane);
+            g->kind = SINK_EVENT_GAP;
+            g->gap = lane->dropped;
+            publish(lane);
+            lane->dropping = 0;
+        }
+        sink_event_t *e = push(lane);
+        e->kind = SINK_EVENT_SAMPLE;
+        e->sample = *s;
+        publish(lane);
+        lane->last_seq = s->seq;
+        lane->last_t = s->t;
+    }
+}
+
+void sink_fanout_gap(sink_fanout_t *fo, const gr_gap_t *g) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_lane_t *lane = &fo->lanes[i];
+        if (lane->dropping || !has_room(lane, 1)) {
+            drop(lane, SINK_EVENT_GAP);  // within the range of the gap record that follows
+            continue;
+        }
+        sink_event_t *e = push(lane);
+        e->kind = SINK_EVENT_GAP;
+        e->gap = *g;
+        publish(lane);
+    }
+}
+
+void sink_fanout_annotate(sink_fanout_t *fo, double t, double duration, const char *text) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_event_t *e = has_room(&fo->lanes[i], 1) ? push(&fo->lanes[i]) : NULL;
+        if (e == NULL) {
+            drop(&fo->lanes[i], SINK_EVENT_ANNOTATION);
+        } else {
+            e->kind = SINK_EVENT_ANNOTATION;
+            e->annotation.t = t;
+            e->annotation.duration = duration;
+            snprintf(e->annotation.text, sizeof(e->annotation.text), "%s", text);
+            publish(&fo->lanes[i]);
+        }
+    }
+}
+
+void sink_fanout_message(sink_fanout_t *fo, const char *fmt, ...) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_event_t *e = has_room(&fo->lanes[i], 1) ? push(&fo->lanes[i]) : NULL;
+        if (e == NULL) {
+            drop(&fo->lanes[i], SINK_EVENT_MESSAGE);
+        } else {
+            va_list args;
+            va_start(args, fmt);
+            e->kind = SINK_EVENT_MESSAGE;
+            vsnprintf(e->message, sizeof(e->message), fmt, args);
+            va_end(args);
+            publish(&fo->lanes[i]);
+        }
+    }
+}
+
+void sink_fanout_commit(sink_fanout_t *fo) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_lane_t *lane = &fo->lanes[i];
+        if (atomic_load_explicit(&lane->n_pushed, memory_order_relaxed)
+                != atomic_load_explicit(&lane->n_taken, memory_order_relaxed)) {
+            pthread_mutex_lock(&lane->lock);
+            pthread_cond_signal(&lane->wake);
+            pthread_mutex_unlock(&lane->lock);
+        }
+    }
+}
+
+void sink_fanout_close(sink_fanout_t *fo, FILE *report) {
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_lane_t *lane = &fo->lanes[i];
+        pthread_mutex_lock(&lane->lock);
+        lane->closing = 1;
+        pthread_cond_signal(&lane->wake);
+        pthread_mutex_unlock(&lane->lock);
+    }
+    for (int i = 0; i < fo->n_lanes; ++i) {
+        sink_lane_t *lane = &fo->lanes[i];
+        pthread_join(lane->thread, NULL);
+        if (report != NULL) {
+            fprintf(report, "Sink %s: %llu samples, %llu events dropped, waited for %llu times, queue peak %llu of %d\n",
+                    lane->sink->name, (unsigned long long)lane->n_samples, (unsigned long long)lane->n_dropped,
+                    (unsigned long long)lane->n_waits, (unsigned long long)lane->max_depth, SINK_QUEUE);
+        }
+        lane->sink->ops->close(lane->sink);
+        pthread_cond_destroy(&lane->room);
+        pthread_cond_destroy(&lane->wake);
+        pthread_mutex_destroy(&lane->lock);
+        free(lane->queue);
+    }
+    fo->n_lanes = 0;
+}
@@ -0,0 +1,189 @@
+/*
+ *  Title: Sinks
+ *  Description: Outputs of the reader behind one interface. A sink receives batches of samples on the
+ *               uniform grid of the gap resampler (both channels, host time, flags, latest vitals),
+ *               the gap records, annotations and the messages of the read loop. Implementations
+ *               (sink_outputs.c):
+ *
+ *                   dsp      runs the DSP graph (pipeline.h) over the samples and hands them on to a
+ *                            fan-out of the other sinks, with the heart rate, SpO2 and beats it found
+ *                   csv      ir,t,red,seq per row, IR first so readers of the old one-column files
+ *                            keep working; to one file or to rotated segments
+ *                   bcap     compressed binary capture, see capture_file.h
+ *                   edf      EDF+ with gap and heart-rate annotations, see edf_writer.h
+ *                   pyramid  min/max/mean overview next to the recording, see summary_pyramid.h
+ *                   stft     spectrogram columns next to the recording and in the live feed, computed
+ *                            from the resampled samples, see spectrogram_file.h
+ *                   live     shared-memory ring for the plotter, see live_feed.h
+ *                   uring    the csv rows through io_uring: large asynchronous writes from registered
+ *                            buffers, see uring_writer.h; csv where io_uring cannot be used
+ *                   udp      "seq,t,red,ir,flags" lines, batched into datagrams
+ *                   null     counts the samples, for measuring the reader without output
+ *                   console  prints the received samples, vitals, gap records and messages
+ *                   gaps     the gap records of the recording as CSV, removed at close if there are none
+ *
+ *               The fan-out hands every event to each sink through its own bounded queue, drained by
+ *               a thread of that sink. The read loop only copies into the queue of the dsp sink, whose
+ *               thread fills the fan-out of the other sinks; it prints nothing and writes no file
+ *               itself, so it never blocks on a terminal or a disk. When a sink falls SINK_QUEUE events
+ *               behind, the thread filling its fan-out waits for it if it is lossless (the dsp sink and
+ *               the recording), so the recording holds every sample and the serial port buffers
+ *               meanwhile. Any other sink loses the newest events instead of stalling the samples, and
+ *               gets a gap record of kind GR_GAP_DROPPED over the samples it missed once it has room
+ *               again.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gap_resample.h"
+#include "latency_trace.h"
+#include "live_feed.h"
+
+#define SINK_CHANNELS 2              // Red, IR
+#define SINK_MAX 10                  // sinks per fan-out
+#define SINK_QUEUE 8192              // events per sink queue, 80 s at 100 Hz; a power of two
+#define SINK_BATCH 256               // samples handed to write() at once
+#define SINK_TEXT 32                 // annotation text, as EDF_ANNOT_TEXT
+#define SINK_MESSAGE 64              // message text, longer lines are cut
+
+#define SINK_VALID LF_VALID          // flags of a sample, the same bits as the live feed
+#define SINK_INTERPOLATED LF_INTERPOLATED
+#define SINK_BEAT LF_BEAT
+
+typedef struct {
+    double   t;                      // host time
+    float    value[SINK_CHANNELS];   // nan if missing
+    uint32_t seq;
+    uint32_t flags;                  // SINK_VALID, SINK_INTERPOLATED, SINK_BEAT
+    float    hr_bpm;                 // nan until the first estimate
+    float    spo2;                   // nan until the first window with a pulse
+    uint64_t rx_us;                  // latency trace (-t): read() returned, 0 if not traced
+    uint64_t parse_us;               // frame parsed
+    int64_t  transit_us;             // ADC -> rx above the session minimum, -1 without device timestamp
+} sink_sample_t;
+
+typedef struct {
+    double t;
+    double duration;
+    char   text[SINK_TEXT];
+} sink_annotation_t;
+
+typedef enum {
+    SINK_EVENT_SAMPLE = 0,
+    SINK_EVENT_GAP,
+    SINK_EVENT_ANNOTATION,
+    SINK_EVENT_MESSAGE               // a line for the console
+} sink_event_kind_t;
+
+typedef struct {
+    sink_event_kind_t kind;
+    union {
+        sink_sample_t     sample;
+        gr_gap_t          gap;
+        sink_annotation_t annotation;
+        char              message[SINK_MESSAGE];
+    };
+} sink_event_t;
+
+typedef struct sink sink_t;
+
+// Called on the thread of the sink only. gap, annotate, flush and message may be NULL.
+typedef struct {
+    const char *kind;
+    void (*write)(sink_t *sink, const sink_sample_t *samples, size_t n);
+    void (*gap)(sink_t *sink, const gr_gap_t *g);
+    void (*annotate)(sink_t *sink, const sink_annotation_t *a);
+    void (*flush)(sink_t *sink);     // after the events available at once have been handed over
+    void (*close)(sink_t *sink);     // flush, report to stdout and free the state
+    void (*message)(sink_t *sink, const char *text);
+} sink_ops_t;
+
+struct sink {
+    const sink_ops_t *ops;
+    void             *state;
+    char              name[128];     // kind and target, for reports
+    latency_trace_t  *trace;         // set for the recording with -t: marks its samples written
+};
+
+// Options shared by the sinks that write files
+typedef struct {
+    float  sample_rate;
+    double segment_mb;               // csv, bcap: rotate segments at this size (0 = no limit) ...
+    double segment_s;                // ... or after this many seconds (0 = no limit)
+} sink_config_t;
+
+// Open a sink from a spec: a file name (the extension picks csv, bcap or edf), "uring:file.csv",
+// "udp:host:port" or "null". Returns NULL with the reason printed if it cannot be opened.
+sink_t *sink_open(const char *spec, const sink_config_t *config);
+
+// Overview pyramid of the recording at path, continuing the one of earlier sessions with append (a
+// segmented recording), and the live feed lf (opened by the caller, who closes it after the fan-out)
+sink_t *sink_open_pyramid(const char *path, float sample_rate, int append);
+
+// Spectrogram of both channels next to the recording at path (continued with append, as the
+// pyramid), its columns also published to lf if not NULL
+sink_t *sink_open_spectrogram(const char *path, float sample_rate, int n_fft, int hop, int append,
+                              live_feed_t *lf);
+sink_t *sink_open_live(live_feed_t *lf);
+sink_t *sink_open_console(void);
+sink_t *sink_open_gaps(const char *path);
+
+// One sink of a fan-out: its queue, thread and counters
+typedef struct {
+    sink_t         *sink;
+    sink_event_t   *queue;           // SINK_QUEUE events
+    _Atomic uint64_t n_pushed;       // events queued so far, written by the read loop only
+    _Atomic uint64_t n_taken;        // events handed to the sink so far, written by its thread only
+    int             lossless;        // the read loop waits for room instead of dropping
+    uint64_t        n_dropped;       // events lost to a full queue
+    uint64_t        n_waits;         // times the read loop waited for room (lossless)
+    uint64_t        n_samples;       // samples written
+    uint64_t        max_depth;       // most events waiting at once
+    int             dropping;        // events are being dropped, since the sample dropped.seq_from
+    gr_gap_t        dropped;         // their gap record, queued before the next sample with room
+    uint32_t        last_seq;        // of the latest sample queued
+    double          last_t;
+    pthread_t       thread;
+    pthread_mutex_t lock;            // guards the sleeps of the thread on wake and of the read loop on room
+    pthread_cond_t  wake;
+    pthread_cond_t  room;
+    int             waiting;         // the read loop sleeps on room
+    int             closing;
+} sink_lane_t;
+
+typedef struct {
+    sink_lane_t lanes[SINK_MAX];
+    int         n_lanes;
+} sink_fanout_t;
+
+void sink_fanout_init(sink_fanout_t *fo);
+
+// Start a thread for the sink, the fan-out owns it from now on. With lossless the read loop waits for
+// the sink rather than drop its events. Returns 0, or -1 (sink closed) if the fan-out is full or the
+// thread cannot be started.
+int sink_fanout_add(sink_fanout_t *fo, sink_t *sink, int lossless);
+
+// Queue an event for every sink. The sinks see it after the next sink_fanout_commit().
+void sink_fanout_sample(sink_fanout_t *fo, const sink_sample_t *s);
+void sink_fanout_gap(sink_fanout_t *fo, const gr_gap_t *g);
+void sink_fanout_annotate(sink_fanout_t *fo, double t, double duration, const char *text);
+void sink_fanout_message(sink_fanout_t *fo, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Wake the sinks that have events waiting, once per chunk read rather than per sample
+void sink_fanout_commit(sink_fanout_t *fo);
+
+// Let every sink drain its queue, stop the threads, close the sinks and report per sink
+void sink_fanout_close(sink_fanout_t *fo, FILE *report);
+
+// DSP graph of the file at path, or the built-in one (PL_DEFAULT_GRAPH) if NULL, handing the samples
+// on to out. With annotate_hr every beat is also an annotation. The caller closes out after this sink.
+sink_t *sink_open_dsp(const char *path, float sample_rate, int annotate_hr, sink_fanout_t *out);
+
+#endif // SINK_H
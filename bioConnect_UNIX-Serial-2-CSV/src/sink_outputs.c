@@ -0,0 +1,767 @@
+/*
+ *  Title: Sink Outputs
+ *  Description: The sinks of the reader: DSP, CSV, capture, EDF+, pyramid, spectrogram, live feed, UDP,
+ *               null, console and gap file, see sink.h.
+ */
+
+#include "sink.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "edf_writer.h"
+#include "pipeline.h"
+#include "ppg_dsp.h"
+#include "spectrogram_file.h"
+#include "summary_pyramid.h"
+#include "uring_writer.h"
+
+#define UDP_DATAGRAM 1400            // Payload per datagram, below the Ethernet MTU
+
+_Static_assert(SINK_TEXT == EDF_ANNOT_TEXT, "annotations reach the EDF+ file whole");
+
+static sink_t *new_sink(const sink_ops_t *ops, void *state, const char *target) {
+    sink_t *sink = calloc(1, sizeof(*sink));
+    if (sink == NULL) {
+        perror("Unable to allocate sink");
+        return NULL;
+    }
+    sink->ops = ops;
+    sink->state = state;
+    snprintf(sink->name, sizeof(sink->name), "%s%s%s", ops->kind, target[0] ? " " : "", target);
+    return sink;
+}
+
+static void free_sink(sink_t *sink) {
+    free(sink->state);
+    free(sink);
+}
+
+// ------------------------------------------------------------------ DSP
+
+// Events of the vitals stage during one batch, at most one per sample and output
+typedef struct {
+    double t;
+    float  v;
+} dsp_vital_t;
+
+typedef struct {
+    pipeline_t    *pl;
+    int            report;           // print the time per stage at close
+    sink_fanout_t *out;
+    int            annotate_hr;
+    float          hr_bpm;           // latest estimates, nan until known
+    float          spo2;
+    dsp_vital_t    hr[SINK_BATCH];
+    dsp_vital_t    sat[SINK_BATCH];
+    int            n_hr;
+    int            n_sat;
+} dsp_sink_t;
+
+static void dsp_output(void *ctx, pl_output_t output, double t, float v) {
+    dsp_sink_t *d = ctx;
+    if (output == PL_OUT_HR && d->n_hr < SINK_BATCH) {
+        d->hr[d->n_hr++] = (dsp_vital_t){ t, v };
+    } else if (output == PL_OUT_SPO2 && d->n_sat < SINK_BATCH) {
+        d->sat[d->n_sat++] = (dsp_vital_t){ t, v };
+    }
+}
+
+// Run the graph over the batch, then hand it on with every estimate from the sample it was made at
+static void dsp_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    dsp_sink_t *d = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        pl_push(d->pl, s[i].t, s[i].value[0], s[i].value[1]);
+    }
+    d->n_hr = d->n_sat = 0;
+    pl_run(d->pl);
+
+    int next_hr = 0, next_sat = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sink_sample_t x = s[i];
+        int last = i + 1 == n;       // takes what is left, the times of the events are those of samples
+        for (; next_hr < d->n_hr && (last || d->hr[next_hr].t <= x.t); ++next_hr) {
+            d->hr_bpm = d->hr[next_hr].v;
+            x.flags |= SINK_BEAT;
+            if (d->annotate_hr) {
+                char text[SINK_TEXT];
+                snprintf(text, sizeof(text), "HR %.0f bpm", d->hr_bpm);
+                sink_fanout_annotate(d->out, d->hr[next_hr].t, 0, text);
+            }
+        }
+        for (; next_sat < d->n_sat && (last || d->sat[next_sat].t <= x.t); ++next_sat) {
+            d->spo2 = d->sat[next_sat].v;
+        }
+        x.hr_bpm = d->hr_bpm;
+        x.spo2 = d->spo2;
+        sink_fanout_sample(d->out, &x);
+    }
+}
+
+static void dsp_gap(sink_t *sink, const gr_gap_t *g) {
+    sink_fanout_gap(((dsp_sink_t *)sink->state)->out, g);
+}
+
+static void dsp_annotate(sink_t *sink, const sink_annotation_t *a) {
+    sink_fanout_annotate(((dsp_sink_t *)sink->state)->out, a->t, a->duration, a->text);
+}
+
+static void dsp_message(sink_t *sink, const char *text) {
+    sink_fanout_message(((dsp_sink_t *)sink->state)->out, "%s", text);
+}
+
+static void dsp_flush(sink_t *sink) {
+    sink_fanout_commit(((dsp_sink_t *)sink->state)->out);
+}
+
+// The caller owns the fan-out of the other sinks and closes it after this one
+static void dsp_close(sink_t *sink) {
+    dsp_sink_t *d = sink->state;
+    pl_close(d->pl, d->report ? stdout : NULL);
+    free_sink(sink);
+}
+
+static const sink_ops_t dsp_ops = { "dsp", dsp_write, dsp_gap, dsp_annotate, dsp_flush, dsp_close, dsp_message };
+
+// ------------------------------------------------------------------ CSV
+
+#define CSV_BUFFER (64 << 10)
+
+typedef struct {
+    FILE *csv;                       // single file, NULL when recording to segments
+    capture_segments_t segments;
+    char  buffer[CSV_BUFFER];        // stdio buffer of csv, set at open so the first row does not allocate it
+} csv_sink_t;
+
+static void csv_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    csv_sink_t *c = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        FILE *f = (c->csv != NULL) ? c->csv : seg_begin_record(&c->segments, s[i].t);
+        if (f == NULL) {
+            continue;
+        }
+        // Missing samples are written as "nan" so every row stays one sequence number apart
+        int n_bytes = fprintf(f, "%.6g,%.3f,%.6g,%u\n", s[i].value[1], s[i].t, s[i].value[0], s[i].seq);
+        if (c->csv == NULL) {
+            seg_end_record(&c->segments, n_bytes);
+        }
+    }
+}
+
+static void csv_flush(sink_t *sink) {
+    csv_sink_t *c = sink->state;
+    FILE *f = (c->csv != NULL) ? c->csv : c->segments.file;
+    if (f != NULL) {
+        fflush(f);
+    }
+}
+
+static void csv_close(sink_t *sink) {
+    csv_sink_t *c = sink->state;
+    if (c->csv == NULL) {
+        seg_close(&c->segments);
+    } else if (fclose(c->csv) != 0) {
+        perror("Error closing CSV file");
+    }
+    free_sink(sink);
+}
+
+static const sink_ops_t csv_ops = { "csv", csv_write, NULL, NULL, csv_flush, csv_close, NULL };
+
+// ------------------------------------------------------------------ CSV through io_uring
+
+static void uring_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    uring_writer_t *w = sink->state;
+    char rows[16 << 10];
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        len += (size_t)snprintf(rows + len, sizeof(rows) - len, "%.6g,%.3f,%.6g,%u\n", s[i].value[1], s[i].t,
+                                s[i].value[0], s[i].seq);
+        if (sizeof(rows) - len < 128 || i == n - 1) {
+            uw_write(w, rows, len);
+            len = 0;
+        }
+    }
+}
+
+static void uring_flush(sink_t *sink) {
+    uw_flush(sink->state);
+}
+
+static void uring_close(sink_t *sink) {
+    uw_stats_t st;
+    uw_stats(sink->state, &st);
+    if (uw_close(sink->state) != 0) {
+        printf("Error writing %s\n", sink->name);
+    }
+    printf("Sink %s: %llu writes, %.1f kB each, %s, %s buffers, stalled %.1f ms (longest %.1f ms), %d in flight at most\n",
+           sink->name, (unsigned long long)st.writes, st.writes > 0 ? (double)st.bytes / (double)st.writes / 1024.0 : 0.0,
+           st.direct ? "O_DIRECT" : "page cache", st.fixed ? "fixed" : "plain", st.stall_us * 1e-3,
+           st.max_stall_us * 1e-3, st.max_in_flight);
+    free(sink);  // the writer was freed by uw_close()
+}
+
+static const sink_ops_t uring_ops = { "uring", uring_write, NULL, NULL, uring_flush, uring_close, NULL };
+
+// ------------------------------------------------------------------ Capture
+
+typedef struct {
+    cap_writer_t capture;
+    capture_segments_t segments;
+    int segmented;
+} capture_sink_t;
+
+// The capture is the raw archive: samples filled in by -r are stored as missing, as they were not measured
+static void capture_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    capture_sink_t *c = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        int valid = (s[i].flags & (SINK_VALID | SINK_INTERPOLATED)) == SINK_VALID;
+        int32_t values[CAP_CHANNELS] = { valid ? (int32_t)lrintf(s[i].value[0]) : 0,
+                                         valid ? (int32_t)lrintf(s[i].value[1]) : 0 };
+        cap_writer_add(&c->capture, s[i].seq, s[i].t, values, valid);
+    }
+}
+
+static void capture_close(sink_t *sink) {
+    capture_sink_t *c = sink->state;
+    cap_writer_close(&c->capture);
+    printf("Capture: %llu chunks, %llu bytes\n",
+           (unsigned long long)c->capture.chunks_written, (unsigned long long)c->capture.bytes_written);
+    if (c->segmented) {
+        seg_close(&c->segments);
+    }
+    free_sink(sink);
+}
+
+// The capture writes and flushes whole chunks itself
+static const sink_ops_t capture_ops = { "bcap", capture_write, NULL, NULL, NULL, capture_close, NULL };
+
+// ------------------------------------------------------------------ EDF+
+
+static void edf_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    edf_writer_t *w = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        edf_writer_add(w, s[i].t, s[i].value, (s[i].flags & SINK_VALID) != 0);
+    }
+}
+
+static void edf_gap(sink_t *sink, const gr_gap_t *g) {
+    char text[EDF_ANNOT_TEXT];
+    snprintf(text, sizeof(text), "Gap %s %u samples", gr_gap_kind_name(g->kind), g->missing);
+    edf_writer_annotate(sink->state, g->t_from, g->t_to - g->t_from, text);
+    if (g->kind != GR_GAP_LOST) {
+        edf_writer_break(sink->state);  // lost samples were written as rows, the others were not
+    }
+}
+
+static void edf_annotate(sink_t *sink, const sink_annotation_t *a) {
+    edf_writer_annotate(sink->state, a->t, a->duration, a->text);
+}
+
+static void edf_close(sink_t *sink) {
+    edf_writer_t *w = sink->state;
+    edf_writer_close(w);
+    printf("EDF+: %lld records, %llu annotations (%llu dropped)\n", (long long)w->records_written,
+           (unsigned long long)w->annotations_written, (unsigned long long)w->annotations_dropped);
+    free_sink(sink);
+}
+
+static const sink_ops_t edf_ops = { "edf", edf_write, edf_gap, edf_annotate, NULL, edf_close, NULL };
+
+// ------------------------------------------------------------------ Pyramid
+
+static void pyramid_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        sp_add(sink->state, s[i].t, s[i].value);
+    }
+}
+
+static void pyramid_flush(sink_t *sink) {
+    sp_flush(sink->state);
+}
+
+static void pyramid_close(sink_t *sink) {
+    sp_close(sink->state);
+    free_sink(sink);
+}
+
+static const sink_ops_t pyramid_ops = { "pyramid", pyramid_write, NULL, NULL, pyramid_flush, pyramid_close, NULL };
+
+// ------------------------------------------------------------------ Spectrogram
+
+typedef struct {
+    ppg_stft_t         stft[SINK_CHANNELS];
+    float              last[SINK_CHANNELS];  // missing samples repeat the last value, nan before the first
+    int                n_fft;
+    int                hop;
+    spectrogram_file_t file;
+    live_feed_t       *lf;
+} stft_sink_t;
+
+static void stft_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    stft_sink_t *st = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        for (int c = 0; c < SINK_CHANNELS; ++c) {
+            if (!isnan(s[i].value[c])) {
+                st->last[c] = s[i].value[c];
+            }
+            if (!isnan(st->last[c]) && ppg_stft_add(&st->stft[c], st->last[c])) {
+                sf_write(&st->file, s[i].t, c, st->stft[c].power_db, st->stft[c].n_bins);
+                if (st->lf != NULL) {
+                    lf_add_column(st->lf, s[i].t, c, st->stft[c].power_db, st->stft[c].n_bins);
+                }
+            }
+        }
+    }
+}
+
+// Lost samples are on the grid and held, after a reset or a discontinuity the frames start over
+static void stft_gap(sink_t *sink, const gr_gap_t *g) {
+    stft_sink_t *st = sink->state;
+    if (g->kind != GR_GAP_LOST) {
+        for (int c = 0; c < SINK_CHANNELS; ++c) {
+            ppg_stft_init(&st->stft[c], st->n_fft, st->hop);
+            st->last[c] = NAN;
+        }
+    }
+}
+
+static void stft_flush(sink_t *sink) {
+    stft_sink_t *st = sink->state;
+    if (st->file.file != NULL) {
+        fflush(st->file.file);
+    }
+}
+
+static void stft_close(sink_t *sink) {
+    stft_sink_t *st = sink->state;
+    sf_close(&st->file);
+    free_sink(sink);
+}
+
+static const sink_ops_t stft_ops = { "stft", stft_write, stft_gap, NULL, stft_flush, stft_close, NULL };
+
+// ------------------------------------------------------------------ Live feed
+
+static void live_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    live_feed_t *lf = *(live_feed_t **)sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        lf_set_vitals(lf, s[i].hr_bpm, s[i].spo2, (s[i].flags & SINK_BEAT) != 0);
+        lf_add(lf, s[i].seq, s[i].t, s[i].value, s[i].flags & ~(uint32_t)SINK_BEAT);
+    }
+}
+
+// The caller owns the feed: it also publishes the spectrogram columns to it
+static void live_close(sink_t *sink) {
+    free_sink(sink);
+}
+
+static const sink_ops_t live_ops = { "live", live_write, NULL, NULL, NULL, live_close, NULL };
+
+// ------------------------------------------------------------------ UDP
+
+typedef struct {
+    int      fd;
+    char     datagram[UDP_DATAGRAM];
+    size_t   len;
+    uint64_t n_sent;
+    uint64_t n_lost;                 // datagrams the socket did not take, the sink never waits
+} udp_sink_t;
+
+static void udp_send(udp_sink_t *u) {
+    if (u->len == 0) {
+        return;
+    }
+    if (send(u->fd, u->datagram, u->len, MSG_DONTWAIT) == (ssize_t)u->len) {
+        u->n_sent++;
+    } else {
+        u->n_lost++;  // buffer full or nobody listening
+    }
+    u->len = 0;
+}
+
+static void udp_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    udp_sink_t *u = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "%u,%.3f,%.6g,%.6g,%u\n",
+                           s[i].seq, s[i].t, s[i].value[0], s[i].value[1], s[i].flags);
+        if (u->len + (size_t)len > sizeof(u->datagram)) {
+            udp_send(u);
+        }
+        memcpy(u->datagram + u->len, line, (size_t)len);
+        u->len += (size_t)len;
+    }
+}
+
+static void udp_flush(sink_t *sink) {
+    udp_send(sink->state);
+}
+
+static void udp_close(sink_t *sink) {
+    udp_sink_t *u = sink->state;
+    udp_send(u);
+    printf("UDP: %llu datagrams sent, %llu lost\n", (unsigned long long)u->n_sent, (unsigned long long)u->n_lost);
+    close(u->fd);
+    free_sink(sink);
+}
+
+static const sink_ops_t udp_ops = { "udp", udp_write, NULL, NULL, udp_flush, udp_close, NULL };
+
+// "host:port", the host may be a name
+static sink_t *udp_open(const char *target) {
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (colon == NULL || colon == target || (size_t)(colon - target) >= sizeof(host)) {
+        printf("UDP sink needs host:port, got %s\n", target);
+        return NULL;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+    struct addrinfo hints, *addr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &addr);
+    if (err != 0) {
+        printf("Unable to resolve %s: %s\n", target, gai_strerror(err));
+        return NULL;
+    }
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+        perror("Unable to open UDP socket");
+        if (fd >= 0) {
+            close(fd);
+        }
+        freeaddrinfo(addr);
+        return NULL;
+    }
+    freeaddrinfo(addr);
+    udp_sink_t *u = calloc(1, sizeof(*u));
+    sink_t *sink = (u != NULL) ? new_sink(&udp_ops, u, target) : NULL;
+    if (sink == NULL) {
+        free(u);
+        close(fd);
+        return NULL;
+    }
+    u->fd = fd;
+    return sink;
+}
+
+// ------------------------------------------------------------------ Null
+
+static void null_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    (void)s;
+    *(uint64_t *)sink->state += n;
+}
+
+static void null_close(sink_t *sink) {
+    free_sink(sink);
+}
+
+static const sink_ops_t null_ops = { "null", null_write, NULL, NULL, NULL, null_close, NULL };
+
+// ------------------------------------------------------------------ Console
+
+// The vitals are printed when they change: a beat, or a new SpO2 estimate
+static void console_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    float *spo2 = sink->state;
+    for (size_t i = 0; i < n; ++i) {
+        if ((s[i].flags & (SINK_VALID | SINK_INTERPOLATED)) == SINK_VALID) {
+            printf("RED: %.0f, IR: %.0f\n", s[i].value[0], s[i].value[1]);
+        }
+        if (s[i].flags & SINK_BEAT) {
+            printf("HR ≈ %.1f bpm\n", s[i].hr_bpm);
+        }
+        if (!isnan(s[i].spo2) && s[i].spo2 != *spo2) {
+            *spo2 = s[i].spo2;
+            printf("SpO2 ≈ %.1f %%\n", *spo2);
+        }
+    }
+}
+
+static void console_gap(sink_t *sink, const gr_gap_t *g) {
+    (void)sink;
+    printf("Gap (%s): %u samples missing between seq %u and %u\n",
+           gr_gap_kind_name(g->kind), g->missing, g->seq_from, g->seq_to);
+}
+
+static void console_message(sink_t *sink, const char *text) {
+    (void)sink;
+    printf("%s\n", text);
+}
+
+static void console_flush(sink_t *sink) {
+    (void)sink;
+    fflush(stdout);
+}
+
+static void console_close(sink_t *sink) {
+    fflush(stdout);
+    free_sink(sink);
+}
+
+static const sink_ops_t console_ops = { "console", console_write, console_gap, NULL, console_flush, console_close,
+                                        console_message };
+
+// ------------------------------------------------------------------ Gap file
+
+// The file is opened with its header up front, so the first gap allocates nothing, and removed at
+// close if there was no gap
+typedef struct {
+    FILE    *csv;
+    uint64_t n_rows;
+    char     path[512];
+} gaps_sink_t;
+
+static void gaps_write(sink_t *sink, const sink_sample_t *s, size_t n) {
+    (void)sink;
+    (void)s;
+    (void)n;
+}
+
+static void gaps_gap(sink_t *sink, const gr_gap_t *g) {
+    gaps_sink_t *gs = sink->state;
+    fprintf(gs->csv, "%s,%u,%u,%u,%.3f,%.3f\n", gr_gap_kind_name(g->kind),
+            g->seq_from, g->seq_to, g->missing, g->t_from, g->t_to);
+    gs->n_rows++;
+}
+
+static void gaps_flush(sink_t *sink) {
+    fflush(((gaps_sink_t *)sink->state)->csv);
+}
+
+static void gaps_close(sink_t *sink) {
+    gaps_sink_t *gs = sink->state;
+    fclose(gs->csv);
+    if (gs->n_rows == 0) {
+        remove(gs->path);
+    }
+    free_sink(sink);
+}
+
+static const sink_ops_t gaps_ops = { "gaps", gaps_write, gaps_gap, NULL, gaps_flush, gaps_close, NULL };
+
+// ------------------------------------------------------------------ Opening
+
+sink_t *sink_open(const char *spec, const sink_config_t *config) {
+    if (strcmp(spec, "null") == 0) {
+        uint64_t *n_samples = calloc(1, sizeof(*n_samples));
+        sink_t *sink = (n_samples != NULL) ? new_sink(&null_ops, n_samples, "") : NULL;
+        if (sink == NULL) {
+            free(n_samples);
+        }
+        return sink;
+    }
+    if (strncmp(spec, "udp:", 4) == 0) {
+        return udp_open(spec + 4);
+    }
+    if (strncmp(spec, "uring:", 6) == 0) {
+        if (config->segment_mb > 0 || config->segment_s > 0) {
+            printf("io_uring sinks cannot be recorded to segments\n");
+            return NULL;
+        }
+        uring_writer_t *w = uw_open(spec + 6);
+        if (w == NULL) {
+            printf("Writing %s with stdio instead\n", spec + 6);
+            return sink_open(spec + 6, config);
+        }
+        sink_t *sink = new_sink(&uring_ops, w, spec + 6);
+        if (sink == NULL) {
+            uw_close(w);
+        }
+        return sink;
+    }
+
+    const char *slash = strrchr(spec, '/');
+    const char *ext = strrchr(slash ? slash : spec, '.');
+    int segmented = config->segment_mb > 0 || config->segment_s > 0;
+    int64_t segment_bytes = (int64_t)(config->segment_mb * 1024 * 1024);
+    if (ext != NULL && strcmp(ext, ".edf") == 0) {
+        if (segmented) {
+            printf("EDF+ files cannot be recorded to segments\n");
+            return NULL;
+        }
+        edf_writer_t *w = calloc(1, sizeof(*w));
+        if (w == NULL || edf_writer_open(w, spec, config->sample_rate) != 0) {
+            free(w);
+            return NULL;
+        }
+        sink_t *sink = new_sink(&edf_ops, w, spec);
+        if (sink == NULL) {
+            edf_writer_close(w);
+            free(w);
+        }
+        return sink;
+    }
+    if (ext != NULL && strcmp(ext, ".bcap") == 0) {
+        capture_sink_t *c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            return NULL;
+        }
+        c->segmented = segmented;
+        if (segmented && seg_open(&c->segments, spec, segment_bytes, config->segment_s) != 0) {
+            free(c);
+            return NULL;
+        }
+        if (cap_writer_open(&c->capture, spec, segmented ? &c->segments : NULL, config->sample_rate) != 0) {
+            if (segmented) {
+                seg_close(&c->segments);
+            }
+            free(c);
+            return NULL;
+        }
+        sink_t *sink = new_sink(&capture_ops, c, spec);
+        if (sink == NULL) {
+            cap_writer_close(&c->capture);
+            free(c);
+        }
+        return sink;
+    }
+
+    csv_sink_t *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    if (segmented) {
+        if (seg_open(&c->segments, spec, segment_bytes, config->segment_s) != 0) {
+            free(c);
+            return NULL;
+        }
+    } else {
+        c->csv = fopen(spec, "w");
+        if (c->csv == NULL) {
+            perror("Unable to open CSV file");
+            free(c);
+            return NULL;
+        }
+        setvbuf(c->csv, c->buffer, _IOFBF, sizeof(c->buffer));
+    }
+    sink_t *sink = new_sink(&csv_ops, c, spec);
+    if (sink == NULL) {
+        if (segmented) {
+            seg_close(&c->segments);
+        } else {
+            fclose(c->csv);
+        }
+        free(c);
+    }
+    return sink;
+}
+
+sink_t *sink_open_pyramid(const char *path, float sample_rate, int append) {
+    summary_pyramid_t *sp = calloc(1, sizeof(*sp));
+    if (sp == NULL) {
+        return NULL;
+    }
+    sp_init(sp, path, sample_rate, append);
+    sink_t *sink = new_sink(&pyramid_ops, sp, path);
+    if (sink == NULL) {
+        sp_close(sp);
+        free(sp);
+    }
+    return sink;
+}
+
+sink_t *sink_open_spectrogram(const char *path, float sample_rate, int n_fft, int hop, int append,
+                              live_feed_t *lf) {
+    stft_sink_t *st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        return NULL;
+    }
+    for (int c = 0; c < SINK_CHANNELS; ++c) {
+        if (ppg_stft_init(&st->stft[c], n_fft, hop) != 0) {
+            free(st);
+            return NULL;
+        }
+        st->last[c] = NAN;
+    }
+    st->n_fft = n_fft;
+    st->hop = hop;
+    st->lf = lf;
+    // Without the file (reason printed) the columns still reach the live feed
+    sf_open(&st->file, path, SINK_CHANNELS, n_fft, hop, sample_rate, append);
+    sink_t *sink = new_sink(&stft_ops, st, path);
+    if (sink == NULL) {
+        sf_close(&st->file);
+        free(st);
+    }
+    return sink;
+}
+
+sink_t *sink_open_dsp(const char *path, float sample_rate, int annotate_hr, sink_fanout_t *out) {
+    dsp_sink_t *d = calloc(1, sizeof(*d));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->pl = path != NULL ? pl_load(path, sample_rate) : pl_load_text(PL_DEFAULT_GRAPH, "built-in graph", sample_rate);
+    if (d->pl == NULL) {
+        free(d);
+        return NULL;
+    }
+    pl_set_output(d->pl, dsp_output, d);
+    d->report = path != NULL;
+    d->out = out;
+    d->annotate_hr = annotate_hr;
+    d->hr_bpm = NAN;
+    d->spo2 = NAN;
+    sink_t *sink = new_sink(&dsp_ops, d, path != NULL ? path : "");
+    if (sink == NULL) {
+        pl_close(d->pl, NULL);
+        free(d);
+    }
+    return sink;
+}
+
+sink_t *sink_open_live(live_feed_t *lf) {
+    live_feed_t **state = malloc(sizeof(*state));
+    if (state == NULL) {
+        return NULL;
+    }
+    *state = lf;
+    sink_t *sink = new_sink(&live_ops, state, lf->name);
+    if (sink == NULL) {
+        free(state);
+    }
+    return sink;
+}
+
+sink_t *sink_open_console(void) {
+    float *spo2 = malloc(sizeof(*spo2));
+    if (spo2 == NULL) {
+        return NULL;
+    }
+    *spo2 = NAN;
+    sink_t *sink = new_sink(&console_ops, spo2, "");
+    if (sink == NULL) {
+        free(spo2);
+    }
+    return sink;
+}
+
+sink_t *sink_open_gaps(const char *path) {
+    gaps_sink_t *gs = calloc(1, sizeof(*gs));
+    if (gs == NULL) {
+        return NULL;
+    }
+    snprintf(gs->path, sizeof(gs->path), "%s", path);
+    gs->csv = fopen(path, "w");
+    if (gs->csv == NULL) {
+        perror("Unable to open gap file");
+        free(gs);
+        return NULL;
+    }
+    fprintf(gs->csv, "kind,seq_from,seq_to,missing,t_from,t_to\n");
+    sink_t *sink = new_sink(&gaps_ops, gs, path);
+    if (sink == NULL) {
+        fclose(gs->csv);
+        remove(path);
+        free(gs);
+    }
+    return sink;
+}
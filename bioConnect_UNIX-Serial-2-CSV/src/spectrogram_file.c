@@ -0,0 +1,91 @@
+/*
+ *  Title: Spectrogram File
+ *  Description: Writer of the spectrogram columns of a recording, see spectrogram_file.h.
+ */
+
+#include "spectrogram_file.h"
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock_sync.h"
+
+// Open the file of an earlier session for appending. Returns NULL if there is none, or if its
+// columns were computed differently, so it is started over.
+static FILE *continue_file(const char *name, int n_channels, int n_fft, int hop) {
+    FILE *f = fopen(name, "r+b");
+    if (f == NULL) {
+        return NULL;
+    }
+    sf_file_header_t h;
+    if (fread(&h, 1, sizeof(h), f) != sizeof(h) || memcmp(h.magic, SF_MAGIC, 4) != 0
+            || h.version != SF_VERSION || h.n_channels != n_channels || h.n_fft != (uint32_t)n_fft
+            || h.hop != (uint32_t)hop || h.n_bins != SF_BINS || fseek(f, 0, SEEK_END) != 0) {
+        printf("%s is not a spectrogram of this recording, starting it over\n", name);
+        fclose(f);
+        return NULL;
+    }
+    // A column cut off by a crash of the earlier session is dropped
+    long size = ftell(f);
+    long whole = (long)sizeof(h) + (size - (long)sizeof(h)) / (long)sizeof(sf_column_t) * (long)sizeof(sf_column_t);
+    if (whole != size && (ftruncate(fileno(f), whole) != 0 || fseek(f, whole, SEEK_SET) != 0)) {
+        perror(name);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+int sf_open(spectrogram_file_t *sf, const char *recording_path, int n_channels, int n_fft, int hop,
+            float sample_rate, int append) {
+    memset(sf, 0, sizeof(*sf));
+    const char *slash = strrchr(recording_path, '/');
+    const char *ext = strrchr(slash ? slash : recording_path, '.');
+    int base_len = ext ? (int)(ext - recording_path) : (int)strlen(recording_path);
+    char name[1024];
+    snprintf(name, sizeof(name), "%.*s_stft.bin", base_len, recording_path);
+    sf->file = append ? continue_file(name, n_channels, n_fft, hop) : NULL;
+    if (sf->file != NULL) {
+        return 0;
+    }
+    sf->file = fopen(name, "wb");
+    if (sf->file == NULL) {
+        perror("Unable to open spectrogram file");
+        return -1;
+    }
+
+    sf_file_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SF_MAGIC, 4);
+    h.version = SF_VERSION;
+    h.n_channels = (uint16_t)n_channels;
+    h.n_fft = (uint32_t)n_fft;
+    h.hop = (uint32_t)hop;
+    h.n_bins = SF_BINS;
+    h.sample_rate = sample_rate;
+    h.t_created = cs_wall_now();
+    fwrite(&h, 1, sizeof(h), sf->file);
+    return 0;
+}
+
+void sf_write(spectrogram_file_t *sf, double t, int channel, const float *power_db, int n_bins) {
+    if (sf->file == NULL) {
+        return;
+    }
+    sf_column_t c;
+    c.t = t;
+    c.channel = (uint32_t)channel;
+    for (int k = 0; k < SF_BINS; ++k) {
+        c.power_db[k] = (k < n_bins) ? power_db[k] : NAN;
+    }
+    fwrite(&c, 1, sizeof(c), sf->file);
+    sf->columns_written++;
+}
+
+void sf_close(spectrogram_file_t *sf) {
+    if (sf->file != NULL && fclose(sf->file) != 0) {
+        perror("Error closing spectrogram file");
+    }
+    sf->file = NULL;
+}
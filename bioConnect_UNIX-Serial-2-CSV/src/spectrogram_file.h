@@ -0,0 +1,61 @@
+/*
+ *  Title: Spectrogram File
+ *  Description: Spectrogram columns of a recording for offline viewing, written next to it as
+ *               <base>_stft.bin while recording:
+ *
+ *                   sf_file_header_t                          once
+ *                   sf_column_t                               repeated, channels interleaved
+ *
+ *               Every column holds the power of one channel in dB for the bins 0 .. n_bins - 1
+ *               (0 Hz to sample_rate / 2) over the last n_fft samples, see ppg_stft_t. The column
+ *               layout is the same as in the live feed, so a viewer reads both the same way.
+ *               All fields are little endian.
+ */
+
+#ifndef SPECTROGRAM_FILE_H
+#define SPECTROGRAM_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SF_MAGIC "BSTF"
+#define SF_VERSION 1
+#define SF_BINS 257                          // n_fft = 512: 5.12 s frames, 0.195 Hz bins at 100 Hz
+
+typedef struct {
+    char     magic[4];                       // SF_MAGIC
+    uint16_t version;
+    uint16_t n_channels;
+    uint32_t n_fft;
+    uint32_t hop;
+    uint32_t n_bins;                         // SF_BINS
+    float    sample_rate;                    // nominal rate of the samples in Hz
+    double   t_created;                      // host wall clock
+    uint8_t  reserved[32];
+} sf_file_header_t;
+
+typedef struct {
+    double   t;                              // host time of the newest sample of the frame
+    uint32_t channel;                        // 0 = Red, 1 = IR
+    float    power_db[SF_BINS];
+} sf_column_t;
+
+_Static_assert(sizeof(sf_file_header_t) == 64, "spectrogram file header layout");
+_Static_assert(sizeof(sf_column_t) == 1040, "spectrogram column layout");
+
+typedef struct {
+    FILE    *file;
+    uint64_t columns_written;
+} spectrogram_file_t;
+
+// Create <base>_stft.bin for the recording path, or with append continue the file of an earlier
+// session if it has the same layout (a segmented recording). Returns 0 on success.
+int sf_open(spectrogram_file_t *sf, const char *recording_path, int n_channels, int n_fft, int hop,
+            float sample_rate, int append);
+
+// Append one column of n_bins (at most SF_BINS) values, missing bins are written as nan
+void sf_write(spectrogram_file_t *sf, double t, int channel, const float *power_db, int n_bins);
+
+void sf_close(spectrogram_file_t *sf);
+
+#endif // SPECTROGRAM_FILE_H
@@ -0,0 +1,199 @@
+/*
+ *  Title: Summary Pyramid
+ *  Description: Incremental min/max/mean pyramid writer, see summary_pyramid.h.
+ */
+
+#include "summary_pyramid.h"
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock_sync.h"
+
+static void acc_reset(sp_acc_t *a) {
+    memset(a, 0, sizeof(*a));
+    for (int c = 0; c < SP_CHANNELS; ++c) {
+        a->min[c] = NAN;
+        a->max[c] = NAN;
+    }
+}
+
+// Open the level file of an earlier session for appending and count its entries. Returns NULL if
+// there is none, or if it is not a level l file of this layout, so it is started over.
+static FILE *continue_level(const char *name, int l, uint64_t *n_entries) {
+    FILE *f = fopen(name, "r+b");
+    if (f == NULL) {
+        return NULL;
+    }
+    sp_file_header_t h;
+    if (fread(&h, 1, sizeof(h), f) != sizeof(h) || memcmp(h.magic, SP_MAGIC, 4) != 0
+            || h.version != SP_VERSION || h.level != l + 1 || h.factor != SP_FACTOR
+            || h.n_channels != SP_CHANNELS || fseek(f, 0, SEEK_END) != 0) {
+        printf("%s is not a pyramid level of this recording, starting it over\n", name);
+        fclose(f);
+        return NULL;
+    }
+    // An entry cut off by a crash of the earlier session is dropped
+    long size = ftell(f);
+    long whole = (long)sizeof(h) + (size - (long)sizeof(h)) / (long)sizeof(sp_entry_t) * (long)sizeof(sp_entry_t);
+    if (whole != size && (ftruncate(fileno(f), whole) != 0 || fseek(f, whole, SEEK_SET) != 0)) {
+        perror(name);
+        fclose(f);
+        return NULL;
+    }
+    *n_entries = (uint64_t)(whole - (long)sizeof(h)) / sizeof(sp_entry_t);
+    return f;
+}
+
+static FILE *open_level(summary_pyramid_t *sp, int l) {
+    char name[sizeof(sp->base) + 32];
+    snprintf(name, sizeof(name), "%s_pyr%d.bin", sp->base, l + 1);
+    FILE *f = sp->append ? continue_level(name, l, &sp->n_entries[l]) : NULL;
+    if (f != NULL) {
+        return f;
+    }
+    f = fopen(name, "wb");
+    if (f == NULL) {
+        perror("Unable to open pyramid file");
+        return NULL;
+    }
+
+    sp_file_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SP_MAGIC, 4);
+    h.version = SP_VERSION;
+    h.level = (uint16_t)(l + 1);
+    h.factor = SP_FACTOR;
+    h.n_channels = SP_CHANNELS;
+    h.t_created = cs_wall_now();
+    h.sample_rate = sp->sample_rate;
+    fwrite(&h, 1, sizeof(h), f);
+    fflush(f);
+    return f;
+}
+
+void sp_init(summary_pyramid_t *sp, const char *recording_path, float sample_rate, int append) {
+    memset(sp, 0, sizeof(*sp));
+    const char *slash = strrchr(recording_path, '/');
+    const char *ext = strrchr(slash ? slash : recording_path, '.');
+    int base_len = ext ? (int)(ext - recording_path) : (int)strlen(recording_path);
+    snprintf(sp->base, sizeof(sp->base), "%.*s", base_len, recording_path);
+    sp->sample_rate = sample_rate;
+    sp->append = append;
+    for (int l = 0; l < SP_MAX_LEVELS; ++l) {
+        acc_reset(&sp->acc[l]);
+        sp->level[l] = open_level(sp, l);
+    }
+}
+
+static void write_entry(summary_pyramid_t *sp, int l) {
+    const sp_acc_t *a = &sp->acc[l];
+    FILE *f = sp->level[l];
+    if (f == NULL) {
+        return;
+    }
+    sp_entry_t e;
+    e.t_first = a->t_first;
+    e.t_last = a->t_last;
+    for (int c = 0; c < SP_CHANNELS; ++c) {
+        e.min[c] = a->min[c];
+        e.max[c] = a->max[c];
+        e.mean[c] = a->n_sum[c] ? (float)(a->sum[c] / a->n_sum[c]) : NAN;
+    }
+    e.n_rows = a->n_rows;
+    e.n_valid = a->n_valid;
+    fwrite(&e, 1, sizeof(e), f);
+    sp->n_entries[l]++;
+    sp->dirty = 1;
+    sp->entries_written++;
+}
+
+// Merge the accumulator of level l into level l + 1
+static void merge_up(summary_pyramid_t *sp, int l) {
+    const sp_acc_t *a = &sp->acc[l];
+    sp_acc_t *p = &sp->acc[l + 1];
+    if (p->n_children == 0) {
+        p->t_first = a->t_first;
+    }
+    p->t_last = a->t_last;
+    for (int c = 0; c < SP_CHANNELS; ++c) {
+        if (!isnan(a->min[c]) && (isnan(p->min[c]) || a->min[c] < p->min[c])) p->min[c] = a->min[c];
+        if (!isnan(a->max[c]) && (isnan(p->max[c]) || a->max[c] > p->max[c])) p->max[c] = a->max[c];
+        p->sum[c] += a->sum[c];
+        p->n_sum[c] += a->n_sum[c];
+    }
+    p->n_rows += a->n_rows;
+    p->n_valid += a->n_valid;
+    p->n_children++;
+}
+
+// Level l is complete: write it, pass it up and start the next entry
+static void complete(summary_pyramid_t *sp, int l) {
+    write_entry(sp, l);
+    if (l + 1 < SP_MAX_LEVELS) {
+        merge_up(sp, l);
+        if (sp->acc[l + 1].n_children == SP_FACTOR) {
+            complete(sp, l + 1);
+        }
+    }
+    acc_reset(&sp->acc[l]);
+}
+
+void sp_add(summary_pyramid_t *sp, double t, const float *value) {
+    sp_acc_t *a = &sp->acc[0];
+    if (a->n_children == 0) {
+        a->t_first = t;
+    }
+    a->t_last = t;
+    int valid = 0;
+    for (int c = 0; c < SP_CHANNELS; ++c) {
+        float v = value[c];
+        if (isnan(v)) {
+            continue;
+        }
+        if (isnan(a->min[c]) || v < a->min[c]) a->min[c] = v;
+        if (isnan(a->max[c]) || v > a->max[c]) a->max[c] = v;
+        a->sum[c] += v;
+        a->n_sum[c]++;
+        valid = 1;
+    }
+    a->n_rows++;
+    a->n_valid += (uint32_t)valid;
+    if (++a->n_children == SP_FACTOR) {
+        complete(sp, 0);
+    }
+}
+
+void sp_flush(summary_pyramid_t *sp) {
+    if (!sp->dirty) {
+        return;
+    }
+    for (int l = 0; l < SP_MAX_LEVELS; ++l) {
+        if (sp->level[l] != NULL) {
+            fflush(sp->level[l]);
+        }
+    }
+    sp->dirty = 0;
+}
+
+void sp_close(summary_pyramid_t *sp) {
+    // Write the tail of the recording at every level that summarises more than one entry below,
+    // so each level covers the whole recording
+    for (int l = 0; l < SP_MAX_LEVELS; ++l) {
+        sp_acc_t *a = &sp->acc[l];
+        if (a->n_children == 0 || (l > 0 && a->n_children < 2 && sp->n_entries[l] == 0)) {
+            continue;
+        }
+        write_entry(sp, l);
+        if (l + 1 < SP_MAX_LEVELS) {
+            merge_up(sp, l);
+        }
+    }
+    for (int l = 0; l < SP_MAX_LEVELS; ++l) {
+        if (sp->level[l] != NULL) {
+            fclose(sp->level[l]);
+            sp->level[l] = NULL;
+        }
+    }
+}
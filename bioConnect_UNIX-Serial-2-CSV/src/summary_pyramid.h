@@ -0,0 +1,91 @@
+/*
+ *  Title: Summary Pyramid
+ *  Description: Multi-resolution min/max/mean summary of a recording for fast zooming. Level 1 holds
+ *               one entry per SP_FACTOR samples, every further level one entry per SP_FACTOR entries of
+ *               the level below. Each level is a file of fixed-size entries next to the recording
+ *               (<base>_pyr1.bin, <base>_pyr2.bin, ...), so a viewer picks the level with about one
+ *               entry per pixel and reads just the entries of the visible time range.
+ *
+ *               The pyramid is built incrementally while recording: an entry is appended as soon as
+ *               its samples are complete, the partially filled entries are written on close. Every
+ *               level file is opened when the pyramid is, so recording opens no file; a level the
+ *               recording has not reached yet holds just its header. A
+ *               segmented recording continues over sessions, and so does its pyramid: the entries of
+ *               a new session are appended to the level files of the earlier ones.
+ *               All fields are little endian.
+ */
+
+#ifndef SUMMARY_PYRAMID_H
+#define SUMMARY_PYRAMID_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SP_MAGIC "BPYR"
+#define SP_VERSION 1
+#define SP_FACTOR 16
+#define SP_MAX_LEVELS 6                      // level 6 entries cover 16^6 samples, 46 h at 100 Hz
+#define SP_CHANNELS 2                        // 0 = Red, 1 = IR
+
+typedef struct {
+    char     magic[4];                       // SP_MAGIC
+    uint16_t version;
+    uint16_t level;                          // 1 = summary of SP_FACTOR samples
+    uint32_t factor;
+    uint32_t n_channels;
+    double   t_created;                      // host wall clock
+    float    sample_rate;                    // nominal rate of the samples in Hz
+    uint8_t  reserved[4];
+} sp_file_header_t;
+
+typedef struct {
+    double   t_first;                        // host time of the first and last sample covered
+    double   t_last;
+    float    min[SP_CHANNELS];               // over valid samples, nan if there are none
+    float    max[SP_CHANNELS];
+    float    mean[SP_CHANNELS];
+    uint32_t n_rows;                         // samples covered, including missing ones
+    uint32_t n_valid;                        // samples that are not missing
+} sp_entry_t;
+
+_Static_assert(sizeof(sp_file_header_t) == 32, "pyramid file header layout");
+_Static_assert(sizeof(sp_entry_t) == 48, "pyramid entry layout");
+
+typedef struct {
+    double   t_first;
+    double   t_last;
+    float    min[SP_CHANNELS];
+    float    max[SP_CHANNELS];
+    double   sum[SP_CHANNELS];
+    uint32_t n_sum[SP_CHANNELS];
+    uint32_t n_rows;
+    uint32_t n_valid;
+    int      n_children;                     // samples or entries of the level below merged so far
+} sp_acc_t;
+
+typedef struct {
+    char     base[512];                      // level files are <base>_pyrN.bin
+    float    sample_rate;
+    int      append;                         // continue the level files of earlier sessions
+    FILE    *level[SP_MAX_LEVELS];           // NULL if it could not be opened
+    uint64_t n_entries[SP_MAX_LEVELS];       // in the level file, of earlier sessions too
+    int      dirty;
+    sp_acc_t acc[SP_MAX_LEVELS];
+    uint64_t entries_written;
+} summary_pyramid_t;
+
+// Name the level files after the recording path without its extension and open them. With append
+// the level files of earlier sessions are continued, otherwise they are started over. A level file
+// that cannot be opened is reported and left out.
+void sp_init(summary_pyramid_t *sp, const char *recording_path, float sample_rate, int append);
+
+// Add one sample, missing values are nan
+void sp_add(summary_pyramid_t *sp, double t, const float *value);
+
+// Make the entries written so far visible to readers
+void sp_flush(summary_pyramid_t *sp);
+
+// Write the partially filled entries and close the level files
+void sp_close(summary_pyramid_t *sp);
+
+#endif // SUMMARY_PYRAMID_H
@@ -0,0 +1,448 @@
+/*
+ *  Title: Batch
+ *  Description: Re-runs the DSP over archived CSV recordings (data.csv style, one IR value per line,
+ *               optionally followed by the host time) using all cores, and writes the detected beats
+ *               of every recording to <base>_features.csv plus one summary line per recording. Rows
+ *               without a time are placed BATCH_FS after the last row with one, or at row / BATCH_FS
+ *               before the first, the same times `start_reader pyramid` gives them:
+ *
+ *                   start_reader batch -s summary.csv ../Export
+ *
+ *               Each file is memory mapped. Large files are split into newline-aligned chunks that
+ *               the other threads parse, while the calling thread runs the DSP over the parsed chunks
+ *               in file order as they become ready. The DSP state is thus handed from one chunk to
+ *               the next exactly as in the reader, and the results do not depend on the number of
+ *               threads. Small files are processed whole, one per thread.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "latency_trace.h"
+#include "ppg_dsp.h"
+#include "tools.h"
+
+#define BATCH_MAX_FILES 65536
+#define BATCH_FS 100.0f                      // Sample rate of rows without a time column
+#define PARALLEL_FILE_BYTES (8 << 20)        // Files from this size are parsed by all threads
+#define PARSE_CHUNK_BYTES (1 << 20)          // Target chunk size for parallel parsing
+
+typedef struct {
+    const char *begin;                       // newline-aligned part of the mapping
+    const char *end;
+    float      *value;                       // nan for missing samples
+    double     *t;                           // nan if the row has no time
+    size_t      n;
+    size_t      cap;
+    int         parsed;                      // set by the parsing thread when done
+} parse_chunk_t;
+
+typedef struct {
+    const char *path;
+    uint64_t    bytes;
+    uint64_t    rows;
+    uint64_t    valid;
+    uint64_t    beats;
+    double      t_first, t_last;
+    double      hr_sum, hr_min, hr_max;
+    double      ms;
+    int         ok;
+} batch_result_t;
+
+typedef struct {
+    char          **files;
+    batch_result_t *results;
+    int             n_files;
+    int            *queue;                   // small files, processed one per thread
+    int             n_queue;
+    int             next;                    // next queue entry to take, shared by the workers
+    const char     *out_dir;
+
+    // Chunks of the large file being parsed by all threads
+    parse_chunk_t  *chunks;
+    int             n_chunks;
+    int             next_chunk;
+} batch_job_t;
+
+// Parse a decimal number like "-12.5", "2294" or "nan". Returns the position after it, or NULL.
+static const char *parse_number(const char *p, const char *end, double *out) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p++ == '-';
+    }
+    if (end - p >= 3 && (p[0] | 0x20) == 'n' && (p[1] | 0x20) == 'a' && (p[2] | 0x20) == 'n') {
+        *out = NAN;
+        return p + 3;
+    }
+    const char *start = p;
+    uint64_t ip = 0;
+    while (p < end && (unsigned)(*p - '0') < 10 && ip < (1ULL << 59)) {
+        ip = ip * 10 + (uint64_t)(*p++ - '0');
+    }
+    double v = (double)ip;
+    if (p < end && *p == '.') {
+        uint64_t frac = 0, scale = 1;
+        for (++p; p < end && (unsigned)(*p - '0') < 10; ++p) {
+            if (scale < 1000000000000ULL) {
+                frac = frac * 10 + (uint64_t)(*p - '0');
+                scale *= 10;
+            }
+        }
+        v += (double)frac / (double)scale;
+    }
+    if (p == start || (p < end && ((*p | 0x20) == 'e' || (unsigned)(*p - '0') < 10))) {
+        // Exponent or more digits than fit: let strtod handle the rare case
+        char buf[64];
+        size_t len = 0;
+        for (const char *q = start; q < end && len < sizeof(buf) - 1 && *q != ',' && *q != '\n'; ++q) {
+            buf[len++] = *q;
+        }
+        buf[len] = '\0';
+        char *stop;
+        v = strtod(buf, &stop);
+        if (stop == buf) {
+            return NULL;
+        }
+        p = start + (stop - buf);
+    }
+    *out = neg ? -v : v;
+    return p;
+}
+
+static void parse_chunk(parse_chunk_t *c) {
+    const char *p = c->begin;
+    while (p < c->end) {
+        const char *eol = memchr(p, '\n', (size_t)(c->end - p));
+        if (eol == NULL) {
+            eol = c->end;
+        }
+        double v, t = NAN;
+        const char *q = parse_number(p, eol, &v);
+        if (q != NULL) {
+            if (q < eol && *q == ',' && parse_number(q + 1, eol, &t) == NULL) {
+                t = NAN;
+            }
+            if (c->n == c->cap) {
+                c->cap = c->cap ? c->cap * 2 : 1 << 16;
+                c->value = realloc(c->value, c->cap * sizeof(float));
+                c->t = realloc(c->t, c->cap * sizeof(double));
+            }
+            c->value[c->n] = (float)v;
+            c->t[c->n] = t;
+            c->n++;
+        }  // else: header or empty line
+        p = eol + 1;
+    }
+}
+
+// Split [data, data + size) into n newline-aligned chunks
+static int split_chunks(const char *data, size_t size, int n, parse_chunk_t *chunks) {
+    const char *begin = data, *end = data + size;
+    int k = 0;
+    for (int i = 1; i <= n && begin < end; ++i) {
+        const char *cut = (i == n) ? end : data + size / n * i;
+        if (cut < begin) {
+            cut = begin;
+        }
+        const char *nl = (cut < end) ? memchr(cut, '\n', (size_t)(end - cut)) : NULL;
+        cut = nl ? nl + 1 : end;
+        memset(&chunks[k], 0, sizeof(chunks[k]));
+        chunks[k].begin = begin;
+        chunks[k].end = cut;
+        begin = cut;
+        k++;
+    }
+    return k;
+}
+
+static void *parse_worker(void *arg) {
+    batch_job_t *job = (batch_job_t *)arg;
+    int i;
+    while ((i = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->n_chunks) {
+        parse_chunk(&job->chunks[i]);
+        __atomic_store_n(&job->chunks[i].parsed, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+typedef struct {
+    ppg_dsp_t       dsp;
+    uint64_t        row;
+    double          t_known;                 // time of the last row that had one, nan before
+    uint64_t        row_known;
+    FILE           *features;
+    batch_result_t *res;
+} dsp_run_t;
+
+static void dsp_begin(dsp_run_t *run, FILE *features, batch_result_t *res) {
+    ppg_dsp_init(&run->dsp, BATCH_FS);
+    run->row = 0;
+    run->t_known = NAN;
+    run->features = features;
+    run->res = res;
+    res->t_first = NAN;
+    res->hr_min = INFINITY;
+    res->hr_max = -INFINITY;
+}
+
+// Continue the DSP with the next chunk of the file and write the beats
+static void dsp_chunk(dsp_run_t *run, const parse_chunk_t *c) {
+    batch_result_t *res = run->res;
+    for (size_t i = 0; i < c->n; ++i, ++run->row) {
+        double t = c->t[i];
+        if (!isnan(t)) {
+            run->t_known = t;
+            run->row_known = run->row;
+        } else if (isnan(run->t_known)) {
+            t = (double)run->row / BATCH_FS;
+        } else {
+            t = run->t_known + (double)(run->row - run->row_known) / BATCH_FS;
+        }
+        if (isnan(c->value[i])) {
+            continue;  // missing sample, the time of the next one keeps the beat intervals right
+        }
+        if (res->valid++ == 0) {
+            res->t_first = t;
+        }
+        res->t_last = t;
+        float proc_val;
+        if (ppg_dsp_process(&run->dsp, 0.0f, c->value[i], t, &proc_val)) {
+            res->beats++;
+            res->hr_sum += run->dsp.hr_bpm;
+            res->hr_min = fmin(res->hr_min, run->dsp.hr_bpm);
+            res->hr_max = fmax(res->hr_max, run->dsp.hr_bpm);
+            if (run->features != NULL) {
+                fprintf(run->features, "%.3f,%.2f,%.2f\n", t, run->dsp.hr_bpm, run->dsp.hr_bpm_filt);
+            }
+        }
+    }
+    res->rows = run->row;
+}
+
+static void features_path(const char *path, const char *out_dir, char *out, size_t size) {
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    const char *ext = strrchr(name, '.');
+    int name_len = ext ? (int)(ext - name) : (int)strlen(name);
+    if (out_dir != NULL) {
+        snprintf(out, size, "%s/%.*s_features.csv", out_dir, name_len, name);
+    } else {
+        snprintf(out, size, "%.*s_features.csv", (int)(name - path) + name_len, path);
+    }
+}
+
+// Process one file. With threads > 1 the file is parsed by that many threads.
+static void process_file(batch_job_t *job, int index, int threads) {
+    batch_result_t *res = &job->results[index];
+    memset(res, 0, sizeof(*res));
+    res->path = job->files[index];
+
+    int fd = open(res->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(res->path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    res->bytes = (uint64_t)st.st_size;
+    const char *data = NULL;
+    if (st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(res->path);
+            close(fd);
+            return;
+        }
+        madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+
+    char out[2048];
+    features_path(res->path, job->out_dir, out, sizeof(out));
+    FILE *features = fopen(out, "w");
+    if (features == NULL) {
+        perror(out);
+    } else {
+        setvbuf(features, NULL, _IOFBF, 1 << 16);
+        fprintf(features, "t,hr_bpm,hr_bpm_filt\n");
+    }
+    dsp_run_t run;
+    dsp_begin(&run, features, res);
+
+    uint64_t t0 = lt_now_us();
+    int n_wanted = 1;
+    if (threads > 1) {
+        n_wanted = (int)(res->bytes / PARSE_CHUNK_BYTES);
+        if (n_wanted < threads) n_wanted = threads;
+    }
+    parse_chunk_t *chunks = calloc((size_t)n_wanted, sizeof(parse_chunk_t));
+    int n_chunks = split_chunks(data, (size_t)st.st_size, n_wanted, chunks);
+    pthread_t *tid = NULL;
+    if (threads > 1) {
+        job->chunks = chunks;
+        job->n_chunks = n_chunks;
+        job->next_chunk = 0;
+        tid = malloc((size_t)threads * sizeof(pthread_t));
+        for (int i = 1; i < threads; ++i) {
+            pthread_create(&tid[i], NULL, parse_worker, job);
+        }
+    }
+
+    // DSP over the chunks in file order, each one as soon as it is parsed
+    for (int k = 0; k < n_chunks; ++k) {
+        if (tid == NULL) {
+            parse_chunk(&chunks[k]);
+        } else {
+            while (!__atomic_load_n(&chunks[k].parsed, __ATOMIC_ACQUIRE)) {
+                sched_yield();
+            }
+        }
+        dsp_chunk(&run, &chunks[k]);
+        free(chunks[k].value);
+        free(chunks[k].t);
+    }
+    if (tid != NULL) {
+        for (int i = 1; i < threads; ++i) {
+            pthread_join(tid[i], NULL);
+        }
+        free(tid);
+    }
+    if (features != NULL) {
+        res->ok = fclose(features) == 0;
+    }
+    res->ms = (lt_now_us() - t0) * 1e-3;
+
+    free(chunks);
+    if (data != NULL) {
+        munmap((void *)data, (size_t)st.st_size);
+    }
+    close(fd);
+}
+
+static void *file_worker(void *arg) {
+    batch_job_t *job = (batch_job_t *)arg;
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n_queue) {
+        process_file(job, job->queue[i], 1);
+    }
+    return NULL;
+}
+
+// Files written by the reader and the tools next to the recordings
+static int is_recording(const char *path) {
+    static const char *derived[] = { "_gaps.csv", "_index.csv", "_features.csv", "_summary.csv" };
+    size_t len = strlen(path);
+    for (size_t i = 0; i < sizeof(derived) / sizeof(derived[0]); ++i) {
+        size_t n = strlen(derived[i]);
+        if (len >= n && strcmp(path + len - n, derived[i]) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int tool_batch(int argc, char *argv[]) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_dir = NULL, *summary_path = NULL;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "j:o:s:h")) != -1) {
+        switch (opt) {
+            case 'j': threads = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 's': summary_path = optarg; break;
+            default:
+                printf("Usage: batch [-j threads] [-o features_dir] [-s summary.csv] dir|file.csv ...\n");
+                return opt != 'h';
+        }
+    }
+    if (optind >= argc || threads < 1) {
+        printf("Usage: batch [-j threads] [-o features_dir] [-s summary.csv] dir|file.csv ...\n");
+        return 1;
+    }
+
+    static char *listed[BATCH_MAX_FILES];
+    int n_listed = tools_list_files(argv + optind, argc - optind, ".csv", listed, BATCH_MAX_FILES);
+    batch_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.files = malloc((n_listed ? n_listed : 1) * sizeof(char *));
+    for (int i = 0; i < n_listed; ++i) {
+        if (is_recording(listed[i])) {
+            job.files[job.n_files++] = listed[i];
+        } else {
+            free(listed[i]);
+        }
+    }
+    job.results = calloc(job.n_files ? job.n_files : 1, sizeof(batch_result_t));
+    job.out_dir = out_dir;
+    uint64_t t_start = lt_now_us();
+
+    // Large files one after the other with all threads parsing, then the small ones one per thread
+    job.queue = malloc((job.n_files ? job.n_files : 1) * sizeof(int));
+    for (int i = 0; i < job.n_files; ++i) {
+        struct stat st;
+        if (threads > 1 && stat(job.files[i], &st) == 0 && st.st_size >= PARALLEL_FILE_BYTES) {
+            process_file(&job, i, threads);
+        } else {
+            job.queue[job.n_queue++] = i;
+        }
+    }
+    int workers = (threads < job.n_queue) ? threads : (job.n_queue ? job.n_queue : 1);
+    pthread_t *tid = malloc((size_t)workers * sizeof(pthread_t));
+    for (int i = 1; i < workers; ++i) {
+        pthread_create(&tid[i], NULL, file_worker, &job);
+    }
+    file_worker(&job);
+    for (int i = 1; i < workers; ++i) {
+        pthread_join(tid[i], NULL);
+    }
+    free(tid);
+    double total_ms = (lt_now_us() - t_start) * 1e-3;
+
+    // Summary
+    FILE *summary = NULL;
+    if (summary_path != NULL && (summary = fopen(summary_path, "w")) == NULL) {
+        perror(summary_path);
+    }
+    if (summary != NULL) {
+        fprintf(summary, "file,rows,valid,t_first,t_last,beats,hr_mean,hr_min,hr_max\n");
+    }
+    uint64_t total_bytes = 0, total_rows = 0, total_beats = 0;
+    int failed = 0;
+    for (int i = 0; i < job.n_files; ++i) {
+        const batch_result_t *r = &job.results[i];
+        failed += !r->ok;
+        total_bytes += r->bytes;
+        total_rows += r->rows;
+        total_beats += r->beats;
+        double hr = r->beats ? r->hr_sum / r->beats : NAN;
+        printf("%s: %llu rows, %llu beats, HR %.1f bpm (%.1f ms)\n", r->path,
+               (unsigned long long)r->rows, (unsigned long long)r->beats, hr, r->ms);
+        if (summary != NULL) {
+            fprintf(summary, "%s,%llu,%llu,%.3f,%.3f,%llu,%.2f,%.2f,%.2f\n", r->path,
+                    (unsigned long long)r->rows, (unsigned long long)r->valid, r->t_first, r->t_last,
+                    (unsigned long long)r->beats, hr, r->beats ? r->hr_min : NAN, r->beats ? r->hr_max : NAN);
+        }
+    }
+    if (summary != NULL) {
+        fclose(summary);
+    }
+    printf("%d files, %llu rows, %llu beats in %.1f ms on %d threads (%.0f MB/s)%s\n", job.n_files,
+           (unsigned long long)total_rows, (unsigned long long)total_beats, total_ms, threads,
+           total_bytes / (total_ms * 1e3), failed ? ", some features could not be written" : "");
+
+    for (int i = 0; i < job.n_files; ++i) {
+        free(job.files[i]);
+    }
+    free(job.files);
+    free(job.results);
+    free(job.queue);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/*
+ *  Title: Codec Bench
+ *  Description: Measures compression ratio and encode/decode throughput of the PPG codec on the
+ *               first column of CSV recordings (Export/data.csv style) and checks the round trip.
+ *               Decoding is measured with the SIMD paths of the decoder and with the scalar code.
+ *
+ *               start_reader codec-bench ../Export/data.csv
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_trace.h"
+#include "ppg_codec.h"
+#include "tools.h"
+
+#define BENCH_MIN_US 300000   // Repeat encode/decode for at least 0.3 s
+
+// Append the integer first column of a CSV file to *values, skipping empty and "nan" rows.
+// Returns the number of bytes of the file or -1 on error.
+static long load_column(const char *path, int32_t **values, size_t *n, size_t *cap) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    long bytes = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        bytes += (long)strlen(line);
+        char *end;
+        double v = strtod(line, &end);
+        if (end == line || isnan(v)) {
+            continue;
+        }
+        if (*n == *cap) {
+            size_t grown = *cap ? *cap * 2 : 4096;
+            int32_t *more = realloc(*values, grown * sizeof(int32_t));
+            if (more == NULL) {
+                perror("Unable to allocate samples");
+                fclose(f);
+                return -1;
+            }
+            *values = more;
+            *cap = grown;
+        }
+        (*values)[(*n)++] = (int32_t)lrint(v);
+    }
+    fclose(f);
+    return bytes;
+}
+
+// Decode every block repeatedly for BENCH_MIN_US. Returns the seconds per round, *ok is cleared if a
+// block is malformed or the values do not round trip.
+static double decode_all(const uint8_t *encoded, const size_t *offsets, size_t n_blocks, size_t n,
+                         const int32_t *values, int32_t *decoded, int *ok) {
+    uint64_t t0 = lt_now_us(), t1;
+    long rounds = 0;
+    do {
+        for (size_t b = 0; b < n_blocks; ++b) {
+            size_t first = b * PC_BLOCK_SIZE;
+            int len = (int)((n - first < PC_BLOCK_SIZE) ? n - first : PC_BLOCK_SIZE);
+            if (pc_decode_block(encoded + offsets[b], offsets[b + 1] - offsets[b], len, decoded + first) == 0) {
+                *ok = 0;
+            }
+        }
+        rounds++;
+        t1 = lt_now_us();
+    } while (t1 - t0 < BENCH_MIN_US);
+    *ok = *ok && memcmp(values, decoded, n * sizeof(int32_t)) == 0;
+    return (t1 - t0) * 1e-6 / rounds;
+}
+
+int tool_codec_bench(int argc, char *argv[]) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+        printf("Usage: codec-bench file.csv [file.csv ...]\n");
+        return argc < 2;
+    }
+
+    int32_t *values = NULL;
+    size_t n = 0, cap = 0;
+    long ascii_bytes = 0;
+    for (int i = 1; i < argc; ++i) {
+        long b = load_column(argv[i], &values, &n, &cap);
+        if (b < 0) {
+            free(values);
+            return 1;
+        }
+        ascii_bytes += b;
+    }
+    if (n == 0) {
+        printf("No samples found.\n");
+        free(values);
+        return 1;
+    }
+
+    size_t n_blocks = (n + PC_BLOCK_SIZE - 1) / PC_BLOCK_SIZE;
+    uint8_t *encoded = malloc(n_blocks * PC_BLOCK_MAX_BYTES);
+    size_t *offsets = malloc((n_blocks + 1) * sizeof(size_t));
+    int32_t *decoded = malloc(n * sizeof(int32_t));
+    if (encoded == NULL || offsets == NULL || decoded == NULL) {
+        perror("Unable to allocate bench");
+        free(values);
+        free(encoded);
+        free(offsets);
+        free(decoded);
+        return 1;
+    }
+
+    // Encode
+    uint64_t t0 = lt_now_us(), t1;
+    long rounds_enc = 0;
+    do {
+        size_t pos = 0;
+        for (size_t b = 0; b < n_blocks; ++b) {
+            size_t first = b * PC_BLOCK_SIZE;
+            int len = (int)((n - first < PC_BLOCK_SIZE) ? n - first : PC_BLOCK_SIZE);
+            offsets[b] = pos;
+            pos += pc_encode_block(values + first, len, encoded + pos);
+        }
+        offsets[n_blocks] = pos;
+        rounds_enc++;
+        t1 = lt_now_us();
+    } while (t1 - t0 < BENCH_MIN_US);
+    double enc_s = (t1 - t0) * 1e-6 / rounds_enc;
+
+    // Decode, with the SIMD paths if the build has them and with the scalar code
+    int ok = 1;
+    int simd = pc_set_simd(1);
+    double dec_s = decode_all(encoded, offsets, n_blocks, n, values, decoded, &ok);
+    double scalar_s = dec_s;
+    if (simd) {
+        pc_set_simd(0);
+        memset(decoded, 0, n * sizeof(int32_t));
+        scalar_s = decode_all(encoded, offsets, n_blocks, n, values, decoded, &ok);
+        pc_set_simd(1);
+    }
+
+    size_t enc_bytes = offsets[n_blocks];
+    printf("Samples:          %zu in %zu blocks of %d\n", n, n_blocks, PC_BLOCK_SIZE);
+    printf("CSV text:         %ld bytes (%.2f bytes/sample)\n", ascii_bytes, (double)ascii_bytes / n);
+    printf("Raw int32:        %zu bytes\n", n * sizeof(int32_t));
+    printf("Encoded:          %zu bytes (%.2f bits/sample)\n", enc_bytes, 8.0 * enc_bytes / n);
+    printf("Ratio vs CSV:     %.2f x\n", (double)ascii_bytes / enc_bytes);
+    printf("Ratio vs int32:   %.2f x\n", (double)(n * sizeof(int32_t)) / enc_bytes);
+    printf("Encode:           %.1f Msamples/s (%.0f MB/s of int32)\n", n / enc_s * 1e-6, n * 4.0 / enc_s * 1e-6);
+    if (simd) {
+        printf("Decode SIMD:      %.1f Msamples/s (%.0f MB/s of int32)\n", n / dec_s * 1e-6, n * 4.0 / dec_s * 1e-6);
+    }
+    printf("Decode scalar:    %.1f Msamples/s (%.0f MB/s of int32)\n", n / scalar_s * 1e-6,
+           n * 4.0 / scalar_s * 1e-6);
+    printf("Round trip:       %s\n", ok ? "lossless" : "MISMATCH");
+
+    free(values);
+    free(encoded);
+    free(offsets);
+    free(decoded);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/*
+ *  Title: Pyramid
+ *  Description: Builds the min/max/mean summary pyramid for a recording made without one, from a
+ *               .bcap capture (both channels) or a CSV file of the reader (IR only, "value[,t]" rows;
+ *               rows without a time are placed 10 ms after the last row with one, or at row / 100 Hz
+ *               before the first, as in `start_reader batch`).
+ *
+ *               start_reader pyramid ../Export/data.csv
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_reader.h"
+#include "summary_pyramid.h"
+#include "tools.h"
+
+#define CSV_FS 100.0f
+
+static int pyramid_from_capture(summary_pyramid_t *sp, const char *path) {
+    cap_reader_t r;
+    if (cap_reader_open(&r, path) != 0) {
+        return -1;
+    }
+    sp_init(sp, path, r.header->sample_rate, 0);
+
+    // Chunk by chunk, so the decoded columns of a long capture are touched only once
+    for (size_t k = 0; k < cap_reader_chunk_count(&r); ++k) {
+        size_t b = r.chunks[k].row_first;
+        size_t e = b + cap_reader_chunk(&r, k)->n_samples;
+        cap_span_f64_t t = cap_reader_times(&r, b, e);
+        cap_span_i32_t red = cap_reader_channel(&r, 0, b, e);
+        cap_span_i32_t ir = cap_reader_channel(&r, 1, b, e);
+        cap_span_u8_t valid = cap_reader_valid(&r, b, e);
+        if (t.len != e - b) {
+            break;  // corrupt chunk, reported by the reader
+        }
+        for (size_t i = 0; i < t.len; ++i) {
+            float v[SP_CHANNELS] = { NAN, NAN };
+            if (valid.data[i]) {
+                v[0] = (float)red.data[i];
+                v[1] = (float)ir.data[i];
+            }
+            sp_add(sp, t.data[i], v);
+        }
+    }
+    cap_reader_close(&r);
+    return 0;
+}
+
+static int pyramid_from_csv(summary_pyramid_t *sp, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    sp_init(sp, path, CSV_FS, 0);
+
+    char line[256];
+    unsigned long row = 0, row_known = 0;
+    double t_known = NAN;      // time of the last row that had one
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *end, *t_end;
+        double v = strtod(line, &end);
+        if (end == line) {
+            continue;  // header or empty line
+        }
+        double t = NAN;
+        if (*end == ',') {
+            t = strtod(end + 1, &t_end);
+            if (t_end == end + 1) {
+                t = NAN;
+            }
+        }
+        if (!isnan(t)) {
+            t_known = t;
+            row_known = row;
+        } else if (isnan(t_known)) {
+            t = (double)row / CSV_FS;
+        } else {
+            t = t_known + (double)(row - row_known) / CSV_FS;
+        }
+        float values[SP_CHANNELS] = { NAN, (float)v };
+        sp_add(sp, t, values);
+        row++;
+    }
+    fclose(f);
+    return 0;
+}
+
+int tool_pyramid(int argc, char *argv[]) {
+    if (argc != 2 || strcmp(argv[1], "-h") == 0) {
+        printf("Usage: pyramid file.bcap|file.csv\n");
+        return argc != 2;
+    }
+
+    summary_pyramid_t sp;
+    const char *slash = strrchr(argv[1], '/');
+    const char *ext = strrchr(slash ? slash : argv[1], '.');
+    int rc = (ext != NULL && strcmp(ext, ".bcap") == 0) ? pyramid_from_capture(&sp, argv[1])
+                                                         : pyramid_from_csv(&sp, argv[1]);
+    if (rc != 0) {
+        return 1;
+    }
+    sp_close(&sp);
+    printf("%s: %llu entries written to %s_pyr*.bin\n", argv[1], (unsigned long long)sp.entries_written, sp.base);
+    return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ *  Title: Query
+ *  Description: Heart rate, SpO2 and signal quality of a time range of a capture archive, e.g. the
+ *               directory a device records its .bcap segments to:
+ *
+ *                   start_reader query "2026-10-17 14:02" "2026-10-17 14:05" ../Export/device3
+ *
+ *               Only data in the range is touched: segments outside it are skipped using the segment
+ *               index, chunks outside it are found with a binary search on the chunk headers, and
+ *               chunks whose statistics show no pulse (all samples missing, or an IR swing too small
+ *               for a beat) are counted without being decoded. The rest is split into parts that are
+ *               decoded and analysed by a pool of threads. Each part first runs the DSP over a few
+ *               seconds before its start, so beats at part boundaries are not lost.
+ */
+
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture_reader.h"
+#include "latency_trace.h"
+#include "ppg_dsp.h"
+#include "tools.h"
+
+#define QUERY_MAX_FILES 4096
+#define PART_CHUNKS 16             // Chunks analysed by one task
+#define WARMUP_S 5.0               // DSP warm-up before every part
+#define WINDOW_S_DEFAULT 4.0       // SpO2 window
+#define MIN_IR_SWING 10            // Chunks with a smaller IR range have no detectable beat
+
+typedef struct {
+    cap_reader_t *reader;
+    size_t row_warm;               // DSP starts here
+    size_t row_begin;              // statistics from here
+    size_t row_end;
+} query_part_t;
+
+typedef struct {
+    uint64_t rows, valid;
+    uint64_t signal;               // valid rows at most one beat interval (at min_hr_bpm) after a beat
+    uint64_t chunks_decoded, chunks_skipped;
+    uint64_t beats;
+    double   hr_sum, hr_min, hr_max;
+    uint64_t windows;
+    double   spo2_sum, spo2_min, spo2_max, pi_sum;
+} query_result_t;
+
+typedef struct {
+    query_part_t   *parts;
+    query_result_t *results;
+    int             n_parts;
+    int             next;          // next part to take, shared by the workers
+    double          window_s;
+} query_job_t;
+
+static void result_init(query_result_t *q) {
+    memset(q, 0, sizeof(*q));
+    q->hr_min = q->spo2_min = INFINITY;
+    q->hr_max = q->spo2_max = -INFINITY;
+}
+
+static void result_merge(query_result_t *q, const query_result_t *p) {
+    q->rows += p->rows;
+    q->valid += p->valid;
+    q->signal += p->signal;
+    q->chunks_decoded += p->chunks_decoded;
+    q->chunks_skipped += p->chunks_skipped;
+    q->beats += p->beats;
+    q->hr_sum += p->hr_sum;
+    q->hr_min = fmin(q->hr_min, p->hr_min);
+    q->hr_max = fmax(q->hr_max, p->hr_max);
+    q->windows += p->windows;
+    q->spo2_sum += p->spo2_sum;
+    q->spo2_min = fmin(q->spo2_min, p->spo2_min);
+    q->spo2_max = fmax(q->spo2_max, p->spo2_max);
+    q->pi_sum += p->pi_sum;
+}
+
+static void close_window(ppg_spo2_t *spo2, query_result_t *q) {
+    float s, pi;
+    if (ppg_spo2_window(spo2, &s, &pi)) {
+        q->windows++;
+        q->spo2_sum += s;
+        q->spo2_min = fmin(q->spo2_min, s);
+        q->spo2_max = fmax(q->spo2_max, s);
+        q->pi_sum += pi;
+    }
+}
+
+static void run_part(const query_part_t *p, query_result_t *q, double window_s) {
+    cap_reader_t *r = p->reader;
+    float fs = r->header->sample_rate;
+    long window_rows = lround(window_s * fs);
+    long in_window = 0;
+
+    ppg_dsp_t dsp;
+    ppg_spo2_t spo2;
+    ppg_dsp_init(&dsp, fs);
+    ppg_spo2_init(&spo2);
+    result_init(q);
+
+    size_t k = cap_reader_chunk_of_row(r, p->row_warm);
+    for (; k < r->n_chunks && r->chunks[k].row_first < p->row_end; ++k) {
+        const cap_chunk_header_t *h = &r->chunks[k].header;
+        size_t b = r->chunks[k].row_first, e = b + h->n_samples;
+        if (b < p->row_warm) b = p->row_warm;
+        if (e > p->row_end) e = p->row_end;
+        size_t b_stat = (b > p->row_begin) ? b : p->row_begin;
+        size_t n_stat = (e > b_stat) ? e - b_stat : 0;
+
+        // Chunk statistics show there is nothing to detect: count the rows, restart the DSP
+        if (h->n_valid == 0 || h->stats[1].max - h->stats[1].min < MIN_IR_SWING) {
+            if (n_stat > 0) {
+                q->rows += n_stat;
+                q->valid += cap_reader_count_valid(r, b_stat, e);
+                q->chunks_skipped++;
+            }
+            ppg_dsp_init(&dsp, fs);
+            ppg_spo2_init(&spo2);
+            in_window = 0;
+            continue;
+        }
+
+        cap_span_f64_t t = cap_reader_times(r, b, e);
+        cap_span_i32_t red = cap_reader_channel(r, 0, b, e);
+        cap_span_i32_t ir = cap_reader_channel(r, 1, b, e);
+        cap_span_u8_t valid = cap_reader_valid(r, b, e);
+        if (t.len != e - b) {
+            continue;  // corrupt chunk, reported by the reader
+        }
+        if (n_stat > 0) {
+            q->chunks_decoded++;
+        }
+
+        for (size_t i = 0; i < t.len; ++i) {
+            size_t row = b + i;
+            if (row == p->row_begin) {
+                ppg_spo2_window(&spo2, &(float){ 0 }, &(float){ 0 });  // drop the warm-up sums
+                in_window = 0;
+            }
+            int stat = row >= p->row_begin;
+            q->rows += stat;
+            if (valid.data[i]) {
+                float proc_val;
+                q->valid += stat;
+                ppg_spo2_add(&spo2, (float)red.data[i], (float)ir.data[i]);
+                if (ppg_dsp_process(&dsp, (float)red.data[i], (float)ir.data[i], t.data[i], &proc_val) && stat) {
+                    q->beats++;
+                    q->hr_sum += dsp.hr_bpm;
+                    q->hr_min = fmin(q->hr_min, dsp.hr_bpm);
+                    q->hr_max = fmax(q->hr_max, dsp.hr_bpm);
+                }
+                // A pulse is present while beats come at least as often as the slowest heart rate
+                q->signal += stat && dsp.last_peak_t >= 0.0 && t.data[i] - dsp.last_peak_t <= 60.0 / dsp.min_hr_bpm;
+            }
+            if (stat && ++in_window == window_rows) {
+                close_window(&spo2, q);
+                in_window = 0;
+            }
+        }
+    }
+    // A last window of at least half the length still counts
+    if (in_window * 2 >= window_rows) {
+        close_window(&spo2, q);
+    }
+}
+
+static void *worker(void *arg) {
+    query_job_t *job = (query_job_t *)arg;
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n_parts) {
+        run_part(&job->parts[i], &job->results[i], job->window_s);
+    }
+    return NULL;
+}
+
+// Times of day and "+seconds" are relative to the start of the archive
+static int is_relative(const char *s) {
+    return s[0] == '+' || (strchr(s, ':') != NULL && strchr(s, '-') == NULL);
+}
+
+// Accepts "YYYY-MM-DD HH:MM[:SS]" (also with 'T'), "HH:MM[:SS]" on the day of day_ref, "+seconds"
+// after day_ref and plain Unix seconds. Local time. Returns 0 on success.
+static int parse_time(const char *s, double day_ref, double *t) {
+    struct tm tm;
+    int y, mo, d, h, mi;
+    double sec = 0;
+    char *end;
+
+    if (s[0] == '+') {
+        *t = day_ref + strtod(s + 1, &end);
+        return *end != '\0';
+    }
+    if (sscanf(s, "%d-%d-%d%*1[ T]%d:%d:%lf", &y, &mo, &d, &h, &mi, &sec) >= 5) {
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = y - 1900;
+        tm.tm_mon = mo - 1;
+        tm.tm_mday = d;
+    } else if (sscanf(s, "%d:%d:%lf", &h, &mi, &sec) >= 2) {
+        time_t ref = (time_t)day_ref;
+        localtime_r(&ref, &tm);
+    } else {
+        *t = strtod(s, &end);
+        return *end != '\0';
+    }
+    tm.tm_hour = h;
+    tm.tm_min = mi;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    *t = (double)mktime(&tm) + sec;
+    return 0;
+}
+
+static void format_time(double t, char *out, size_t size) {
+    time_t s = (time_t)t;
+    struct tm tm;
+    localtime_r(&s, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+typedef struct {
+    char   path[2 * SEG_NAME_SIZE];          // as listed by tools_list_files
+    double t_start;
+    double t_end;
+} segment_range_t;
+
+// Time range of every segment listed in the index files of a directory
+static int read_index(const char *dir, segment_range_t *ranges, int max) {
+    int n = 0;
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    while (d != NULL && (de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 10 || strcmp(de->d_name + len - 10, "_index.csv") != 0) {
+            continue;
+        }
+        char path[2 * SEG_NAME_SIZE];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        FILE *f = fopen(path, "r");
+        char line[2 * SEG_NAME_SIZE], kind[16], name[SEG_NAME_SIZE];
+        double t;
+        while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "%15[^,],%511[^,],%*[^,],%*[^,],%lf", kind, name, &t) != 3) {
+                continue;
+            }
+            char seg_path[2 * SEG_NAME_SIZE];
+            snprintf(seg_path, sizeof(seg_path), "%s/%s", dir, name);
+            int i = 0;
+            while (i < n && strcmp(ranges[i].path, seg_path) != 0) i++;
+            if (i == n) {
+                if (n == max) break;
+                snprintf(ranges[n].path, sizeof(ranges[n].path), "%s", seg_path);
+                ranges[n].t_start = t;
+                ranges[n].t_end = INFINITY;  // still recording or not closed properly
+                n++;
+            }
+            if (strcmp(kind, "end") == 0) {
+                ranges[i].t_end = t;
+            }
+        }
+        if (f != NULL) fclose(f);
+    }
+    if (d != NULL) closedir(d);
+    return n;
+}
+
+// Collect the .bcap files of the arguments, expanding directories. Files that the segment index
+// places outside [t0, t1) are left out when the range is known.
+static int collect_files(char **args, int n_args, char **files, int max, double t0, double t1, int *n_pruned) {
+    static segment_range_t ranges[QUERY_MAX_FILES];
+    int n_ranges = 0;
+    for (int a = 0; a < n_args && t1 > t0; ++a) {
+        n_ranges += read_index(args[a], ranges + n_ranges, QUERY_MAX_FILES - n_ranges);
+    }
+
+    int n_listed = tools_list_files(args, n_args, ".bcap", files, max);
+    int n = 0;
+    for (int f = 0; f < n_listed; ++f) {
+        int i = 0;
+        while (i < n_ranges && strcmp(ranges[i].path, files[f]) != 0) i++;
+        if (i < n_ranges && (ranges[i].t_end < t0 || ranges[i].t_start >= t1)) {
+            (*n_pruned)++;
+            free(files[f]);
+            continue;
+        }
+        files[n++] = files[f];
+    }
+    return n;
+}
+
+int tool_query(int argc, char *argv[]) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double window_s = WINDOW_S_DEFAULT;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "j:w:h")) != -1) {
+        switch (opt) {
+            case 'j': threads = atoi(optarg); break;
+            case 'w': window_s = atof(optarg); break;
+            default:
+                printf("Usage: query [-j threads] [-w spo2_window_s] from to archive_dir|file.bcap ...\n"
+                       "  from/to: \"YYYY-MM-DD HH:MM[:SS]\", \"HH:MM[:SS]\" on the day the archive starts,\n"
+                       "           \"+seconds\" after the start of the archive or Unix seconds\n");
+                return opt != 'h';
+        }
+    }
+    if (argc - optind < 3 || threads < 1 || window_s <= 0) {
+        printf("Usage: query [-j threads] [-w spo2_window_s] from to archive_dir|file.bcap ...\n");
+        return 1;
+    }
+    const char *from = argv[optind], *to = argv[optind + 1];
+    uint64_t t_start_us = lt_now_us();
+
+    // Absolute times allow pruning with the segment index, relative ones are resolved once the
+    // start of the archive is known
+    double t0 = 0, t1 = 0;
+    int relative = is_relative(from) || is_relative(to);
+    if (!relative && (parse_time(from, 0, &t0) != 0 || parse_time(to, 0, &t1) != 0)) {
+        printf("Invalid time range: %s to %s\n", from, to);
+        return 1;
+    }
+
+    static char *files[QUERY_MAX_FILES];
+    int n_pruned = 0;
+    int n_files = collect_files(argv + optind + 2, argc - optind - 2, files, QUERY_MAX_FILES, t0, t1, &n_pruned);
+    cap_reader_t *readers = calloc(n_files ? n_files : 1, sizeof(cap_reader_t));
+    int n_open = 0;
+    double archive_start = INFINITY;
+    for (int i = 0; i < n_files; ++i) {
+        if (cap_reader_open(&readers[n_open], files[i]) == 0) {
+            if (readers[n_open].n_chunks > 0) {
+                archive_start = fmin(archive_start, readers[n_open].chunks[0].header.t_first);
+            }
+            n_open++;
+        }
+        free(files[i]);
+    }
+    if (n_open == 0) {
+        printf("No captures found.\n");
+        free(readers);
+        return 1;
+    }
+    if (relative && (parse_time(from, archive_start, &t0) != 0 || parse_time(to, archive_start, &t1) != 0)) {
+        printf("Invalid time range: %s to %s\n", from, to);
+        for (int i = 0; i < n_open; ++i) cap_reader_close(&readers[i]);
+        free(readers);
+        return 1;
+    }
+
+    // Split the rows in range into parts of PART_CHUNKS chunks
+    size_t n_parts = 0, cap_parts = 64, n_chunks_total = 0;
+    query_part_t *parts = malloc(cap_parts * sizeof(*parts));
+    int failed = parts == NULL;
+    for (int i = 0; i < n_open && !failed; ++i) {
+        cap_reader_t *r = &readers[i];
+        size_t b, e;
+        n_chunks_total += r->n_chunks;
+        if (cap_reader_find_time(r, t0, t1, &b, &e) == 0) {
+            continue;
+        }
+        size_t warm = (size_t)lround(WARMUP_S * r->header->sample_rate);
+        size_t k = cap_reader_chunk_of_row(r, b);
+        while (b < e && !failed) {
+            size_t k_end = k + PART_CHUNKS;
+            size_t part_end = (k_end < r->n_chunks) ? r->chunks[k_end].row_first : r->n_rows;
+            if (part_end > e) part_end = e;
+            if (n_parts == cap_parts) {
+                query_part_t *more = realloc(parts, 2 * cap_parts * sizeof(*parts));
+                if (more == NULL) {
+                    failed = 1;
+                    break;
+                }
+                parts = more;
+                cap_parts *= 2;
+            }
+            parts[n_parts].reader = r;
+            parts[n_parts].row_warm = (b > warm) ? b - warm : 0;
+            parts[n_parts].row_begin = b;
+            parts[n_parts].row_end = part_end;
+            n_parts++;
+            b = part_end;
+            k = k_end;
+        }
+    }
+
+    query_job_t job = { parts, NULL, (int)n_parts, 0, window_s };
+    if (threads > (int)n_parts) threads = n_parts ? (int)n_parts : 1;
+    pthread_t *tid = NULL;
+    if (!failed) {
+        job.results = calloc(n_parts ? n_parts : 1, sizeof(query_result_t));
+        tid = malloc(threads * sizeof(pthread_t));
+        failed = job.results == NULL || tid == NULL;
+    }
+    if (failed) {
+        perror("Unable to allocate query");
+        for (int i = 0; i < n_open; ++i) cap_reader_close(&readers[i]);
+        free(readers);
+        free(parts);
+        free(job.results);
+        free(tid);
+        return 1;
+    }
+    for (int i = 1; i < threads; ++i) {
+        pthread_create(&tid[i], NULL, worker, &job);
+    }
+    worker(&job);
+    for (int i = 1; i < threads; ++i) {
+        pthread_join(tid[i], NULL);
+    }
+
+    query_result_t q;
+    result_init(&q);
+    for (size_t i = 0; i < n_parts; ++i) {
+        result_merge(&q, &job.results[i]);
+    }
+    double elapsed_ms = (lt_now_us() - t_start_us) * 1e-3;
+
+    char s0[32], s1[32];
+    format_time(t0, s0, sizeof(s0));
+    format_time(t1, s1, sizeof(s1));
+    printf("Range:      %s to %s (%.1f s)\n", s0, s1, t1 - t0);
+    printf("Files:      %d opened, %d skipped by the index\n", n_open, n_pruned);
+    printf("Chunks:     %llu decoded, %llu skipped by statistics, %zu outside the range\n",
+           (unsigned long long)q.chunks_decoded, (unsigned long long)q.chunks_skipped,
+           n_chunks_total - (size_t)(q.chunks_decoded + q.chunks_skipped));
+    if (q.rows == 0) {
+        printf("No samples in this range.\n");
+    } else {
+        printf("Samples:    %llu, %.1f %% valid, %.1f %% with pulse signal\n", (unsigned long long)q.rows,
+               100.0 * q.valid / q.rows, 100.0 * q.signal / q.rows);
+        if (q.beats > 0) {
+            printf("HR:         %.1f bpm (min %.1f, max %.1f, %llu beats)\n",
+                   q.hr_sum / q.beats, q.hr_min, q.hr_max, (unsigned long long)q.beats);
+        } else {
+            printf("HR:         no beats detected\n");
+        }
+        if (q.windows > 0) {
+            printf("SpO2:       %.1f %% (min %.1f, max %.1f, %llu windows of %.1f s, uncalibrated)\n",
+                   q.spo2_sum / q.windows, q.spo2_min, q.spo2_max, (unsigned long long)q.windows, window_s);
+            printf("Perfusion:  %.2f %%\n", q.pi_sum / q.windows);
+        } else {
+            printf("SpO2:       no window with a usable pulse\n");
+        }
+    }
+    printf("Time:       %.1f ms, %zu parts on %d threads\n", elapsed_ms, n_parts, threads);
+
+    for (int i = 0; i < n_open; ++i) {
+        cap_reader_close(&readers[i]);
+    }
+    free(readers);
+    free(parts);
+    free(job.results);
+    free(tid);
+    return 0;
+}
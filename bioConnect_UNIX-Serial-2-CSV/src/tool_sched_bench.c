@@ -0,0 +1,375 @@
+/*
+ *  Title: Scheduler Bench
+ *  Description: Throughput and tail latency of the DSP for many devices at once, scheduled by the
+ *               work-stealing pool (work_steal.h) against one thread per device:
+ *
+ *                   start_reader sched-bench -d 4,16,64 -j 8
+ *
+ *               Every simulated device delivers batches of BENCH_BATCH samples (one chunk read at
+ *               100 Hz) from a synthetic pulse and runs the beat detector and SpO2 on them. One device
+ *               in four also estimates the heart rate from the spectrum of both channels, so the cost
+ *               per device varies by two orders of magnitude as it does with mixed configurations.
+ *
+ *               Throughput: all batches of the recording are available at once and processed as fast
+ *               as possible. Latency: batches are released on the timeline of the recording, sped up
+ *               so the offered load is a share (-l) of the throughput of the pool; the latency of a
+ *               batch is the time from its release until it has been processed. The batches of one
+ *               device always run in order, a device is queued as one task that runs at most
+ *               BENCH_SLICE batches before it queues itself again behind the others.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ppg_dsp.h"
+#include "tools.h"
+#include "work_steal.h"
+
+#define BENCH_FS 100.0f
+#define BENCH_BATCH 10                       // samples per batch, 100 ms
+#define BENCH_SLICE 4                        // batches per task run
+#define BENCH_MAX_DEVICES 1024
+#define BENCH_SPO2_BATCHES 50                // SpO2 window, 5 s
+#define BENCH_HEAVY_EVERY 4                  // one device in four runs the spectral estimate
+
+typedef struct bench bench_t;
+
+typedef struct {
+    bench_t    *bench;
+    int         index;
+    int         heavy;
+    ppg_dsp_t   dsp;
+    ppg_spo2_t  spo2;
+    ppg_stft_t *stft[2];                     // Red, IR; heavy devices only
+    long        done;                        // batches processed, by the thread running the device
+    atomic_long released;                    // batches available
+    atomic_int  scheduled;                   // a task of the device is queued or running
+    ws_task_t   task;
+    double     *latency_us;                  // per batch
+    pthread_t   thread;
+    float       sink;                        // keeps the results alive
+} device_t;
+
+struct bench {
+    const float *red, *ir;                   // synthetic recording, n_samples long
+    long         n_samples;
+    long         n_batches;
+    device_t    *devices[BENCH_MAX_DEVICES];
+    int          n_devices;
+    ws_pool_t   *pool;
+    uint64_t     t0_us;
+    double       period_us;                  // between two batches, 0: all at once
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void sleep_until_us(uint64_t us) {
+    struct timespec ts = { (time_t)(us / 1000000u), (long)(us % 1000000u) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static uint64_t release_us(const bench_t *b, long k) {
+    return b->t0_us + (uint64_t)(b->period_us * (double)k);
+}
+
+static void process_batch(device_t *d, long k) {
+    const bench_t *b = d->bench;
+    long first = (k * BENCH_BATCH + d->index * 131L) % b->n_samples;
+    for (int j = 0; j < BENCH_BATCH; ++j) {
+        long i = (first + j) % b->n_samples;
+        float proc;
+        ppg_dsp_process(&d->dsp, b->red[i], b->ir[i], -1.0, &proc);
+        ppg_spo2_add(&d->spo2, b->red[i], b->ir[i]);
+        d->sink += proc;
+        if (d->heavy) {
+            if (ppg_stft_add(d->stft[0], b->red[i])) {
+                d->sink += d->stft[0]->power_db[1];
+            }
+            if (ppg_stft_add(d->stft[1], b->ir[i])) {
+                d->sink += d->stft[1]->power_db[1];
+            }
+        }
+    }
+    if ((k + 1) % BENCH_SPO2_BATCHES == 0) {
+        float spo2, perfusion;
+        if (ppg_spo2_window(&d->spo2, &spo2, &perfusion)) {
+            d->sink += spo2;
+        }
+    }
+    d->latency_us[k] = (double)(now_us() - release_us(b, k));
+}
+
+static int device_reset(device_t *d, bench_t *b, int index) {
+    d->bench = b;
+    d->index = index;
+    d->heavy = index % BENCH_HEAVY_EVERY == BENCH_HEAVY_EVERY - 1;
+    ppg_dsp_init(&d->dsp, BENCH_FS);
+    ppg_spo2_init(&d->spo2);
+    for (int c = 0; c < 2 && d->heavy; ++c) {
+        if (d->stft[c] == NULL && (d->stft[c] = malloc(sizeof(ppg_stft_t))) == NULL) {
+            return -1;
+        }
+        ppg_stft_init(d->stft[c], 1024, BENCH_BATCH);
+    }
+    if (d->latency_us == NULL && (d->latency_us = malloc((size_t)b->n_batches * sizeof(double))) == NULL) {
+        return -1;
+    }
+    d->done = 0;
+    atomic_store(&d->released, 0);
+    atomic_store(&d->scheduled, 0);
+    d->sink = 0.0f;
+    return 0;
+}
+
+// ------------------------------------------------------------------ Work stealing
+
+static void device_task(ws_task_t *task) {
+    device_t *d = (device_t *)task->arg;
+    long released = atomic_load_explicit(&d->released, memory_order_acquire);
+    long end = d->done + BENCH_SLICE < released ? d->done + BENCH_SLICE : released;
+    while (d->done < end) {
+        process_batch(d, d->done);
+        d->done++;
+    }
+    if (d->done < released) {
+        ws_submit(d->bench->pool, task);  // behind the devices waiting on this worker
+        return;
+    }
+    atomic_store(&d->scheduled, 0);
+    // A batch released after the load above would otherwise wait for the next one
+    if (atomic_load(&d->released) > d->done && !atomic_exchange(&d->scheduled, 1)) {
+        ws_submit(d->bench->pool, task);
+    }
+}
+
+static void release(bench_t *b, device_t *d, long n, ws_group_t *group) {
+    atomic_store_explicit(&d->released, n, memory_order_release);
+    if (!atomic_exchange(&d->scheduled, 1)) {
+        d->task = (ws_task_t){ device_task, d, group };
+        ws_submit(b->pool, &d->task);
+    }
+}
+
+static double run_stealing(bench_t *b, int threads) {
+    ws_group_t group = { 0 };
+    // All at once the calling thread helps from the start; paced it releases the batches and helps
+    // only with the last ones
+    b->pool = ws_start(b->period_us > 0.0 ? threads : (threads > 1 ? threads - 1 : 1));
+    if (b->pool == NULL) {
+        return -1.0;
+    }
+    b->t0_us = now_us();
+    if (b->period_us > 0.0) {
+        for (long k = 0; k < b->n_batches; ++k) {
+            sleep_until_us(release_us(b, k));
+            for (int i = 0; i < b->n_devices; ++i) {
+                release(b, b->devices[i], k + 1, &group);
+            }
+        }
+    } else {
+        for (int i = 0; i < b->n_devices; ++i) {
+            release(b, b->devices[i], b->n_batches, &group);
+        }
+    }
+    ws_wait(b->pool, &group);
+    double s = (double)(now_us() - b->t0_us) * 1e-6;
+    ws_stop(b->pool);
+    b->pool = NULL;
+    return s;
+}
+
+// ------------------------------------------------------------------ Thread per device
+
+static void *device_thread(void *arg) {
+    device_t *d = (device_t *)arg;
+    const bench_t *b = d->bench;
+    for (long k = 0; k < b->n_batches; ++k) {
+        if (b->period_us > 0.0) {
+            sleep_until_us(release_us(b, k));
+        }
+        process_batch(d, k);
+    }
+    return NULL;
+}
+
+static double run_threads(bench_t *b) {
+    b->t0_us = now_us();
+    int started = 0;
+    for (; started < b->n_devices; ++started) {
+        if (pthread_create(&b->devices[started]->thread, NULL, device_thread, b->devices[started]) != 0) {
+            perror("Unable to start device thread");
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(b->devices[i]->thread, NULL);
+    }
+    double s = (double)(now_us() - b->t0_us) * 1e-6;
+    return started == b->n_devices ? s : -1.0;
+}
+
+// ------------------------------------------------------------------ Report
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Latency percentiles in ms over every batch of every device
+static void latencies(const bench_t *b, double *all, double *p50, double *p99, double *max) {
+    size_t n = 0;
+    for (int i = 0; i < b->n_devices; ++i) {
+        memcpy(all + n, b->devices[i]->latency_us, (size_t)b->n_batches * sizeof(double));
+        n += (size_t)b->n_batches;
+    }
+    qsort(all, n, sizeof(double), compare_doubles);
+    *p50 = all[n / 2] * 1e-3;
+    *p99 = all[(size_t)((double)(n - 1) * 0.99)] * 1e-3;
+    *max = all[n - 1] * 1e-3;
+}
+
+static int parse_counts(const char *s, int *counts, int max) {
+    int n = 0;
+    while (*s != '\0' && n < max) {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s || v < 1 || v > BENCH_MAX_DEVICES) {
+            return -1;
+        }
+        counts[n++] = (int)v;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+int tool_sched_bench(int argc, char *argv[]) {
+    const char *usage = "Usage: sched-bench [-d devices,...] [-j threads] [-s seconds] [-l load]\n";
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int counts[16] = { 4, 16, 64 }, n_counts = 3;
+    double seconds = 60.0, load = 0.5;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "d:j:s:l:h")) != -1) {
+        switch (opt) {
+            case 'd': n_counts = parse_counts(optarg, counts, 16); break;
+            case 'j': threads = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'l': load = atof(optarg); break;
+            default:
+                printf("%s", usage);
+                return opt != 'h';
+        }
+    }
+    if (n_counts < 1 || threads < 1 || threads > WS_MAX_WORKERS || seconds < 1.0 || load <= 0.0 || load > 1.0) {
+        printf("%s", usage);
+        return 1;
+    }
+
+    bench_t b;
+    memset(&b, 0, sizeof(b));
+    b.n_batches = (long)(seconds * BENCH_FS) / BENCH_BATCH;
+    b.n_samples = b.n_batches * BENCH_BATCH;
+    float *red = malloc((size_t)b.n_samples * sizeof(float));
+    float *ir = malloc((size_t)b.n_samples * sizeof(float));
+    int max_devices = 0;
+    for (int c = 0; c < n_counts; ++c) {
+        max_devices = counts[c] > max_devices ? counts[c] : max_devices;
+    }
+    double *all = malloc((size_t)max_devices * (size_t)b.n_batches * sizeof(double));
+    int failed = red == NULL || ir == NULL || all == NULL;
+    for (long i = 0; i < b.n_samples && !failed; ++i) {
+        // 72 bpm pulse with breathing drift and noise on a DC level, as from the sensor
+        double t = (double)i / BENCH_FS;
+        double pulse = sin(2.0 * M_PI * 1.2 * t) + 0.3 * sin(2.0 * M_PI * 2.4 * t);
+        double drift = 20.0 * sin(2.0 * M_PI * 0.25 * t);
+        double noise = (double)(rand() % 200 - 100) * 0.05;
+        red[i] = (float)(30000.0 + 150.0 * pulse + drift + noise);
+        ir[i] = (float)(40000.0 + 300.0 * pulse + drift + noise);
+    }
+    b.red = red;
+    b.ir = ir;
+    for (int i = 0; i < max_devices && !failed; ++i) {
+        failed = (b.devices[i] = calloc(1, sizeof(device_t))) == NULL;
+    }
+    if (failed) {
+        perror("Unable to allocate bench");
+    }
+
+    printf("%ld batches of %d samples per device (%.0f s at %.0f Hz), 1 device in %d spectral, %d threads\n",
+           b.n_batches, BENCH_BATCH, seconds, BENCH_FS, BENCH_HEAVY_EVERY, threads);
+    printf("%8s  %-14s %8s %12s %10s %8s %9s %9s %9s\n", "devices", "schedule", "threads",
+           "Msamples/s", "x realtime", "speedup", "p50 ms", "p99 ms", "max ms");
+    for (int c = 0; c < n_counts && !failed; ++c) {
+        b.n_devices = counts[c];
+        double samples = (double)b.n_devices * (double)b.n_samples;
+
+        // Throughput, all batches at once
+        double s_steal = -1.0, s_threads = -1.0;
+        for (int mode = 0; mode < 2 && !failed; ++mode) {
+            b.period_us = 0.0;
+            for (int i = 0; i < b.n_devices && !failed; ++i) {
+                failed = device_reset(b.devices[i], &b, i) != 0;
+            }
+            if (failed) {
+                break;
+            }
+            double s = mode == 0 ? run_stealing(&b, threads) : run_threads(&b);
+            failed = s < 0.0;
+            *(mode == 0 ? &s_steal : &s_threads) = s;
+        }
+        if (failed) {
+            break;
+        }
+
+        // Latency at a share of the throughput of the pool
+        double speed = load * seconds / s_steal;
+        b.period_us = BENCH_BATCH / BENCH_FS * 1e6 / speed;
+        for (int mode = 0; mode < 2 && !failed; ++mode) {
+            for (int i = 0; i < b.n_devices && !failed; ++i) {
+                failed = device_reset(b.devices[i], &b, i) != 0;
+            }
+            if (failed) {
+                break;
+            }
+            failed = (mode == 0 ? run_stealing(&b, threads) : run_threads(&b)) < 0.0;
+            if (failed) {
+                break;
+            }
+            double p50, p99, max;
+            latencies(&b, all, &p50, &p99, &max);
+            double s = mode == 0 ? s_steal : s_threads;
+            printf("%8d  %-14s %8d %12.2f %10.0f %7.2fx %9.2f %9.2f %9.2f\n", b.n_devices,
+                   mode == 0 ? "work stealing" : "thread/device", mode == 0 ? threads : b.n_devices,
+                   samples / s * 1e-6, seconds * b.n_devices / s, s_threads / s, p50, p99, max);
+        }
+        printf("%8s  latency with each device at %.1fx real time, %.0f%% of the work-stealing throughput\n",
+               "", speed, load * 100.0);
+    }
+    if (failed) {
+        printf("Bench stopped.\n");
+    }
+
+    for (int i = 0; i < max_devices; ++i) {
+        if (b.devices[i] != NULL) {
+            free(b.devices[i]->stft[0]);
+            free(b.devices[i]->stft[1]);
+            free(b.devices[i]->latency_us);
+            free(b.devices[i]);
+        }
+    }
+    free(all);
+    free(red);
+    free(ir);
+    return failed;
+}
@@ -0,0 +1,225 @@
+/*
+ *  Title: Sink Bench
+ *  Description: Disk throughput and blocking of the CSV sinks for many devices recording at once,
+ *               stdio against io_uring (uring_writer.h):
+ *
+ *                   start_reader sink-bench -n 32 -s 600 /mnt/data
+ *
+ *               Every device has a writer thread of its own, as a sink of the fan-out has, and hands
+ *               its recording to the sink in batches of SINK_BATCH samples, each followed by a flush,
+ *               as fast as the sink takes them. The time of every write and flush is the time the
+ *               thread of the sink would be blocked and its queue fill up in the reader.
+ *
+ *               Throughput is given twice: until every sink is closed, and until the files have
+ *               also been synced, since stdio leaves most of the data in the page cache at close.
+ *               The files are removed after each run.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "latency_trace.h"
+#include "sink.h"
+#include "tools.h"
+#include "uring_writer.h"
+
+#define BENCH_FS 100.0f
+#define BENCH_MAX_DEVICES 256
+
+typedef struct {
+    const char    *prefix;                   // "" or "uring:"
+    char           path[512];
+    long           n_samples;
+    int            index;
+    sink_t        *sink;
+    lt_histogram_t calls;                    // write and flush of one batch, in us
+    uw_stats_t     uring;                    // io_uring sinks only
+    int            failed;
+    pthread_t      thread;
+} device_t;
+
+static void *device_thread(void *arg) {
+    device_t *d = (device_t *)arg;
+    sink_sample_t batch[SINK_BATCH];
+    memset(batch, 0, sizeof(batch));
+    for (long i = 0; i < d->n_samples; i += SINK_BATCH) {
+        size_t n = (size_t)(d->n_samples - i < SINK_BATCH ? d->n_samples - i : SINK_BATCH);
+        for (size_t j = 0; j < n; ++j) {
+            // 72 bpm pulse on the DC level of the sensor, so the rows are as long as recorded ones
+            double t = (double)(i + (long)j) / BENCH_FS;
+            double pulse = sin(2.0 * M_PI * 1.2 * t + d->index);
+            batch[j].t = 1.7e9 + t;
+            batch[j].value[0] = (float)(40000.0 + 300.0 * pulse);
+            batch[j].value[1] = (float)(30000.0 + 150.0 * pulse);
+            batch[j].seq = (uint32_t)(i + (long)j);
+            batch[j].flags = SINK_VALID;
+        }
+        uint64_t t0 = lt_now_us();
+        d->sink->ops->write(d->sink, batch, n);
+        d->sink->ops->flush(d->sink);
+        lt_hist_add(&d->calls, lt_now_us() - t0);
+    }
+    if (strcmp(d->sink->ops->kind, "uring") == 0) {
+        uw_stats(d->sink->state, &d->uring);
+    }
+    return NULL;
+}
+
+// Run one kind of sink on every device. Returns -1 if a sink could not be opened or written.
+static int run(device_t *devices, int n_devices, const char *kind, double *s_closed, double *s_synced,
+               uint64_t *bytes) {
+    sink_config_t config = { BENCH_FS, 0.0, 0.0 };
+    int failed = 0, opened = 0;
+    for (; opened < n_devices && !failed; ++opened) {
+        char spec[600];
+        snprintf(spec, sizeof(spec), "%s%s", devices[opened].prefix, devices[opened].path);
+        failed = (devices[opened].sink = sink_open(spec, &config)) == NULL;
+    }
+    if (failed) {
+        opened--;
+    }
+
+    // The io_uring sinks print their statistics at close, they are summed up here instead
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    uint64_t t0 = lt_now_us();
+    int started = 0;
+    for (; started < opened && !failed; ++started) {
+        if (pthread_create(&devices[started].thread, NULL, device_thread, &devices[started]) != 0) {
+            perror("Unable to start writer thread");
+            failed = 1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(devices[i].thread, NULL);
+    }
+    if (saved_stdout >= 0 && devnull >= 0) {
+        dup2(devnull, STDOUT_FILENO);
+    }
+    for (int i = 0; i < opened; ++i) {
+        devices[i].sink->ops->close(devices[i].sink);
+        devices[i].sink = NULL;
+    }
+    fflush(stdout);
+    if (saved_stdout >= 0 && devnull >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+    }
+    if (saved_stdout >= 0) {
+        close(saved_stdout);
+    }
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    *s_closed = (double)(lt_now_us() - t0) * 1e-6;
+
+    *bytes = 0;
+    for (int i = 0; i < opened; ++i) {
+        int fd = open(devices[i].path, O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            *bytes += (uint64_t)lseek(fd, 0, SEEK_END);
+            close(fd);
+        }
+    }
+    *s_synced = (double)(lt_now_us() - t0) * 1e-6;
+    for (int i = 0; i < opened; ++i) {
+        unlink(devices[i].path);
+    }
+    if (failed) {
+        printf("Unable to run the %s sinks\n", kind);
+    }
+    return failed ? -1 : 0;
+}
+
+int tool_sink_bench(int argc, char *argv[]) {
+    const char *usage = "Usage: sink-bench [-n devices] [-s seconds] [directory]\n";
+    int n_devices = 32;
+    double seconds = 600.0;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+        switch (opt) {
+            case 'n': n_devices = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            default:
+                printf("%s", usage);
+                return opt != 'h';
+        }
+    }
+    const char *dir = optind < argc ? argv[optind] : ".";
+    if (n_devices < 1 || n_devices > BENCH_MAX_DEVICES || seconds < 1.0) {
+        printf("%s", usage);
+        return 1;
+    }
+
+    device_t *devices = calloc((size_t)n_devices, sizeof(device_t));
+    if (devices == NULL) {
+        perror("Unable to allocate bench");
+        return 1;
+    }
+    long n_samples = (long)(seconds * BENCH_FS);
+    printf("%d devices writing %ld samples each (%.0f s at %.0f Hz) to %s, batches of %d\n", n_devices,
+           n_samples, seconds, BENCH_FS, dir, SINK_BATCH);
+    printf("%-7s %8s %10s %10s %9s %9s %9s %11s  %s\n", "sink", "MB", "MB/s", "synced", "p50 us", "p99 us",
+           "max us", "blocked ms", "io_uring");
+
+    static const char *const kinds[] = { "csv", "uring" };
+    int failed = 0;
+    for (int k = 0; k < 2 && !failed; ++k) {
+        for (int i = 0; i < n_devices; ++i) {
+            memset(&devices[i], 0, sizeof(devices[i]));
+            devices[i].prefix = k == 0 ? "" : "uring:";
+            devices[i].n_samples = n_samples;
+            devices[i].index = i;
+            snprintf(devices[i].path, sizeof(devices[i].path), "%s/sink-bench-%s-%d.csv", dir, kinds[k], i);
+        }
+        double s_closed, s_synced;
+        uint64_t bytes;
+        failed = run(devices, n_devices, kinds[k], &s_closed, &s_synced, &bytes) != 0;
+        if (failed) {
+            break;
+        }
+
+        lt_histogram_t all;
+        memset(&all, 0, sizeof(all));
+        all.min_us = UINT64_MAX;
+        uw_stats_t uring = { 0 };
+        for (int i = 0; i < n_devices; ++i) {
+            const lt_histogram_t *h = &devices[i].calls;
+            all.count += h->count;
+            all.sum_us += h->sum_us;
+            all.min_us = h->min_us < all.min_us ? h->min_us : all.min_us;
+            all.max_us = h->max_us > all.max_us ? h->max_us : all.max_us;
+            for (int b = 0; b < LT_BUCKETS; ++b) {
+                all.buckets[b] += h->buckets[b];
+            }
+            uring.writes += devices[i].uring.writes;
+            uring.stall_us += devices[i].uring.stall_us;
+            uring.direct += devices[i].uring.direct;
+            uring.fixed += devices[i].uring.fixed;
+        }
+        double mb = (double)bytes / (1024.0 * 1024.0);
+        char detail[96] = "";
+        if (k == 1) {
+            snprintf(detail, sizeof(detail), "%llu writes, %d/%d O_DIRECT, %d/%d fixed, stalled %.1f ms",
+                     (unsigned long long)uring.writes, uring.direct, n_devices, uring.fixed, n_devices,
+                     uring.stall_us * 1e-3);
+        }
+        printf("%-7s %8.1f %10.1f %10.1f %9llu %9llu %9llu %11.1f  %s\n", kinds[k], mb, mb / s_closed,
+               mb / s_synced, (unsigned long long)lt_percentile(&all, 50.0),
+               (unsigned long long)lt_percentile(&all, 99.0), (unsigned long long)all.max_us,
+               all.sum_us * 1e-3, detail);
+    }
+    if (failed) {
+        printf("Bench stopped.\n");
+    }
+    free(devices);
+    return failed;
+}
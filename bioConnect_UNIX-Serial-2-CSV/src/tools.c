@@ -0,0 +1,69 @@
+/*
+ *  Title: Tools
+ *  Description: Dispatch of the offline tools, see tools.h.
+ */
+
+#include "tools.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const tool_t tools[] = {
+    { "codec-bench", tool_codec_bench, "compression ratio and speed of the PPG codec on CSV files" },
+    { "capture-dump", tool_capture_dump, "print a .bcap capture or a time range of it as CSV" },
+    { "pyramid",      tool_pyramid,      "build the min/max/mean zoom pyramid of a recording" },
+    { "query",        tool_query,        "HR, SpO2 and signal quality of a time range of a capture archive" },
+    { "batch",        tool_batch,        "re-run the DSP over CSV recordings on all cores" },
+    { "sched-bench",  tool_sched_bench,  "DSP throughput and latency for many devices, work stealing vs a thread each" },
+    { "sink-bench",   tool_sink_bench,   "disk throughput and blocking of the CSV sinks for many devices, stdio vs io_uring" },
+};
+
+#define N_TOOLS (int)(sizeof(tools) / sizeof(tools[0]))
+
+void tools_print(FILE *out) {
+    for (int i = 0; i < N_TOOLS; ++i) {
+        fprintf(out, "  %-14s %s\n", tools[i].name, tools[i].summary);
+    }
+}
+
+int tools_run(int argc, char *argv[]) {
+    for (int i = 0; i < N_TOOLS; ++i) {
+        if (strcmp(argv[0], tools[i].name) == 0) {
+            return tools[i].run(argc, argv);
+        }
+    }
+    fprintf(stderr, "Unknown tool: %s\nTools:\n", argv[0]);
+    tools_print(stderr);
+    return 1;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int tools_list_files(char **args, int n_args, const char *ext, char **files, int max) {
+    size_t ext_len = strlen(ext);
+    int n = 0;
+    for (int a = 0; a < n_args && n < max; ++a) {
+        DIR *d = opendir(args[a]);
+        if (d == NULL) {
+            files[n++] = strdup(args[a]);
+            continue;
+        }
+        int first = n;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL && n < max) {
+            size_t len = strlen(de->d_name);
+            if (len <= ext_len || strcmp(de->d_name + len - ext_len, ext) != 0) {
+                continue;
+            }
+            size_t size = strlen(args[a]) + len + 2;
+            files[n] = malloc(size);
+            snprintf(files[n++], size, "%s/%s", args[a], de->d_name);
+        }
+        closedir(d);
+        qsort(files + first, n - first, sizeof(char *), compare_names);
+    }
+    return n;
+}
@@ -0,0 +1,40 @@
+/*
+ *  Title: Tools
+ *  Description: Offline tools built into the reader binary, run as "start_reader <tool> [args]".
+ *               They share the capture and DSP modules with the reader, so there is still a single
+ *               program to build.
+ */
+
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include <stdio.h>
+
+typedef int (*tool_fn)(int argc, char *argv[]);
+
+typedef struct {
+    const char *name;
+    tool_fn     run;
+    const char *summary;
+} tool_t;
+
+// argv[0] is the tool name. Returns the exit code of the tool.
+int tools_run(int argc, char *argv[]);
+
+void tools_print(FILE *out);
+
+// Expand the arguments into file paths: a directory is replaced by its files ending in ext, sorted
+// by name, other arguments are taken as they are. The paths are allocated with malloc.
+// Returns the number of paths stored in files.
+int tools_list_files(char **args, int n_args, const char *ext, char **files, int max);
+
+// Tools
+int tool_codec_bench(int argc, char *argv[]);
+int tool_capture_dump(int argc, char *argv[]);
+int tool_pyramid(int argc, char *argv[]);
+int tool_query(int argc, char *argv[]);
+int tool_batch(int argc, char *argv[]);
+int tool_sched_bench(int argc, char *argv[]);
+int tool_sink_bench(int argc, char *argv[]);
+
+#endif // TOOLS_H
@@ -0,0 +1,369 @@
+/*
+ *  Title: io_uring Writer
+ *  Description: Ring setup, buffer recycling and O_DIRECT handling of the asynchronous writer, see
+ *               uring_writer.h.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE  // O_DIRECT
+#endif
+
+#include "uring_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "latency_trace.h"
+
+struct uring_writer {
+    int       fd;
+    int       ring_fd;
+
+    // Rings shared with the kernel
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *sq_map, *cq_map, *sqe_map;
+    size_t    sq_map_len, cq_map_len, sqe_map_len;
+
+    uint8_t  *buffers;                       // UW_BUFFERS * UW_BUFFER_SIZE, aligned to UW_ALIGN
+    int       busy[UW_BUFFERS];              // write in flight
+    uint32_t  len[UW_BUFFERS];               // of that write
+    int       in_flight;
+    int       current;                       // buffer being filled
+    size_t    fill;
+    uint64_t  offset;                        // file offset of the start of the current buffer
+    uint64_t  last_submit_us;
+    int       error;                         // errno of the first failed write
+    uw_stats_t stats;
+};
+
+static uint8_t *buffer(uring_writer_t *w, int i) {
+    return w->buffers + (size_t)i * UW_BUFFER_SIZE;
+}
+
+static void fail(uring_writer_t *w, int err) {
+    if (w->error == 0) {
+        w->error = err;
+        fprintf(stderr, "io_uring write failed: %s\n", strerror(err));
+    }
+}
+
+// Take the completed writes off the completion ring and free their buffers
+static void reap(uring_writer_t *w) {
+    unsigned head = *w->cq_head;
+    unsigned tail = __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &w->cqes[head & *w->cq_mask];
+        int i = (int)cqe->user_data;
+        if (cqe->res < 0) {
+            fail(w, -cqe->res);
+        } else if ((uint32_t)cqe->res != w->len[i]) {
+            fail(w, EIO);  // short write: the disk is full
+        }
+        w->busy[i] = 0;
+        w->in_flight--;
+    }
+    __atomic_store_n(w->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int wait_completion(uring_writer_t *w) {
+    if (syscall(__NR_io_uring_enter, w->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+        fail(w, errno);
+        return -1;
+    }
+    reap(w);
+    return 0;
+}
+
+// The entry is published in the tail before io_uring_enter(), where the kernel takes it. If it was
+// not taken it is taken back off the ring, so it is not submitted later with a buffer being refilled.
+static void submit(uring_writer_t *w, int i, uint32_t len, uint64_t offset) {
+    unsigned tail = *w->sq_tail;
+    unsigned index = tail & *w->sq_mask;
+    struct io_uring_sqe *sqe = &w->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = w->stats.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = w->fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer(w, i);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = (uint16_t)(w->stats.fixed ? i : 0);
+    sqe->user_data = (uint64_t)i;
+    w->sq_array[index] = index;
+    __atomic_store_n(w->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    long submitted;
+    do {
+        submitted = syscall(__NR_io_uring_enter, w->ring_fd, 1, 0, 0, NULL, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted != 1 && __atomic_load_n(w->sq_head, __ATOMIC_ACQUIRE) == tail) {
+        __atomic_store_n(w->sq_tail, tail, __ATOMIC_RELEASE);
+        fail(w, submitted < 0 ? errno : EAGAIN);
+        return;
+    }
+    w->busy[i] = 1;
+    w->len[i] = len;
+    if (++w->in_flight > w->stats.max_in_flight) {
+        w->stats.max_in_flight = w->in_flight;
+    }
+    w->stats.writes++;
+    w->last_submit_us = lt_now_us();
+}
+
+// Submit the first len bytes of the current buffer and continue in a free one with the rest
+static void submit_current(uring_writer_t *w, size_t len) {
+    int done = w->current;
+    submit(w, done, (uint32_t)len, w->offset);
+    reap(w);
+    int next = -1;
+    uint64_t t0 = 0;
+    while (next < 0 && w->error == 0) {
+        for (int i = 0; i < UW_BUFFERS && next < 0; ++i) {
+            if (!w->busy[i] && i != done) {
+                next = i;
+            }
+        }
+        if (next < 0) {
+            if (t0 == 0) {
+                t0 = lt_now_us();
+            }
+            wait_completion(w);
+        }
+    }
+    if (t0 != 0) {
+        uint64_t stall = lt_now_us() - t0;
+        w->stats.stall_us += stall;
+        if (stall > w->stats.max_stall_us) {
+            w->stats.max_stall_us = stall;
+        }
+    }
+    if (next < 0) {
+        return;
+    }
+    memcpy(buffer(w, next), buffer(w, done) + len, w->fill - len);
+    w->fill -= len;
+    w->offset += len;
+    w->current = next;
+}
+
+// Whether the kernel has the opcode. Kernels before 5.6 cannot be probed and have no IORING_OP_WRITE.
+static int supported(int ring_fd, int op) {
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        return 0;
+    }
+    int ok = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0
+             && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    free(probe);
+    return ok;
+}
+
+static int setup_ring(uring_writer_t *w) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    w->ring_fd = (int)syscall(__NR_io_uring_setup, UW_BUFFERS, &p);
+    if (w->ring_fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    w->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    w->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && w->cq_map_len > w->sq_map_len) {
+        w->sq_map_len = w->cq_map_len;
+    }
+    w->sq_map = mmap(NULL, w->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (w->sq_map == MAP_FAILED) {
+        w->sq_map = NULL;
+        perror("io_uring mmap");
+        return -1;
+    }
+    w->cq_map = single ? w->sq_map
+                       : mmap(NULL, w->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd,
+                              IORING_OFF_CQ_RING);
+    w->sqe_map_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    w->sqe_map = mmap(NULL, w->sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->ring_fd,
+                      IORING_OFF_SQES);
+    if (w->cq_map == MAP_FAILED || w->sqe_map == MAP_FAILED) {
+        w->cq_map = w->cq_map == MAP_FAILED ? NULL : w->cq_map;
+        w->sqe_map = w->sqe_map == MAP_FAILED ? NULL : w->sqe_map;
+        perror("io_uring mmap");
+        return -1;
+    }
+    uint8_t *sq = w->sq_map, *cq = w->cq_map;
+    w->sq_head = (unsigned *)(sq + p.sq_off.head);
+    w->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    w->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    w->sq_array = (unsigned *)(sq + p.sq_off.array);
+    w->cq_head = (unsigned *)(cq + p.cq_off.head);
+    w->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    w->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    w->sqes = w->sqe_map;
+
+    // Fixed buffers count against the locked memory limit; without them plain writes are used
+    struct iovec iov[UW_BUFFERS];
+    for (int i = 0; i < UW_BUFFERS; ++i) {
+        iov[i].iov_base = buffer(w, i);
+        iov[i].iov_len = UW_BUFFER_SIZE;
+    }
+    w->stats.fixed = supported(w->ring_fd, IORING_OP_WRITE_FIXED)
+                     && syscall(__NR_io_uring_register, w->ring_fd, IORING_REGISTER_BUFFERS, iov, UW_BUFFERS) == 0;
+    if (!w->stats.fixed && !supported(w->ring_fd, IORING_OP_WRITE)) {
+        printf("io_uring of this kernel has no write operation\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void teardown(uring_writer_t *w) {
+    if (w->sqe_map != NULL) {
+        munmap(w->sqe_map, w->sqe_map_len);
+    }
+    if (w->cq_map != NULL && w->cq_map != w->sq_map) {
+        munmap(w->cq_map, w->cq_map_len);
+    }
+    if (w->sq_map != NULL) {
+        munmap(w->sq_map, w->sq_map_len);
+    }
+    if (w->ring_fd >= 0) {
+        close(w->ring_fd);  // also unregisters the buffers
+    }
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    free(w->buffers);
+    free(w);
+}
+
+uring_writer_t *uw_open(const char *path) {
+    uring_writer_t *w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        perror("Unable to allocate io_uring writer");
+        return NULL;
+    }
+    w->ring_fd = -1;
+    w->fd = -1;
+    if (posix_memalign((void **)&w->buffers, UW_ALIGN, (size_t)UW_BUFFERS * UW_BUFFER_SIZE) != 0) {
+        w->buffers = NULL;
+        perror("Unable to allocate io_uring buffers");
+        teardown(w);
+        return NULL;
+    }
+    if (setup_ring(w) != 0) {  // before the file, which is not touched when the ring cannot be used
+        teardown(w);
+        return NULL;
+    }
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    w->stats.direct = w->fd >= 0;
+    if (w->fd < 0 && errno == EINVAL) {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);  // file system without O_DIRECT
+    }
+    if (w->fd < 0) {
+        perror("Unable to open file for io_uring");
+        teardown(w);
+        return NULL;
+    }
+    w->last_submit_us = lt_now_us();
+    return w;
+}
+
+int uw_write(uring_writer_t *w, const void *data, size_t n) {
+    const uint8_t *p = data;
+    while (n > 0 && w->error == 0) {
+        size_t take = UW_BUFFER_SIZE - w->fill < n ? UW_BUFFER_SIZE - w->fill : n;
+        memcpy(buffer(w, w->current) + w->fill, p, take);
+        w->fill += take;
+        w->stats.bytes += take;
+        p += take;
+        n -= take;
+        if (w->fill == UW_BUFFER_SIZE) {
+            submit_current(w, UW_BUFFER_SIZE);
+        }
+    }
+    reap(w);
+    return w->error == 0 ? 0 : -1;
+}
+
+void uw_flush(uring_writer_t *w) {
+    if (w->error != 0 || lt_now_us() - w->last_submit_us < UW_FLUSH_US) {
+        return;
+    }
+    size_t len = w->stats.direct ? w->fill & ~(size_t)(UW_ALIGN - 1) : w->fill;
+    if (len > 0) {
+        submit_current(w, len);
+    }
+}
+
+void uw_stats(const uring_writer_t *w, uw_stats_t *stats) {
+    *stats = w->stats;
+}
+
+int uw_close(uring_writer_t *w) {
+    if (w == NULL) {
+        return 0;
+    }
+    uint64_t end = w->offset + w->fill;
+    if (w->fill > 0 && w->error == 0) {
+        size_t len = w->fill;
+        if (w->stats.direct) {
+            // O_DIRECT writes whole blocks: pad the last one, the file is truncated to its length
+            len = (len + UW_ALIGN - 1) & ~(size_t)(UW_ALIGN - 1);
+            memset(buffer(w, w->current) + w->fill, 0, len - w->fill);
+        }
+        submit(w, w->current, (uint32_t)len, w->offset);
+    }
+    // Also after a failure: the kernel may still read from the buffers
+    while (w->in_flight > 0 && wait_completion(w) == 0) {
+    }
+    if (w->stats.direct && w->error == 0 && ftruncate(w->fd, (off_t)end) != 0) {
+        fail(w, errno);
+    }
+    int ok = w->error == 0;
+    teardown(w);
+    return ok ? 0 : -1;
+}
+
+#else
+
+uring_writer_t *uw_open(const char *path) {
+    (void)path;
+    printf("io_uring is not available on this system\n");
+    return NULL;
+}
+
+int uw_write(uring_writer_t *w, const void *data, size_t n) {
+    (void)w;
+    (void)data;
+    (void)n;
+    return -1;
+}
+
+void uw_flush(uring_writer_t *w) {
+    (void)w;
+}
+
+void uw_stats(const uring_writer_t *w, uw_stats_t *stats) {
+    (void)w;
+    *stats = (uw_stats_t){ 0 };
+}
+
+int uw_close(uring_writer_t *w) {
+    (void)w;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ *  Title: io_uring Writer
+ *  Description: Asynchronous file writer for the sinks on Linux, so a slow or network-backed disk
+ *               does not block the sink thread in fwrite()/fflush(). Bytes are copied into one of
+ *               UW_BUFFERS buffers of UW_BUFFER_SIZE; a full buffer is submitted as one write at its
+ *               file offset and filling goes on in the next free buffer. A buffer is free again once
+ *               the kernel has completed its write. The writer only waits when every buffer is in
+ *               flight, which is counted as stall time.
+ *
+ *               The buffers are registered with the ring (fixed buffers), so the kernel does not map
+ *               them for every write, and the file is opened with O_DIRECT where the file system
+ *               allows it: the writes then bypass the page cache and are aligned to UW_ALIGN. The
+ *               last partial block is written padded and the file truncated to its length on close.
+ *
+ *               The ring is driven with the raw system calls, no library is needed. Elsewhere than
+ *               on Linux, and on kernels without IORING_OP_WRITE (found with IORING_REGISTER_PROBE),
+ *               uw_open() fails and the sinks keep using stdio.
+ */
+
+#ifndef URING_WRITER_H
+#define URING_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UW_BUFFERS 8
+#define UW_BUFFER_SIZE (256 << 10)           // bytes per write
+#define UW_ALIGN 4096                        // of buffers, offsets and lengths with O_DIRECT
+#define UW_FLUSH_US 1000000                  // uw_flush() submits at most this often
+
+typedef struct uring_writer uring_writer_t;
+
+typedef struct {
+    uint64_t bytes;                          // handed to uw_write()
+    uint64_t writes;                         // submitted
+    uint64_t stall_us;                       // waiting for a free buffer
+    uint64_t max_stall_us;
+    int      max_in_flight;
+    int      direct;                         // O_DIRECT
+    int      fixed;                          // registered buffers
+} uw_stats_t;
+
+// Create or truncate the file at path. Returns NULL with the reason printed, without touching the
+// file if io_uring cannot be used.
+uring_writer_t *uw_open(const char *path);
+
+// Copy n bytes to the file. Returns -1 once a write has failed.
+int uw_write(uring_writer_t *w, const void *data, size_t n);
+
+// Submit what has been written so far if the last submission is UW_FLUSH_US ago, so a slow sink
+// still reaches the disk regularly. With O_DIRECT only whole blocks are submitted.
+void uw_flush(uring_writer_t *w);
+
+void uw_stats(const uring_writer_t *w, uw_stats_t *stats);
+
+// Write the rest, wait for every write and close the file. Returns -1 if a write failed.
+int uw_close(uring_writer_t *w);
+
+#endif // URING_WRITER_H
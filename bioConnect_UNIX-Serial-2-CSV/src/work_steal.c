@@ -0,0 +1,267 @@
+/*
+ *  Title: Work Stealing
+ *  Description: Worker deques, stealing and sleeping of the task scheduler, see work_steal.h.
+ */
+
+#include "work_steal.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static _Thread_local ws_worker_t *self;     // worker running on this thread, NULL outside a pool
+static _Thread_local uint32_t outside_rng = 2463534242u;
+
+static uint32_t xorshift(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+// ------------------------------------------------------------------ Deque
+
+// Owner only. Returns -1 if the deque is full.
+static int deque_push(ws_deque_t *d, ws_task_t *task) {
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t >= WS_DEQUE) {
+        return -1;
+    }
+    atomic_store_explicit(&d->tasks[b & (WS_DEQUE - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Owner only: the newest task, whose data is most likely still in the cache
+static ws_task_t *deque_pop(ws_deque_t *d) {
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    ws_task_t *task = atomic_load_explicit(&d->tasks[b & (WS_DEQUE - 1)], memory_order_relaxed);
+    if (t == b) {
+        // Last task: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// Any thread: the oldest task. NULL if empty or another thread took it first.
+static ws_task_t *deque_steal(ws_deque_t *d) {
+    long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    ws_task_t *task = atomic_load_explicit(&d->tasks[t & (WS_DEQUE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+// ------------------------------------------------------------------ Scheduling
+
+static void run_task(ws_pool_t *pool, ws_task_t *task) {
+    ws_group_t *group = task->group;     // the task may be reused by fn
+    task->fn(task);
+    if (group != NULL && atomic_fetch_sub(&group->pending, 1) == 1 && atomic_load(&pool->n_waiting) > 0) {
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+static ws_task_t *inject_take(ws_pool_t *pool) {
+    ws_task_t *task = NULL;
+    pthread_mutex_lock(&pool->inject_lock);
+    if (pool->inject_head != pool->inject_tail) {
+        task = pool->inject[pool->inject_head++ & (WS_INJECT - 1)];
+    }
+    pthread_mutex_unlock(&pool->inject_lock);
+    return task;
+}
+
+// Own deque first, then the injection queue, then the other workers from a random one on
+static ws_task_t *find_task(ws_pool_t *pool, ws_worker_t *w) {
+    ws_task_t *task = NULL;
+    if (w != NULL) {
+        task = deque_pop(&w->deque);
+    }
+    if (task == NULL && pool->inject_head != pool->inject_tail) {
+        task = inject_take(pool);
+    }
+    if (task == NULL) {
+        uint32_t first = xorshift(w != NULL ? &w->rng : &outside_rng) % (uint32_t)pool->n_workers;
+        for (int i = 0; i < pool->n_workers && task == NULL; ++i) {
+            ws_worker_t *victim = &pool->workers[(first + (uint32_t)i) % (uint32_t)pool->n_workers];
+            if (victim != w) {
+                task = deque_steal(&victim->deque);
+            }
+        }
+        if (task != NULL && w != NULL) {
+            w->n_stolen++;
+        }
+    }
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->queued, 1);
+        if (w != NULL) {
+            w->n_run++;
+        }
+    }
+    return task;
+}
+
+static void *worker_thread(void *arg) {
+    ws_worker_t *w = (ws_worker_t *)arg;
+    ws_pool_t *pool = w->pool;
+    self = w;
+    for (;;) {
+        ws_task_t *task = find_task(pool, w);
+        if (task != NULL) {
+            run_task(pool, task);
+            continue;
+        }
+        if (atomic_load(&pool->queued) > 0) {
+            sched_yield();  // lost a race for a task, or one is being queued
+            continue;
+        }
+        if (atomic_load(&pool->quit)) {
+            break;
+        }
+        // Checked again under the lock after announcing the sleep, so a submit in between wakes us
+        pthread_mutex_lock(&pool->sleep_lock);
+        atomic_fetch_add(&pool->n_sleeping, 1);
+        while (atomic_load(&pool->queued) <= 0 && !atomic_load(&pool->quit)) {
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        atomic_fetch_sub(&pool->n_sleeping, 1);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+    return NULL;
+}
+
+ws_pool_t *ws_start(int n_workers) {
+    if (n_workers < 1 || n_workers > WS_MAX_WORKERS) {
+        printf("Scheduler: 1 to %d workers\n", WS_MAX_WORKERS);
+        return NULL;
+    }
+    ws_pool_t *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        perror("Unable to allocate scheduler");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->inject_lock, NULL);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->n_workers = n_workers;
+    for (int i = 0; i < n_workers; ++i) {
+        ws_worker_t *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->rng = 2654435761u * (uint32_t)(i + 1);
+    }
+    for (; pool->n_started < n_workers; ++pool->n_started) {
+        ws_worker_t *w = &pool->workers[pool->n_started];
+        if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+            perror("Unable to start scheduler thread");
+            ws_stop(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void ws_submit(ws_pool_t *pool, ws_task_t *task) {
+    if (task->group != NULL) {
+        atomic_fetch_add_explicit(&task->group->pending, 1, memory_order_relaxed);
+    }
+    // Counted before it is visible, so no worker goes to sleep while it is on its way
+    atomic_fetch_add(&pool->queued, 1);
+    int queued;
+    if (self != NULL && self->pool == pool) {
+        queued = deque_push(&self->deque, task) == 0;
+    } else {
+        pthread_mutex_lock(&pool->inject_lock);
+        queued = pool->inject_tail - pool->inject_head < WS_INJECT;
+        if (queued) {
+            pool->inject[pool->inject_tail++ & (WS_INJECT - 1)] = task;
+        }
+        pthread_mutex_unlock(&pool->inject_lock);
+    }
+    if (!queued) {
+        atomic_fetch_sub(&pool->queued, 1);
+        run_task(pool, task);
+        return;
+    }
+    if (atomic_load(&pool->n_sleeping) > 0) {
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+void ws_wait(ws_pool_t *pool, ws_group_t *group) {
+    ws_worker_t *w = (self != NULL && self->pool == pool) ? self : NULL;
+    int idle = 0;
+    while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+        ws_task_t *task = find_task(pool, w);
+        if (task != NULL) {
+            run_task(pool, task);
+            idle = 0;
+        } else if (++idle < WS_WAIT_SPINS) {
+            sched_yield();  // the last tasks of the group run on other threads
+        } else {
+            // Block rather than spin: under SCHED_FIFO sched_yield() never lets the workers run
+            pthread_mutex_lock(&pool->sleep_lock);
+            atomic_fetch_add(&pool->n_waiting, 1);
+            while (atomic_load(&group->pending) > 0) {
+                pthread_cond_wait(&pool->done, &pool->sleep_lock);
+            }
+            atomic_fetch_sub(&pool->n_waiting, 1);
+            pthread_mutex_unlock(&pool->sleep_lock);
+        }
+    }
+}
+
+void ws_stop(ws_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->sleep_lock);
+    atomic_store(&pool->quit, 1);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+    for (int i = 0; i < pool->n_started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_mutex_destroy(&pool->inject_lock);
+    free(pool);
+}
+
+void ws_report(const ws_pool_t *pool, FILE *f) {
+    uint64_t run = 0, stolen = 0;
+    for (int i = 0; i < pool->n_workers; ++i) {
+        run += pool->workers[i].n_run;
+        stolen += pool->workers[i].n_stolen;
+    }
+    fprintf(f, "Scheduler: %d workers ran %llu tasks, %llu stolen (%.1f%%)\n", pool->n_workers,
+            (unsigned long long)run, (unsigned long long)stolen, run > 0 ? 100.0 * (double)stolen / (double)run : 0.0);
+}
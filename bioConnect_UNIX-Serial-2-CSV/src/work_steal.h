@@ -0,0 +1,96 @@
+/*
+ *  Title: Work Stealing
+ *  Description: Task scheduler for DSP work of uneven cost, e.g. the stages of the pipeline or the
+ *               sample batches of many devices, on a fixed pool of threads. Every worker owns a
+ *               deque (Chase-Lev): it pushes and pops its own tasks at the bottom without locks,
+ *               idle workers steal the oldest task from the top of another deque. Tasks submitted
+ *               from outside the pool go to a shared injection queue. A worker that finds nothing
+ *               sleeps until a task is submitted.
+ *
+ *               Tasks belong to a group; ws_wait() runs tasks on the calling thread until every task
+ *               of the group has finished, so the submitting thread works too.
+ */
+
+#ifndef WORK_STEAL_H
+#define WORK_STEAL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WS_MAX_WORKERS 64
+#define WS_DEQUE 1024                // tasks per worker deque, a power of two
+#define WS_INJECT 4096               // tasks in the injection queue, a power of two
+#define WS_WAIT_SPINS 16             // yields of ws_wait() before it blocks
+
+typedef struct ws_group {
+    atomic_long pending;             // tasks submitted and not finished
+} ws_group_t;
+
+typedef struct ws_task ws_task_t;
+typedef void (*ws_fn)(ws_task_t *task);
+
+// Owned by the caller and valid until the task has run; it may submit itself again from fn
+struct ws_task {
+    ws_fn       fn;
+    void       *arg;
+    ws_group_t *group;               // may be NULL
+};
+
+typedef struct {
+    atomic_llong         top;        // next task to steal
+    atomic_llong         bottom;     // next free slot of the owner
+    _Atomic(ws_task_t *) tasks[WS_DEQUE];
+} ws_deque_t;
+
+typedef struct ws_pool ws_pool_t;
+
+typedef struct {
+    ws_pool_t *pool;
+    int        index;
+    pthread_t  thread;
+    ws_deque_t deque;
+    uint32_t   rng;                  // victim selection
+    uint64_t   n_run;                // tasks run
+    uint64_t   n_stolen;             // of which stolen from another worker
+} ws_worker_t;
+
+struct ws_pool {
+    ws_worker_t     workers[WS_MAX_WORKERS];
+    int             n_workers;       // deques to steal from, set before the threads start
+    int             n_started;
+
+    // Tasks submitted from outside the pool
+    pthread_mutex_t inject_lock;
+    ws_task_t      *inject[WS_INJECT];
+    atomic_ullong   inject_head;     // changed under inject_lock, peeked at without it
+    atomic_ullong   inject_tail;
+
+    // Sleeping of idle workers
+    atomic_long     queued;          // tasks in the deques and the injection queue
+    atomic_int      n_sleeping;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  wake;
+    atomic_int      n_waiting;       // threads blocked in ws_wait()
+    pthread_cond_t  done;            // the last task of a group has finished
+    atomic_int      quit;
+};
+
+// Start n_workers threads (1 to WS_MAX_WORKERS). Returns NULL if none can be started.
+ws_pool_t *ws_start(int n_workers);
+
+// Queue a task. From a worker of the pool it goes to the deque of that worker, otherwise to the
+// injection queue. A full deque runs the task at once.
+void ws_submit(ws_pool_t *pool, ws_task_t *task);
+
+// Run tasks on the calling thread until every task of the group has finished
+void ws_wait(ws_pool_t *pool, ws_group_t *group);
+
+// Finish the queued tasks, stop the workers and free the pool
+void ws_stop(ws_pool_t *pool);
+
+// Tasks run and stolen by the workers
+void ws_report(const ws_pool_t *pool, FILE *f);
+
+#endif // WORK_STEAL_H
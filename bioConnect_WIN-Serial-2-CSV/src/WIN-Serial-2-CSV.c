@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <windows.h>
 
+#include "../../bioConnect_STM32-MCU/Core/Inc/bc_protocol.h"  // wire format shared with the firmware
+
 #define BUFFER_SIZE 1024  // Buffer size for storing each complete value
 #define CHUNK_SIZE 256    // Number of bytes to read in each call
 
@@ -130,9 +132,13 @@ int main(int argc, const char* argv[]) {
                     buffer[buffer_index] = '\0';  // Null-terminate the string
 
                     // Parse two values: red and ir
+                    // (timestamped firmware sends "seq,tick,red,ir", legacy firmware "red,ir")
+                    unsigned long seq = 0, dev_tick = 0;
                     int red_int = 0;
                     int ir_int  = 0;
-                    sscanf(buffer, "%d,%d", &red_int, &ir_int);
+                    if (sscanf(buffer, BC_TEXT_SAMPLE_SCAN, &seq, &dev_tick, &red_int, &ir_int) != 4) {
+                        sscanf(buffer, BC_TEXT_LEGACY_SCAN, &red_int, &ir_int);
+                    }
                     red_raw = (float)red_int;
                     ir_raw  = (float)ir_int;
 